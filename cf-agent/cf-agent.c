@@ -93,6 +93,7 @@
 #include <syntax.h>                     /* IsBuiltInPromiseType() */
 #include <mod_common.h>
 #include <mod_custom.h>                 /* EvaluateCustomPromise(), Intialize/FinalizeCustomPromises() */
+#include <regex_cache.h>                /* RegexCacheLogStats() */
 
 #ifdef HAVE_AVAHI_CLIENT_CLIENT_H
 #ifdef HAVE_AVAHI_COMMON_ADDRESS_H
@@ -352,6 +353,8 @@ int main(int argc, char *argv[])
     }
 
     EndAudit(ctx, CFA_BACKGROUND);
+    RegexCacheLogStats();
+    DepthSearchLogStats();
 
     Nova_NoteAgentExecutionPerformance(config->input_file, start);
 
@@ -1038,12 +1041,7 @@ static void KeepControlPromises(EvalContext *ctx, const Policy *policy, GenericA
                 for (const Rlist *rp = value; rp != NULL; rp = rp->next)
                 {
                     Log(LOG_LEVEL_VERBOSE, "%s", RlistScalarValue(rp));
-                    // TODO: why is this only done in verbose mode?
-                    // original commit says 'optimization'.
-                    if (LogGetGlobalLevel() >= LOG_LEVEL_VERBOSE)
-                    {
-                        PrependItem(&PROCESSREFRESH, RlistScalarValue(rp), NULL);
-                    }
+                    PrependItem(&PROCESSREFRESH, RlistScalarValue(rp), NULL);
                 }
                 continue;
             }
@@ -1531,7 +1529,10 @@ PromiseResult ScheduleAgentOperations(EvalContext *ctx, const Bundle *bp)
     int save_pr_notkept = PR_NOTKEPT;
     struct timespec start = BeginMeasure();
 
-    if (PROCESSREFRESH == NULL || (PROCESSREFRESH && IsRegexItemIn(ctx, PROCESSREFRESH, bp->name)))
+    /* The process table snapshot is shared by all bundles, it's only
+     * refreshed after promises that may have changed it (see
+     * InvalidateProcessTable()) or for the bundles in refresh_processes. */
+    if (PROCESSREFRESH != NULL && IsRegexItemIn(ctx, PROCESSREFRESH, bp->name))
     {
         ClearProcessTable();
     }
@@ -29,6 +29,7 @@
 #include <misc_lib.h>
 #include <file_lib.h>
 #include <dbm_api.h>
+#include <map.h>
 #include <promises.h>
 #include <actuator.h>
 #include <eval_context.h>
@@ -40,16 +41,30 @@
          Key:   |            Value:
   "D_<path>"    | "<basename>\0<basename>\0..." (SORTED!)
                 |
+  "U_<path>"    | "<+|-><basename>\0<+|-><basename>\0..." (SORTED!)
+                |
   "H_<hash_key> | "<hash>\0"
                 |
-  "S_<path>     | "<struct stat>"
+  "S_<path>     | "<StatValue>" (or "<struct stat>" from older versions)
+                |
+  "R_<path>     | "<ContentValue>"
+                |
+  "I_<path>     | "<ContentValue>"
 
   Explanation:
 
   - The "D" entry contains all the filenames that have been recorded in that
     directory, stored as the basename.
+  - The "U" entry contains the filenames added to (+) and removed from (-)
+    the "D" entry since it was written, so that small changes of big
+    directories don't rewrite the whole list.
   - The "H" entry records the hash of a file.
   - The "S" entry records the stat information of a file.
+  - The "R" entry records the digest of the content promised for a file
+    (rendered template or content attribute) together with the identity of
+    the file when it was last verified to have that content.
+  - The "I" entry records the identity of a file when its "H" entries were
+    last verified to be the digests of its content (no digest of its own).
 */
 
 #define CHANGES_HASH_STRING_LEN 7
@@ -60,7 +75,54 @@ typedef struct
     unsigned char mess_digest[EVP_MAX_MD_SIZE + 1];     /* Content digest */
 } ChecksumValue;
 
+typedef struct
+{
+    HashMethod type;
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];          /* Content digest */
+    uintmax_t dev;
+    uintmax_t ino;
+    uintmax_t size;
+    time_t mtime;
+    time_t ctime;
+    time_t recorded;                  /* When the content was last verified */
+} ContentValue;
+
+typedef struct
+{
+    uintmax_t dev;
+    uintmax_t ino;
+    time_t mtime;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+} StatValue;
+
+/* The "U" entry is folded into the "D" entry when it gets bigger than this
+ * fraction of it */
+#define DIRECTORY_LIST_MAX_UPDATES_RATIO 4
+
+/* Key of an update collected in a batch, see FileChangesBatchBegin() */
+typedef struct
+{
+    char *data;
+    int size;
+} BatchKey;
+
+/* Value of an update collected in a batch, data is NULL for a deletion */
+typedef struct
+{
+    char *data;
+    int size;
+} BatchValue;
+
+/* Updates of the current batch, by key */
+static Map *CHANGES_BATCH = NULL; /* GLOBAL_X */
+static int CHANGES_BATCH_DEPTH = 0; /* GLOBAL_X */
+
 static bool GetDirectoryListFromDatabase(CF_DB *db, const char * path, Seq *files);
+static bool ChangesRead(CF_DB *db, const char *key, int key_size, void *dest, int dest_size);
+static bool ChangesWrite(CF_DB *db, const char *key, int key_size, const void *value, int value_size);
+static bool ChangesDelete(CF_DB *db, const char *key, int key_size);
 static bool FileChangesSetDirectoryList(CF_DB *db, const char *path, const Seq *files, bool *change);
 
 /*
@@ -118,7 +180,7 @@ static bool ReadHash(CF_DB *dbp, HashMethod type, const char *name, unsigned cha
 
     key = NewIndexKey(type, name, &size);
 
-    if (ReadComplexKeyDB(dbp, key, size, (void *) &chk_val, sizeof(ChecksumValue)))
+    if (ChangesRead(dbp, key, size, (void *) &chk_val, sizeof(ChecksumValue)))
     {
         memcpy(digest, chk_val.mess_digest, EVP_MAX_MD_SIZE + 1);
         DeleteIndexKey(key);
@@ -139,7 +201,7 @@ static int WriteHash(CF_DB *dbp, HashMethod type, const char *name, unsigned cha
 
     key = NewIndexKey(type, name, &keysize);
     value = NewHashValue(digest);
-    ret = WriteComplexKeyDB(dbp, key, keysize, value, sizeof(ChecksumValue));
+    ret = ChangesWrite(dbp, key, keysize, value, sizeof(ChecksumValue));
     DeleteIndexKey(key);
     DeleteHashValue(value);
     return ret;
@@ -151,7 +213,7 @@ static void DeleteHash(CF_DB *dbp, HashMethod type, const char *name)
     char *key;
 
     key = NewIndexKey(type, name, &size);
-    DeleteComplexKeyDB(dbp, key, size);
+    ChangesDelete(dbp, key, size);
     DeleteIndexKey(key);
 }
 
@@ -342,6 +404,226 @@ static bool OpenChangesDB(CF_DB **db)
     return true;
 }
 
+static void CloseChangesDB(CF_DB *db)
+{
+    CloseDB(db);
+}
+
+static unsigned BatchKeyHash(const void *p, unsigned seed)
+{
+    /* One-at-a-time, the keys of hashes contain '\0' */
+    const BatchKey *key = p;
+    unsigned hash = seed;
+    for (int i = 0; i < key->size; i++)
+    {
+        hash += (unsigned char) key->data[i];
+        hash += (hash << 10);
+        hash ^= (hash >> 6);
+    }
+    hash += (hash << 3);
+    hash ^= (hash >> 11);
+    hash += (hash << 15);
+    return hash;
+}
+
+static bool BatchKeyEqual(const void *a, const void *b)
+{
+    const BatchKey *ka = a;
+    const BatchKey *kb = b;
+    return (ka->size == kb->size) && (memcmp(ka->data, kb->data, ka->size) == 0);
+}
+
+static void BatchKeyDestroy(void *p)
+{
+    BatchKey *key = p;
+    free(key->data);
+    free(key);
+}
+
+static void BatchValueDestroy(void *p)
+{
+    BatchValue *value = p;
+    free(value->data);
+    free(value);
+}
+
+/**
+ * @return the update of #key collected in the current batch, NULL if there is
+ *         none
+ */
+static const BatchValue *GetBatchUpdate(const char *key, int key_size)
+{
+    if (CHANGES_BATCH == NULL)
+    {
+        return NULL;
+    }
+
+    /* Only used for the lookup, the data is not modified */
+    const BatchKey batch_key = { .data = (char *) key, .size = key_size };
+    return MapGet(CHANGES_BATCH, &batch_key);
+}
+
+/**
+ * Collect an update of #key in the current batch, #data NULL for deleting it.
+ */
+static void AddBatchUpdate(const char *key, int key_size, const void *data, int size)
+{
+    assert(CHANGES_BATCH != NULL);
+
+    const BatchKey lookup = { .data = (char *) key, .size = key_size };
+    BatchValue *value = MapGet(CHANGES_BATCH, &lookup);
+    if (value == NULL)
+    {
+        BatchKey *batch_key = xmalloc(sizeof(BatchKey));
+        batch_key->data = xmemdup(key, key_size);
+        batch_key->size = key_size;
+        value = xcalloc(1, sizeof(BatchValue));
+        MapInsert(CHANGES_BATCH, batch_key, value);
+    }
+
+    free(value->data);
+    value->data = (data != NULL) ? xmemdup(data, size) : NULL;
+    value->size = (data != NULL) ? size : 0;
+}
+
+/*
+ * Access to the changes DB entries, going through the updates collected in
+ * the current batch (if any).
+ */
+
+static bool ChangesHasKey(CF_DB *db, const char *key, int key_size)
+{
+    const BatchValue *update = GetBatchUpdate(key, key_size);
+    if (update != NULL)
+    {
+        return (update->data != NULL);
+    }
+    return HasKeyDB(db, key, key_size);
+}
+
+static int ChangesValueSize(CF_DB *db, const char *key, int key_size)
+{
+    const BatchValue *update = GetBatchUpdate(key, key_size);
+    if (update != NULL)
+    {
+        return (update->data != NULL) ? update->size : -1;
+    }
+    return ValueSizeDB(db, key, key_size);
+}
+
+static bool ChangesRead(CF_DB *db, const char *key, int key_size, void *dest, int dest_size)
+{
+    const BatchValue *update = GetBatchUpdate(key, key_size);
+    if (update != NULL)
+    {
+        if (update->data == NULL)
+        {
+            return false;
+        }
+        memcpy(dest, update->data, MIN(dest_size, update->size));
+        return true;
+    }
+    return ReadComplexKeyDB(db, key, key_size, dest, dest_size);
+}
+
+static bool ChangesWrite(CF_DB *db, const char *key, int key_size, const void *value, int value_size)
+{
+    if (CHANGES_BATCH != NULL)
+    {
+        AddBatchUpdate(key, key_size, value, value_size);
+        return true;
+    }
+    return WriteComplexKeyDB(db, key, key_size, value, value_size);
+}
+
+/**
+ * @return whether #key was there, same as DeleteDB()
+ */
+static bool ChangesDelete(CF_DB *db, const char *key, int key_size)
+{
+    if (CHANGES_BATCH != NULL)
+    {
+        const bool found = ChangesHasKey(db, key, key_size);
+        if (found)
+        {
+            AddBatchUpdate(key, key_size, NULL, 0);
+        }
+        return found;
+    }
+    return DeleteComplexKeyDB(db, key, key_size);
+}
+
+void FileChangesBatchBegin(void)
+{
+    assert(CHANGES_BATCH_DEPTH >= 0);
+    if (CHANGES_BATCH_DEPTH++ == 0)
+    {
+        assert(CHANGES_BATCH == NULL);
+        CHANGES_BATCH = MapNew(BatchKeyHash, BatchKeyEqual, BatchKeyDestroy, BatchValueDestroy);
+    }
+}
+
+/**
+ * Write the updates collected in the batch in one transaction.
+ */
+static bool WriteBatchUpdates(Map *batch)
+{
+    if (MapSize(batch) == 0)
+    {
+        return true;
+    }
+
+    CF_DB *db;
+    if (!OpenChangesDB(&db))
+    {
+        return false;
+    }
+
+    bool success = true;
+    MapIterator it = MapIteratorInit(batch);
+    MapKeyValue *item;
+    while (success && ((item = MapIteratorNext(&it)) != NULL))
+    {
+        const BatchKey *key = item->key;
+        const BatchValue *value = item->value;
+        if (value->data != NULL)
+        {
+            success = WriteComplexKeyDB(db, key->data, key->size, value->data, value->size);
+        }
+        else
+        {
+            /* Fails if the entry is already gone as well, errors
+             * (discarding the transaction) are caught by the commit */
+            DeleteComplexKeyDB(db, key->data, key->size);
+        }
+    }
+
+    success = CommitDB(db) && success;
+    CloseDB(db);
+    return success;
+}
+
+bool FileChangesBatchEnd(void)
+{
+    assert(CHANGES_BATCH_DEPTH > 0);
+    if (--CHANGES_BATCH_DEPTH > 0)
+    {
+        /* Written by the outermost batch */
+        return true;
+    }
+
+    Map *batch = CHANGES_BATCH;
+    CHANGES_BATCH = NULL;
+
+    const bool success = WriteBatchUpdates(batch);
+    if (!success)
+    {
+        Log(LOG_LEVEL_ERR, "Could not write the updates of the changes database");
+    }
+    MapDestroy(batch);
+    return success;
+}
+
 static void RemoveAllFileTraces(CF_DB *db, const char *path)
 {
     for (int c = 0; c < HASH_METHOD_NONE; c++)
@@ -350,50 +632,179 @@ static void RemoveAllFileTraces(CF_DB *db, const char *path)
     }
     char key[strlen(path) + 3];
     xsnprintf(key, sizeof(key), "S_%s", path);
-    DeleteDB(db, key);
+    ChangesDelete(db, key, strlen(key) + 1);
+    key[0] = 'R';
+    ChangesDelete(db, key, strlen(key) + 1);
+    key[0] = 'I';
+    ChangesDelete(db, key, strlen(key) + 1);
 }
 
-static bool GetDirectoryListFromDatabase(CF_DB *db, const char *path, Seq *files)
+/**
+ * Read the directory list (or its updates) stored under #key into #value,
+ * which is NULL if there is none.
+ */
+static bool ReadDirectoryListValue(CF_DB *db, const char *key, char **value, int *size)
 {
-    char key[strlen(path) + 3];
-    xsnprintf(key, sizeof(key), "D_%s", path);
-    if (!HasKeyDB(db, key, sizeof(key)))
+    *value = NULL;
+    *size = 0;
+
+    const int key_size = strlen(key) + 1;
+    if (!ChangesHasKey(db, key, key_size))
     {
-        // Not an error, so successful, but seq remains unchanged.
         return true;
     }
-    int size = ValueSizeDB(db, key, sizeof(key));
-    if (size <= 0)
+    const int value_size = ChangesValueSize(db, key, key_size);
+    if (value_size <= 0)
     {
         // Shouldn't happen, since we don't store empty lists, but play it safe
-        // and return empty seq.
+        // and return empty list.
         return true;
     }
 
-    char raw_entries[size];
-    if (!ReadDB(db, key, raw_entries, size))
+    char *raw_entries = xmalloc(value_size);
+    if (!ChangesRead(db, key, strlen(key) + 1, raw_entries, value_size))
     {
         Log(LOG_LEVEL_ERR, "Could not read changes database entry");
+        free(raw_entries);
+        return false;
+    }
+    if (raw_entries[value_size - 1] != '\0')
+    {
+        Log(LOG_LEVEL_ERR, "Unexpected end of value in changes database");
+        free(raw_entries);
         return false;
     }
 
-    char *raw_entries_end = raw_entries + size;
-    for (char *pos = raw_entries; pos < raw_entries_end;)
+    *value = raw_entries;
+    *size = value_size;
+    return true;
+}
+
+/**
+ * Append the entries of the directory list #base with the #updates (both
+ * as stored in the database) applied to #files, keeping them sorted.
+ */
+static bool ApplyDirectoryListUpdates(const char *base, int base_size,
+                                      const char *updates, int updates_size, Seq *files)
+{
+    const char *b = base;
+    const char *const base_end = (base != NULL) ? base + base_size : NULL;
+    const char *u = updates;
+    const char *const updates_end = (updates != NULL) ? updates + updates_size : NULL;
+
+    while ((b < base_end) || (u < updates_end))
     {
-        char *null_pos = memchr(pos, '\0', raw_entries_end - pos);
-        if (!null_pos)
+        if ((u < updates_end) && (u[0] != '+') && (u[0] != '-'))
         {
-            Log(LOG_LEVEL_ERR, "Unexpected end of value in changes database");
+            Log(LOG_LEVEL_ERR, "Invalid directory list update in changes database");
             return false;
         }
 
-        SeqAppend(files, xstrdup(pos));
-        pos = null_pos + 1;
+        const int cmp = (u >= updates_end) ? -1 : (b >= base_end) ? 1 : strcmp(b, u + 1);
+        if (cmp < 0)
+        {
+            SeqAppend(files, xstrdup(b));
+            b += strlen(b) + 1;
+        }
+        else
+        {
+            if (u[0] == '+')
+            {
+                SeqAppend(files, xstrdup(u + 1));
+            }
+            if (cmp == 0)
+            {
+                b += strlen(b) + 1;
+            }
+            u += strlen(u) + 1;
+        }
     }
 
     return true;
 }
 
+/**
+ * @return the updates turning the stored directory list #base into the
+ *         sorted #files, as stored in the "U" entry
+ */
+static char *DirectoryListUpdates(const char *base, int base_size, const Seq *files, int *size)
+{
+    size_t capacity = 64;
+    size_t length = 0;
+    char *updates = xmalloc(capacity);
+
+    const char *b = base;
+    const char *const base_end = base + base_size;
+    const size_t n_files = SeqLength(files);
+    size_t i = 0;
+    while ((b < base_end) || (i < n_files))
+    {
+        const char *file = (i < n_files) ? SeqAt(files, i) : NULL;
+        const int cmp = (file == NULL) ? -1 : (b >= base_end) ? 1 : strcmp(b, file);
+
+        char op;
+        const char *name;
+        if (cmp == 0)
+        {
+            b += strlen(b) + 1;
+            i++;
+            continue;
+        }
+        else if (cmp < 0)
+        {
+            op = '-';
+            name = b;
+            b += strlen(b) + 1;
+        }
+        else
+        {
+            op = '+';
+            name = file;
+            i++;
+        }
+
+        const size_t name_size = strlen(name) + 1;
+        if (length + name_size + 1 > capacity)
+        {
+            capacity = MAX(2 * capacity, length + name_size + 1);
+            updates = xrealloc(updates, capacity);
+        }
+        updates[length++] = op;
+        memcpy(updates + length, name, name_size);
+        length += name_size;
+    }
+
+    *size = length;
+    return updates;
+}
+
+static bool GetDirectoryListFromDatabase(CF_DB *db, const char *path, Seq *files)
+{
+    char key[strlen(path) + 3];
+    xsnprintf(key, sizeof(key), "D_%s", path);
+
+    char *base;
+    int base_size;
+    if (!ReadDirectoryListValue(db, key, &base, &base_size))
+    {
+        return false;
+    }
+    if (base == NULL)
+    {
+        // Not an error, so successful, but seq remains unchanged.
+        return true;
+    }
+
+    key[0] = 'U';
+    char *updates;
+    int updates_size;
+    const bool success = (ReadDirectoryListValue(db, key, &updates, &updates_size) &&
+                          ApplyDirectoryListUpdates(base, base_size, updates, updates_size, files));
+    free(updates);
+    free(base);
+    return success;
+}
+
 bool FileChangesGetDirectoryList(const char *path, Seq *files)
 {
     CF_DB *db;
@@ -404,7 +815,7 @@ bool FileChangesGetDirectoryList(const char *path, Seq *files)
     }
 
     bool result = GetDirectoryListFromDatabase(db, path, files);
-    CloseDB(db);
+    CloseChangesDB(db);
     return result;
 }
 
@@ -412,44 +823,93 @@ static bool FileChangesSetDirectoryList(CF_DB *db, const char *path, const Seq *
 {
     assert(change != NULL);
 
-    int size = 0;
-    int n_files = SeqLength(files);
+    const int n_files = SeqLength(files);
 
     char key[strlen(path) + 3];
     xsnprintf(key, sizeof(key), "D_%s", path);
+    char updates_key[sizeof(key)];
+    xsnprintf(updates_key, sizeof(updates_key), "U_%s", path);
 
     if (n_files == 0)
     {
-        *change = DeleteDB(db, key);
+        *change = ChangesDelete(db, key, strlen(key) + 1);
+        ChangesDelete(db, updates_key, strlen(updates_key) + 1);
         return true;
     }
 
-    for (int c = 0; c < n_files; c++)
+    char *base = NULL;
+    int base_size = 0;
+    char *old_updates = NULL;
+    int old_updates_size = 0;
+    if (!ReadDirectoryListValue(db, key, &base, &base_size) ||
+        !ReadDirectoryListValue(db, updates_key, &old_updates, &old_updates_size))
+    {
+        /* Written as a whole again */
+        free(base);
+        base = NULL;
+    }
+
+    bool same = false;
+    if (base != NULL)
     {
-        size += strlen(SeqAt(files, c)) + 1;
+        Seq *old_files = SeqNew(n_files, free);
+        if (ApplyDirectoryListUpdates(base, base_size, old_updates, old_updates_size, old_files) &&
+            ((int) SeqLength(old_files) == n_files))
+        {
+            same = true;
+            for (int c = 0; same && (c < n_files); c++)
+            {
+                same = StringEqual(SeqAt(old_files, c), SeqAt(files, c));
+            }
+        }
+        SeqDestroy(old_files);
     }
+    free(old_updates);
 
-    char raw_entries[size];
-    char *pos = raw_entries;
-    for (int c = 0; c < n_files; c++)
+    if (same)
     {
-        strcpy(pos, SeqAt(files, c));
-        pos += strlen(pos) + 1;
+        Log(LOG_LEVEL_VERBOSE, "No changes in directory list");
+        free(base);
+        *change = false;
+        return true;
     }
 
-    if (HasKeyDB(db, key, sizeof(key)))
+    /* Only the differences from the stored list unless they are a big part
+     * of it, the full list is written again otherwise */
+    bool success;
+    int updates_size = 0;
+    char *updates = (base != NULL) ? DirectoryListUpdates(base, base_size, files, &updates_size) : NULL;
+    if ((updates != NULL) && (updates_size <= base_size / DIRECTORY_LIST_MAX_UPDATES_RATIO))
+    {
+        success = (updates_size == 0) ?
+            ChangesDelete(db, updates_key, strlen(updates_key) + 1) :
+            ChangesWrite(db, updates_key, strlen(updates_key) + 1, updates, updates_size);
+    }
+    else
     {
-        char old_entries[MAX(size, 2 * CF_BUFSIZE)];
-        if (ReadDB(db, key, old_entries, sizeof(old_entries)) &&
-            (memcmp(old_entries, raw_entries, size) == 0))
+        int size = 0;
+        for (int c = 0; c < n_files; c++)
         {
-            Log(LOG_LEVEL_VERBOSE, "No changes in directory list");
-            *change = false;
-            return true;
+            size += strlen(SeqAt(files, c)) + 1;
         }
+
+        char *raw_entries = xmalloc(size);
+        char *pos = raw_entries;
+        for (int c = 0; c < n_files; c++)
+        {
+            strcpy(pos, SeqAt(files, c));
+            pos += strlen(pos) + 1;
+        }
+
+        /* The old updates don't apply to the new list */
+        ChangesDelete(db, updates_key, strlen(updates_key) + 1);
+        success = ChangesWrite(db, key, strlen(key) + 1, raw_entries, size);
+        free(raw_entries);
     }
+    free(updates);
+    free(base);
 
-    if (!WriteDB(db, key, raw_entries, size))
+    if (!success)
     {
         Log(LOG_LEVEL_ERR, "Could not write to changes database");
         return false;
@@ -519,14 +979,21 @@ bool FileChangesCheckAndUpdateHash(EvalContext *ctx,
         }
         else if (!found || update)
         {
-            const char *action = found ? "Updated" : "Stored";
-            char buffer[CF_HOSTKEY_STRING_SIZE];
-            RecordChange(ctx, pp, attr, "%s %s hash for '%s' (%s)",
-                         action, HashNameFromId(type), filename,
-                         HashPrintSafe(buffer, sizeof(buffer), digest, type, true));
-            *result = PromiseResultUpdate(*result, PROMISE_RESULT_CHANGE);
-
-            WriteHash(dbp, type, filename, digest);
+            if (!WriteHash(dbp, type, filename, digest))
+            {
+                RecordFailure(ctx, pp, attr, "Failed to record %s hash for '%s'",
+                              HashNameFromId(type), filename);
+                *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
+            }
+            else
+            {
+                const char *action = found ? "Updated" : "Stored";
+                char buffer[CF_HOSTKEY_STRING_SIZE];
+                RecordChange(ctx, pp, attr, "%s %s hash for '%s' (%s)",
+                             action, HashNameFromId(type), filename,
+                             HashPrintSafe(buffer, sizeof(buffer), digest, type, true));
+                *result = PromiseResultUpdate(*result, PROMISE_RESULT_CHANGE);
+            }
             ret = found;
         }
         else
@@ -544,7 +1011,7 @@ bool FileChangesCheckAndUpdateHash(EvalContext *ctx,
         ret = false;
     }
 
-    CloseDB(dbp);
+    CloseChangesDB(dbp);
     return ret;
 }
 
@@ -666,7 +1133,46 @@ void FileChangesCheckAndUpdateDirectory(EvalContext *ctx, const Attributes *attr
     }
 
     SeqSoftDestroy(disk_file_set);
-    CloseDB(db);
+    CloseChangesDB(db);
+}
+
+static void StatToStatValue(const struct stat *sb, StatValue *value)
+{
+    /* Also zeroes the padding, it ends up in the database */
+    memset(value, 0, sizeof(StatValue));
+    value->dev = sb->st_dev;
+    value->ino = sb->st_ino;
+    value->mtime = sb->st_mtime;
+    value->mode = sb->st_mode;
+    value->uid = sb->st_uid;
+    value->gid = sb->st_gid;
+}
+
+/**
+ * Read the stat information stored under #key, in either the current or the
+ * old (whole struct stat) format.
+ */
+static bool ReadStatValue(CF_DB *db, const char *key, StatValue *value)
+{
+    nt_static_assert(sizeof(StatValue) != sizeof(struct stat));
+
+    const int size = ChangesValueSize(db, key, strlen(key) + 1);
+    if (size == sizeof(struct stat))
+    {
+        struct stat sb;
+        if (!ChangesRead(db, key, strlen(key) + 1, &sb, sizeof(struct stat)))
+        {
+            return false;
+        }
+        StatToStatValue(&sb, value);
+        return true;
+    }
+    else if (size == sizeof(StatValue))
+    {
+        return ChangesRead(db, key, strlen(key) + 1, value, sizeof(StatValue));
+    }
+
+    return false;
 }
 
 void FileChangesCheckAndUpdateStats(EvalContext *ctx,
@@ -677,7 +1183,9 @@ void FileChangesCheckAndUpdateStats(EvalContext *ctx,
                                     const Promise *pp,
                                     PromiseResult *result)
 {
-    struct stat cmpsb;
+    StatValue cmp;
+    StatValue value;
+    StatToStatValue(sb, &value);
     CF_DB *dbp;
 
     if (!OpenChangesDB(&dbp))
@@ -690,12 +1198,12 @@ void FileChangesCheckAndUpdateStats(EvalContext *ctx,
     char key[strlen(file) + 3];
     xsnprintf(key, sizeof(key), "S_%s", file);
 
-    if (!ReadDB(dbp, key, &cmpsb, sizeof(struct stat)))
+    if (!ReadStatValue(dbp, key, &cmp))
     {
         if (MakingInternalChanges(ctx, pp, attr, result,
                                   "write stat information for '%s' to database", file))
         {
-            if (!WriteDB(dbp, key, sb, sizeof(struct stat)))
+            if (!ChangesWrite(dbp, key, strlen(key) + 1, &value, sizeof(StatValue)))
             {
                 RecordFailure(ctx, pp, attr, "Could not write stat information for '%s' to database", file);
                 *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
@@ -707,30 +1215,30 @@ void FileChangesCheckAndUpdateStats(EvalContext *ctx,
             }
         }
 
-        CloseDB(dbp);
+        CloseChangesDB(dbp);
         return;
     }
 
-    if (cmpsb.st_mode == sb->st_mode
-        && cmpsb.st_uid == sb->st_uid
-        && cmpsb.st_gid == sb->st_gid
-        && cmpsb.st_dev == sb->st_dev
-        && cmpsb.st_ino == sb->st_ino
-        && cmpsb.st_mtime == sb->st_mtime)
+    if (cmp.mode == value.mode
+        && cmp.uid == value.uid
+        && cmp.gid == value.gid
+        && cmp.dev == value.dev
+        && cmp.ino == value.ino
+        && cmp.mtime == value.mtime)
     {
         RecordNoChange(ctx, pp, attr, "No stat information change for '%s'", file);
-        CloseDB(dbp);
+        CloseChangesDB(dbp);
         return;
     }
 
-    if (cmpsb.st_mode != sb->st_mode)
+    if (cmp.mode != value.mode)
     {
         Log(LOG_LEVEL_NOTICE, "Permissions for '%s' changed %04jo -> %04jo",
-                 file, (uintmax_t)cmpsb.st_mode, (uintmax_t)sb->st_mode);
+                 file, (uintmax_t)cmp.mode, (uintmax_t)value.mode);
 
         char msg_temp[CF_MAXVARSIZE];
         snprintf(msg_temp, sizeof(msg_temp), "Permission: %04jo -> %04jo",
-                 (uintmax_t)cmpsb.st_mode, (uintmax_t)sb->st_mode);
+                 (uintmax_t)cmp.mode, (uintmax_t)value.mode);
 
         if (MakingInternalChanges(ctx, pp, attr, result, "record permissions changes in '%s'", file))
         {
@@ -747,14 +1255,14 @@ void FileChangesCheckAndUpdateStats(EvalContext *ctx,
         }
     }
 
-    if (cmpsb.st_uid != sb->st_uid)
+    if (cmp.uid != value.uid)
     {
         Log(LOG_LEVEL_NOTICE, "Owner for '%s' changed %ju -> %ju",
-            file, (uintmax_t) cmpsb.st_uid, (uintmax_t) sb->st_uid);
+            file, (uintmax_t) cmp.uid, (uintmax_t) value.uid);
 
         char msg_temp[CF_MAXVARSIZE];
         snprintf(msg_temp, sizeof(msg_temp), "Owner: %ju -> %ju",
-                 (uintmax_t) cmpsb.st_uid, (uintmax_t) sb->st_uid);
+                 (uintmax_t) cmp.uid, (uintmax_t) value.uid);
 
         if (MakingInternalChanges(ctx, pp, attr, result,
                                   "record ownership changes in '%s'", file))
@@ -772,14 +1280,14 @@ void FileChangesCheckAndUpdateStats(EvalContext *ctx,
         }
     }
 
-    if (cmpsb.st_gid != sb->st_gid)
+    if (cmp.gid != value.gid)
     {
         Log(LOG_LEVEL_NOTICE, "Group for '%s' changed %ju -> %ju",
-            file, (uintmax_t) cmpsb.st_gid, (uintmax_t) sb->st_gid);
+            file, (uintmax_t) cmp.gid, (uintmax_t) value.gid);
 
         char msg_temp[CF_MAXVARSIZE];
         snprintf(msg_temp, sizeof(msg_temp), "Group: %ju -> %ju",
-                 (uintmax_t)cmpsb.st_gid, (uintmax_t)sb->st_gid);
+                 (uintmax_t)cmp.gid, (uintmax_t)value.gid);
 
         if (MakingInternalChanges(ctx, pp, attr, result,
                                   "record group changes in '%s'", file))
@@ -797,14 +1305,14 @@ void FileChangesCheckAndUpdateStats(EvalContext *ctx,
         }
     }
 
-    if (cmpsb.st_dev != sb->st_dev)
+    if (cmp.dev != value.dev)
     {
         Log(LOG_LEVEL_NOTICE, "Device for '%s' changed %ju -> %ju",
-            file, (uintmax_t) cmpsb.st_dev, (uintmax_t) sb->st_dev);
+            file, (uintmax_t) cmp.dev, (uintmax_t) value.dev);
 
         char msg_temp[CF_MAXVARSIZE];
         snprintf(msg_temp, sizeof(msg_temp), "Device: %ju -> %ju",
-                 (uintmax_t)cmpsb.st_dev, (uintmax_t)sb->st_dev);
+                 (uintmax_t)cmp.dev, (uintmax_t)value.dev);
 
         if (MakingInternalChanges(ctx, pp, attr, result, "record device changes in '%s'", file))
         {
@@ -821,13 +1329,13 @@ void FileChangesCheckAndUpdateStats(EvalContext *ctx,
         }
     }
 
-    if (cmpsb.st_ino != sb->st_ino)
+    if (cmp.ino != value.ino)
     {
         Log(LOG_LEVEL_NOTICE, "inode for '%s' changed %ju -> %ju",
-            file, (uintmax_t) cmpsb.st_ino, (uintmax_t) sb->st_ino);
+            file, (uintmax_t) cmp.ino, (uintmax_t) value.ino);
     }
 
-    if (cmpsb.st_mtime != sb->st_mtime)
+    if (cmp.mtime != value.mtime)
     {
         char from[25]; // ctime() string is 26 bytes (incl NUL)
         char to[25];   // we ignore the newline at the end
@@ -836,8 +1344,8 @@ void FileChangesCheckAndUpdateStats(EvalContext *ctx,
         // TODO: Should be possible using memcpy
         //       but I ran into some weird issues when trying
         //       to assert the contents of ctime()
-        StringCopy(ctime(&(cmpsb.st_mtime)), from, 25);
-        StringCopy(ctime(&(sb->st_mtime)), to, 25);
+        StringCopy(ctime(&(cmp.mtime)), from, 25);
+        StringCopy(ctime(&(value.mtime)), to, 25);
 
         assert(strlen(from) == 24);
         assert(strlen(to) == 24);
@@ -873,7 +1381,8 @@ void FileChangesCheckAndUpdateStats(EvalContext *ctx,
         if (MakingInternalChanges(ctx, pp, attr, result,
                                   "write stat information for '%s' to database", file))
         {
-            if (!DeleteDB(dbp, key) || !WriteDB(dbp, key, sb, sizeof(struct stat)))
+            if (!ChangesDelete(dbp, key, strlen(key) + 1) ||
+                !ChangesWrite(dbp, key, strlen(key) + 1, &value, sizeof(StatValue)))
             {
                 RecordFailure(ctx, pp, attr, "Failed to write stat information for '%s' to database", file);
                 *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
@@ -886,7 +1395,7 @@ void FileChangesCheckAndUpdateStats(EvalContext *ctx,
         }
     }
 
-    CloseDB(dbp);
+    CloseChangesDB(dbp);
 }
 
 static char FileStateToChar(FileState status)
@@ -944,3 +1453,137 @@ bool FileChangesLogChange(const char *file, FileState status, char *msg, const P
     fclose(fp);
     return true;
 }
+
+/*********************************************************************/
+
+static bool ReadContentValue(const char *prefix, const char *path, ContentValue *value)
+{
+    CF_DB *db;
+    if (!OpenChangesDB(&db))
+    {
+        return false;
+    }
+
+    char key[strlen(path) + 3];
+    xsnprintf(key, sizeof(key), "%s%s", prefix, path);
+
+    bool found = ChangesRead(db, key, strlen(key) + 1, value, sizeof(ContentValue));
+    CloseChangesDB(db);
+    return found;
+}
+
+static void WriteContentValue(CF_DB *db, const char *prefix, const char *path,
+                              const struct stat *sb, HashMethod type,
+                              const unsigned char digest[EVP_MAX_MD_SIZE + 1])
+{
+    char key[strlen(path) + 3];
+    xsnprintf(key, sizeof(key), "%s%s", prefix, path);
+
+    ContentValue value;
+    memset(&value, 0, sizeof(value));   /* no garbage in the padding */
+    value.type = type;
+    if (digest != NULL)
+    {
+        memcpy(value.digest, digest, sizeof(value.digest));
+    }
+    value.dev = sb->st_dev;
+    value.ino = sb->st_ino;
+    value.size = sb->st_size;
+    value.mtime = sb->st_mtime;
+    value.ctime = sb->st_ctime;
+    value.recorded = time(NULL);
+
+    if (!ChangesWrite(db, key, strlen(key) + 1, &value, sizeof(value)))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not record the content identity of '%s'", path);
+    }
+}
+
+/**
+ * @return true if #value was recorded for the same file with the same
+ *         content as #sb describes
+ */
+static bool SameIdentity(const ContentValue *value, const struct stat *sb, HashMethod type)
+{
+    /* A file modified within the same second as it was verified could have
+     * the same identity with a different content, so such records
+     * (mtime/ctime not older than the verification) are not trusted. */
+    return (value->type == type &&
+            value->dev == (uintmax_t) sb->st_dev &&
+            value->ino == (uintmax_t) sb->st_ino &&
+            value->size == (uintmax_t) sb->st_size &&
+            value->mtime == sb->st_mtime &&
+            value->ctime == sb->st_ctime &&
+            value->mtime < value->recorded &&
+            value->ctime < value->recorded);
+}
+
+bool FileChangesContentKnown(const char *path, const struct stat *sb,
+                             HashMethod type,
+                             const unsigned char digest[EVP_MAX_MD_SIZE + 1])
+{
+    assert(path != NULL);
+    assert(sb != NULL);
+
+    ContentValue value;
+    return (ReadContentValue("R_", path, &value) &&
+            SameIdentity(&value, sb, type) &&
+            HashesMatch(value.digest, digest, type));
+}
+
+void FileChangesRecordContent(const char *path, const struct stat *sb,
+                              HashMethod type,
+                              const unsigned char digest[EVP_MAX_MD_SIZE + 1])
+{
+    assert(path != NULL);
+    assert(sb != NULL);
+
+    CF_DB *db;
+    if (!OpenChangesDB(&db))
+    {
+        return;
+    }
+
+    WriteContentValue(db, "R_", path, sb, type, digest);
+    CloseChangesDB(db);
+}
+
+bool FileChangesHashesKnown(const char *path, const struct stat *sb, HashMethod method)
+{
+    assert(path != NULL);
+    assert(sb != NULL);
+
+    ContentValue value;
+    return (ReadContentValue("I_", path, &value) &&
+            SameIdentity(&value, sb, method));
+}
+
+void FileChangesRecordHashes(const char *path, const struct stat *sb, HashMethod method,
+                             const HashMethod *types, size_t n_types,
+                             unsigned char digests[][EVP_MAX_MD_SIZE + 1])
+{
+    assert(path != NULL);
+    assert(sb != NULL);
+
+    CF_DB *db;
+    if (!OpenChangesDB(&db))
+    {
+        return;
+    }
+
+    /* Only if the hashes were stored (or already were there), they are not
+     * updated if a change is only reported */
+    for (size_t i = 0; i < n_types; i++)
+    {
+        unsigned char dbdigest[EVP_MAX_MD_SIZE + 1];
+        if (!ReadHash(db, types[i], path, dbdigest) ||
+            !HashesMatch(dbdigest, digests[i], types[i]))
+        {
+            CloseChangesDB(db);
+            return;
+        }
+    }
+
+    WriteContentValue(db, "I_", path, sb, method, NULL);
+    CloseChangesDB(db);
+}
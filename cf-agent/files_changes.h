@@ -35,6 +35,18 @@ typedef enum
     FILE_STATE_STATS_CHANGED
 } FileState;
 
+/**
+ * Collect the updates of the changes database in memory until the matching
+ * FileChangesBatchEnd() and write them in a single short transaction then.
+ * Reads see the updates collected so far. Batches can be nested, the updates
+ * are written when the outermost batch ends.
+ *
+ * @return %false if the updates of the batch could not be written (they are
+ *         lost then)
+ */
+void FileChangesBatchBegin(void);
+bool FileChangesBatchEnd(void);
+
 bool FileChangesLogChange(const char *file, FileState status, char *msg, const Promise *pp);
 bool FileChangesCheckAndUpdateHash(EvalContext *ctx,
                                    const char *filename,
@@ -56,4 +68,27 @@ void FileChangesCheckAndUpdateStats(EvalContext *ctx,
                                     const Promise *pp,
                                     PromiseResult *result);
 
+/**
+ * @return true if #path (stat()-ed into #sb) is known to have the content with
+ *         the #digest since it was recorded by FileChangesRecordContent(),
+ *         i.e. the file doesn't have to be read to verify its content
+ */
+bool FileChangesContentKnown(const char *path, const struct stat *sb,
+                             HashMethod type,
+                             const unsigned char digest[EVP_MAX_MD_SIZE + 1]);
+void FileChangesRecordContent(const char *path, const struct stat *sb,
+                              HashMethod type,
+                              const unsigned char digest[EVP_MAX_MD_SIZE + 1]);
+
+/**
+ * @return true if #path (stat()-ed into #sb) was not modified since its
+ *         digests for the change detection with the #method (can be
+ *         HASH_METHOD_BEST) were recorded by FileChangesRecordHashes(),
+ *         i.e. the file doesn't have to be hashed again
+ */
+bool FileChangesHashesKnown(const char *path, const struct stat *sb, HashMethod method);
+void FileChangesRecordHashes(const char *path, const struct stat *sb, HashMethod method,
+                             const HashMethod *types, size_t n_types,
+                             unsigned char digests[][EVP_MAX_MD_SIZE + 1]);
+
 #endif
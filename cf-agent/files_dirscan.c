@@ -0,0 +1,694 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+
+#include <files_dirscan.h>
+
+#include <alloc.h>
+#include <logging.h>
+#include <mutex.h>                                /* ThreadLock */
+#include <sequence.h>
+#include <file_lib.h>                             /* safe_chdir */
+#include <files_lib.h>                            /* DirentFileType */
+#include <dir.h>
+
+#if defined(HAVE_FDOPENDIR) && !defined(__MINGW32__)
+# define DIRSCAN_USE_FD 1
+#endif
+
+#ifndef O_DIRECTORY
+# define O_DIRECTORY 0
+#endif
+#ifndef O_CLOEXEC
+# define O_CLOEXEC 0
+#endif
+
+/* How many directories may be read ahead per thread of a DirScanPool, each
+ * of them holding a file descriptor until it is taken. */
+#define DIR_SCAN_READ_AHEAD 4
+
+struct DirScan_
+{
+#ifdef DIRSCAN_USE_FD
+    int fd;
+#else
+    char *path;
+#endif
+    Seq *entries;                                 /* DirScanEntry */
+};
+
+static void DirScanEntryDestroy(void *p)
+{
+    DirScanEntry *entry = p;
+    if (entry != NULL)
+    {
+        free(entry->name);
+        free(entry);
+    }
+}
+
+static void DirScanAppend(DirScan *dir, const struct dirent *dirp)
+{
+    DirScanEntry *entry = xcalloc(1, sizeof(DirScanEntry));
+    entry->name = xstrdup(dirp->d_name);
+    entry->type = DirentFileType(dirp);
+    entry->dir = S_ISDIR(entry->type);
+    SeqAppend(dir->entries, entry);
+}
+
+/**
+ * Stat all the entries of #dir, for DirScanEntryStat(). Errors are left for
+ * the caller to run into (and report) again.
+ */
+static void ReadAhead(DirScan *dir, bool follow_links)
+{
+    const size_t length = SeqLength(dir->entries);
+    for (size_t i = 0; i < length; i++)
+    {
+        DirScanEntry *entry = SeqAt(dir->entries, i);
+        if (DirScanStat(dir, entry->name, &(entry->lsb), false) == -1)
+        {
+            continue;
+        }
+        entry->have_lsb = true;
+        entry->type = entry->lsb.st_mode & S_IFMT;
+
+        if (!S_ISLNK(entry->lsb.st_mode))
+        {
+            entry->sb = entry->lsb;
+            entry->have_sb = true;
+        }
+        else if (follow_links &&
+                 DirScanStat(dir, entry->name, &(entry->sb), true) != -1)
+        {
+            entry->have_sb = true;
+        }
+
+        if (entry->have_sb)
+        {
+            entry->dir = S_ISDIR(entry->sb.st_mode);
+        }
+    }
+}
+
+#ifdef DIRSCAN_USE_FD
+
+static DirScan *DirScanFromFd(int fd)
+{
+    DirScan *dir = xmalloc(sizeof(DirScan));
+    dir->fd = fd;
+    dir->entries = SeqNew(16, DirScanEntryDestroy);
+    return dir;
+}
+
+static bool ReadEntries(DirScan *dir)
+{
+    /* A new descriptor for the DIR stream, closed with it */
+    int fd = openat(dir->fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    DIR *dirh = fdopendir(fd);
+    if (dirh == NULL)
+    {
+        const int error = errno;
+        close(fd);
+        errno = error;
+        return false;
+    }
+
+    const struct dirent *dirp;
+    while ((dirp = readdir(dirh)) != NULL)
+    {
+        DirScanAppend(dir, dirp);
+    }
+    closedir(dirh);
+    return true;
+}
+
+DirScan *DirScanOpen(const char *path)
+{
+    assert(path != NULL);
+
+    if (safe_chdir(path) == -1)
+    {
+        return NULL;
+    }
+
+    int fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    DirScan *dir = DirScanFromFd(fd);
+    if (!ReadEntries(dir))
+    {
+        const int error = errno;
+        DirScanClose(dir);
+        errno = error;
+        return NULL;
+    }
+    return dir;
+}
+
+DirScan *DirScanOpenAt(const DirScan *parent, const char *name,
+                       bool follow_links, bool read_ahead)
+{
+    assert(parent != NULL);
+    assert(name != NULL);
+
+    int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    if (!follow_links)
+    {
+        flags |= O_NOFOLLOW;
+    }
+
+    int fd = openat(parent->fd, name, flags);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    DirScan *dir = DirScanFromFd(fd);
+    if (!ReadEntries(dir))
+    {
+        const int error = errno;
+        DirScanClose(dir);
+        errno = error;
+        return NULL;
+    }
+
+    if (read_ahead)
+    {
+        ReadAhead(dir, follow_links);
+    }
+    return dir;
+}
+
+/**
+ * Another handle on #dir, without the entries.
+ */
+static DirScan *DirScanCopy(const DirScan *dir)
+{
+    int fd = openat(dir->fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    return DirScanFromFd(fd);
+}
+
+void DirScanClose(DirScan *dir)
+{
+    if (dir != NULL)
+    {
+        close(dir->fd);
+        SeqDestroy(dir->entries);
+        free(dir);
+    }
+}
+
+int DirScanStat(const DirScan *dir, const char *name, struct stat *sb,
+                bool follow_links)
+{
+    assert(dir != NULL);
+    return fstatat(dir->fd, name, sb, follow_links ? 0 : AT_SYMLINK_NOFOLLOW);
+}
+
+bool DirScanIsDirectory(const DirScan *dir, const struct stat *sb)
+{
+    assert(dir != NULL);
+    assert(sb != NULL);
+
+    struct stat dir_sb;
+    if (fstat(dir->fd, &dir_sb) == -1)
+    {
+        return false;
+    }
+    return (dir_sb.st_dev == sb->st_dev) && (dir_sb.st_ino == sb->st_ino);
+}
+
+bool DirScanEnter(const DirScan *dir)
+{
+    assert(dir != NULL);
+    return (fchdir(dir->fd) == 0);
+}
+
+#else /* !DIRSCAN_USE_FD */
+
+static DirScan *DirScanFromPath(char *path)
+{
+    DirScan *dir = xmalloc(sizeof(DirScan));
+    dir->path = path;
+    dir->entries = SeqNew(16, DirScanEntryDestroy);
+    return dir;
+}
+
+static bool ReadEntries(DirScan *dir)
+{
+    Dir *dirh = DirOpen(dir->path);
+    if (dirh == NULL)
+    {
+        return false;
+    }
+
+    const struct dirent *dirp;
+    while ((dirp = DirRead(dirh)) != NULL)
+    {
+        DirScanAppend(dir, dirp);
+    }
+    DirClose(dirh);
+    return true;
+}
+
+static char *EntryPath(const DirScan *dir, const char *name)
+{
+    char *path;
+    xasprintf(&path, "%s%c%s", dir->path, FILE_SEPARATOR, name);
+    return path;
+}
+
+DirScan *DirScanOpen(const char *path)
+{
+    assert(path != NULL);
+
+    if (safe_chdir(path) == -1)
+    {
+        return NULL;
+    }
+
+    DirScan *dir = DirScanFromPath(xstrdup(path));
+    if (!ReadEntries(dir))
+    {
+        const int error = errno;
+        DirScanClose(dir);
+        errno = error;
+        return NULL;
+    }
+    return dir;
+}
+
+DirScan *DirScanOpenAt(const DirScan *parent, const char *name,
+                       bool follow_links, bool read_ahead)
+{
+    assert(parent != NULL);
+    assert(name != NULL);
+
+    struct stat sb;
+    if (DirScanStat(parent, name, &sb, follow_links) == -1)
+    {
+        return NULL;
+    }
+    if (!S_ISDIR(sb.st_mode))
+    {
+        errno = S_ISLNK(sb.st_mode) ? ELOOP : ENOTDIR;
+        return NULL;
+    }
+
+    DirScan *dir = DirScanFromPath(EntryPath(parent, name));
+    if (!ReadEntries(dir))
+    {
+        const int error = errno;
+        DirScanClose(dir);
+        errno = error;
+        return NULL;
+    }
+
+    if (read_ahead)
+    {
+        ReadAhead(dir, follow_links);
+    }
+    return dir;
+}
+
+static DirScan *DirScanCopy(const DirScan *dir)
+{
+    return DirScanFromPath(xstrdup(dir->path));
+}
+
+void DirScanClose(DirScan *dir)
+{
+    if (dir != NULL)
+    {
+        free(dir->path);
+        SeqDestroy(dir->entries);
+        free(dir);
+    }
+}
+
+int DirScanStat(const DirScan *dir, const char *name, struct stat *sb,
+                bool follow_links)
+{
+    assert(dir != NULL);
+
+    char *path = EntryPath(dir, name);
+    int ret = follow_links ? stat(path, sb) : lstat(path, sb);
+    const int error = errno;
+    free(path);
+    errno = error;
+    return ret;
+}
+
+bool DirScanIsDirectory(const DirScan *dir, const struct stat *sb)
+{
+    assert(dir != NULL);
+    assert(sb != NULL);
+
+    struct stat dir_sb;
+    if (stat(dir->path, &dir_sb) == -1)
+    {
+        return false;
+    }
+    return (dir_sb.st_dev == sb->st_dev) && (dir_sb.st_ino == sb->st_ino);
+}
+
+bool DirScanEnter(const DirScan *dir)
+{
+    assert(dir != NULL);
+    return (safe_chdir(dir->path) == 0);
+}
+
+#endif /* !DIRSCAN_USE_FD */
+
+size_t DirScanLength(const DirScan *dir)
+{
+    assert(dir != NULL);
+    return SeqLength(dir->entries);
+}
+
+const DirScanEntry *DirScanAt(const DirScan *dir, size_t i)
+{
+    assert(dir != NULL);
+    return SeqAt(dir->entries, i);
+}
+
+int DirScanEntryStat(const DirScan *dir, const DirScanEntry *entry,
+                     struct stat *sb, bool follow_links)
+{
+    assert(entry != NULL);
+    assert(sb != NULL);
+
+    if (follow_links ? entry->have_sb : entry->have_lsb)
+    {
+        *sb = follow_links ? entry->sb : entry->lsb;
+        return 0;
+    }
+    return DirScanStat(dir, entry->name, sb, follow_links);
+}
+
+/*********************************************************************/
+
+typedef enum
+{
+    DIR_SCAN_QUEUED,
+    DIR_SCAN_RUNNING,
+    DIR_SCAN_DONE,
+} DirScanState;
+
+struct DirScanRequest_
+{
+    DirScanPool *pool;
+    DirScan *parent;
+    char *name;
+    DirScanState state;
+    bool cancelled;                    /* freed by the thread when done */
+    DirScan *result;
+    int error;                         /* errno if result is NULL */
+    DirScanRequest *prev;              /* in the queue */
+    DirScanRequest *next;
+};
+
+struct DirScanPool_
+{
+    pthread_mutex_t lock;
+    pthread_cond_t queued;             /* a request was queued or stop set */
+    pthread_cond_t done;               /* a request is done */
+    DirScanRequest *head;
+    DirScanRequest *tail;
+    size_t pending;                    /* submitted, not taken or cancelled */
+    size_t max_pending;
+    bool follow_links;
+    bool stop;
+    int threads;
+    pthread_t *tids;
+};
+
+static void DirScanRequestDestroy(DirScanRequest *req)
+{
+    DirScanClose(req->parent);
+    free(req->name);
+    free(req);
+}
+
+/* Call with the pool locked */
+static void QueueRemove(DirScanPool *pool, DirScanRequest *req)
+{
+    if (req->prev != NULL)
+    {
+        req->prev->next = req->next;
+    }
+    else
+    {
+        pool->head = req->next;
+    }
+
+    if (req->next != NULL)
+    {
+        req->next->prev = req->prev;
+    }
+    else
+    {
+        pool->tail = req->prev;
+    }
+    req->prev = NULL;
+    req->next = NULL;
+}
+
+static void *DirScanThread(void *arg)
+{
+    DirScanPool *pool = arg;
+
+    ThreadLock(&pool->lock);
+    while (!pool->stop)
+    {
+        DirScanRequest *req = pool->head;
+        if (req == NULL)
+        {
+            pthread_cond_wait(&pool->queued, &pool->lock);
+            continue;
+        }
+        QueueRemove(pool, req);
+        req->state = DIR_SCAN_RUNNING;
+        ThreadUnlock(&pool->lock);
+
+        DirScan *dir = DirScanOpenAt(req->parent, req->name, pool->follow_links, true);
+        const int error = errno;
+
+        ThreadLock(&pool->lock);
+        if (req->cancelled)
+        {
+            DirScanClose(dir);
+            DirScanRequestDestroy(req);
+        }
+        else
+        {
+            req->result = dir;
+            req->error = error;
+            req->state = DIR_SCAN_DONE;
+            pthread_cond_broadcast(&pool->done);
+        }
+    }
+    ThreadUnlock(&pool->lock);
+
+    return NULL;
+}
+
+DirScanPool *DirScanPoolNew(int threads, bool follow_links)
+{
+    assert(threads > 0);
+
+    DirScanPool *pool = xcalloc(1, sizeof(DirScanPool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->queued, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->follow_links = follow_links;
+    pool->tids = xcalloc(threads, sizeof(pthread_t));
+
+    for (int i = 0; i < threads; i++)
+    {
+        int ret = pthread_create(&(pool->tids[i]), NULL, DirScanThread, pool);
+        if (ret != 0)
+        {
+            Log(LOG_LEVEL_VERBOSE,
+                "Could only start %d of %d threads for reading directories (pthread_create: %s)",
+                i, threads, GetErrorStrFromCode(ret));
+            break;
+        }
+        pool->threads++;
+    }
+
+    if (pool->threads == 0)
+    {
+        DirScanPoolDestroy(pool);
+        return NULL;
+    }
+
+    pool->max_pending = pool->threads * DIR_SCAN_READ_AHEAD;
+    return pool;
+}
+
+void DirScanPoolDestroy(DirScanPool *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    ThreadLock(&pool->lock);
+    assert(pool->pending == 0);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->queued);
+    ThreadUnlock(&pool->lock);
+
+    for (int i = 0; i < pool->threads; i++)
+    {
+        pthread_join(pool->tids[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->queued);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->tids);
+    free(pool);
+}
+
+DirScanRequest *DirScanPoolSubmit(DirScanPool *pool, const DirScan *parent,
+                                  const char *name)
+{
+    assert(pool != NULL);
+    assert(parent != NULL);
+    assert(name != NULL);
+
+    ThreadLock(&pool->lock);
+    const bool full = (pool->pending >= pool->max_pending);
+    ThreadUnlock(&pool->lock);
+    if (full)
+    {
+        return NULL;
+    }
+
+    DirScan *parent_copy = DirScanCopy(parent);
+    if (parent_copy == NULL)
+    {
+        /* Most likely out of file descriptors, just don't read ahead */
+        return NULL;
+    }
+
+    DirScanRequest *req = xcalloc(1, sizeof(DirScanRequest));
+    req->pool = pool;
+    req->parent = parent_copy;
+    req->name = xstrdup(name);
+    req->state = DIR_SCAN_QUEUED;
+
+    ThreadLock(&pool->lock);
+    req->prev = pool->tail;
+    if (pool->tail != NULL)
+    {
+        pool->tail->next = req;
+    }
+    else
+    {
+        pool->head = req;
+    }
+    pool->tail = req;
+    pool->pending++;
+    pthread_cond_signal(&pool->queued);
+    ThreadUnlock(&pool->lock);
+
+    return req;
+}
+
+DirScan *DirScanRequestTake(DirScanRequest *req)
+{
+    assert(req != NULL);
+    DirScanPool *pool = req->pool;
+
+    ThreadLock(&pool->lock);
+    pool->pending--;
+    if (req->state == DIR_SCAN_QUEUED)
+    {
+        /* No thread got to it yet, no point in waiting for one */
+        QueueRemove(pool, req);
+        ThreadUnlock(&pool->lock);
+
+        DirScan *dir = DirScanOpenAt(req->parent, req->name, pool->follow_links, true);
+        const int error = errno;
+        DirScanRequestDestroy(req);
+        errno = error;
+        return dir;
+    }
+
+    while (req->state != DIR_SCAN_DONE)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    ThreadUnlock(&pool->lock);
+
+    DirScan *dir = req->result;
+    const int error = req->error;
+    DirScanRequestDestroy(req);
+    errno = error;
+    return dir;
+}
+
+void DirScanRequestCancel(DirScanRequest *req)
+{
+    if (req == NULL)
+    {
+        return;
+    }
+    DirScanPool *pool = req->pool;
+
+    ThreadLock(&pool->lock);
+    pool->pending--;
+    switch (req->state)
+    {
+    case DIR_SCAN_QUEUED:
+        QueueRemove(pool, req);
+        DirScanRequestDestroy(req);
+        break;
+    case DIR_SCAN_RUNNING:
+        req->cancelled = true;
+        break;
+    case DIR_SCAN_DONE:
+        DirScanClose(req->result);
+        DirScanRequestDestroy(req);
+        break;
+    }
+    ThreadUnlock(&pool->lock);
+}
@@ -0,0 +1,141 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+
+#ifndef CFENGINE_FILES_DIRSCAN_H
+#define CFENGINE_FILES_DIRSCAN_H
+
+#include <platform.h>
+
+/**
+ * Directory opened for a depth_search together with the names of its
+ * entries. Entries are looked up relative to the open directory (openat(),
+ * fstatat()) so that the traversal doesn't depend on the current working
+ * directory and a directory renamed or replaced by a symlink under our feet
+ * can't redirect it.
+ *
+ * On platforms without fdopendir() the directory is remembered by its path.
+ */
+typedef struct DirScan_ DirScan;
+
+typedef struct
+{
+    char *name;
+    mode_t type; /* S_IFMT bits from readdir(), 0 if not known */
+    bool dir;    /* directory (or link to one, if read ahead following links) */
+    bool have_lsb;   /* lsb filled in by the read ahead */
+    bool have_sb;    /* sb filled in by the read ahead */
+    struct stat lsb; /* lstat() of the entry */
+    struct stat sb;  /* stat() of the entry */
+} DirScanEntry;
+
+/**
+ * Change to the directory #path with safe_chdir() and read its entries.
+ *
+ * @return NULL in case of error with errno set
+ */
+DirScan *DirScanOpen(const char *path);
+
+/**
+ * Open the subdirectory #name of #parent and read its entries.
+ *
+ * @param follow_links whether #name may be a symlink to a directory
+ * @param read_ahead also stat all the entries, filling the dir hint and
+ *                   the results DirScanEntryStat() returns
+ * @return NULL in case of error with errno set
+ */
+DirScan *DirScanOpenAt(const DirScan *parent, const char *name,
+                       bool follow_links, bool read_ahead);
+void DirScanClose(DirScan *dir);
+
+size_t DirScanLength(const DirScan *dir);
+const DirScanEntry *DirScanAt(const DirScan *dir, size_t i);
+
+/**
+ * lstat() (or stat() with #follow_links) the entry #name of #dir
+ */
+int DirScanStat(const DirScan *dir, const char *name, struct stat *sb,
+                bool follow_links);
+
+/**
+ * Like DirScanStat() for #entry of #dir, but reuses the result from when
+ * #dir was read ahead if there is one.
+ */
+int DirScanEntryStat(const DirScan *dir, const DirScanEntry *entry,
+                     struct stat *sb, bool follow_links);
+
+/**
+ * @return whether #dir is the directory #sb is about, to detect it being
+ *         swapped while we were opening it
+ */
+bool DirScanIsDirectory(const DirScan *dir, const struct stat *sb);
+
+/**
+ * Make #dir the current working directory, for the file promise attributes
+ * which expect to run in the directory of the file.
+ */
+bool DirScanEnter(const DirScan *dir);
+
+/**
+ * Pool of threads reading subdirectories ahead of the depth_search walking
+ * them. The pool only ever reads directories, all promise evaluation stays
+ * on the calling thread, in the same order as without the pool.
+ */
+typedef struct DirScanPool_ DirScanPool;
+typedef struct DirScanRequest_ DirScanRequest;
+
+/**
+ * @return NULL if no thread could be started
+ */
+DirScanPool *DirScanPoolNew(int threads, bool follow_links);
+
+/**
+ * All requests have to be taken or cancelled before destroying the pool.
+ */
+void DirScanPoolDestroy(DirScanPool *pool);
+
+/**
+ * Queue reading the subdirectory #name of #parent. #parent may be closed
+ * before the request is taken.
+ *
+ * @return NULL if there are already enough directories read ahead
+ */
+DirScanRequest *DirScanPoolSubmit(DirScanPool *pool, const DirScan *parent,
+                                  const char *name);
+
+/**
+ * Wait for the directory of #req, or open it right away if no thread has
+ * started on it yet. #req is freed.
+ *
+ * @return NULL in case of error with errno set
+ */
+DirScan *DirScanRequestTake(DirScanRequest *req);
+
+/**
+ * Drop a request which is not going to be taken. #req is freed.
+ */
+void DirScanRequestCancel(DirScanRequest *req);
+
+#endif
@@ -176,6 +176,7 @@ end:
     if (ec != NULL)
     {
         DeleteItemList(ec->file_start);
+        EditLineIndexDestroy(ec->line_index);
         free(ec->changes_filename);
         free(ec);
     }
@@ -27,6 +27,8 @@
 
 #include <cf3.defs.h>
 #include <file_lib.h>
+#include <files_editline_index.h>
+#include <files_editline_batch.h>
 
 #ifdef HAVE_LIBXML2
 #include <libxml/parser.h>
@@ -46,6 +48,8 @@ typedef struct
     char *filename;
     char *changes_filename;
     Item *file_start;
+    EditLineIndex *line_index;  /* lazily created for edit_line */
+    EditLineBatch *line_batch;  /* patterns of the section being evaluated */
     int num_edits;
 #ifdef HAVE_LIBXML2
     xmlDocPtr xmldoc;
@@ -37,6 +37,8 @@
 #include <scope.h>
 #include <matching.h>
 #include <match_scope.h>
+#include <regex_cache.h>                              /* RegexCacheGet */
+#include <files_editline_index.h>
 #include <attributes.h>
 #include <locks.h>
 #include <string_lib.h>
@@ -98,6 +100,8 @@ static bool NotAnchored(char *s);
 static bool SelectRegion(EvalContext *ctx, Item *start, Item **begin_ptr, Item **end_ptr, const Attributes *a, EditContext *edcontext);
 static bool MultiLineString(char *s);
 static bool InsertFileAtLocation(EvalContext *ctx, Item **start, Item *begin_ptr, Item *end_ptr, Item *location, Item *prev, const Attributes *a, const Promise *pp, EditContext *edcontext, PromiseResult *result);
+static EditLineBatch *NewSectionBatch(const BundleSection *sp, const EditContext *edcontext);
+static bool UsesMatchVariables(const char *s);
 
 /*****************************************************************************/
 /* Level                                                                     */
@@ -140,6 +144,7 @@ bool ScheduleEditLineOperations(EvalContext *ctx, const Bundle *bp, const Attrib
             }
 
             EvalContextStackPushBundleSectionFrame(ctx, sp);
+            edcontext->line_batch = NewSectionBatch(sp, edcontext);
             const size_t length = SeqLength(sp->promises);
             for (size_t ppi = 0; ppi < length; ppi++)
             {
@@ -149,11 +154,15 @@ bool ScheduleEditLineOperations(EvalContext *ctx, const Bundle *bp, const Attrib
 
                 if (BundleAbort(ctx))
                 {
+                    EditLineBatchDestroy(edcontext->line_batch);
+                    edcontext->line_batch = NULL;
                     YieldCurrentLock(thislock);
                     EvalContextStackPopFrame(ctx);
                     return false;
                 }
             }
+            EditLineBatchDestroy(edcontext->line_batch);
+            edcontext->line_batch = NULL;
             EvalContextStackPopFrame(ctx);
         }
     }
@@ -162,6 +171,74 @@ bool ScheduleEditLineOperations(EvalContext *ctx, const Bundle *bp, const Attrib
     return true;
 }
 
+/**
+ * Whether #pp always runs with the same pattern and is meant to run: no
+ * class guard, if, ifvarclass, unless or classes body, and a promiser
+ * without variables (a single line one for delete_lines).
+ */
+static bool IsBatchable(const Promise *pp, bool deletions)
+{
+    if ((pp->classes != NULL) && !StringEqual(pp->classes, "any"))
+    {
+        return false;
+    }
+
+    const char *const promiser = pp->promiser;
+    if ((strstr(promiser, "$(") != NULL) || (strstr(promiser, "${") != NULL) ||
+        (strstr(promiser, "@(") != NULL) || (strstr(promiser, "@{") != NULL) ||
+        (deletions && (strchr(promiser, '\n') != NULL)))
+    {
+        return false;
+    }
+
+    const size_t length = SeqLength(pp->conlist);
+    for (size_t i = 0; i < length; i++)
+    {
+        const Constraint *cp = SeqAt(pp->conlist, i);
+        if (StringEqual(cp->lval, "if") || StringEqual(cp->lval, "ifvarclass") ||
+            StringEqual(cp->lval, "unless") || StringEqual(cp->lval, "classes"))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Match the patterns of the delete_lines or replace_patterns promises of #sp
+ * against the file in one pass, see files_editline_batch.h.
+ *
+ * @return NULL if there are less than two promises to batch
+ */
+static EditLineBatch *NewSectionBatch(const BundleSection *sp, const EditContext *edcontext)
+{
+    const bool deletions = StringEqual(sp->promise_type, "delete_lines");
+    if (!deletions && !StringEqual(sp->promise_type, "replace_patterns"))
+    {
+        return NULL;
+    }
+
+    EditLineBatch *batch = EditLineBatchNew(deletions);
+    const size_t length = SeqLength(sp->promises);
+    for (size_t i = 0; i < length; i++)
+    {
+        const Promise *pp = SeqAt(sp->promises, i);
+        if (IsBatchable(pp, deletions))
+        {
+            EditLineBatchAdd(batch, pp->promiser);
+        }
+    }
+
+    if (EditLineBatchLength(batch) < 2)
+    {
+        EditLineBatchDestroy(batch);
+        return NULL;
+    }
+
+    EditLineBatchScan(batch, edcontext->file_start);
+    return batch;
+}
+
 /*****************************************************************************/
 
 Bundle *MakeTemporaryBundleFromTemplate(EvalContext *ctx, Policy *policy, const Attributes *a, const Promise *pp, PromiseResult *result)
@@ -632,6 +709,23 @@ static PromiseResult VerifyPatterns(EvalContext *ctx, const Promise *pp, EditCon
 
 /***************************************************************************/
 
+static EditLineIndex *LineIndex(EditContext *edcontext)
+{
+    if (edcontext->line_index == NULL)
+    {
+        edcontext->line_index = EditLineIndexNew();
+    }
+    return edcontext->line_index;
+}
+
+/* To be called after every change of the lines in edcontext->file_start */
+static void LinesChanged(EditContext *edcontext)
+{
+    EditLineIndexInvalidate(edcontext->line_index);
+}
+
+/***************************************************************************/
+
 static bool SelectNextItemMatching(EvalContext *ctx, const char *regexp, Item *begin, Item *end, Item **match, Item **prev)
 {
     Item *ip_prev = NULL;
@@ -639,6 +733,7 @@ static bool SelectNextItemMatching(EvalContext *ctx, const char *regexp, Item *b
     *match = NULL;
     *prev = NULL;
 
+    CachedRegex *crx = RegexCacheGet(regexp);
     for (Item *ip = begin; ip != end; ip = ip->next)
     {
         if (ip->name == NULL)
@@ -646,16 +741,18 @@ static bool SelectNextItemMatching(EvalContext *ctx, const char *regexp, Item *b
             continue;
         }
 
-        if (FullTextMatch(ctx, regexp, ip->name))
+        if (FullTextMatchCached(ctx, regexp, crx, ip->name))
         {
             *match = ip;
             *prev = ip_prev;
+            RegexCacheRelease(crx);
             return true;
         }
 
         ip_prev = ip;
     }
 
+    RegexCacheRelease(crx);
     return false;
 }
 
@@ -671,6 +768,7 @@ static bool SelectLastItemMatching(EvalContext *ctx, const char *regexp, Item *b
     *match = NULL;
     *prev = NULL;
 
+    CachedRegex *crx = RegexCacheGet(regexp);
     for (ip = begin; ip != end; ip = ip->next)
     {
         if (ip->name == NULL)
@@ -678,7 +776,7 @@ static bool SelectLastItemMatching(EvalContext *ctx, const char *regexp, Item *b
             continue;
         }
 
-        if (FullTextMatch(ctx, regexp, ip->name))
+        if (FullTextMatchCached(ctx, regexp, crx, ip->name))
         {
             *prev = ip_prev;
             ip_last = ip;
@@ -686,6 +784,7 @@ static bool SelectLastItemMatching(EvalContext *ctx, const char *regexp, Item *b
 
         ip_prev = ip;
     }
+    RegexCacheRelease(crx);
 
     if (ip_last)
     {
@@ -1054,6 +1153,24 @@ static bool InsertMultipleLinesToRegion(EvalContext *ctx, Item **start, Item *be
          * begin_ptr.
          * As a bonus Redmine #7640 is fixed as we are not interested in
          * matching values outside of the region we are iterating over. */
+        if (!allow_multi_lines && begin_ptr != NULL && strchr(pp->promiser, '\n') == NULL)
+        {
+            /* A single line, look it up in the index instead of matching it
+             * against every line of the region. */
+            EditLineIndex *index = LineIndex(edcontext);
+            if (EditLineIndexRegionContains(index, *start, begin_ptr, end_ptr, pp->promiser))
+            {
+                RecordNoChange(ctx, pp, a, "Promised chunk '%s' exists within selected region of %s",
+                               pp->promiser, edcontext->filename);
+                return false;
+            }
+
+            ip = (end_ptr != NULL) ? EditLineIndexPrevious(index, *start, end_ptr)
+                                   : EditLineIndexLast(index, *start);
+            prev = (ip == begin_ptr) ? NULL : EditLineIndexPrevious(index, *start, ip);
+            return InsertMultipleLinesAtLocation(ctx, start, begin_ptr, end_ptr, ip, prev, a, pp, edcontext, result);
+        }
+
         for (ip = begin_ptr; ip != NULL; ip = ip->next)
         {
             if (!allow_multi_lines && MatchRegion(ctx, pp->promiser, ip, end_ptr, false))
@@ -1117,6 +1234,11 @@ static bool DeletePromisedLinesMatching(EvalContext *ctx, Item **start, Item *be
     Item *ip, *np = NULL, *lp, *initiator = begin, *terminator = NULL;
     int i, matches, noedits = true;
     bool retval = false;
+    /* A single line promiser just has to match the line, no need to go
+     * through MatchRegion() for every line with the regex compiled once */
+    const bool single_line = (strchr(pp->promiser, '\n') == NULL);
+    /* Lines none of the batched patterns matched don't need to be matched */
+    const bool batched = single_line && EditLineBatchHas(edcontext->line_batch, pp->promiser);
 
     if (start == NULL)
     {
@@ -1157,19 +1279,41 @@ static bool DeletePromisedLinesMatching(EvalContext *ctx, Item **start, Item *be
         }
     }
 
+// Line before the initiator, to patch the hole when deleting lines
+
+    if (initiator == NULL || initiator == *start)
+    {
+        lp = NULL;
+    }
+    else if (begin != NULL && initiator == begin->next)
+    {
+        lp = begin;
+    }
+    else
+    {
+        lp = EditLineIndexPrevious(LineIndex(edcontext), *start, initiator);
+    }
+
 // Now do the deletion
 
+    CachedRegex *crx = single_line ? RegexCacheGet(pp->promiser) : NULL;
     for (ip = initiator; ip != terminator && ip != NULL; ip = np)
     {
-        if (a->not_matching)
+        if (single_line)
         {
-            matches = !MatchRegion(ctx, pp->promiser, ip, terminator, true);
+            matches = ((!batched || EditLineBatchMayMatch(edcontext->line_batch, ip)) &&
+                       FullTextMatchCached(ctx, pp->promiser, crx, ip->name)) ? 1 : 0;
         }
         else
         {
             matches = MatchRegion(ctx, pp->promiser, ip, terminator, true);
         }
 
+        if (a->not_matching)
+        {
+            matches = !matches;
+        }
+
         if (matches)
         {
             Log(LOG_LEVEL_VERBOSE, "Multi-line region (%d lines) matched text in the file", matches);
@@ -1181,6 +1325,7 @@ static bool DeletePromisedLinesMatching(EvalContext *ctx, Item **start, Item *be
 
         if (!SelectLine(ctx, ip->name, a))       // Start search from location
         {
+            lp = ip;
             np = ip->next;
             continue;
         }
@@ -1192,6 +1337,7 @@ static bool DeletePromisedLinesMatching(EvalContext *ctx, Item **start, Item *be
             if (!MakingChanges(ctx, pp, a, result, "delete line '%s' from %s",
                                ip->name, edcontext->filename))
             {
+                lp = ip;
                 np = ip->next;
                 noedits = false;
             }
@@ -1212,28 +1358,18 @@ static bool DeletePromisedLinesMatching(EvalContext *ctx, Item **start, Item *be
 
                     np = ip->next;
 
-                    if (ip == *start)
+                    if (lp == NULL)
                     {
-                        if (initiator == *start)
-                        {
-                            initiator = np;
-                        }
+                        assert(ip == *start);
                         *start = np;
                     }
                     else
                     {
-                        if (ip == initiator)
-                        {
-                            initiator = *start;
-                        }
-
-                        for (lp = initiator; lp->next != ip; lp = lp->next)
-                        {
-                        }
-
+                        assert(lp->next == ip);
                         lp->next = np;
                     }
                     free((char *) ip);
+                    LinesChanged(edcontext);
 
                     (edcontext->num_edits)++;
 
@@ -1243,9 +1379,11 @@ static bool DeletePromisedLinesMatching(EvalContext *ctx, Item **start, Item *be
         }
         else
         {
+            lp = ip;
             np = ip->next;
         }
     }
+    RegexCacheRelease(crx);
 
     if (noedits)
     {
@@ -1279,6 +1417,14 @@ static bool ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end,
         once_only = true;
     }
 
+    /* Compile the pattern once for the whole pass over the file */
+    CachedRegex *crx = RegexCacheGet(pp->promiser);
+    const bool not_anchored = NotAnchored(pp->promiser);
+    /* Lines none of the batched patterns matched don't need to be matched,
+     * unless the replacement depends on what was matched */
+    const bool batched = EditLineBatchHas(edcontext->line_batch, pp->promiser) &&
+        !UsesMatchVariables(a->replace.replace_value);
+
     Buffer *replace = BufferNew();
     for (ip = file_start; ip != NULL && ip != file_end; ip = ip->next)
     {
@@ -1292,7 +1438,9 @@ static bool ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end,
         replaced = false;
         match_len = 0;
 
-        while (BlockTextMatch(ctx, pp->promiser, line_buff, &start_off, &end_off))
+        const bool may_match = !batched || EditLineBatchMayMatch(edcontext->line_batch, ip);
+        bool matched;
+        while ((matched = (may_match && BlockTextMatchCached(ctx, crx, line_buff, &start_off, &end_off))))
         {
             if (match_len == strlen(line_buff))
             {
@@ -1331,7 +1479,12 @@ static bool ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end,
             }
         }
 
-        if (NotAnchored(pp->promiser) && BlockTextMatch(ctx, pp->promiser, line_buff, &start_off, &end_off))
+        /* Unless we stopped right after the first replacement, 'matched' is
+         * the result for line_buff as it is now, no need to match again */
+        if (not_anchored &&
+            ((once_only && replaced) ?
+             BlockTextMatchCached(ctx, crx, line_buff, &start_off, &end_off) :
+             matched))
         {
             RecordInterruption(ctx, pp, a,
                                "Promised replacement '%s' on line '%s' for pattern '%s'"
@@ -1352,6 +1505,8 @@ static bool ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end,
         {
             free(ip->name);
             ip->name = xstrdup(line_buff);
+            LinesChanged(edcontext);
+            EditLineBatchLineChanged(edcontext->line_batch, ip);
             RecordChange(ctx, pp, a, "Replaced pattern '%s' in '%s'", pp->promiser, edcontext->filename);
             *result = PromiseResultUpdate(*result, PROMISE_RESULT_CHANGE);
             (edcontext->num_edits)++;
@@ -1366,7 +1521,7 @@ static bool ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end,
                 break;
             }
 
-            if (BlockTextMatch(ctx, pp->promiser, ip->name, &start_off, &end_off))
+            if (BlockTextMatchCached(ctx, crx, ip->name, &start_off, &end_off))
             {
                 RecordInterruption(ctx, pp, a,
                                    "Promised replacement '%s' for pattern '%s' is not properly convergent while editing '%s'"
@@ -1379,6 +1534,7 @@ static bool ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end,
     }
 
     BufferDestroy(replace);
+    RegexCacheRelease(crx);
 
     if (notfound)
     {
@@ -1449,6 +1605,7 @@ static bool EditColumns(EvalContext *ctx, Item *file_start, Item *file_end, cons
         {
             free(ip->name);
             ip->name = Rlist2String(columns, separator);
+            LinesChanged(edcontext);
         }
 
         RlistDestroy(columns);
@@ -1799,8 +1956,16 @@ static bool MatchPolicy(EvalContext *ctx, const char *camel, const char *haystac
     return ok;
 }
 
-static bool IsItemInRegion(EvalContext *ctx, const char *item, const Item *begin_ptr, const Item *end_ptr, Rlist *insert_match, const Promise *pp)
+static bool IsItemInRegion(EvalContext *ctx, const char *item, const Item *begin_ptr, const Item *end_ptr, Rlist *insert_match,
+                           const Promise *pp, EditContext *edcontext)
 {
+    if (insert_match == NULL && begin_ptr != NULL)
+    {
+        /* Exact match, no need to compare with every line */
+        return EditLineIndexRegionContains(LineIndex(edcontext), edcontext->file_start,
+                                           begin_ptr, end_ptr, item);
+    }
+
     for (const Item *ip = begin_ptr; ((ip != end_ptr) && (ip != NULL)); ip = ip->next)
     {
         if (MatchPolicy(ctx, item, ip->name, insert_match, pp))
@@ -1867,7 +2032,7 @@ static bool InsertFileAtLocation(EvalContext *ctx, Item **start, Item *begin_ptr
             continue;
         }
 
-        if (!preserve_block && IsItemInRegion(ctx, BufferData(exp), begin_ptr, end_ptr, a->insert_match, pp))
+        if (!preserve_block && IsItemInRegion(ctx, BufferData(exp), begin_ptr, end_ptr, a->insert_match, pp, edcontext))
         {
             RecordNoChange(ctx, pp, a, "Promised file line '%s' exists within file '%s'",
                            BufferData(exp), edcontext->filename);
@@ -1979,7 +2144,7 @@ static bool InsertCompoundLineAtLocation(EvalContext *ctx, const char *chunk, It
             continue;
         }
 
-        if (!preserve_block && IsItemInRegion(ctx, buf, begin_ptr, end_ptr, a->insert_match, pp))
+        if (!preserve_block && IsItemInRegion(ctx, buf, begin_ptr, end_ptr, a->insert_match, pp, edcontext))
         {
             RecordNoChange(ctx, pp, a,
                            "Promised chunk '%s' exists within selected region of '%s'",
@@ -2026,7 +2191,7 @@ static bool InsertCompoundLineAtLocation(EvalContext *ctx, const char *chunk, It
 /**
  * Look for a line matching proposed insert before or after location
  */
-static bool NeighbourItemMatches(EvalContext *ctx, const Item *file_start, const Item *location,
+static bool NeighbourItemMatches(EvalContext *ctx, EditContext *edcontext, const Item *location,
                                  const char *string, EditOrder pos, Rlist *insert_match,
                                  const Promise *pp)
 {
@@ -2041,15 +2206,9 @@ static bool NeighbourItemMatches(EvalContext *ctx, const Item *file_start, const
                 (MatchPolicy(ctx, string, location->next->name, insert_match, pp)));
     }
     /* else => (pos == EDIT_ORDER_BEFORE) */
-    for (const Item *ip = file_start; ip != NULL; ip = ip->next)
-    {
-        if ((ip->next != NULL) && (ip->next == location))
-        {
-            return (MatchPolicy(ctx, string, ip->name, insert_match, pp));
-        }
-    }
-
-    return false;
+    const Item *prev = EditLineIndexPrevious(LineIndex(edcontext), edcontext->file_start, location);
+    return ((prev != NULL) &&
+            (MatchPolicy(ctx, string, prev->name, insert_match, pp)));
 }
 
 static bool InsertLineAtLocation(EvalContext *ctx, char *newline, Item **start, Item *location, Item *prev, const Attributes *a,
@@ -2080,6 +2239,7 @@ static bool InsertLineAtLocation(EvalContext *ctx, char *newline, Item **start,
                 else
                 {
                     PrependItemList(start, newline);
+                    LinesChanged(edcontext);
                     (edcontext->num_edits)++;
                     RecordChange(ctx, pp, a, "Inserted the promised line '%s' into '%s'",
                                  newline, edcontext->filename);
@@ -2098,6 +2258,7 @@ static bool InsertLineAtLocation(EvalContext *ctx, char *newline, Item **start,
                 else
                 {
                     PrependItemList(start, newline);
+                    LinesChanged(edcontext);
                     (edcontext->num_edits)++;
                     RecordChange(ctx, pp, a, "Prepended the promised line '%s' to %s", newline,
                                  edcontext->filename);
@@ -2116,7 +2277,7 @@ static bool InsertLineAtLocation(EvalContext *ctx, char *newline, Item **start,
 
     if (a->location.before_after == EDIT_ORDER_BEFORE)
     {
-        if (!preserve_block && NeighbourItemMatches(ctx, *start, location, newline, EDIT_ORDER_BEFORE, a->insert_match, pp))
+        if (!preserve_block && NeighbourItemMatches(ctx, edcontext, location, newline, EDIT_ORDER_BEFORE, a->insert_match, pp))
         {
             RecordNoChange(ctx, pp, a, "Promised line '%s' exists before locator in '%s'",
                            newline, edcontext->filename);
@@ -2132,6 +2293,7 @@ static bool InsertLineAtLocation(EvalContext *ctx, char *newline, Item **start,
             else
             {
                 InsertAfter(start, prev, newline);
+                LinesChanged(edcontext);
                 (edcontext->num_edits)++;
                 RecordChange(ctx, pp, a, "Inserted the promised line '%s' into '%s' before locator",
                              newline, edcontext->filename);
@@ -2142,7 +2304,7 @@ static bool InsertLineAtLocation(EvalContext *ctx, char *newline, Item **start,
     }
     else
     {
-        if (!preserve_block && NeighbourItemMatches(ctx, *start, location, newline, EDIT_ORDER_AFTER, a->insert_match, pp))
+        if (!preserve_block && NeighbourItemMatches(ctx, edcontext, location, newline, EDIT_ORDER_AFTER, a->insert_match, pp))
         {
             RecordNoChange(ctx, pp, a, "Promised line '%s' exists after locator in '%s'",
                            newline, edcontext->filename);
@@ -2158,6 +2320,7 @@ static bool InsertLineAtLocation(EvalContext *ctx, char *newline, Item **start,
             else
             {
                 InsertAfter(start, location, newline);
+                LinesChanged(edcontext);
                 RecordChange(ctx, pp, a, "Inserted the promised line '%s' into '%s' after locator",
                              newline, edcontext->filename);
                 *result = PromiseResultUpdate(*result, PROMISE_RESULT_CHANGE);
@@ -2547,3 +2710,11 @@ static bool MultiLineString(char *s)
 
     return (strchr(s, '\n') != NULL);
 }
+
+/********************************************************************/
+
+static bool UsesMatchVariables(const char *s)
+{
+    return (s != NULL) &&
+        ((strstr(s, "$(match.") != NULL) || (strstr(s, "${match.") != NULL));
+}
@@ -0,0 +1,217 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <files_editline_batch.h>
+
+#include <alloc.h>
+#include <buffer.h>
+#include <logging.h>
+#include <map.h>
+#include <sequence.h>
+#include <set.h>                                  /* StringSet */
+#include <regex_cache.h>                          /* CachedRegexExec */
+
+struct EditLineBatch_
+{
+    bool full_match;
+    bool scanned;
+    StringSet *patterns;
+    Seq *regexes;               /* CachedRegex * of the patterns */
+    Buffer *combined;           /* (?:pattern)|(?:pattern)|... */
+    Map *candidates;            /* Item * -> Item *, lines a pattern may match */
+};
+
+static unsigned int LineHash(const void *p, unsigned int seed)
+{
+    const uint64_t key = (uintptr_t) p;
+    return ((unsigned int) ((key * 0x9E3779B97F4A7C15ULL) >> 32)) ^ seed;
+}
+
+static bool LineEqual(const void *a, const void *b)
+{
+    return (a == b);
+}
+
+/* The lines are owned by the Item list. */
+static void LineDestroy(ARG_UNUSED void *p)
+{
+}
+
+static void RegexRelease(void *p)
+{
+    RegexCacheRelease(p);
+}
+
+EditLineBatch *EditLineBatchNew(bool full_match)
+{
+    EditLineBatch *batch = xcalloc(1, sizeof(EditLineBatch));
+    batch->full_match = full_match;
+    batch->patterns = StringSetNew();
+    batch->regexes = SeqNew(8, RegexRelease);
+    batch->combined = BufferNew();
+    batch->candidates = MapNew(LineHash, LineEqual, LineDestroy, LineDestroy);
+    return batch;
+}
+
+void EditLineBatchDestroy(EditLineBatch *batch)
+{
+    if (batch != NULL)
+    {
+        StringSetDestroy(batch->patterns);
+        SeqDestroy(batch->regexes);
+        BufferDestroy(batch->combined);
+        MapDestroy(batch->candidates);
+        free(batch);
+    }
+}
+
+/**
+ * @return whether #pattern has back references, recursions or verbs, which
+ *         would mean something else next to other patterns
+ */
+static bool RefersToGroups(const char *pattern)
+{
+    for (const char *sp = pattern; *sp != '\0'; sp++)
+    {
+        if (sp[0] == '\\' && sp[1] != '\0')
+        {
+            if (isdigit((unsigned char) sp[1]) || sp[1] == 'g' || sp[1] == 'k')
+            {
+                return true;
+            }
+            sp++;               /* skip the escaped character */
+        }
+        else if (sp[0] == '(' && sp[1] == '?' && sp[2] != '\0' &&
+                 (isdigit((unsigned char) sp[2]) || strchr("R+-&P", sp[2]) != NULL))
+        {
+            return true;
+        }
+        else if (sp[0] == '(' && sp[1] == '*')
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool EditLineBatchAdd(EditLineBatch *batch, const char *pattern)
+{
+    assert(batch != NULL);
+    assert(pattern != NULL);
+    assert(!batch->scanned);
+
+    if (StringSetContains(batch->patterns, pattern))
+    {
+        return true;
+    }
+    if (RefersToGroups(pattern))
+    {
+        return false;
+    }
+
+    /* Also keeps the compiled pattern in the cache for the promise */
+    CachedRegex *crx = RegexCacheGet(pattern);
+    if (crx == NULL)
+    {
+        return false;
+    }
+    SeqAppend(batch->regexes, crx);
+
+    if (BufferSize(batch->combined) > 0)
+    {
+        BufferAppendChar(batch->combined, '|');
+    }
+    BufferAppendF(batch->combined, "(?:%s)", pattern);
+    StringSetAdd(batch->patterns, xstrdup(pattern));
+    return true;
+}
+
+size_t EditLineBatchLength(const EditLineBatch *batch)
+{
+    assert(batch != NULL);
+    return StringSetSize(batch->patterns);
+}
+
+void EditLineBatchScan(EditLineBatch *batch, const Item *file_start)
+{
+    assert(batch != NULL);
+    assert(!batch->scanned);
+
+    char *combined;
+    if (batch->full_match)
+    {
+        xasprintf(&combined, "^(?:%s)$", BufferData(batch->combined));
+    }
+    else
+    {
+        combined = xstrdup(BufferData(batch->combined));
+    }
+
+    CachedRegex *crx = RegexCacheGet(combined);
+    free(combined);
+    if (crx == NULL)
+    {
+        /* Leave the patterns to the promises */
+        return;
+    }
+
+    size_t lines = 0;
+    for (const Item *ip = file_start; ip != NULL; ip = ip->next, lines++)
+    {
+        int ovector[OVECCOUNT];
+        if ((ip->name == NULL) ||
+            /* FullTextMatch() also takes the pattern as a literal line */
+            (batch->full_match && StringSetContains(batch->patterns, ip->name)) ||
+            (CachedRegexExec(crx, ip->name, strlen(ip->name), ovector, OVECCOUNT) >= 0))
+        {
+            MapInsert(batch->candidates, (void *) ip, (void *) ip);
+        }
+    }
+    RegexCacheRelease(crx);
+    batch->scanned = true;
+
+    Log(LOG_LEVEL_DEBUG, "Matched %zu patterns against %zu lines in one pass, %zu lines may match",
+        StringSetSize(batch->patterns), lines, MapSize(batch->candidates));
+}
+
+bool EditLineBatchHas(const EditLineBatch *batch, const char *pattern)
+{
+    return (batch != NULL) && batch->scanned &&
+        StringSetContains(batch->patterns, pattern);
+}
+
+bool EditLineBatchMayMatch(const EditLineBatch *batch, const Item *line)
+{
+    assert(batch != NULL);
+    assert(batch->scanned);
+    return (MapGet(batch->candidates, line) != NULL);
+}
+
+void EditLineBatchLineChanged(EditLineBatch *batch, const Item *line)
+{
+    if (batch != NULL && batch->scanned)
+    {
+        MapInsert(batch->candidates, (void *) line, (void *) line);
+    }
+}
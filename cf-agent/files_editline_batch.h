@@ -0,0 +1,77 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_FILES_EDITLINE_BATCH_H
+#define CFENGINE_FILES_EDITLINE_BATCH_H
+
+#include <cf3.defs.h>                                                 /* Item */
+
+/**
+ * Patterns of the delete_lines or replace_patterns promises of an edit_line
+ * bundle section, combined into one regular expression and matched against
+ * all the lines of the file in a single pass. The promises are still
+ * evaluated one after another, with their own regions, classes and
+ * reporting, but only need to match their own pattern against the lines any
+ * pattern of the batch may match.
+ *
+ * EditLineBatchLineChanged() must be called whenever the contents of a line
+ * are changed while the batch is in use. Lines may be deleted, but not
+ * inserted.
+ */
+typedef struct EditLineBatch_ EditLineBatch;
+
+/**
+ * @param full_match  whether the patterns have to match whole lines
+ *                    (delete_lines) or any part of them (replace_patterns)
+ */
+EditLineBatch *EditLineBatchNew(bool full_match);
+void EditLineBatchDestroy(EditLineBatch *batch);
+
+/**
+ * Add #pattern to the batch, before EditLineBatchScan().
+ *
+ * @return false if #pattern can't be combined with other patterns (it is
+ *         not valid or refers to its own groups)
+ */
+bool EditLineBatchAdd(EditLineBatch *batch, const char *pattern);
+size_t EditLineBatchLength(const EditLineBatch *batch);
+
+/**
+ * Match the combined patterns against all the lines from #file_start.
+ */
+void EditLineBatchScan(EditLineBatch *batch, const Item *file_start);
+
+/**
+ * @return whether #pattern was scanned for by #batch (which may be NULL)
+ */
+bool EditLineBatchHas(const EditLineBatch *batch, const char *pattern);
+
+/**
+ * @return false if no pattern of #batch matches #line, true if some may
+ */
+bool EditLineBatchMayMatch(const EditLineBatch *batch, const Item *line);
+
+void EditLineBatchLineChanged(EditLineBatch *batch, const Item *line);
+
+#endif
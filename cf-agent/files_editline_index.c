@@ -0,0 +1,240 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <files_editline_index.h>
+
+#include <alloc.h>
+#include <map.h>                                  /* TYPED_MAP_* */
+#include <sequence.h>
+#include <string_lib.h>                           /* StringEqual */
+
+typedef struct
+{
+    size_t *positions;                            /* ascending */
+    size_t length;
+    size_t capacity;
+} LinePositions;
+
+static void LinePositionsDestroy(void *p)
+{
+    LinePositions *lp = p;
+    if (lp != NULL)
+    {
+        free(lp->positions);
+        free(lp);
+    }
+}
+
+/* The keys are the names of the Items, owned by the Item list. */
+static void LineKeyDestroy(ARG_UNUSED void *p)
+{
+}
+
+TYPED_MAP_DECLARE(Line, char *, LinePositions *)
+
+TYPED_MAP_DEFINE(Line, char *, LinePositions *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 LineKeyDestroy,
+                 LinePositionsDestroy)
+
+struct EditLineIndex_
+{
+    const Item *file_start;     /* the list the index was built from */
+    Seq *lines;                 /* Item * in file order, NULL if invalid */
+    LineMap *positions;         /* line -> positions in lines */
+};
+
+EditLineIndex *EditLineIndexNew(void)
+{
+    return xcalloc(1, sizeof(EditLineIndex));
+}
+
+void EditLineIndexInvalidate(EditLineIndex *index)
+{
+    if (index != NULL && index->lines != NULL)
+    {
+        SeqDestroy(index->lines);
+        LineMapDestroy(index->positions);
+        index->lines = NULL;
+        index->positions = NULL;
+        index->file_start = NULL;
+    }
+}
+
+void EditLineIndexDestroy(EditLineIndex *index)
+{
+    EditLineIndexInvalidate(index);
+    free(index);
+}
+
+static void AddPosition(LineMap *positions, char *line, size_t pos)
+{
+    LinePositions *lp = LineMapGet(positions, line);
+    if (lp == NULL)
+    {
+        lp = xcalloc(1, sizeof(LinePositions));
+        LineMapInsert(positions, line, lp);
+    }
+
+    if (lp->length == lp->capacity)
+    {
+        lp->capacity = (lp->capacity == 0) ? 1 : lp->capacity * 2;
+        lp->positions = xrealloc(lp->positions, lp->capacity * sizeof(size_t));
+    }
+    lp->positions[lp->length++] = pos;
+}
+
+static void EnsureIndex(EditLineIndex *index, const Item *file_start)
+{
+    if (index->lines != NULL && index->file_start == file_start)
+    {
+        return;
+    }
+
+    EditLineIndexInvalidate(index);
+
+    index->lines = SeqNew(1024, NULL);
+    index->positions = LineMapNew();
+    index->file_start = file_start;
+
+    size_t pos = 0;
+    for (const Item *ip = file_start; ip != NULL; ip = ip->next, pos++)
+    {
+        SeqAppend(index->lines, (void *) ip);
+        if (ip->name != NULL)
+        {
+            AddPosition(index->positions, ip->name, pos);
+        }
+    }
+}
+
+static bool ItemPosition(const EditLineIndex *index, const Item *item, size_t *pos)
+{
+    if (item->name == NULL)
+    {
+        return false;
+    }
+
+    const LinePositions *lp = LineMapGet(index->positions, item->name);
+    if (lp != NULL)
+    {
+        for (size_t i = 0; i < lp->length; i++)
+        {
+            if (SeqAt(index->lines, lp->positions[i]) == item)
+            {
+                *pos = lp->positions[i];
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool EditLineIndexRegionContains(EditLineIndex *index, const Item *file_start,
+                                 const Item *begin, const Item *end,
+                                 const char *line)
+{
+    assert(index != NULL);
+    assert(begin != NULL);
+    assert(line != NULL);
+
+    EnsureIndex(index, file_start);
+
+    size_t from = 0;
+    size_t to = SeqLength(index->lines);
+    if (!ItemPosition(index, begin, &from) ||
+        (end != NULL && !ItemPosition(index, end, &to)) ||
+        (to < from))
+    {
+        /* Not a region of this file, do what the callers used to do. */
+        for (const Item *ip = begin; ip != end && ip != NULL; ip = ip->next)
+        {
+            if (ip->name != NULL && StringEqual(ip->name, line))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const LinePositions *lp = LineMapGet(index->positions, line);
+    if (lp == NULL)
+    {
+        return false;
+    }
+
+    /* First position >= from */
+    size_t low = 0;
+    size_t high = lp->length;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (lp->positions[mid] < from)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return (low < lp->length) && (lp->positions[low] < to);
+}
+
+Item *EditLineIndexPrevious(EditLineIndex *index, const Item *file_start,
+                            const Item *item)
+{
+    assert(index != NULL);
+    assert(item != NULL);
+
+    EnsureIndex(index, file_start);
+
+    size_t pos;
+    if (ItemPosition(index, item, &pos))
+    {
+        return (pos == 0) ? NULL : SeqAt(index->lines, pos - 1);
+    }
+
+    for (const Item *ip = file_start; ip != NULL; ip = ip->next)
+    {
+        if (ip->next == item)
+        {
+            return (Item *) ip;
+        }
+    }
+    return NULL;
+}
+
+Item *EditLineIndexLast(EditLineIndex *index, const Item *file_start)
+{
+    assert(index != NULL);
+
+    EnsureIndex(index, file_start);
+
+    const size_t length = SeqLength(index->lines);
+    return (length == 0) ? NULL : SeqAt(index->lines, length - 1);
+}
@@ -0,0 +1,65 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_FILES_EDITLINE_INDEX_H
+#define CFENGINE_FILES_EDITLINE_INDEX_H
+
+#include <cf3.defs.h>                                                 /* Item */
+
+/**
+ * Index of the lines of a file being edited by edit_line promises: the lines
+ * in file order plus a hash of the line contents, so that checking whether a
+ * line exists in a region or finding the line before another one doesn't
+ * need a walk over the whole Item list.
+ *
+ * The index is built lazily from the Item list and must be invalidated by
+ * EditLineIndexInvalidate() whenever lines are inserted, deleted or changed.
+ */
+typedef struct EditLineIndex_ EditLineIndex;
+
+EditLineIndex *EditLineIndexNew(void);
+void EditLineIndexDestroy(EditLineIndex *index);
+void EditLineIndexInvalidate(EditLineIndex *index);
+
+/**
+ * @return whether a line equal to #line is in the region from #begin
+ *         (included) to #end (excluded, NULL for the end of the file)
+ */
+bool EditLineIndexRegionContains(EditLineIndex *index, const Item *file_start,
+                                 const Item *begin, const Item *end,
+                                 const char *line);
+
+/**
+ * @return the line before #item or NULL if #item is the first line
+ */
+Item *EditLineIndexPrevious(EditLineIndex *index, const Item *file_start,
+                            const Item *item);
+
+/**
+ * @return the last line of the file or NULL if it is empty
+ */
+Item *EditLineIndexLast(EditLineIndex *index, const Item *file_start);
+
+#endif
@@ -83,8 +83,9 @@ static bool ConsiderFile(const char *nodename, const char *path, struct stat *st
 
 bool ConsiderLocalFile(const char *filename, const char *directory)
 {
+    /* The type only matters for suspicious names, don't stat the others */
     struct stat stat;
-    if (lstat(filename, &stat) == -1)
+    if (!IsItemIn(SUSPICIOUSLIST, filename) || (lstat(filename, &stat) == -1))
     {
         return ConsiderFile(filename, directory, NULL);
     }
@@ -197,6 +197,69 @@ bool SelectLeaf(EvalContext *ctx, char *path, const struct stat *sb, const FileS
     return result;
 }
 
+/*******************************************************************/
+
+bool SelectLeafNeedsStat(const FileSelect *fs)
+{
+    /* Leaf attributes SelectLeaf() sets without looking at more than the
+     * file type in the stat */
+    static const char *const NO_STAT_ATTRS[] =
+    {
+        "leaf_name",
+        "leaf_path",
+        "path_name",
+        "file_types",
+        "issymlinkto",
+        "exec_regex",
+        "exec_program",
+        NULL
+    };
+
+    assert(fs != NULL);
+    if (fs->result == NULL)
+    {
+        return true;
+    }
+
+    const char *p = fs->result;
+    while (*p != '\0')
+    {
+        if ((*p == '$') || (*p == '@'))
+        {
+            /* Variable references, can be anything */
+            return true;
+        }
+        if (!isalnum((unsigned char) *p) && (*p != '_'))
+        {
+            p++;
+            continue;
+        }
+
+        size_t len = 0;
+        while (isalnum((unsigned char) p[len]) || (p[len] == '_'))
+        {
+            len++;
+        }
+
+        bool known = false;
+        for (int i = 0; NO_STAT_ATTRS[i] != NULL; i++)
+        {
+            if ((strlen(NO_STAT_ATTRS[i]) == len) && (strncmp(p, NO_STAT_ATTRS[i], len) == 0))
+            {
+                known = true;
+                break;
+            }
+        }
+        if (!known)
+        {
+            return true;
+        }
+        p += len;
+    }
+
+    return false;
+}
+
 /*******************************************************************/
 /* Level                                                           */
 /*******************************************************************/
@@ -29,6 +29,12 @@
 
 bool SelectLeaf(EvalContext *ctx, char *path, const struct stat *sb, const FileSelect *fs);
 
+/**
+ * @return whether #fs needs more than the name and the type of a file, which
+ *         are known without stat() when reading the directory
+ */
+bool SelectLeafNeedsStat(const FileSelect *fs);
+
 /* For implementation in Nova */
 bool GetOwnerName(char *path, const struct stat *lstatptr, char *owner, int ownerSz);
 
@@ -33,16 +33,43 @@
 #include <file_lib.h>
 #include <known_dirs.h>
 #include <string_sequence.h>
+#include <map.h>              /* StringMap, TYPED_MAP_* */
 #include <locks.h>
 #include <rlist.h>
 #include <policy.h>
 #include <eval_context.h>
 #include <changes_chroot.h>     /* RecordPkgOperationInChroot() */
 #include <simulate_mode.h>      /* CHROOT_PKG_OPERATION_* */
+#include <processes_select.h>   /* InvalidateProcessTable() */
 
 #define INVENTORY_LIST_BUFFER_SIZE 100 * 80 /* 100 entries with 80 characters
                                              * per line */
 
+#define INVENTORY_KEY "<inventory>"
+
+/*
+ * In-memory copies of the installed packages and available updates caches,
+ * loaded once per run and package module from the respective sub-DB. The
+ * keys are the same as in the DBs ("N<name>", "N<name>V<version>A<arch>",...),
+ * the DBs only persist the caches between runs and are rewritten in one go
+ * when the package module reports new lists.
+ */
+static void StringMapDestroy_untyped(void *p)
+{
+    StringMapDestroy(p);
+}
+
+TYPED_MAP_DECLARE(PackagesCache, char *, StringMap *)
+
+TYPED_MAP_DEFINE(PackagesCache, char *, StringMap *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 StringMapDestroy_untyped)
+
+static PackagesCacheMap *INSTALLED_PACKAGES_CACHE = NULL; /* GLOBAL_X */
+static PackagesCacheMap *PACKAGE_UPDATES_CACHE = NULL;    /* GLOBAL_X */
+
 static bool UpdateSinglePackageModuleCache(EvalContext *ctx,
                                     const PackageModuleWrapper *module_wrapper,
                                     UpdateType type, bool force_update);
@@ -521,6 +548,72 @@ static void GetPackageModuleExecInfo(const PackageModuleBody *package_module, ch
     }
 }
 
+static PackagesCacheMap **GetPackagesCacheMap(dbid db_id)
+{
+    assert(db_id == dbid_packages_installed || db_id == dbid_packages_updates);
+
+    PackagesCacheMap **caches = (db_id == dbid_packages_installed) ?
+        &INSTALLED_PACKAGES_CACHE : &PACKAGE_UPDATES_CACHE;
+    if (*caches == NULL)
+    {
+        *caches = PackagesCacheMapNew();
+    }
+    return caches;
+}
+
+static bool LoadPackagesCacheEntry(const void *key, int key_size,
+                                   const void *value, int value_size,
+                                   void *data)
+{
+    StringMap *cache = data;
+
+    /* Keys are stored with the terminating NUL byte, values without it. */
+    StringMapInsert(cache, xstrndup(key, key_size), xstrndup(value, value_size));
+    return true;
+}
+
+/**
+ * Get the in-memory copy of the packages cache of the given type for the
+ * given package module, loading it from the DB on first use.
+ *
+ * @return %NULL if the DB cannot be opened
+ */
+static const StringMap *GetPackagesCache(dbid db_id, const char *pm_name)
+{
+    assert(pm_name != NULL);
+
+    PackagesCacheMap **caches = GetPackagesCacheMap(db_id);
+    StringMap *cache = PackagesCacheMapGet(*caches, pm_name);
+    if (cache != NULL)
+    {
+        return cache;
+    }
+
+    CF_DB *db_cached;
+    if (!OpenSubDB(&db_cached, db_id, pm_name))
+    {
+        return NULL;
+    }
+
+    cache = StringMapNew();
+    if (!ScanDBSnapshot(db_cached, LoadPackagesCacheEntry, cache))
+    {
+        Log(LOG_LEVEL_ERR, "Failed to load packages cache database for '%s'",
+            pm_name);
+        StringMapDestroy(cache);
+        CloseDB(db_cached);
+        return NULL;
+    }
+    CloseDB(db_cached);
+
+    Log(LOG_LEVEL_DEBUG, "Loaded %zu entries from %s packages cache for '%s'",
+        StringMapSize(cache),
+        (db_id == dbid_packages_installed) ? "installed" : "updates", pm_name);
+
+    PackagesCacheMapInsert(*caches, xstrdup(pm_name), cache);
+    return cache;
+}
+
 static int IsPackageInCache(EvalContext *ctx,
                             const PackageModuleWrapper *module_wrapper,
                             const char *name, const char *ver, const char *arch)
@@ -544,9 +637,9 @@ static int IsPackageInCache(EvalContext *ctx,
         }
     }
 
-    CF_DB *db_cached;
-    if (!OpenSubDB(&db_cached, dbid_packages_installed,
-                   module_wrapper->package_module->name))
+    const StringMap *cache = GetPackagesCache(dbid_packages_installed,
+                                              module_wrapper->package_module->name);
+    if (cache == NULL)
     {
         Log(LOG_LEVEL_INFO, "Can not open cache database.");
         return -1;
@@ -571,14 +664,14 @@ static int IsPackageInCache(EvalContext *ctx,
     }
 
     int is_in_cache = 0;
-    char buff[1];
 
     Log(LOG_LEVEL_DEBUG, "Looking for key in installed packages cache: %s", key);
 
-    if (ReadDB(db_cached, key, buff, 1))
+    const char *value = StringMapGet(cache, key);
+    if (value != NULL)
     {
         /* Just make sure DB is not corrupted. */
-        if (buff[0] == '1')
+        if (value[0] == '1')
         {
             is_in_cache = 1;
         }
@@ -593,56 +686,64 @@ static int IsPackageInCache(EvalContext *ctx,
     Log(LOG_LEVEL_DEBUG,
         "Looking for package %s in cache returned: %d", name, is_in_cache);
 
-    CloseDB(db_cached);
+    free(key);
 
     return is_in_cache;
 }
 
-void WritePackageDataToDB(CF_DB *db_installed,
-        const char *name, const char *ver, const char *arch,
-        UpdateType type)
+static void AddPackageDataToCache(StringMap *cache,
+                                  const char *name, const char *ver, const char *arch,
+                                  UpdateType type)
 {
-    char package_key[strlen(name) + strlen(ver) +
-                     strlen(arch) + 11];
-
-    xsnprintf(package_key, sizeof(package_key),
-              "N<%s>", name);
     if (type == UPDATE_TYPE_INSTALLED)
     {
-        WriteDB(db_installed, package_key, "1", 1);
-        xsnprintf(package_key, sizeof(package_key),
-                "N<%s>V<%s>", name, ver);
-        WriteDB(db_installed, package_key, "1", 1);
-        xsnprintf(package_key, sizeof(package_key),
-                "N<%s>A<%s>", name, arch);
-        WriteDB(db_installed, package_key, "1", 1);
-        xsnprintf(package_key, sizeof(package_key),
-                "N<%s>V<%s>A<%s>", name, ver, arch);
-        WriteDB(db_installed, package_key, "1", 1);
+        StringMapInsert(cache, StringFormat("N<%s>", name), xstrdup("1"));
+        StringMapInsert(cache, StringFormat("N<%s>V<%s>", name, ver), xstrdup("1"));
+        StringMapInsert(cache, StringFormat("N<%s>A<%s>", name, arch), xstrdup("1"));
+        StringMapInsert(cache, StringFormat("N<%s>V<%s>A<%s>", name, ver, arch),
+                        xstrdup("1"));
     }
-    else if (HasKeyDB(db_installed, package_key, strlen(package_key) + 1))
+    else
     {
         /* type == UPDATE_TYPE_UPDATES || type == UPDATE_TYPE_LOCAL_UPDATES */
-        size_t val_size =
-                ValueSizeDB(db_installed, package_key, strlen(package_key) + 1);
-        char buff[val_size + strlen(arch) + strlen(ver) + 8];
-
-        ReadDB(db_installed, package_key, buff, val_size);
-        xsnprintf(buff + val_size, sizeof(package_key), "V<%s>A<%s>\n",
-                  ver, arch);
+        char *package_key = StringFormat("N<%s>", name);
+        const char *old_value = StringMapGet(cache, package_key);
+        char *value = StringFormat("%sV<%s>A<%s>\n",
+                                   (old_value != NULL) ? old_value : "", ver, arch);
         Log(LOG_LEVEL_DEBUG,
             "Updating available updates key '%s' with value '%s'",
-            package_key, buff);
+            package_key, value);
 
-        WriteDB(db_installed, package_key, buff, strlen(buff));
+        StringMapInsert(cache, package_key, value);
     }
-    else
+}
+
+/**
+ * Replace the contents of the packages cache DB with #cache in a single
+ * transaction (all writes of a thread go to one transaction committed in
+ * CloseDB()).
+ */
+static bool WritePackagesCacheToDB(dbid db_id, const char *pm_name,
+                                   const StringMap *cache)
+{
+    CF_DB *db_cached;
+    if (!OpenSubDB(&db_cached, db_id, pm_name))
     {
-        /* type == UPDATE_TYPE_UPDATES || type == UPDATE_TYPE_LOCAL_UPDATES */
-        char buff[strlen(arch) + strlen(ver) + 8];
-        xsnprintf(buff, sizeof(package_key), "V<%s>A<%s>\n", ver, arch);
-        WriteDB(db_installed, package_key, buff, strlen(buff));
+        return false;
+    }
+
+    bool success = CleanDB(db_cached);
+
+    MapIterator it = MapIteratorInit(cache->impl);
+    MapKeyValue *item;
+    while (success && (item = MapIteratorNext(&it)) != NULL)
+    {
+        const char *value = item->value;
+        success = WriteDB(db_cached, item->key, value, strlen(value));
     }
+
+    CloseDB(db_cached);
+    return success;
 }
 
 int UpdatePackagesDB(Rlist *data, const char *pm_name, UpdateType type)
@@ -651,113 +752,110 @@ int UpdatePackagesDB(Rlist *data, const char *pm_name, UpdateType type)
 
     bool have_error = false;
 
-    CF_DB *db_cached;
     dbid db_id = type == UPDATE_TYPE_INSTALLED ? dbid_packages_installed :
                                                  dbid_packages_updates;
-    if (OpenSubDB(&db_cached, db_id, pm_name))
-    {
-        CleanDB(db_cached);
 
-        Buffer *inventory_data = BufferNewWithCapacity(INVENTORY_LIST_BUFFER_SIZE);
+    StringMap *cache = StringMapNew();
 
-        const char *package_data[3] = {NULL, NULL, NULL};
+    Buffer *inventory_data = BufferNewWithCapacity(INVENTORY_LIST_BUFFER_SIZE);
 
-        for (const Rlist *rp = data; rp != NULL; rp = rp->next)
-        {
-            const char *line = RlistScalarValue(rp);
+    const char *package_data[3] = {NULL, NULL, NULL};
 
-            if (StringStartsWith(line, "Name="))
+    for (const Rlist *rp = data; rp != NULL; rp = rp->next)
+    {
+        const char *line = RlistScalarValue(rp);
+
+        if (StringStartsWith(line, "Name="))
+        {
+            if (package_data[0])
             {
-                if (package_data[0])
+                if (package_data[1] && package_data[2])
+                {
+                    AddPackageDataToCache(cache, package_data[0],
+                                          package_data[1], package_data[2],
+                                          type);
+
+                    BufferAppendF(inventory_data, "%s,%s,%s\n",
+                                  package_data[0], package_data[1],
+                                  package_data[2]);
+                }
+                else
                 {
-                    if (package_data[1] && package_data[2])
-                    {
-                        WritePackageDataToDB(db_cached, package_data[0],
-                                             package_data[1], package_data[2],
-                                             type);
-
-                        BufferAppendF(inventory_data, "%s,%s,%s\n",
-                                      package_data[0], package_data[1],
-                                      package_data[2]);
-                    }
-                    else
-                    {
-                        /* some error occurred */
-                        Log(LOG_LEVEL_VERBOSE,
-                                "Malformed response from package module for package %s",
-                                package_data[0]);
-                    }
-                    package_data[1] = NULL;
-                    package_data[2] = NULL;
+                    /* some error occurred */
+                    Log(LOG_LEVEL_VERBOSE,
+                            "Malformed response from package module for package %s",
+                            package_data[0]);
                 }
+                package_data[1] = NULL;
+                package_data[2] = NULL;
+            }
 
-                /* This must be the first entry on a list */
-                package_data[0] = line + strlen("Name=");
+            /* This must be the first entry on a list */
+            package_data[0] = line + strlen("Name=");
 
-            }
-            else if (StringStartsWith(line, "Version="))
-            {
-                package_data[1] = line + strlen("Version=");
-            }
-            else if (StringStartsWith(line, "Architecture="))
-            {
-                package_data[2] = line + strlen("Architecture=");
-            }
-            else if (StringStartsWith(line, "Error="))
-            {
-                Log(LOG_LEVEL_ERR, "package module: %s", line);
-                have_error = true;
-            }
-            else if (StringStartsWith(line, "ErrorMessage="))
-            {
-                Log(LOG_LEVEL_ERR, "package module: %s", line);
-                have_error = true;
-            }
-            else
-            {
-                 Log(LOG_LEVEL_ERR,
-                     "Unsupported response from package module: %s", line);
-                 have_error = true;
-            }
         }
-        /* We should have one more entry left or empty 'package_data'. */
-        if (package_data[0] && package_data[1] && package_data[2])
+        else if (StringStartsWith(line, "Version="))
         {
-            WritePackageDataToDB(db_cached, package_data[0],
-                             package_data[1], package_data[2], type);
-
-            BufferAppendF(inventory_data, "%s,%s,%s\n", package_data[0],
-                          package_data[1], package_data[2]);
+            package_data[1] = line + strlen("Version=");
         }
-        else if (package_data[0] || package_data[1] || package_data[2])
+        else if (StringStartsWith(line, "Architecture="))
         {
-            Log(LOG_LEVEL_VERBOSE,
-                "Malformed response from package manager: [%s:%s:%s]",
-                package_data[0] ? package_data[0] : "",
-                package_data[1] ? package_data[1] : "",
-                package_data[2] ? package_data[2] : "");
+            package_data[2] = line + strlen("Architecture=");
         }
-
-        char *inventory_key = "<inventory>";
-        char *inventory_list = BufferClose(inventory_data);
-
-        /* We can have empty list of installed software or available updates. */
-        if (inventory_list == NULL)
+        else if (StringStartsWith(line, "Error="))
         {
-            WriteDB(db_cached, inventory_key, "", 0);
+            Log(LOG_LEVEL_ERR, "package module: %s", line);
+            have_error = true;
+        }
+        else if (StringStartsWith(line, "ErrorMessage="))
+        {
+            Log(LOG_LEVEL_ERR, "package module: %s", line);
+            have_error = true;
         }
         else
         {
-            WriteDB(db_cached, inventory_key, inventory_list,
-                    strlen(inventory_list));
-            free(inventory_list);
+             Log(LOG_LEVEL_ERR,
+                 "Unsupported response from package module: %s", line);
+             have_error = true;
         }
+    }
+    /* We should have one more entry left or empty 'package_data'. */
+    if (package_data[0] && package_data[1] && package_data[2])
+    {
+        AddPackageDataToCache(cache, package_data[0],
+                              package_data[1], package_data[2], type);
 
-        CloseDB(db_cached);
-        return have_error ? -1 : 0;
+        BufferAppendF(inventory_data, "%s,%s,%s\n", package_data[0],
+                      package_data[1], package_data[2]);
     }
-    /* Unable to open database. */
-    return -1;
+    else if (package_data[0] || package_data[1] || package_data[2])
+    {
+        Log(LOG_LEVEL_VERBOSE,
+            "Malformed response from package manager: [%s:%s:%s]",
+            package_data[0] ? package_data[0] : "",
+            package_data[1] ? package_data[1] : "",
+            package_data[2] ? package_data[2] : "");
+    }
+
+    char *inventory_list = BufferClose(inventory_data);
+
+    /* We can have empty list of installed software or available updates. */
+    StringMapInsert(cache, xstrdup(INVENTORY_KEY),
+                    (inventory_list != NULL) ? inventory_list : xstrdup(""));
+
+    if (!WritePackagesCacheToDB(db_id, pm_name, cache))
+    {
+        /* Unable to open or write the database, the lists are still valid for
+         * this run though. */
+        Log(LOG_LEVEL_ERR, "Failed to write packages cache database for '%s'",
+            pm_name);
+        have_error = true;
+    }
+
+    /* The new lists are the in-memory cache for the rest of the run. */
+    PackagesCacheMapInsert(*GetPackagesCacheMap(db_id), xstrdup(pm_name), cache);
+
+    return have_error ? -1 : 0;
 }
 
 
@@ -885,6 +983,8 @@ PromiseResult RemovePackage(const char *name, Rlist* options,
             "Error communicating package module while removing package.");
         res = PROMISE_RESULT_FAIL;
     }
+    /* Package scripts may have started or stopped services. */
+    InvalidateProcessTable();
     if (error_message)
     {
         ParseAndLogErrorMessage(error_message);
@@ -944,6 +1044,8 @@ static PromiseResult InstallPackageGeneric(Rlist *options,
             "package module while installing package.");
         res = PROMISE_RESULT_FAIL;
     }
+    /* Package scripts may have started or stopped services. */
+    InvalidateProcessTable();
     if (error_message)
     {
         ParseAndLogErrorMessage(error_message);
@@ -1054,8 +1156,6 @@ static Seq *GetVersionsFromUpdates(EvalContext *ctx, const PackageInfo *info,
 {
     assert(info && info->name);
 
-    CF_DB *db_updates;
-    dbid db_id = dbid_packages_updates;
     Seq *updates_list = NULL;
 
     /* Make sure cache is updated. */
@@ -1065,7 +1165,9 @@ static Seq *GetVersionsFromUpdates(EvalContext *ctx, const PackageInfo *info,
         Log(LOG_LEVEL_INFO, "Can not update packages cache.");
     }
 
-    if (OpenSubDB(&db_updates, db_id, module_wrapper->package_module->name))
+    const StringMap *cache = GetPackagesCache(dbid_packages_updates,
+                                              module_wrapper->package_module->name);
+    if (cache != NULL)
     {
         char package_key[strlen(info->name) + 4];
 
@@ -1074,18 +1176,13 @@ static Seq *GetVersionsFromUpdates(EvalContext *ctx, const PackageInfo *info,
 
         Log(LOG_LEVEL_DEBUG, "Looking for key in updates: %s", package_key);
 
-        if (HasKeyDB(db_updates, package_key, sizeof(package_key)))
+        const char *value = StringMapGet(cache, package_key);
+        if (value != NULL)
         {
             Log(LOG_LEVEL_DEBUG, "Found key in updates database");
 
             updates_list = SeqNew(3, FreePackageInfo);
-            size_t val_size =
-                    ValueSizeDB(db_updates, package_key, sizeof(package_key));
-            char buff[val_size + 1];
-            buff[val_size] = '\0';
-
-            ReadDB(db_updates, package_key, buff, val_size);
-            Seq* updates = SeqStringFromString(buff, '\n');
+            Seq* updates = SeqStringFromString(value, '\n');
 
             for (size_t i = 0; i < SeqLength(updates); i++)
             {
@@ -1113,8 +1210,8 @@ static Seq *GetVersionsFromUpdates(EvalContext *ctx, const PackageInfo *info,
                         package_line);
                 }
             }
+            SeqDestroy(updates);
         }
-        CloseDB(db_updates);
     }
     return updates_list;
 }
@@ -45,6 +45,7 @@
 #include <eval_context.h>
 #include <retcode.h>
 #include <timeout.h>
+#include <processes_select.h>                     /* InvalidateProcessTable() */
 
 typedef enum
 {
@@ -288,6 +289,9 @@ static ActionResult RepairExec(EvalContext *ctx, const Attributes *a,
 
     CommandPrefix(cmdline, comm);
 
+    /* Commands can start and stop processes. */
+    InvalidateProcessTable();
+
     bool do_work_here = true;
 
 #ifndef __MINGW32__
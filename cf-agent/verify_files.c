@@ -56,9 +56,11 @@
 #include <audit.h>
 #include <expand.h>
 #include <mustache.h>
+#include <mustache_template.h>                      /* MustacheTemplateLoad */
 #include <known_dirs.h>
 #include <evalfunction.h>
 #include <changes_chroot.h>     /* PrepareChangesChroot(), RecordFileChangedInChroot() */
+#include <files_changes.h>      /* FileChangesContentKnown(), FileChangesRecordContent() */
 
 static PromiseResult FindFilePromiserObjects(EvalContext *ctx, const Promise *pp);
 static PromiseResult VerifyFilePromise(EvalContext *ctx, char *path, const Promise *pp);
@@ -667,6 +669,52 @@ skip:
 
 /*****************************************************************************/
 
+/**
+ * Check whether the file #path already has the content #data.
+ *
+ * The file is not read at all if it still is the same file (inode, size and
+ * times) that was verified to have the content before, otherwise it is only
+ * read up to the first difference. #digest is set to the digest of #data for
+ * RecordContent().
+ */
+static bool ContentUpToDate(const char *path, const char *data, size_t length, bool text_mode,
+                            unsigned char digest[EVP_MAX_MD_SIZE + 1])
+{
+    HashString(data, length, digest, CF_DEFAULT_DIGEST);
+
+    struct stat sb;
+    if (stat(path, &sb) == -1)
+    {
+        return false;
+    }
+
+    if (!ChrootChanges() && FileChangesContentKnown(path, &sb, CF_DEFAULT_DIGEST, digest))
+    {
+        Log(LOG_LEVEL_DEBUG, "File '%s' unchanged since its content was last verified", path);
+        return true;
+    }
+
+    if (!FileContentEquals(path, data, length, text_mode))
+    {
+        return false;
+    }
+
+    if (!ChrootChanges())
+    {
+        FileChangesRecordContent(path, &sb, CF_DEFAULT_DIGEST, digest);
+    }
+    return true;
+}
+
+static void RecordContent(const char *path, const unsigned char digest[EVP_MAX_MD_SIZE + 1])
+{
+    struct stat sb;
+    if (!ChrootChanges() && stat(path, &sb) != -1)
+    {
+        FileChangesRecordContent(path, &sb, CF_DEFAULT_DIGEST, digest);
+    }
+}
+
 static PromiseResult WriteContentFromString(EvalContext *ctx, const char *path, const Attributes *attr,
                                             const Promise *pp)
 {
@@ -682,19 +730,11 @@ static PromiseResult WriteContentFromString(EvalContext *ctx, const char *path,
 
     PromiseResult result = PROMISE_RESULT_NOOP;
 
-    unsigned char existing_content_digest[EVP_MAX_MD_SIZE + 1] = { 0 };
-    if (access(changes_path, R_OK) == 0)
-    {
-        HashFile(changes_path, existing_content_digest, CF_DEFAULT_DIGEST,
-                 FileNewLineMode(changes_path) == NewLineMode_Native);
-    }
-
     size_t bytes_to_write = strlen(attr->content);
     unsigned char promised_content_digest[EVP_MAX_MD_SIZE + 1] = { 0 };
-    HashString(attr->content, strlen(attr->content),
-               promised_content_digest, CF_DEFAULT_DIGEST);
-
-    if (!HashesMatch(existing_content_digest, promised_content_digest, CF_DEFAULT_DIGEST))
+    if (!ContentUpToDate(changes_path, attr->content, bytes_to_write,
+                         FileNewLineMode(changes_path) == NewLineMode_Native,
+                         promised_content_digest))
     {
         if (!MakingChanges(ctx, pp, attr, &result,
                           "update file '%s' with content '%s'",
@@ -711,11 +751,15 @@ static PromiseResult WriteContentFromString(EvalContext *ctx, const char *path,
         }
 
         Writer *w = FileWriter(f);
-        if (WriterWriteLen(w, attr->content, bytes_to_write) == bytes_to_write )
+        bool written = (WriterWriteLen(w, attr->content, bytes_to_write) == bytes_to_write);
+        WriterClose(w);
+
+        if (written)
         {
             RecordChange(ctx, pp, attr,
                          "Updated file '%s' with content '%s'",
                          path, attr->content);
+            RecordContent(changes_path, promised_content_digest);
 
             result = PromiseResultUpdate(result, PROMISE_RESULT_CHANGE);
         }
@@ -726,7 +770,6 @@ static PromiseResult WriteContentFromString(EvalContext *ctx, const char *path,
                           path, attr->content);
             result = PromiseResultUpdate(result, PROMISE_RESULT_FAIL);
         }
-        WriterClose(w);
     }
 
     return result;
@@ -816,7 +859,7 @@ static PromiseResult RenderTemplateMustache(EvalContext *ctx,
                                             const Promise *pp,
                                             const Attributes *attr,
                                             EditContext *edcontext,
-                                            const char *template,
+                                            const MustacheTemplate *template,
                                             bool file_exists)
 {
     assert(attr != NULL);
@@ -828,17 +871,10 @@ static PromiseResult RenderTemplateMustache(EvalContext *ctx,
 
     if (template_data == NULL)
     {
-        destroy_this = DefaultTemplateData(ctx, NULL);
+        destroy_this = MustacheTemplateData(ctx, template->refs);
         template_data = destroy_this;
     }
 
-    unsigned char existing_output_digest[EVP_MAX_MD_SIZE + 1] = { 0 };
-    if (access(edcontext->changes_filename, R_OK) == 0)
-    {
-        HashFile(edcontext->changes_filename, existing_output_digest, CF_DEFAULT_DIGEST,
-                 edcontext->new_line_mode == NewLineMode_Native);
-    }
-
     Buffer *output_buffer = BufferNew();
 
     char *message;
@@ -851,11 +887,13 @@ static PromiseResult RenderTemplateMustache(EvalContext *ctx,
         message = xstrdup(attr->edit_template);
     }
 
-    if (MustacheRender(output_buffer, template, template_data))
+    if (MustacheRender(output_buffer, template->text, template_data))
     {
         unsigned char rendered_output_digest[EVP_MAX_MD_SIZE + 1] = { 0 };
-        HashString(BufferData(output_buffer), BufferSize(output_buffer), rendered_output_digest, CF_DEFAULT_DIGEST);
-        if (!HashesMatch(existing_output_digest, rendered_output_digest, CF_DEFAULT_DIGEST))
+        if (!ContentUpToDate(edcontext->changes_filename,
+                             BufferData(output_buffer), BufferSize(output_buffer),
+                             edcontext->new_line_mode == NewLineMode_Native,
+                             rendered_output_digest))
         {
             if (MakingChanges(ctx, pp, attr, &result,
                               "update rendering of '%s' from mustache template '%s'",
@@ -877,6 +915,7 @@ static PromiseResult RenderTemplateMustache(EvalContext *ctx,
                     RecordChange(ctx, pp, attr,
                                  "Updated rendering of '%s' from mustache template '%s'",
                                  edcontext->filename, message);
+                    RecordContent(edcontext->changes_filename, rendered_output_digest);
                     result = PromiseResultUpdate(result, PROMISE_RESULT_CHANGE);
                 }
                 else
@@ -922,27 +961,16 @@ static PromiseResult RenderTemplateMustacheFromFile(EvalContext *ctx,
         return PromiseResultUpdate(result, PROMISE_RESULT_FAIL);
     }
 
-
-    int template_fd = safe_open(a->edit_template, O_RDONLY | O_TEXT);
-    Writer *template_writer = NULL;
-    if (template_fd >= 0)
-    {
-        template_writer = FileReadFromFd(template_fd, SIZE_MAX, NULL);
-        close(template_fd);
-    }
-    if (template_writer == NULL)
+    /* The same template is often rendered for many files, it's only read
+     * again when it changes */
+    const MustacheTemplate *template = MustacheTemplateLoad(a->edit_template);
+    if (template == NULL)
     {
         RecordFailure(ctx, pp, a, "Could not read template file '%s'", a->edit_template);
         return PromiseResultUpdate(result, PROMISE_RESULT_FAIL);
     }
 
-    result = RenderTemplateMustache(ctx, pp, a, edcontext,
-                                    StringWriterData(template_writer),
-                                    file_exists);
-
-    WriterClose(template_writer);
-
-    return result;
+    return RenderTemplateMustache(ctx, pp, a, edcontext, template, file_exists);
 }
 
 static PromiseResult RenderTemplateMustacheFromString(EvalContext *ctx,
@@ -960,9 +988,13 @@ static PromiseResult RenderTemplateMustacheFromString(EvalContext *ctx,
         return PromiseResultUpdate(result, PROMISE_RESULT_FAIL);
     }
 
-    return RenderTemplateMustache(ctx, pp, a, edcontext,
-                                  a->edit_template_string,
-                                  file_exists);
+    MustacheTemplate *template = MustacheTemplateNew(a->edit_template_string,
+                                                     strlen(a->edit_template_string));
+    PromiseResult result = RenderTemplateMustache(ctx, pp, a, edcontext,
+                                                  template, file_exists);
+    MustacheTemplateDestroy(template);
+
+    return result;
 }
 
 PromiseResult ScheduleEditOperation(EvalContext *ctx, char *filename,
@@ -40,9 +40,11 @@
 #include <item_lib.h>
 #include <client_code.h>
 #include <hash.h>
+#include <files_digest.h>                   /* HashFileMulti() */
 #include <files_repository.h>
 #include <files_select.h>
 #include <files_changes.h>
+#include <files_dirscan.h>
 #include <expand.h>
 #include <conversion.h>
 #include <pipes.h>
@@ -79,6 +81,11 @@ static Item *VSETXIDLIST = NULL;
 const Rlist *SINGLE_COPY_LIST = NULL; /* GLOBAL_P */
 StringSet *SINGLE_COPY_CACHE = NULL; /* GLOBAL_X */
 
+/* Directory entries considered by DepthSearch() and how many of them were
+ * rejected by file_select without stat() */
+static size_t DEPTH_SEARCH_ENTRIES = 0; /* GLOBAL_X */
+static size_t DEPTH_SEARCH_STATS_AVOIDED = 0; /* GLOBAL_X */
+
 static bool TransformFile(EvalContext *ctx, char *file, const Attributes *attr, const Promise *pp, PromiseResult *result);
 static PromiseResult VerifyName(EvalContext *ctx, char *path, const struct stat *sb, const Attributes *attr, const Promise *pp);
 static PromiseResult VerifyDelete(EvalContext *ctx,
@@ -88,10 +95,15 @@ static PromiseResult VerifyCopy(EvalContext *ctx, const char *source, char *dest
                                 CompressedArray **inode_cache, AgentConnection *conn);
 static PromiseResult TouchFile(EvalContext *ctx, char *path, const Attributes *attr, const Promise *pp);
 static PromiseResult VerifyFileAttributes(EvalContext *ctx, const char *file, const struct stat *dstat, const Attributes *attr, const Promise *pp);
-static bool PushDirState(EvalContext *ctx, const Promise *pp, const Attributes *attr, char *name, const struct stat *sb, PromiseResult *result);
-static bool PopDirState(EvalContext *ctx, const Promise *pp, const Attributes *attr, int goback, char *name, const struct stat *sb,
-                        DirectoryRecursion r, PromiseResult *result);
-static bool CheckLinkSecurity(const struct stat *sb, const char *name);
+static bool DepthSearchDir(EvalContext *ctx, char *name, DirScan *dir, const struct stat *sb, int rlevel,
+                           const Attributes *attr, const Promise *pp, dev_t rootdevice,
+                           DirScanPool *pool, PromiseResult *result);
+static void ReadAheadSubdirs(EvalContext *ctx, DirScanPool *pool, const DirScan *dir, const char *name,
+                             const Attributes *attr, dev_t rootdevice,
+                             DirScanRequest **read_ahead, size_t current, size_t *next);
+static bool CheckLinkSecurity(const DirScan *dir, const struct stat *sb, const char *name);
+static void EndFileChangesBatch(EvalContext *ctx, const char *name, const Attributes *attr,
+                                const Promise *pp, PromiseResult *result);
 static bool CompareForFileCopy(char *sourcefile, char *destfile, const struct stat *ssb, const struct stat *dsb, const FileCopy *fc, AgentConnection *conn);
 static void FileAutoDefine(EvalContext *ctx, char *destfile);
 static void TruncateFile(const char *name);
@@ -104,6 +116,7 @@ static int cf_stat(const char *file, struct stat *buf, const FileCopy *fc, Agent
 static int cf_readlink(EvalContext *ctx, const char *sourcefile, char *linkbuf, size_t buffsize, const Attributes *attr, const Promise *pp, AgentConnection *conn, PromiseResult *result);
 #endif
 static bool SkipDirLinks(EvalContext *ctx, const char *path, const char *lastnode, DirectoryRecursion r);
+static bool IsDirExcluded(EvalContext *ctx, const char *path, const char *lastnode, DirectoryRecursion r);
 static bool DeviceBoundary(const struct stat *sb, dev_t rootdevice);
 static PromiseResult LinkCopy(EvalContext *ctx, char *sourcefile, char *destfile, const struct stat *sb, const Attributes *attr,
                               const Promise *pp, CompressedArray **inode_cache, AgentConnection *conn);
@@ -2705,13 +2718,6 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
                 const Promise *pp, dev_t rootdevice, PromiseResult *result)
 {
     assert(attr != NULL);
-    Dir *dirh;
-    int goback;
-    const struct dirent *dirp;
-    struct stat lsb;
-    Seq *db_file_set = NULL;
-    Seq *selected_files = NULL;
-    bool retval = true;
 
     if (!attr->havedepthsearch)  /* if the search is trivial, make sure that we are in the parent dir of the leaf */
     {
@@ -2742,6 +2748,47 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
         }
     }
 
+    DirScan *dir = DirScanOpen(ToChangesPath(name));
+    if (dir == NULL)
+    {
+        RecordFailure(ctx, pp, attr, "Could not open directory '%s' (mode '%04jo', open: %s)",
+                      name, (uintmax_t)(sb->st_mode & 07777), GetErrorStr());
+        *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
+        return false;
+    }
+
+    DirScanPool *pool = NULL;
+    if ((attr->recursion.scan_threads > 0) && (attr->recursion.depth > 1))
+    {
+        pool = DirScanPoolNew(attr->recursion.scan_threads, attr->recursion.travlinks);
+    }
+
+    bool retval = DepthSearchDir(ctx, name, dir, sb, rlevel, attr, pp, rootdevice, pool, result);
+
+    DirScanPoolDestroy(pool);
+    DirScanClose(dir);
+    return retval;
+}
+
+void DepthSearchLogStats(void)
+{
+    if (DEPTH_SEARCH_ENTRIES > 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Depth search: %zu directory entries, %zu rejected without stat()",
+            DEPTH_SEARCH_ENTRIES, DEPTH_SEARCH_STATS_AVOIDED);
+    }
+}
+
+static bool DepthSearchDir(EvalContext *ctx, char *name, DirScan *dir, const struct stat *sb, int rlevel,
+                           const Attributes *attr, const Promise *pp, dev_t rootdevice,
+                           DirScanPool *pool, PromiseResult *result)
+{
+    assert(attr != NULL);
+    struct stat lsb;
+    Seq *db_file_set = NULL;
+    Seq *selected_files = NULL;
+    bool retval = true;
+
     if (rlevel > CF_RECURSION_LIMIT)
     {
         RecordWarning(ctx, pp, attr,
@@ -2751,20 +2798,26 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
         return false;
     }
 
-    if (!PushDirState(ctx, pp, attr, name, sb, result))
+    if (!CheckLinkSecurity(dir, sb, name))
     {
-        /* PushDirState() reports errors and updates 'result' in case of failures */
-        return false;
+        FatalError(ctx, "Not safe to continue");
     }
 
-    if ((dirh = DirOpen(".")) == NULL)
+    if (!DirScanEnter(dir))
     {
-        Log(LOG_LEVEL_INFO, "Could not open existing directory '%s'. (opendir: %s)", name, GetErrorStr());
+        RecordFailure(ctx, pp, attr, "Could not change to directory '%s' (mode '%04jo', chdir: %s)",
+                      name, (uintmax_t)(sb->st_mode & 07777), GetErrorStr());
+        *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
         return false;
     }
 
     if (attr->havechange)
     {
+        /* The changes DB updates for the files in this directory are
+         * collected and written in one transaction, before descending into
+         * subdirectories and at the end */
+        FileChangesBatchBegin();
+
         db_file_set = SeqNew(1, &free);
         if (!FileChangesGetDirectoryList(name, db_file_set))
         {
@@ -2772,31 +2825,75 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
                           "Failed to get directory listing for recording file changes in '%s'", name);
             *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
             SeqDestroy(db_file_set);
+            FileChangesBatchEnd();
             return false;
         }
         selected_files = SeqNew(1, &free);
     }
 
+    const bool descend = (attr->recursion.depth > 1) && (rlevel <= attr->recursion.depth);
+    const size_t length = DirScanLength(dir);
+
+    /* Files can be rejected by their name and type from readdir() without
+     * being stat'ed if that's all file_select looks at */
+    const bool select_by_type = attr->haveselect && !SelectLeafNeedsStat(&(attr->select));
+
+    /* Subdirectories being read ahead by the pool, by entry */
+    DirScanRequest **read_ahead = NULL;
+    size_t next_read_ahead = 0;
+    if ((pool != NULL) && descend && (length > 0))
+    {
+        read_ahead = xcalloc(length, sizeof(DirScanRequest *));
+    }
+
     char path[CF_BUFSIZE];
-    for (dirp = DirRead(dirh); dirp != NULL; dirp = DirRead(dirh))
+    for (size_t i = 0; i < length; i++)
     {
-        if (!ConsiderLocalFile(dirp->d_name, name))
+        const DirScanEntry *entry = DirScanAt(dir, i);
+        const char *d_name = entry->name;
+        bool selected = false;
+        DEPTH_SEARCH_ENTRIES++;
+
+        if (read_ahead != NULL)
+        {
+            /* Not descended into (excluded, other device,...) */
+            if (i > 0)
+            {
+                DirScanRequestCancel(read_ahead[i - 1]);
+                read_ahead[i - 1] = NULL;
+            }
+            ReadAheadSubdirs(ctx, pool, dir, name, attr, rootdevice, read_ahead, i, &next_read_ahead);
+        }
+
+        if (!ConsiderLocalFile(d_name, name))
         {
             continue;
         }
 
         size_t total_len = strlcpy(path, name, sizeof(path));
-        if ((total_len >= sizeof(path)) || (JoinPaths(path, sizeof(path), dirp->d_name) == NULL))
+        if ((total_len >= sizeof(path)) || (JoinPaths(path, sizeof(path), d_name) == NULL))
         {
             RecordFailure(ctx, pp, attr,
                           "Internal limit reached in DepthSearch(), path too long: '%s' + '%s'",
-                          path, dirp->d_name);
+                          path, d_name);
             *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
             retval = false;
             goto end;
         }
 
-        if (lstat(dirp->d_name, &lsb) == -1)
+        if (select_by_type && (entry->type != 0) && !S_ISDIR(entry->type) && !S_ISLNK(entry->type))
+        {
+            struct stat type_sb = { .st_mode = entry->type };
+            if (!SelectLeaf(ctx, path, &type_sb, &(attr->select)))
+            {
+                Log(LOG_LEVEL_DEBUG, "Skipping non-selected file '%s'", path);
+                DEPTH_SEARCH_STATS_AVOIDED++;
+                continue;
+            }
+            selected = true;
+        }
+
+        if (DirScanEntryStat(dir, entry, &lsb, false) == -1)
         {
             Log(LOG_LEVEL_VERBOSE, "Recurse was looking at '%s' when an error occurred. (lstat: %s)", path, GetErrorStr());
             continue;
@@ -2827,7 +2924,7 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
 
             /* if so, hide the difference by replacing with actual object */
 
-            if (stat(dirp->d_name, &lsb) == -1)
+            if (DirScanEntryStat(dir, entry, &lsb, true) == -1)
             {
                 RecordFailure(ctx, pp, attr,
                               "Recurse was working on '%s' when this failed. (stat: %s)",
@@ -2845,33 +2942,72 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
 
         if (S_ISDIR(lsb.st_mode))
         {
-            if (SkipDirLinks(ctx, path, dirp->d_name, attr->recursion))
+            if (SkipDirLinks(ctx, path, d_name, attr->recursion))
             {
                 continue;
             }
 
-            if ((attr->recursion.depth > 1) && (rlevel <= attr->recursion.depth))
+            if (descend)
             {
-                Log(LOG_LEVEL_VERBOSE, "Entering '%s', level %d", path, rlevel);
-                goback = DepthSearch(ctx, path, &lsb, rlevel + 1, attr, pp, rootdevice, result);
-                if (!PopDirState(ctx, pp, attr, goback, name, sb, attr->recursion, result))
+                DirScan *subdir;
+                if ((read_ahead != NULL) && (read_ahead[i] != NULL))
+                {
+                    subdir = DirScanRequestTake(read_ahead[i]);
+                    read_ahead[i] = NULL;
+                }
+                else
+                {
+                    subdir = DirScanOpenAt(dir, d_name, attr->recursion.travlinks, pool != NULL);
+                }
+
+                if (subdir == NULL)
                 {
-                    FatalError(ctx, "Not safe to continue");
+                    RecordFailure(ctx, pp, attr, "Could not open directory '%s' (mode '%04jo', open: %s)",
+                                  path, (uintmax_t)(lsb.st_mode & 07777), GetErrorStr());
+                    *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
+                }
+                else
+                {
+                    /* Don't keep the updates in memory for the whole
+                     * subtree, the subdirectory has its own batch */
+                    if (attr->havechange)
+                    {
+                        EndFileChangesBatch(ctx, name, attr, pp, result);
+                    }
+
+                    Log(LOG_LEVEL_VERBOSE, "Entering '%s', level %d", path, rlevel);
+                    DepthSearchDir(ctx, path, subdir, &lsb, rlevel + 1, attr, pp, rootdevice, pool, result);
+                    DirScanClose(subdir);
+
+                    if (attr->havechange)
+                    {
+                        FileChangesBatchBegin();
+                    }
+
+                    /* Back to this directory for the promise on the subdirectory itself */
+                    if (!DirScanEnter(dir))
+                    {
+                        RecordFailure(ctx, pp, attr,
+                                      "Error in backing out of recursive descent securely to '%s'. (chdir: %s)",
+                                      name, GetErrorStr());
+                        *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
+                        FatalError(ctx, "Not safe to continue");
+                    }
                 }
             }
         }
 
-        if (!attr->haveselect || SelectLeaf(ctx, path, &lsb, &(attr->select)))
+        if (!attr->haveselect || selected || SelectLeaf(ctx, path, &lsb, &(attr->select)))
         {
             if (attr->havechange)
             {
-                if (!SeqBinaryLookup(db_file_set, dirp->d_name, StrCmpWrapper))
+                if (!SeqBinaryLookup(db_file_set, d_name, StrCmpWrapper))
                 {
                     // See comments in FileChangesCheckAndUpdateDirectory(),
                     // regarding this function call.
                     FileChangesLogNewFile(path, pp);
                 }
-                SeqAppend(selected_files, xstrdup(dirp->d_name));
+                SeqAppend(selected_files, xstrdup(d_name));
             }
 
             VerifyFileLeaf(ctx, path, &lsb, attr, pp, result);
@@ -2899,62 +3035,79 @@ bool DepthSearch(EvalContext *ctx, char *name, const struct stat *sb, int rlevel
     }
 
 end:
+    if (read_ahead != NULL)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            DirScanRequestCancel(read_ahead[i]);
+        }
+        free(read_ahead);
+    }
     SeqDestroy(selected_files);
     SeqDestroy(db_file_set);
-    DirClose(dirh);
+    if (attr->havechange)
+    {
+        EndFileChangesBatch(ctx, name, attr, pp, result);
+    }
     return retval;
 }
 
-static bool PushDirState(EvalContext *ctx, const Promise *pp, const Attributes *attr, char *name, const struct stat *sb, PromiseResult *result)
+static void EndFileChangesBatch(EvalContext *ctx, const char *name, const Attributes *attr,
+                                const Promise *pp, PromiseResult *result)
 {
-    const char *changes_name = (ToChangesPath(name));
-    if (safe_chdir(changes_name) == -1)
+    if (!FileChangesBatchEnd())
     {
-        RecordFailure(ctx, pp, attr, "Could not change to directory '%s' (mode '%04jo', chdir: %s)",
-                      name, (uintmax_t)(sb->st_mode & 07777), GetErrorStr());
+        RecordFailure(ctx, pp, attr, "Failed to record file changes in '%s'", name);
         *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
-        return false;
     }
-
-    if (!CheckLinkSecurity(sb, changes_name))
-    {
-        FatalError(ctx, "Not safe to continue");
-    }
-    return true;
 }
 
 /**
- * @return true if safe for agent to continue
+ * Whether DepthSearchDir() is going to descend into the entry #entry of
+ * #dir, checked quietly (the walk logs the reasons when it gets there).
  */
-static bool PopDirState(EvalContext *ctx, const Promise *pp, const Attributes *attr,
-                        int goback, char *name, const struct stat *sb, DirectoryRecursion r,
-                        PromiseResult *result)
+static bool WillDescendInto(EvalContext *ctx, const DirScan *dir, const char *name,
+                            const DirScanEntry *entry, const Attributes *attr, dev_t rootdevice)
 {
-    const char *changes_name = (ToChangesPath(name));
-    if (goback && (r.travlinks))
+    if (!entry->dir || !ConsiderLocalFile(entry->name, name))
+    {
+        return false;
+    }
+
+    char path[CF_BUFSIZE];
+    size_t total_len = strlcpy(path, name, sizeof(path));
+    if ((total_len >= sizeof(path)) || (JoinPaths(path, sizeof(path), entry->name) == NULL))
+    {
+        return false;
+    }
+
+    if (IsDirExcluded(ctx, path, entry->name, attr->recursion))
+    {
+        return false;
+    }
+
+    if (attr->recursion.xdev || !S_ISDIR(entry->type))
     {
-        if (safe_chdir(changes_name) == -1)
+        /* Links to directories (only followed if owned by root or us) and
+         * device boundaries need the same stat() as the walk */
+        struct stat sb;
+        if (DirScanEntryStat(dir, entry, &sb, false) == -1)
         {
-            RecordFailure(ctx, pp, attr,
-                          "Error in backing out of recursive travlink descent securely to '%s'. (chdir: %s)",
-                          name, GetErrorStr());
-            *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
             return false;
         }
-
-        if (!CheckLinkSecurity(sb, changes_name))
+        if (S_ISLNK(sb.st_mode))
         {
-            return false;
+            if ((sb.st_uid != 0) && (sb.st_uid != getuid()))
+            {
+                return false;
+            }
+            if (DirScanEntryStat(dir, entry, &sb, true) == -1)
+            {
+                return false;
+            }
         }
-    }
-    else if (goback)
-    {
-        if (safe_chdir("..") == -1)
+        if (attr->recursion.xdev && (sb.st_dev != rootdevice))
         {
-            RecordFailure(ctx, pp, attr,
-                          "Error in backing out of recursive descent securely to '%s'. (chdir: %s)",
-                          name, GetErrorStr());
-            *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
             return false;
         }
     }
@@ -2963,22 +3116,45 @@ static bool PopDirState(EvalContext *ctx, const Promise *pp, const Attributes *a
 }
 
 /**
- * @return true if it is safe for the agent to continue execution
+ * Read ahead the subdirectories of #dir following the entry #current, as
+ * long as #pool takes more. #next is the first entry not considered yet.
+ * Only the subdirectories DepthSearchDir() is going to descend into are
+ * read, excluded ones and those on other devices are left alone.
  */
-static bool CheckLinkSecurity(const struct stat *sb, const char *name)
+static void ReadAheadSubdirs(EvalContext *ctx, DirScanPool *pool, const DirScan *dir, const char *name,
+                             const Attributes *attr, dev_t rootdevice,
+                             DirScanRequest **read_ahead, size_t current, size_t *next)
 {
-    struct stat security;
-
-    Log(LOG_LEVEL_DEBUG, "Checking the inode and device to make sure we are where we think we are...");
+    const size_t length = DirScanLength(dir);
+    if (*next <= current)
+    {
+        *next = current + 1;
+    }
 
-    if (stat(".", &security) == -1)
+    while (*next < length)
     {
-        Log(LOG_LEVEL_ERR, "Could not stat directory '%s' after entering. (stat: %s)",
-            name, GetErrorStr());
-        return true; // continue anyway
+        const DirScanEntry *entry = DirScanAt(dir, *next);
+        if (WillDescendInto(ctx, dir, name, entry, attr, rootdevice))
+        {
+            DirScanRequest *req = DirScanPoolSubmit(pool, dir, entry->name);
+            if (req == NULL)
+            {
+                return;
+            }
+            read_ahead[*next] = req;
+        }
+        (*next)++;
     }
+}
 
-    if ((sb->st_dev != security.st_dev) || (sb->st_ino != security.st_ino))
+/**
+ * @return true if it is safe for the agent to continue execution
+ */
+static bool CheckLinkSecurity(const DirScan *dir, const struct stat *sb, const char *name)
+{
+    Log(LOG_LEVEL_DEBUG, "Checking the inode and device to make sure we are where we think we are...");
+
+    if (!DirScanIsDirectory(dir, sb))
     {
         Log(LOG_LEVEL_ERR,
             "SERIOUS SECURITY ALERT: path race exploited in recursion to/from '%s'. Not safe for agent to continue - aborting",
@@ -3561,35 +3737,45 @@ PromiseResult ScheduleLinkChildrenOperation(EvalContext *ctx, char *destination,
 static PromiseResult VerifyFileIntegrity(EvalContext *ctx, const char *file, const Attributes *attr, const Promise *pp)
 {
     assert(attr != NULL);
-    unsigned char digest1[EVP_MAX_MD_SIZE + 1];
-    unsigned char digest2[EVP_MAX_MD_SIZE + 1];
 
     if ((attr->change.report_changes != FILE_CHANGE_REPORT_CONTENT_CHANGE) && (attr->change.report_changes != FILE_CHANGE_REPORT_ALL))
     {
         return PROMISE_RESULT_NOOP;
     }
 
-    memset(digest1, 0, EVP_MAX_MD_SIZE + 1);
-    memset(digest2, 0, EVP_MAX_MD_SIZE + 1);
-
     PromiseResult result = PROMISE_RESULT_NOOP;
     bool changed = false;
-    if (attr->change.hash == HASH_METHOD_BEST)
-    {
-        HashFile(file, digest1, HASH_METHOD_MD5, false);
-        HashFile(file, digest2, HASH_METHOD_SHA1, false);
 
-        changed = (changed ||
-                   FileChangesCheckAndUpdateHash(ctx, file, digest1, HASH_METHOD_MD5, attr, pp, &result));
-        changed = (changed ||
-                   FileChangesCheckAndUpdateHash(ctx, file, digest2, HASH_METHOD_SHA1, attr, pp, &result));
+    /* Stat'ed before hashing, a modification while the file is being hashed
+     * makes the recorded identity outdated rather than the digests. */
+    struct stat sb;
+    const bool hashes_recordable = (!ChrootChanges() && (stat(file, &sb) != -1));
+
+    if (hashes_recordable && FileChangesHashesKnown(file, &sb, attr->change.hash))
+    {
+        RecordNoChange(ctx, pp, attr, "File hash for %s is correct (not modified since it was hashed)", file);
     }
     else
     {
-        HashFile(file, digest1, attr->change.hash, false);
+        /* Both digests of "best" are computed in a single pass */
+        const HashMethod best[] = { HASH_METHOD_MD5, HASH_METHOD_SHA1 };
+        const HashMethod *types = (attr->change.hash == HASH_METHOD_BEST) ? best : &(attr->change.hash);
+        const size_t n_types = (attr->change.hash == HASH_METHOD_BEST) ? 2 : 1;
+
+        /* Left zeroed if the file cannot be read, like by HashFile() */
+        unsigned char digests[2][EVP_MAX_MD_SIZE + 1] = { { 0 } };
+        const bool hashed = HashFileMulti(file, types, n_types, digests);
+
+        for (size_t i = 0; i < n_types; i++)
+        {
+            changed = (changed ||
+                       FileChangesCheckAndUpdateHash(ctx, file, digests[i], types[i], attr, pp, &result));
+        }
 
-        changed = (changed ||
-                   FileChangesCheckAndUpdateHash(ctx, file, digest1, attr->change.hash, attr, pp, &result));
+        if (hashed && hashes_recordable)
+        {
+            FileChangesRecordHashes(file, &sb, attr->change.hash, types, n_types, digests);
+        }
     }
 
     if (changed && MakingInternalChanges(ctx, pp, attr, &result, "record integrity changes in '%s'", file))
@@ -4075,24 +4261,29 @@ static int cf_readlink(EvalContext *ctx, const char *sourcefile, char *linkbuf,
 
 #endif /* !__MINGW32__ */
 
-static bool SkipDirLinks(EvalContext *ctx, const char *path, const char *lastnode, DirectoryRecursion r)
+static bool IsDirExcluded(EvalContext *ctx, const char *path, const char *lastnode, DirectoryRecursion r)
 {
-    if (r.exclude_dirs)
+    if (r.exclude_dirs &&
+        ((MatchRlistItem(ctx, r.exclude_dirs, path)) || (MatchRlistItem(ctx, r.exclude_dirs, lastnode))))
     {
-        if ((MatchRlistItem(ctx, r.exclude_dirs, path)) || (MatchRlistItem(ctx, r.exclude_dirs, lastnode)))
-        {
-            Log(LOG_LEVEL_VERBOSE, "Skipping matched excluded directory '%s'", path);
-            return true;
-        }
+        return true;
     }
 
-    if (r.include_dirs)
+    if (r.include_dirs &&
+        !((MatchRlistItem(ctx, r.include_dirs, path)) || (MatchRlistItem(ctx, r.include_dirs, lastnode))))
     {
-        if (!((MatchRlistItem(ctx, r.include_dirs, path)) || (MatchRlistItem(ctx, r.include_dirs, lastnode))))
-        {
-            Log(LOG_LEVEL_VERBOSE, "Skipping matched non-included directory '%s'", path);
-            return true;
-        }
+        return true;
+    }
+
+    return false;
+}
+
+static bool SkipDirLinks(EvalContext *ctx, const char *path, const char *lastnode, DirectoryRecursion r)
+{
+    if (IsDirExcluded(ctx, path, lastnode, r))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Skipping excluded or non-included directory '%s'", path);
+        return true;
     }
 
     return false;
@@ -54,6 +54,7 @@
 #include <csv_writer.h>
 #include <cf-agent-enterprise-stubs.h>
 #include <cf-windows-functions.h>
+#include <processes_select.h>   /* InvalidateProcessTable() */
 
 /* Called structure:
 
@@ -3298,6 +3299,10 @@ bool ExecPackageCommand(EvalContext *ctx, char *command, int verify, int setCmdC
 
     Log(LOG_LEVEL_VERBOSE, "Executing %-.60s...", command);
 
+    /* Package scripts may start or stop services; the command runs to
+     * completion below before anything can reload the process table. */
+    InvalidateProcessTable();
+
 /* Look for short command summary */
     for (cmd = command; (*cmd != '\0') && (*cmd != ' '); cmd++)
     {
@@ -237,7 +237,9 @@ static PromiseResult VerifyProcessOp(EvalContext *ctx, const Attributes *a, cons
                 {
                     Log(LOG_LEVEL_DEBUG, "Found process_stop command '%s' is executable.", a->process_stop);
 
-                    if (ShellCommandReturnsZero(a->process_stop, SHELL_TYPE_NONE))
+                    const bool stopped = ShellCommandReturnsZero(a->process_stop, SHELL_TYPE_NONE);
+                    InvalidateProcessTable();
+                    if (stopped)
                     {
                         cfPS(ctx, LOG_LEVEL_INFO, PROMISE_RESULT_CHANGE, pp, a,
                              "Promise to stop '%s' repaired, '%s' returned zero",
@@ -356,6 +358,7 @@ bool DoAllSignals(EvalContext *ctx, Item *procs_to_signal, const Attributes *a,
                 }
                 else
                 {
+                    InvalidateProcessTable();
                     cfPS(ctx, LOG_LEVEL_INFO, PROMISE_RESULT_CHANGE, pp, a,
                          "Signalled '%s' (%d) to process %jd (%s)",
                          spec, signal, (intmax_t) pid, ip->name);
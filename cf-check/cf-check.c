@@ -3,6 +3,7 @@
 #include <diagnose.h>
 #include <backup.h>
 #include <repair.h>
+#include <compact.h>
 #include <string_lib.h>
 #include <logging.h>
 #include <man.h>
@@ -26,6 +27,7 @@ static void print_help()
         "\tdiagnose - Assess the health of one or more database files\n"
         "\tbackup - Copy database files to a timestamped folder\n"
         "\trepair - Diagnose, then backup and delete any corrupt databases\n"
+        "\tcompact - Shrink database files and drop expired entries\n"
         "\tversion - Print version information\n"
         "\thelp - Print this help menu\n"
         "\n"
@@ -58,6 +60,8 @@ static const Description COMMANDS[] =
                  "cf-check backup"},
     {"repair",   "Diagnose, then backup and delete any corrupt databases",
                  "cf-check repair"},
+    {"compact",  "Shrink database files and drop expired entries",
+                 "cf-check compact"},
     {"dump",     "Print the contents of a database file",
                  "cf-check dump " WORKDIR "/state/cf_lastseen.lmdb"},
     {"lmdump",   "LMDB database dumper (deprecated)",
@@ -243,6 +247,12 @@ int main(int argc, const char *const *argv)
         CallCleanupFunctions();
         return ret;
     }
+    if (StringEqual_IgnoreCase(command, "compact"))
+    {
+        int ret = compact_main(cmd_argc, cmd_argv);
+        CallCleanupFunctions();
+        return ret;
+    }
     if (StringEqual_IgnoreCase(command, "help"))
     {
         if (cmd_argc > 2)
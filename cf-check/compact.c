@@ -0,0 +1,533 @@
+#include <platform.h>
+#include <compact.h>
+#include <logging.h>
+
+#if defined(__MINGW32__) || !defined(LMDB)
+
+int compact_main(ARG_UNUSED int argc, ARG_UNUSED const char *const *const argv)
+{
+    Log(LOG_LEVEL_ERR,
+        "cf-check compact not available on this platform/build");
+    return 1;
+}
+
+int compact_lmdb_default(ARG_UNUSED int threshold)
+{
+    Log(LOG_LEVEL_VERBOSE,
+        "database compaction not available on this platform/build");
+    return 0;
+}
+
+int compact_lmdb_file(ARG_UNUSED const char *file, ARG_UNUSED int threshold)
+{
+    Log(LOG_LEVEL_VERBOSE,
+        "database compaction not available on this platform/build");
+    return 0;
+}
+
+#else
+
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <lmdb.h>
+#include <alloc.h>
+#include <diagnose.h>
+#include <db_structs.h>
+#include <sequence.h>
+#include <utilities.h>
+#include <string_lib.h>
+#include <file_lib.h>
+#include <replicate_lmdb.h>
+
+#ifndef O_CLOEXEC
+# define O_CLOEXEC 0
+#endif
+
+// Keep in sync with CF_LOCKHORIZON in libpromises/locks.c
+#define LOCK_RETENTION ((time_t) (4 * 7 * 24 * 3600))
+
+// Performance data of promises which haven't been evaluated for this long
+// most likely belongs to promises no longer in policy
+#define PERFORMANCE_RETENTION ((time_t) (4 * 7 * 24 * 3600))
+
+static void print_usage(void)
+{
+    printf("Usage: cf-check compact [-t|--threshold PERCENT] [FILE ...]\n");
+    printf("Example: cf-check compact /var/cfengine/state/cf_lock.lmdb\n");
+    printf("Options: -t|--threshold only compact files with at least PERCENT %% of free pages\n");
+}
+
+/******************************************************************************/
+/* Retention rules                                                            */
+/******************************************************************************/
+
+static bool key_starts_with(const void *key, size_t key_size, const char *prefix)
+{
+    const size_t prefix_len = strlen(prefix);
+    return (key_size >= prefix_len) && (memcmp(key, prefix, prefix_len) == 0);
+}
+
+static bool keep_lock_entry(
+    const void *key, size_t key_size,
+    const void *value, size_t value_size,
+    void *data)
+{
+    const time_t now = *((time_t *) data);
+
+    if (value_size != sizeof(LockData)
+        || key_starts_with(key, key_size, "lock_horizon")
+        || key_starts_with(key, key_size, "last.internal_bundle.track_license.handle"))
+    {
+        return true;
+    }
+
+    // Copy, the value is not necessarily aligned
+    LockData lock;
+    memcpy(&lock, value, sizeof(lock));
+
+    return ((now - lock.time) <= LOCK_RETENTION);
+}
+
+static bool keep_performance_entry(
+    ARG_UNUSED const void *key, ARG_UNUSED size_t key_size,
+    const void *value, size_t value_size,
+    void *data)
+{
+    const time_t now = *((time_t *) data);
+
+    if (value_size != sizeof(Event))
+    {
+        return true;
+    }
+
+    Event event;
+    memcpy(&event, value, sizeof(event));
+
+    return ((now - event.t) <= PERFORMANCE_RETENTION);
+}
+
+typedef struct
+{
+    const char *file_name;
+    ReplicateFilter keep;
+} RetentionRule;
+
+// Databases not listed here are compacted without dropping any entries
+static const RetentionRule RETENTION_RULES[] =
+{
+    {"cf_lock.lmdb",     keep_lock_entry},
+    {"performance.lmdb", keep_performance_entry},
+    {NULL, NULL}
+};
+
+static ReplicateFilter get_retention_filter(const char *file)
+{
+    for (int i = 0; RETENTION_RULES[i].file_name != NULL; i++)
+    {
+        if (StringEndsWith(file, RETENTION_RULES[i].file_name))
+        {
+            return RETENTION_RULES[i].keep;
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************/
+
+typedef struct
+{
+    char *lock_file;
+    int fd;
+} LockFileProbe;
+
+// Descriptors of the LMDB lock files probed by lmdb_in_use(), never closed
+static Seq *LOCK_FILE_PROBES = NULL;
+
+/**
+ * Get a descriptor of #lock_file to probe its locks with.
+ *
+ * Closing any descriptor of a file releases all the POSIX locks the process
+ * holds on it, including the ones of LMDB if the DB is open in this process.
+ * So the descriptors are kept open for the lifetime of the process, one per
+ * lock file (and per inode, in case the lock file was recreated).
+ *
+ * @return -1 in case of error with errno set
+ */
+static int get_lock_file_fd(const char *lock_file)
+{
+    if (LOCK_FILE_PROBES == NULL)
+    {
+        LOCK_FILE_PROBES = SeqNew(16, NULL);
+    }
+
+    struct stat path_stat;
+    if (stat(lock_file, &path_stat) == -1)
+    {
+        return -1;
+    }
+
+    LockFileProbe *probe = NULL;
+    const size_t length = SeqLength(LOCK_FILE_PROBES);
+    for (size_t i = 0; (probe == NULL) && (i < length); i++)
+    {
+        LockFileProbe *p = SeqAt(LOCK_FILE_PROBES, i);
+        if (StringEqual(p->lock_file, lock_file))
+        {
+            probe = p;
+        }
+    }
+
+    if (probe != NULL)
+    {
+        struct stat fd_stat;
+        if ((fstat(probe->fd, &fd_stat) == 0)
+            && (fd_stat.st_dev == path_stat.st_dev)
+            && (fd_stat.st_ino == path_stat.st_ino))
+        {
+            return probe->fd;
+        }
+        // Recreated, the old descriptor is left open (see above)
+    }
+
+    const int fd = open(lock_file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (probe == NULL)
+    {
+        probe = xmalloc(sizeof(LockFileProbe));
+        probe->lock_file = xstrdup(lock_file);
+        SeqAppend(LOCK_FILE_PROBES, probe);
+    }
+    probe->fd = fd;
+    return fd;
+}
+
+/**
+ * Check if the LMDB environment is open in some process, including this one
+ * (cf-execd compacts the DBs it uses itself). Every process using the
+ * environment holds a shared lock on the first byte of the lock file created
+ * by LMDB (see mdb_env_excl_lock() in LMDB sources).
+ *
+ * F_GETLK never reports the locks of the calling process, OFD locks conflict
+ * with them though. Where OFD locks are not available, DBs open in this
+ * process are not detected.
+ */
+static bool lmdb_in_use(const char *file)
+{
+    char *lock_file = StringFormat("%s-lock", file);
+    const int fd = get_lock_file_fd(lock_file);
+    free(lock_file);
+
+    if (fd == -1)
+    {
+        // No lock file means nobody ever opened the environment
+        return (errno != ENOENT);
+    }
+
+    struct flock lock_info = { 0 };
+    lock_info.l_type = F_WRLCK;
+    lock_info.l_whence = SEEK_SET;
+    lock_info.l_start = 0;
+    lock_info.l_len = 1;
+
+#ifdef F_OFD_GETLK
+    const int cmd = F_OFD_GETLK;
+#else
+    const int cmd = F_GETLK;
+#endif
+    return ((fcntl(fd, cmd, &lock_info) == -1)
+            || (lock_info.l_type != F_UNLCK));
+}
+
+/**
+ * Get the number of pages used by the file and the number of those which are
+ * free (reusable by LMDB, but never returned to the file system).
+ */
+static int get_page_usage(const char *file, size_t *total_pages, size_t *free_pages)
+{
+    assert(total_pages != NULL);
+    assert(free_pages != NULL);
+
+    int r;
+    MDB_env *env = NULL;
+    MDB_txn *txn = NULL;
+    MDB_cursor *cursor = NULL;
+    MDB_envinfo info;
+
+    if (0 != (r = mdb_env_create(&env))
+        || 0 != (r = mdb_env_open(env, file, MDB_NOSUBDIR | MDB_RDONLY, 0600))
+        || 0 != (r = mdb_env_info(env, &info))
+        || 0 != (r = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn))
+        || 0 != (r = mdb_cursor_open(txn, 0 /* FREE_DBI */, &cursor)))
+    {
+        if (env != NULL)
+        {
+            if (txn != NULL)
+            {
+                mdb_txn_abort(txn);
+            }
+            mdb_env_close(env);
+        }
+        return r;
+    }
+
+    *total_pages = info.me_last_pgno + 1;
+    *free_pages = 0;
+
+    // Every record in the freelist is an array of page numbers prefixed by
+    // its length (see mdb_stat -f)
+    MDB_val key, value;
+    while ((r = mdb_cursor_get(cursor, &key, &value, MDB_NEXT)) == MDB_SUCCESS)
+    {
+        size_t n_pages;
+        if (value.mv_size >= sizeof(n_pages))
+        {
+            memcpy(&n_pages, value.mv_data, sizeof(n_pages));
+            *free_pages += n_pages;
+        }
+    }
+
+    mdb_cursor_close(cursor);
+    mdb_txn_abort(txn);
+    mdb_env_close(env);
+
+    return (r == MDB_NOTFOUND) ? 0 : r;
+}
+
+/**
+ * Create a compacted copy of #file in #dest_file, dropping the entries not
+ * matching the retention rules for the given file (if any).
+ *
+ * @return  CFCheckCode code
+ * @WARNING Can exit the calling process in case of a corrupted DB (see
+ *          replicate_lmdb()), use in a child process.
+ */
+static int compact_copy(const char *file, const char *dest_file)
+{
+    ReplicateFilter keep = get_retention_filter(file);
+    if (keep != NULL)
+    {
+        time_t now = time(NULL);
+        return replicate_lmdb_filtered(file, dest_file, keep, &now);
+    }
+
+    int r;
+    MDB_env *env = NULL;
+    if (0 != (r = mdb_env_create(&env))
+        || 0 != (r = mdb_env_open(env, file, MDB_NOSUBDIR | MDB_RDONLY, 0600))
+        || 0 != (r = mdb_env_copy2(env, dest_file, MDB_CP_COMPACT)))
+    {
+        report_mdb_error(file, "compacting copy", r);
+    }
+    if (env != NULL)
+    {
+        mdb_env_close(env);
+    }
+    return lmdb_errno_to_cf_check_code(r);
+}
+
+/**
+ * Compact an LMDB file if at least #threshold percent of its pages are free.
+ *
+ * The compacted copy replaces the original file atomically. The per-DB lock
+ * (the same one OpenDB() uses) is held the whole time so no CFEngine process
+ * can open the DB in the meantime and files open in other processes are
+ * skipped (and will be compacted some other time).
+ *
+ * @return -1 in case of error, 0 otherwise (also when skipped)
+ */
+int compact_lmdb_file(const char *file, int threshold)
+{
+    assert(file != NULL);
+
+    struct stat orig_stat;
+    if (stat(file, &orig_stat) != 0)
+    {
+        if (errno == ENOENT)
+        {
+            return 0;
+        }
+        Log(LOG_LEVEL_ERR, "Failed to stat '%s': %s", file, GetErrorStr());
+        return -1;
+    }
+
+    char *lock_file = StringFormat("%s.lock", file);
+    FileLock lock = EMPTY_FILE_LOCK;
+    const int lock_ret = ExclusiveFileLockPath(&lock, lock_file, true); /* wait=true */
+    free(lock_file);
+    if (lock_ret < 0)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to acquire lock for the '%s' DB", file);
+        return -1;
+    }
+
+    int ret = 0;
+    char *dest_file = StringFormat("%s"COMPACT_FILE_EXTENSION, file);
+
+    if (lmdb_in_use(file))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Not compacting '%s', it is in use", file);
+        goto cleanup;
+    }
+
+    size_t total_pages, free_pages;
+    const int rc = get_page_usage(file, &total_pages, &free_pages);
+    if (rc != 0)
+    {
+        report_mdb_error(file, "page usage", rc);
+        ret = -1;
+        goto cleanup;
+    }
+
+    const size_t free_percent = (total_pages > 0) ? (free_pages * 100 / total_pages) : 0;
+    Log(LOG_LEVEL_VERBOSE, "%zu of %zu pages in '%s' are free (%zu%%)",
+        free_pages, total_pages, file, free_percent);
+    if (free_percent < (size_t) MAX(threshold, 0))
+    {
+        goto cleanup;
+    }
+
+    // Leftover from an interrupted compaction
+    unlink(dest_file);
+
+    pid_t child_pid = fork();
+    if (child_pid == 0)
+    {
+        /* child */
+        /* Same as in repair_lmdb_file(), just die in case of SIGBUS caused by
+         * a corrupted file, the parent process handles it. */
+        signal(SIGBUS, SIG_DFL);
+        exit(compact_copy(file, dest_file));
+    }
+    else if (child_pid < 0)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to fork for compaction of '%s': %s",
+            file, GetErrorStr());
+        ret = -1;
+        goto cleanup;
+    }
+
+    /* parent */
+    int status;
+    if (waitpid(child_pid, &status, 0) != child_pid)
+    {
+        /* real error that should never happen */
+        ret = -1;
+        goto cleanup;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != CF_CHECK_OK)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to compact '%s', leaving it as it is", file);
+        unlink(dest_file);
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (chmod(dest_file, orig_stat.st_mode & 07777) != 0)
+    {
+        Log(LOG_LEVEL_WARNING, "Failed to set permissions of '%s': %s",
+            dest_file, GetErrorStr());
+    }
+    if (rename(dest_file, file) != 0)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to replace '%s' with the compacted copy: %s",
+            file, GetErrorStr());
+        unlink(dest_file);
+        ret = -1;
+        goto cleanup;
+    }
+
+    struct stat new_stat;
+    if (stat(file, &new_stat) == 0)
+    {
+        Log(LOG_LEVEL_INFO, "Compacted '%s' (%jd -> %jd bytes)", file,
+            (intmax_t) orig_stat.st_size, (intmax_t) new_stat.st_size);
+    }
+
+  cleanup:
+    free(dest_file);
+    ExclusiveFileUnlock(&lock, true); /* close=true */
+    return ret;
+}
+
+static int compact_lmdb_files(Seq *files, int threshold)
+{
+    assert(files != NULL);
+
+    int failures = 0;
+    const size_t length = SeqLength(files);
+    for (size_t i = 0; i < length; ++i)
+    {
+        const char *file = SeqAt(files, i);
+        if (compact_lmdb_file(file, threshold) == -1)
+        {
+            failures++;
+        }
+    }
+
+    if (failures != 0)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to compact %d database%s",
+            failures, failures != 1 ? "s" : "");
+    }
+    return failures;
+}
+
+int compact_main(int argc, const char *const *const argv)
+{
+    size_t offset = 1;
+    int threshold = 0; // Compact unconditionally when run manually
+    if (argc > 1 && argv[1] != NULL && argv[1][0] == '-')
+    {
+        if (StringMatchesOption(argv[1], "--threshold", "-t")
+            && argc > 2 && argv[2] != NULL)
+        {
+            threshold = StringToLongDefaultOnError(argv[2], -1);
+            if (threshold < 0 || threshold > 100)
+            {
+                print_usage();
+                printf("Invalid threshold: '%s'\n", argv[2]);
+                return 1;
+            }
+            offset += 2;
+        }
+        else
+        {
+            print_usage();
+            printf("Unrecognized option: '%s'\n", argv[1]);
+            return 1;
+        }
+    }
+
+    Seq *files = argv_to_lmdb_files(argc, argv, offset);
+    if (files == NULL || SeqLength(files) == 0)
+    {
+        Log(LOG_LEVEL_ERR, "No database files to compact");
+        SeqDestroy(files);
+        return 1;
+    }
+    const int ret = compact_lmdb_files(files, threshold);
+    SeqDestroy(files);
+    return ret;
+}
+
+int compact_lmdb_default(int threshold)
+{
+    // This function is used by cf-execd, not cf-check
+
+    Seq *files = default_lmdb_files();
+    if (files == NULL)
+    {
+        // Error message printed default_lmdb_files()
+        return 1;
+    }
+    const int ret = compact_lmdb_files(files, threshold);
+    SeqDestroy(files);
+    return ret;
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef __COMPACT_H__
+#define __COMPACT_H__
+
+#define COMPACT_FILE_EXTENSION ".compact"
+
+// Compact a database when at least this percentage of its pages is free
+#define COMPACT_DEFAULT_THRESHOLD 50
+
+int compact_main(int argc, const char *const *argv);
+int compact_lmdb_default(int threshold);
+int compact_lmdb_file(const char *file, int threshold);
+
+#endif
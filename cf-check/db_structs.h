@@ -29,6 +29,13 @@ typedef struct
     time_t process_start_time;
 } LockData; // Keep in sync with cf3.defs.h
 
+// Struct used for entries in /var/cfengine/state/performance.lmdb:
+typedef struct
+{
+    time_t t;
+    QPoint Q;
+} Event; // Keep in sync with cf3.defs.h
+
 #define OBSERVABLES_APPLY(apply_macro) \
     apply_macro(users)                 \
     apply_macro(rootprocs)             \
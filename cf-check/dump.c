@@ -10,6 +10,7 @@
 #include <known_dirs.h> // GetStateDir() for usage printout
 #include <file_lib.h>   // FILE_SEPARATOR
 #include <observables.h>
+#include <time_series_block.h>
 
 typedef enum
 {
@@ -202,6 +203,36 @@ static void print_struct_averages(
     }
 }
 
+// Used to print values in /var/cfengine/state/cf_timeseries.lmdb:
+static void print_struct_time_series(
+    const MDB_val value, const bool strip_strings)
+{
+    size_t count;
+    TimeSeriesPoint *points =
+        TimeSeriesBlockDecode(value.mv_data, value.mv_size, &count);
+    if (points == NULL)
+    {
+        // Not a block (e.g. the migration marker), print it as it is
+        print_json_string(value.mv_data, value.mv_size, strip_strings);
+        return;
+    }
+
+    JsonElement *json_points = JsonArrayCreate(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        JsonElement *point = JsonArrayCreate(2);
+        JsonArrayAppendInteger(point, points[i].time);
+        JsonArrayAppendReal(point, points[i].value);
+        JsonArrayAppendArray(json_points, point);
+    }
+    free(points);
+
+    Writer *w = FileWriter(stdout);
+    JsonWriteCompact(w, json_points);
+    FileWriterDetach(w);
+    JsonDestroy(json_points);
+}
+
 static void print_struct_persistent_class(
     const MDB_val value, const bool strip_strings)
 {
@@ -303,6 +334,10 @@ static void print_struct_or_string(
         {
             print_struct_averages(value, strip_strings, tskey_filename);
         }
+        else if (StringEndsWith(file, "cf_timeseries.lmdb"))
+        {
+            print_struct_time_series(value, strip_strings);
+        }
         else if (StringEndsWith(file, "cf_state.lmdb"))
         {
             print_struct_persistent_class(value, strip_strings);
@@ -442,17 +477,20 @@ static int dump_db(const char *file, const dump_mode mode, const char *tskey_fil
     }
     print_closing_bracket(mode);
 
-    if (r != MDB_NOTFOUND)
-    {
-        // At this point, not found is expected, anything else is an error
-        return dump_report_error(r);
-    }
+    // Release the read snapshot as soon as possible, a long-lived reader
+    // prevents LMDB from reusing pages and makes the file grow
     mdb_cursor_close(cursor);
     mdb_close(env, dbi);
 
     mdb_txn_abort(txn);
     mdb_env_close(env);
 
+    if (r != MDB_NOTFOUND)
+    {
+        // At this point, not found is expected, anything else is an error
+        return dump_report_error(r);
+    }
+
     return 0;
 }
 
@@ -10,6 +10,15 @@ int replicate_lmdb(ARG_UNUSED const char *s_file, ARG_UNUSED const char *d_file)
     return 1;
 }
 
+int replicate_lmdb_filtered(ARG_UNUSED const char *s_file,
+                            ARG_UNUSED const char *d_file,
+                            ARG_UNUSED ReplicateFilter filter,
+                            ARG_UNUSED void *data)
+{
+    Log(LOG_LEVEL_ERR, "Database replication only available for LMDB");
+    return 1;
+}
+
 #else
 
 #include <lmdb.h>
@@ -83,6 +92,17 @@ static void HandleDstLMDBCorruption(MDB_env *env, const char *msg)
  *          operation failure.
  */
 int replicate_lmdb(const char *s_file, const char *d_file)
+{
+    return replicate_lmdb_filtered(s_file, d_file, NULL, NULL);
+}
+
+/**
+ * Same as replicate_lmdb(), but only the entries for which #filter returns
+ * true are written into the new LMDB file (all entries if #filter is NULL).
+ * Since the new file only contains the live pages, this also compacts the DB.
+ */
+int replicate_lmdb_filtered(const char *s_file, const char *d_file,
+                            ReplicateFilter filter, void *filter_data)
 {
     MDB_env *s_env = NULL;
     MDB_txn *s_txn = NULL;
@@ -161,6 +181,20 @@ int replicate_lmdb(const char *s_file, const char *d_file)
     mdb_env_set_userctx(d_env, &info);
     mdb_env_set_assert(d_env, (MDB_assert_func*) HandleDstLMDBCorruption);
 
+    /* Make sure everything from the source fits into the new file. */
+    MDB_envinfo s_info;
+    rc = mdb_env_info(s_env, &s_info);
+    if (rc == 0)
+    {
+        rc = mdb_env_set_mapsize(d_env, s_info.me_mapsize);
+    }
+    if (rc != 0)
+    {
+        ret = rc;
+        report_mdb_error(d_file, "mdb_env_set_mapsize", rc);
+        goto cleanup;
+    }
+
     rc = mdb_env_open(d_env, d_file, MDB_NOSUBDIR | MDB_NOTLS, 0600);
     if (rc != 0)
     {
@@ -210,6 +244,12 @@ int replicate_lmdb(const char *s_file, const char *d_file)
             report_mdb_error(s_file, "mdb_cursor_get", rc);
             ret = rc;
         }
+        if ((rc == MDB_SUCCESS) && (filter != NULL) &&
+            !filter(key.mv_data, key.mv_size, data.mv_data, data.mv_size,
+                    filter_data))
+        {
+            continue;
+        }
         if (rc == MDB_SUCCESS)
         {
             rc = mdb_put(d_txn, d_dbi, &key, &data, 0);
@@ -1,5 +1,17 @@
 #ifndef __REPLICATE_H__
 #define __REPLICATE_H__
 
+#include <stddef.h>
+
+/**
+ * Decides whether an entry should be copied to the new LMDB file. The key and
+ * value point directly to the source DB's memory and may not be aligned.
+ */
+typedef bool (*ReplicateFilter)(const void *key, size_t key_size,
+                                const void *value, size_t value_size,
+                                void *data);
+
 int replicate_lmdb(const char *s_file, const char *d_file);
+int replicate_lmdb_filtered(const char *s_file, const char *d_file,
+                            ReplicateFilter filter, void *data);
 #endif
@@ -55,6 +55,7 @@
 #include <printsize.h>
 #include <cleanup.h>
 #include <repair.h>
+#include <compact.h>
 #include <dbm_api.h>            /* CheckDBRepairFlagFile() */
 #include <string_lib.h>
 #include <acl_tools.h>          /* AllowAccessForUsers() */
@@ -66,6 +67,9 @@
 
 #define CF_EXECD_RUNAGENT_SOCKET_NAME "runagent.socket"
 
+/* How often to check if some of the local databases need compacting. */
+#define CF_EXECD_DB_COMPACT_INTERVAL SECONDS_PER_DAY
+
 /* The listen() queue doesn't need to be long, new connections are accepted
  * quickly and handed over to forked child processes so a pile up means some
  * serious problem and it's better to just throw such connections away. */
@@ -524,6 +528,26 @@ static bool HandleRequestsOrSleep(time_t seconds, const char *reason,
     return false;
 }
 
+/**
+ * Compact the local databases with too much free space in them once in a
+ * while. Databases in use by other processes are skipped, so this is best
+ * done when no agent run is in progress.
+ */
+static void MaybeCompactDatabases(void)
+{
+    static time_t last_check = 0;
+
+    const time_t now = time(NULL);
+    if ((now - last_check) < CF_EXECD_DB_COMPACT_INTERVAL)
+    {
+        return;
+    }
+    last_check = now;
+
+    Log(LOG_LEVEL_VERBOSE, "Checking if local databases need compacting");
+    compact_lmdb_default(COMPACT_DEFAULT_THRESHOLD);
+}
+
 static void CFExecdMainLoop(EvalContext *ctx, Policy **policy, GenericAgentConfig *config,
                             ExecdConfig **execd_config, ExecConfig **exec_config,
                             int runagent_socket)
@@ -537,6 +561,8 @@ static void CFExecdMainLoop(EvalContext *ctx, Policy **policy, GenericAgentConfi
             Log(LOG_LEVEL_DEBUG, "Reaped child process");
         }
 
+        MaybeCompactDatabases();
+
         if (ScheduleRun(ctx, policy, config, execd_config, exec_config))
         {
             terminate = HandleRequestsOrSleep((*execd_config)->splay_time, "splay time",
@@ -46,6 +46,7 @@ typedef enum
     MONITOR_CONTROL_MONITOR_FACILITY,
     MONITOR_CONTROL_HISTOGRAMS,
     MONITOR_CONTROL_TCP_DUMP,
+    MONITOR_CONTROL_TCP_DUMP_COMMAND,
     MONITOR_CONTROL_NONE
 } MonitorControl;
 
@@ -48,8 +48,11 @@
 #include <verify_classes.h>
 #include <known_dirs.h>
 #include <probes.h>                      /* MonOtherInit,MonOtherGatherData */
-#include <history.h>                     /* HistoryUpdate */
+#include <history.h>                     /* HistoryUpdate,HistoryCloseStreams */
 #include <monitoring.h>                  /* GetObservable */
+#include <mon_scheduler.h>               /* MonProbeRegister */
+#include <mon_stats.h>                   /* MonStatsUpdate */
+#include <string_lib.h>                  /* StringEqual */
 #include <cleanup.h>
 
 
@@ -58,8 +61,6 @@
 /*****************************************************************************/
 
 #define CF_ENVNEW_FILE   "env_data.new"
-#define cf_noise_threshold 6    /* number that does not warrant large anomaly status */
-#define MON_THRESHOLD_HIGH 1000000      // samples should stay below this threshold
 #define LDT_BUFSIZE 10
 
 double FORGETRATE = 0.7;
@@ -68,6 +69,7 @@ static char ENVFILE_NEW[CF_BUFSIZE] = "";
 static char ENVFILE[CF_BUFSIZE] = "";
 
 static double HISTOGRAM[CF_OBSERVABLES][7][CF_GRAINS] = { { { 0.0 } } };
+static bool HISTOGRAM_DIRTY = false;
 
 /* persistent observations */
 
@@ -78,7 +80,14 @@ static double CF_THIS[CF_OBSERVABLES] = { 0.0 };
 static long ITER = 0;               /* Iteration since start */
 static double AGE = 0.0, WAGE = 0.0;        /* Age and weekly age of database */
 
-static Averages LOCALAV = { 0 };
+static MonStats STATS;
+
+/* The averages of the current time slot, written to the observations DB only
+ * when the slot changes (or the daemon stops) instead of every cycle */
+
+static char SLOT_KEY[CF_SMALLBUF] = "";
+static Averages SLOT;
+static bool SLOT_DIRTY = false;
 
 /* Leap Detection vars */
 
@@ -105,14 +114,13 @@ static void ArmClasses(EvalContext *ctx, const Averages *newvals);
 static void GatherPromisedMeasures(EvalContext *ctx, const Policy *policy);
 
 static void LeapDetection(void);
-static Averages *GetCurrentAverages(char *timekey);
-static void UpdateAverages(EvalContext *ctx, char *timekey, const Averages *newvals);
-static void UpdateDistributions(EvalContext *ctx, char *timekey, Averages *av);
-static double WAverage(double new_val, double old_val, double age);
-static double SetClasses(EvalContext *ctx, char *name, double variable, double av_expect, double av_var, double localav_expect,
-                         double localav_var, Item **classlist);
+static const Averages *GetCurrentAverages(const char *timekey);
+static void UpdateAverages(EvalContext *ctx, const char *timekey, const Averages *newvals);
+static void UpdateDistributions(EvalContext *ctx, const char *timekey, const Averages *av);
+static void SaveAverages(void);
+static void SaveHistogram(void);
+static void SetClasses(EvalContext *ctx, const char *name, const MonStatsClass *class, Item **classlist);
 static void SetVariable(char *name, double now, double average, double stddev, Item **list);
-static double RejectAnomaly(double new, double av, double var, double av2, double var2);
 static void ZeroArrivals(void);
 static PromiseResult KeepMonitorPromise(EvalContext *ctx, const Promise *pp, void *param);
 
@@ -137,11 +145,9 @@ void MonitorInitialize(void)
     MonEntropyClassesInit();
 
     GetDatabaseAge();
+    HistoryMigrate();
 
-    for (i = 0; i < CF_OBSERVABLES; i++)
-    {
-        LOCALAV.Q[i] = QDefinite(0.0);
-    }
+    MonStatsInit(&STATS);
 
     for (i = 0; i < CF_OBSERVABLES; i++)
     {
@@ -171,6 +177,19 @@ void MonitorInitialize(void)
     MonTempInit();
     MonOtherInit();
 
+/* Probes which may block for a long time (spawning commands, walking /proc)
+   run in the background so that they don't delay the other measurements */
+
+    MonProbeRegister("processes", &MonProcessesGatherData, 150, MON_PROBE_COST_HIGH);
+    MonProbeRegister("disk", &MonDiskGatherData, 300, MON_PROBE_COST_HIGH);
+#ifndef __MINGW32__
+    MonProbeRegister("cpu", &MonCPUGatherData, 150, MON_PROBE_COST_LOW);
+    MonProbeRegister("load", &MonLoadGatherData, 150, MON_PROBE_COST_LOW);
+    MonProbeRegister("network", &MonNetworkGatherData, 150, MON_PROBE_COST_LOW);
+    MonProbeRegister("temp", &MonTempGatherData, 300, MON_PROBE_COST_HIGH);
+#endif /* !__MINGW32__ */
+    MonProbeRegister("other", &MonOtherGatherData, 150, MON_PROBE_COST_LOW);
+
     Log(LOG_LEVEL_DEBUG, "Finished with monitor initialization");
 }
 
@@ -313,6 +332,7 @@ void MonitorStartServer(EvalContext *ctx, const Policy *policy)
     WritePID("cf-monitord.pid");
 
     MonNetworkSnifferOpen();
+    MonProbesStart();
 
     while (!IsPendingTermination())
     {
@@ -329,6 +349,9 @@ void MonitorStartServer(EvalContext *ctx, const Policy *policy)
         ITER++;
     }
 
+    SaveAverages();
+    HistoryCloseStreams();
+    MonProbesStop();
     PolicyDestroy(monitor_cfengine_policy);
     YieldCurrentLock(thislock);
 }
@@ -341,16 +364,11 @@ static void GetQ(EvalContext *ctx, const Policy *policy)
 
     ZeroArrivals();
 
-    MonProcessesGatherData(CF_THIS);
-    MonDiskGatherData(CF_THIS);
+    MonProbesRun(time(NULL));
+    MonProbesCollect(CF_THIS);
 #ifndef __MINGW32__
-    MonCPUGatherData(CF_THIS);
-    MonLoadGatherData(CF_THIS);
-    MonNetworkGatherData(CF_THIS);
     MonNetworkSnifferGatherData();
-    MonTempGatherData(CF_THIS);
 #endif /* !__MINGW32__ */
-    MonOtherGatherData(CF_THIS);
     GatherPromisedMeasures(ctx, policy);
 }
 
@@ -358,115 +376,64 @@ static void GetQ(EvalContext *ctx, const Policy *policy)
 
 static Averages EvalAvQ(EvalContext *ctx, char *t)
 {
-    Averages *lastweek_vals, newvals;
-    double last5_vals[CF_OBSERVABLES];
-    char name[CF_MAXVARSIZE];
+    Averages lastweek_vals, newvals;
     time_t now = time(NULL);
-    int i;
-
-    for (i = 0; i < CF_OBSERVABLES; i++)
-    {
-        last5_vals[i] = 0.0;
-    }
 
     Banner("Evaluating and storing new weekly averages");
 
-    if ((lastweek_vals = GetCurrentAverages(t)) == NULL)
+    const Averages *current = GetCurrentAverages(t);
+    if (current == NULL)
     {
         Log(LOG_LEVEL_ERR, "Error reading average database");
         DoCleanupAndExit(EXIT_FAILURE);
     }
+    lastweek_vals = *current;
 
-/* Discard any apparently anomalous behaviour before renormalizing database */
-
-    for (i = 0; i < CF_OBSERVABLES; i++)
+    if ((FORGETRATE > 0.9) || (FORGETRATE < 0.1))
     {
-        double delta2;
-        char desc[CF_BUFSIZE];
-        double This;
-        name[0] = '\0';
-        GetObservable(i, name, desc);
-
-        /* Overflow protection */
-
-        if (lastweek_vals->Q[i].expect < 0)
-        {
-            lastweek_vals->Q[i].expect = 0;
-        }
-
-        if (lastweek_vals->Q[i].q < 0)
-        {
-            lastweek_vals->Q[i].q = 0;
-        }
-
-        if (lastweek_vals->Q[i].var < 0)
-        {
-            lastweek_vals->Q[i].var = 0;
-        }
-
-        // lastweek_vals is last week's stored data
-
-        This =
-            RejectAnomaly(CF_THIS[i], lastweek_vals->Q[i].expect, lastweek_vals->Q[i].var, LOCALAV.Q[i].expect,
-                          LOCALAV.Q[i].var);
-
-        newvals.Q[i].q = This;
-        newvals.last_seen = now;  // Record the freshness of this slot
-
-        LOCALAV.Q[i].q = This;
+        FORGETRATE = 0.6;
+    }
 
-        Log(LOG_LEVEL_DEBUG, "Previous week's '%s.q' %lf", name, lastweek_vals->Q[i].q);
-        Log(LOG_LEVEL_DEBUG, "Previous week's '%s.var' %lf", name, lastweek_vals->Q[i].var);
-        Log(LOG_LEVEL_DEBUG, "Previous week's '%s.ex' %lf", name, lastweek_vals->Q[i].expect);
+    /* Big jumps are accepted with the same probability for all observables
+     * (the generator used to be re-seeded with the current time for each of
+     * them anyway) */
+    srand48((unsigned int) now);
+    const double draw = drand48();
 
-        Log(LOG_LEVEL_DEBUG, "Just measured: CF_THIS[%s] = %lf", name, CF_THIS[i]);
-        Log(LOG_LEVEL_DEBUG, "Just sanitized: This[%s] = %lf", name, This);
+    MonStatsUpdate(&STATS, CF_THIS, now, &lastweek_vals, &newvals,
+                   WAGE, ITER, FORGETRATE, draw);
 
-        newvals.Q[i].expect = WAverage(This, lastweek_vals->Q[i].expect, WAGE);
-        LOCALAV.Q[i].expect = WAverage(newvals.Q[i].expect, LOCALAV.Q[i].expect, ITER);
+    if (WouldLog(LOG_LEVEL_VERBOSE))
+    {
+        const QPoint *local = STATS.local.Q;
 
-        if (last5_vals[i] > 0)
-        {
-            newvals.Q[i].dq = newvals.Q[i].q - last5_vals[i];
-            LOCALAV.Q[i].dq = newvals.Q[i].q - last5_vals[i];
-        }
-        else
+        for (int i = 0; i < CF_OBSERVABLES; i++)
         {
-            newvals.Q[i].dq = 0;
-            LOCALAV.Q[i].dq = 0;
-        }
+            char name[CF_MAXVARSIZE], desc[CF_BUFSIZE];
+            name[0] = '\0';
+            GetObservable(i, name, desc);
 
-        // Save the last measured value as the value "from five minutes ago" to get the gradient
-        last5_vals[i] = newvals.Q[i].q;
+            Log(LOG_LEVEL_DEBUG, "Previous week's '%s.q' %lf", name, lastweek_vals.Q[i].q);
+            Log(LOG_LEVEL_DEBUG, "Previous week's '%s.var' %lf", name, lastweek_vals.Q[i].var);
+            Log(LOG_LEVEL_DEBUG, "Previous week's '%s.ex' %lf", name, lastweek_vals.Q[i].expect);
 
-        delta2 = (This - lastweek_vals->Q[i].expect) * (This - lastweek_vals->Q[i].expect);
+            Log(LOG_LEVEL_DEBUG, "Just measured: CF_THIS[%s] = %lf", name, CF_THIS[i]);
 
-        if (lastweek_vals->Q[i].var > delta2 * 2.0)
-        {
-            /* Clean up past anomalies */
-            newvals.Q[i].var = delta2;
-            LOCALAV.Q[i].var = WAverage(newvals.Q[i].var, LOCALAV.Q[i].var, ITER);
-        }
-        else
-        {
-            newvals.Q[i].var = WAverage(delta2, lastweek_vals->Q[i].var, WAGE);
-            LOCALAV.Q[i].var = WAverage(newvals.Q[i].var, LOCALAV.Q[i].var, ITER);
-        }
-
-        Log(LOG_LEVEL_VERBOSE, "[%d] %s q=%lf, var=%lf, ex=%lf", i, name,
-            newvals.Q[i].q, newvals.Q[i].var, newvals.Q[i].expect);
+            Log(LOG_LEVEL_VERBOSE, "[%d] %s q=%lf, var=%lf, ex=%lf", i, name,
+                newvals.Q[i].q, newvals.Q[i].var, newvals.Q[i].expect);
 
-        Log(LOG_LEVEL_VERBOSE, "[%d] = %lf -> (%lf#%lf) local [%lf#%lf]", i, This, newvals.Q[i].expect,
-            sqrt(newvals.Q[i].var), LOCALAV.Q[i].expect, sqrt(LOCALAV.Q[i].var));
+            Log(LOG_LEVEL_VERBOSE, "[%d] = %lf -> (%lf#%lf) local [%lf#%lf]", i, newvals.Q[i].q, newvals.Q[i].expect,
+                sqrt(newvals.Q[i].var), local[i].expect, sqrt(local[i].var));
 
-        if (This > 0)
-        {
-            Log(LOG_LEVEL_VERBOSE, "Storing %.2lf in %s", This, name);
+            if (newvals.Q[i].q > 0)
+            {
+                Log(LOG_LEVEL_VERBOSE, "Storing %.2lf in %s", newvals.Q[i].q, name);
+            }
         }
     }
 
     UpdateAverages(ctx, t, &newvals);
-    UpdateDistributions(ctx, t, lastweek_vals);        /* Distribution about mean */
+    UpdateDistributions(ctx, t, &lastweek_vals);        /* Distribution about mean */
 
     return newvals;
 }
@@ -586,7 +553,7 @@ static void AddOpenPorts(const char *name, const Item *value, Item **mon_data)
 static void ArmClasses(EvalContext *ctx, const Averages *const av)
 {
     assert(av != NULL);
-    double sigma;
+    MonStatsClass classes[CF_OBSERVABLES];
     Item *ip, *mon_data = NULL;
     int i, j, k;
     char buff[CF_BUFSIZE], ldt_buff[CF_BUFSIZE], name[CF_MAXVARSIZE];
@@ -594,13 +561,15 @@ static void ArmClasses(EvalContext *ctx, const Averages *const av)
     extern Item *ALL_INCOMING;
     extern Item *MON_UDP4, *MON_UDP6, *MON_TCP4, *MON_TCP6;
 
+    MonStatsClassify(&STATS, CF_THIS, av, classes);
+
     for (i = 0; i < CF_OBSERVABLES; i++)
     {
         char desc[CF_BUFSIZE];
 
         GetObservable(i, name, desc);
-        sigma = SetClasses(ctx, name, CF_THIS[i], av->Q[i].expect, av->Q[i].var, LOCALAV.Q[i].expect, LOCALAV.Q[i].var, &mon_data);
-        SetVariable(name, CF_THIS[i], av->Q[i].expect, sigma, &mon_data);
+        SetClasses(ctx, name, &classes[i], &mon_data);
+        SetVariable(name, CF_THIS[i], av->Q[i].expect, classes[i].sigma, &mon_data);
 
         /* LDT */
 
@@ -717,28 +686,34 @@ static void ArmClasses(EvalContext *ctx, const Averages *const av)
 
 /*****************************************************************************/
 
-static Averages *GetCurrentAverages(char *timekey)
+static const Averages *GetCurrentAverages(const char *timekey)
 {
-    CF_DB *dbp;
-    static Averages entry; /* No need to initialize */
+    AGE++;
+    WAGE = AGE / SECONDS_PER_WEEK * CF_MEASURE_INTERVAL;
 
+    if (StringEqual(timekey, SLOT_KEY))
+    {
+        return &SLOT;
+    }
+
+    /* Moving on to a new time slot, store the previous one */
+    SaveAverages();
+
+    CF_DB *dbp;
     if (!OpenDB(&dbp, dbid_observations))
     {
         return NULL;
     }
 
-    memset(&entry, 0, sizeof(entry));
+    memset(&SLOT, 0, sizeof(SLOT));
 
-    AGE++;
-    WAGE = AGE / SECONDS_PER_WEEK * CF_MEASURE_INTERVAL;
-
-    if (ReadDB(dbp, timekey, &entry, sizeof(Averages)))
+    if (ReadDB(dbp, timekey, &SLOT, sizeof(Averages)))
     {
         int i;
 
         for (i = 0; i < CF_OBSERVABLES; i++)
         {
-            Log(LOG_LEVEL_DEBUG, "Previous values (%lf,..) for time index '%s'", entry.Q[i].expect, timekey);
+            Log(LOG_LEVEL_DEBUG, "Previous values (%lf,..) for time index '%s'", SLOT.Q[i].expect, timekey);
         }
     }
     else
@@ -747,28 +722,56 @@ static Averages *GetCurrentAverages(char *timekey)
     }
 
     CloseDB(dbp);
-    return &entry;
+
+    strlcpy(SLOT_KEY, timekey, sizeof(SLOT_KEY));
+    return &SLOT;
 }
 
 /*****************************************************************************/
 
-static void UpdateAverages(EvalContext *ctx, char *timekey, const Averages *const newvals)
+static void UpdateAverages(EvalContext *ctx, const char *timekey, const Averages *const newvals)
 {
     assert(newvals != NULL);
-    CF_DB *dbp;
+    assert(StringEqual(timekey, SLOT_KEY));
+
+    SLOT = *newvals;
+    SLOT_DIRTY = true;
+
+    Log(LOG_LEVEL_VERBOSE, "Updated averages at '%s'", timekey);
+
+    HistoryRecordObservations(newvals);
+    HistoryUpdate(ctx, newvals);
+}
 
+/**
+ * Write the averages of the current time slot (and the histograms) if they
+ * changed since they were last written.
+ */
+static void SaveAverages(void)
+{
+    if (HISTOGRAM_DIRTY)
+    {
+        SaveHistogram();
+    }
+
+    if (!SLOT_DIRTY)
+    {
+        return;
+    }
+
+    CF_DB *dbp;
     if (!OpenDB(&dbp, dbid_observations))
     {
         return;
     }
 
-    Log(LOG_LEVEL_INFO, "Updated averages at '%s'", timekey);
+    Log(LOG_LEVEL_INFO, "Updated averages at '%s'", SLOT_KEY);
 
-    WriteDB(dbp, timekey, newvals, sizeof(Averages));
+    WriteDB(dbp, SLOT_KEY, &SLOT, sizeof(Averages));
     WriteDB(dbp, "DATABASE_AGE", &AGE, sizeof(double));
 
     CloseDB(dbp);
-    HistoryUpdate(ctx, newvals);
+    SLOT_DIRTY = false;
 }
 
 static int Day2Number(const char *datestring)
@@ -786,10 +789,9 @@ static int Day2Number(const char *datestring)
     return -1;
 }
 
-static void UpdateDistributions(EvalContext *ctx, char *timekey, Averages *av)
+static void UpdateDistributions(EvalContext *ctx, const char *timekey, const Averages *av)
 {
     int position, day, i;
-    char filename[CF_BUFSIZE];
 
 /* Take an interval of 4 standard deviations from -2 to +2, divided into CF_GRAINS
    parts. Centre each measurement on CF_GRAINS/2 and scale each measurement by the
@@ -811,225 +813,110 @@ static void UpdateDistributions(EvalContext *ctx, char *timekey, Averages *av)
             }
         }
 
-        snprintf(filename, CF_BUFSIZE, "%s%chistograms", GetStateDir(), FILE_SEPARATOR);
-
-        FILE *fp = safe_fopen(filename, "w");
-        if (fp == NULL)
-        {
-            Log(LOG_LEVEL_ERR, "Unable to save histograms to '%s' (fopen: %s)", filename, GetErrorStr());
-            return;
-        }
-
-        for (position = 0; position < CF_GRAINS; position++)
-        {
-            fprintf(fp, "%d ", position);
-
-            for (i = 0; i < CF_OBSERVABLES; i++)
-            {
-                for (day = 0; day < 7; day++)
-                {
-                    fprintf(fp, "%.0lf ", HISTOGRAM[i][day][position]);
-                }
-            }
-            fprintf(fp, "\n");
-        }
-
-        fclose(fp);
+        /* Saved together with the averages */
+        HISTOGRAM_DIRTY = true;
     }
 }
 
-/*****************************************************************************/
-
-/*
-    This function performs a weighted average of an old and a new measured
-    value. Weights depend on the age of the data. If one or both values
-    are "unreasonably" large (>9999999) they will be ignored.
-*/
-/* For a couple of weeks, learn eagerly. Otherwise variances will
-   be way too large. Then downplay newer data somewhat, and rely on
-   experience of a couple of months of data ... */
-
-static double WAverage(double new_val, double old_val, double age)
+static void SaveHistogram(void)
 {
-    const double cf_sane_monitor_limit = 9999999.0;
-    double average, weight_new, weight_old;
-
-    // First do some database corruption self-healing
-    const bool old_bad = (old_val > cf_sane_monitor_limit);
-    const bool new_bad = (new_val > cf_sane_monitor_limit);
-    if (old_bad && new_bad)
-    {
-        return 0.0;
-    }
-    else if (old_bad)
-    {
-        return new_val;
-    }
-    else if (new_bad)
-    {
-        return old_val;
-    }
+    int position, day, i;
+    char filename[CF_BUFSIZE];
 
-    // Now look at the self-learning
-    if ((FORGETRATE > 0.9) || (FORGETRATE < 0.1))
-    {
-        FORGETRATE = 0.6;
-    }
+    snprintf(filename, CF_BUFSIZE, "%s%chistograms", GetStateDir(), FILE_SEPARATOR);
 
-    // More aggressive learning for young database
-    if (age < 2.0)
-    {
-        weight_new = FORGETRATE;
-        weight_old = (1.0 - FORGETRATE);
-    }
-    else
+    FILE *fp = safe_fopen(filename, "w");
+    if (fp == NULL)
     {
-        weight_new = (1.0 - FORGETRATE);
-        weight_old = FORGETRATE;
+        Log(LOG_LEVEL_ERR, "Unable to save histograms to '%s' (fopen: %s)", filename, GetErrorStr());
+        return;
     }
 
-    if ((old_val == 0) && (new_val == 0))
+    for (position = 0; position < CF_GRAINS; position++)
     {
-        return 0.0;
-    }
+        fprintf(fp, "%d ", position);
 
-    /*
-     * Average = (w1*v1 + w2*v2) / (w1 + w2)
-     *
-     * w1 + w2 always equals to 1, so we omit it for better precision and
-     * performance.
-     */
-
-    average = (weight_new * new_val + weight_old * old_val);
-
-    if (average < 0)
-    {
-        /* Accuracy lost - something wrong */
-        return 0.0;
+        for (i = 0; i < CF_OBSERVABLES; i++)
+        {
+            for (day = 0; day < 7; day++)
+            {
+                fprintf(fp, "%.0lf ", HISTOGRAM[i][day][position]);
+            }
+        }
+        fprintf(fp, "\n");
     }
 
-    return average;
+    fclose(fp);
+    HISTOGRAM_DIRTY = false;
 }
 
 /*****************************************************************************/
 
-static double SetClasses(EvalContext *ctx, char *name, double variable, double av_expect, double av_var, double localav_expect,
-                         double localav_var, Item **classlist)
+static void AppendPersistentClass(EvalContext *ctx, Item **classlist, const char *base,
+                                  const char *suffix, const char *level)
 {
-    char buffer[CF_BUFSIZE], buffer2[CF_BUFSIZE];
-    double dev, delta, sigma, ldelta, lsigma, sig;
+    char class[CF_BUFSIZE];
+
+    snprintf(class, sizeof(class), "%s%s", base, suffix);
+    AppendItem(classlist, class, level);
 
-    delta = variable - av_expect;
-    sigma = sqrt(av_var);
-    ldelta = variable - localav_expect;
-    lsigma = sqrt(localav_var);
-    sig = sqrt(sigma * sigma + lsigma * lsigma);
+    /* Now use persistent classes so that serious anomalies last for about
+       2 autocorrelation lengths, so that they can be cross correlated and
+       seen by normally scheduled cfagent processes ... */
 
-    Log(LOG_LEVEL_DEBUG, "delta = %lf, sigma = %lf, lsigma = %lf, sig = %lf", delta, sigma, lsigma, sig);
+    EvalContextHeapPersistentSave(ctx, class, CF_PERSISTENCE, CONTEXT_STATE_POLICY_PRESERVE, "");
+    EvalContextClassPutSoft(ctx, class, CONTEXT_SCOPE_NAMESPACE, "");
+}
 
-    if ((sigma == 0.0) || (lsigma == 0.0))
+static void SetClasses(EvalContext *ctx, const char *name, const MonStatsClass *class, Item **classlist)
+{
+    char buffer[CF_BUFSIZE], buffer2[CF_BUFSIZE];
+
+    if (class->level == MON_STATS_LEVEL_NONE)
     {
         Log(LOG_LEVEL_DEBUG, "No sigma variation .. can't measure class");
 
         snprintf(buffer, CF_MAXVARSIZE, "entropy_%s.*", name);
         MonEntropyPurgeUnused(buffer);
-
-        return sig;
+        return;
     }
 
     Log(LOG_LEVEL_DEBUG, "Setting classes for '%s'...", name);
 
-    if (fabs(delta) < cf_noise_threshold)       /* Arbitrary limits on sensitivity  */
+    snprintf(buffer, sizeof(buffer), "%s_%s", name, MonStatsDirectionToString(class->direction));
+
+    switch (class->level)
     {
+    case MON_STATS_LEVEL_NOISE:
+    case MON_STATS_LEVEL_MICROANOMALY:
         Log(LOG_LEVEL_DEBUG, "Sensitivity too high");
-
-        buffer[0] = '\0';
-        strcpy(buffer, name);
-
-        if ((delta > 0) && (ldelta > 0))
-        {
-            strcat(buffer, "_high");
-        }
-        else if ((delta < 0) && (ldelta < 0))
-        {
-            strcat(buffer, "_low");
-        }
-        else
-        {
-            strcat(buffer, "_normal");
-        }
-
         AppendItem(classlist, buffer, "0");
 
-        dev = sqrt(delta * delta / (1.0 + sigma * sigma) + ldelta * ldelta / (1.0 + lsigma * lsigma));
-
-        if (dev > 2.0 * sqrt(2.0))
-        {
-            strcpy(buffer2, buffer);
-            strcat(buffer2, "_microanomaly");
-            AppendItem(classlist, buffer2, "2");
-            EvalContextHeapPersistentSave(ctx, buffer2, CF_PERSISTENCE, CONTEXT_STATE_POLICY_PRESERVE, "");
-            EvalContextClassPutSoft(ctx, buffer2, CONTEXT_SCOPE_NAMESPACE, "");
-        }
-
-        return sig;             /* Granularity makes this silly */
-    }
-    else
-    {
-        buffer[0] = '\0';
-        strcpy(buffer, name);
-
-        if ((delta > 0) && (ldelta > 0))
-        {
-            strcat(buffer, "_high");
-        }
-        else if ((delta < 0) && (ldelta < 0))
-        {
-            strcat(buffer, "_low");
-        }
-        else
+        if (class->level == MON_STATS_LEVEL_MICROANOMALY)
         {
-            strcat(buffer, "_normal");
+            AppendPersistentClass(ctx, classlist, buffer, "_microanomaly", "2");
         }
+        break;
 
-        dev = sqrt(delta * delta / (1.0 + sigma * sigma) + ldelta * ldelta / (1.0 + lsigma * lsigma));
+    case MON_STATS_LEVEL_NORMAL:
+        snprintf(buffer2, sizeof(buffer2), "%s_normal", buffer);
+        AppendItem(classlist, buffer2, "0");
+        break;
 
-        if (dev <= sqrt(2.0))
-        {
-            strcpy(buffer2, buffer);
-            strcat(buffer2, "_normal");
-            AppendItem(classlist, buffer2, "0");
-        }
-        else
-        {
-            strcpy(buffer2, buffer);
-            strcat(buffer2, "_dev1");
-            AppendItem(classlist, buffer2, "0");
-        }
-
-        /* Now use persistent classes so that serious anomalies last for about
-           2 autocorrelation lengths, so that they can be cross correlated and
-           seen by normally scheduled cfagent processes ... */
+    default:
+        snprintf(buffer2, sizeof(buffer2), "%s_dev1", buffer);
+        AppendItem(classlist, buffer2, "0");
 
-        if (dev > 2.0 * sqrt(2.0))
+        if (class->level >= MON_STATS_LEVEL_DEV2)
         {
-            strcpy(buffer2, buffer);
-            strcat(buffer2, "_dev2");
-            AppendItem(classlist, buffer2, "2");
-            EvalContextHeapPersistentSave(ctx, buffer2, CF_PERSISTENCE, CONTEXT_STATE_POLICY_PRESERVE, "");
-            EvalContextClassPutSoft(ctx, buffer2, CONTEXT_SCOPE_NAMESPACE, "");
+            AppendPersistentClass(ctx, classlist, buffer, "_dev2", "2");
         }
 
-        if (dev > 3.0 * sqrt(2.0))
+        if (class->level >= MON_STATS_LEVEL_ANOMALY)
         {
-            strcpy(buffer2, buffer);
-            strcat(buffer2, "_anomaly");
-            AppendItem(classlist, buffer2, "3");
-            EvalContextHeapPersistentSave(ctx, buffer2, CF_PERSISTENCE, CONTEXT_STATE_POLICY_PRESERVE, "");
-            EvalContextClassPutSoft(ctx, buffer2, CONTEXT_SCOPE_NAMESPACE, "");
+            AppendPersistentClass(ctx, classlist, buffer, "_anomaly", "3");
         }
-
-        return sig;
+        break;
     }
 }
 
@@ -1058,73 +945,6 @@ static void ZeroArrivals()
 
 /*****************************************************************************/
 
-static double RejectAnomaly(double new, double average, double variance, double localav, double localvar)
-{
-    double dev = sqrt(variance + localvar);     /* Geometrical average dev */
-    double delta;
-    int bigger;
-
-    if (average == 0)
-    {
-        return new;
-    }
-
-    if (new > MON_THRESHOLD_HIGH * 4.0)
-    {
-        return 0.0;
-    }
-
-    if (new > MON_THRESHOLD_HIGH)
-    {
-        return average;
-    }
-
-    if ((new - average) * (new - average) < cf_noise_threshold * cf_noise_threshold)
-    {
-        return new;
-    }
-
-    if (new - average > 0)
-    {
-        bigger = true;
-    }
-    else
-    {
-        bigger = false;
-    }
-
-/* This routine puts some inertia into the changes, so that the system
-   doesn't respond to every little change ...   IR and UV cutoff */
-
-    delta = sqrt((new - average) * (new - average) + (new - localav) * (new - localav));
-
-    if (delta > 4.0 * dev)      /* IR */
-    {
-        srand48((unsigned int) time(NULL));
-
-        if (drand48() < 0.7)    /* 70% chance of using full value - as in learning policy */
-        {
-            return new;
-        }
-        else
-        {
-            if (bigger)
-            {
-                return average + 2.0 * dev;
-            }
-            else
-            {
-                return average - 2.0 * dev;
-            }
-        }
-    }
-    else
-    {
-        Log(LOG_LEVEL_VERBOSE, "Value accepted");
-        return new;
-    }
-}
-
 /***************************************************************/
 /* Level 5                                                     */
 /***************************************************************/
@@ -23,167 +23,34 @@
 */
 
 #include <stdio.h>
-#include <arpa/inet.h>
 
-#include <sequence.h>
-#include <file_lib.h>
-#include <logging.h>
-#include <alloc.h>
+#include <net_sockets.h>
 
-#include <proc_net_parsing.h>
+static void PrintSocket(const NetSocket *sock, ARG_UNUSED void *data)
+{
+    char local_addr[INET6_ADDRSTRLEN];
+    char remote_addr[INET6_ADDRSTRLEN];
+    NetSocketAddressToString(sock, true, local_addr, sizeof(local_addr));
+    NetSocketAddressToString(sock, false, remote_addr, sizeof(remote_addr));
+
+    printf("%s:%d -> %s:%d [%s]%s\n",
+           local_addr, sock->local_port,
+           remote_addr, sock->remote_port,
+           NetSocketTypeToString(sock->type),
+           (sock->state == NET_SOCKET_STATE_LISTEN) ? " [LISTEN]" : "");
+}
 
 int main()
 {
-    FILE *fp = fopen("/proc/net/tcp", "r");
-
-    size_t buff_size = 256;
-    char *buff = xmalloc(buff_size);
-
-    /* Read the header */
-    ssize_t ret = CfReadLine(&buff, &buff_size, fp);
-    if (ret == -1)
-    {
-        Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/tcp");
-        free(buff);
-        return 1;
-    }
-
-    /* Read real data */
-    Seq *lines = SeqNew(64, free);
-    ret = CfReadLines(&buff, &buff_size, fp, lines);
-    if (ret < 0)
-    {
-        Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/tcp");
-        SeqDestroy(lines);
-        free(buff);
-        return 1;
-    }
-
-    /* else */
-    char local_addr[INET_ADDRSTRLEN];
-    char remote_addr[INET_ADDRSTRLEN];
-    uint32_t l_port, r_port;
-    SocketState state;
-    for (size_t i = 0; i < (size_t) ret; i++)
-    {
-        char *line = SeqAt(lines,i);
-        if (ParseIPv4SocketInfo(line, local_addr, &l_port, remote_addr, &r_port, &state))
-        {
-            printf("%s:%d -> %s:%d%s\n",
-                   local_addr, l_port,
-                   remote_addr, r_port,
-                   (state == SOCK_STATE_LISTEN) ? " [LISTEN]" : "");
-        }
-    }
-    SeqClear(lines);
-
-    char local_addr6[INET6_ADDRSTRLEN];
-    char remote_addr6[INET6_ADDRSTRLEN];
-    fp = fopen("/proc/net/tcp6", "r");
-    if (fp != NULL)
+    if (!NetSocketsForEach("", NET_SOCKET_TCP4, &PrintSocket, NULL) ||
+        !NetSocketsForEach("", NET_SOCKET_UDP4, &PrintSocket, NULL))
     {
-        ret = CfReadLine(&buff, &buff_size, fp);
-        if (ret == -1)
-        {
-            Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/tcp6");
-            SeqDestroy(lines);
-            free(buff);
-            return 1;
-        }
-
-        /* Read real data */
-        ret = CfReadLines(&buff, &buff_size, fp, lines);
-        if (ret < 0)
-        {
-            Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/tcp6");
-            SeqDestroy(lines);
-            free(buff);
-            return 1;
-        }
-
-        /* else */
-        for (size_t i = 0; i < (size_t) ret; i++)
-        {
-            char *line = SeqAt(lines,i);
-            if (ParseIPv6SocketInfo(line, local_addr6, &l_port, remote_addr6, &r_port, &state))
-            {
-                printf("%s:%d -> %s:%d%s\n",
-                       local_addr6, l_port,
-                       remote_addr6, r_port,
-                       (state == SOCK_STATE_LISTEN) ? " [LISTEN]" : "");
-            }
-        }
-        SeqClear(lines);
-    }
-
-    fp = fopen("/proc/net/udp", "r");
-    ret = CfReadLine(&buff, &buff_size, fp);
-    if (ret == -1)
-    {
-        Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/udp");
-        SeqDestroy(lines);
-        free(buff);
         return 1;
     }
 
-    /* Read real data */
-    ret = CfReadLines(&buff, &buff_size, fp, lines);
-    if (ret < 0)
-    {
-        Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/udp");
-        SeqDestroy(lines);
-        free(buff);
-        return 1;
-    }
+    /* IPv6 may be completely disabled in kernel */
+    NetSocketsForEach("", NET_SOCKET_TCP6, &PrintSocket, NULL);
+    NetSocketsForEach("", NET_SOCKET_UDP6, &PrintSocket, NULL);
 
-    /* else */
-    for (size_t i = 0; i < (size_t) ret; i++)
-    {
-        char *line = SeqAt(lines,i);
-        if (ParseIPv4SocketInfo(line, local_addr, &l_port, remote_addr, &r_port, &state))
-        {
-            printf("%s:%d -> %s:%d [udp]\n",
-                   local_addr, l_port,
-                   remote_addr, r_port);
-        }
-    }
-    SeqClear(lines);
-
-    fp = fopen("/proc/net/udp6", "r");
-    if (fp != NULL)
-    {
-        ret = CfReadLine(&buff, &buff_size, fp);
-        if (ret == -1)
-        {
-            Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/udp6");
-            SeqDestroy(lines);
-            free(buff);
-            return 1;
-        }
-
-        /* Read real data */
-        ret = CfReadLines(&buff, &buff_size, fp, lines);
-        if (ret < 0)
-        {
-            Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/udp6");
-            SeqDestroy(lines);
-            free(buff);
-            return 1;
-        }
-
-        /* else */
-        for (size_t i = 0; i < (size_t) ret; i++)
-        {
-            char *line = SeqAt(lines,i);
-            if (ParseIPv6SocketInfo(line, local_addr6, &l_port, remote_addr6, &r_port, &state))
-            {
-                printf("%s:%d -> %s:%d [udp6]\n",
-                       local_addr6, l_port,
-                       remote_addr6, r_port);
-            }
-        }
-    }
-    SeqDestroy(lines);
-    free(buff);
     return 0;
 }
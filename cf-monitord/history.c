@@ -25,7 +25,11 @@
 
 #include <history.h>
 
-#include <monitoring.h>                                      /* MakeTimekey */
+#include <monitoring.h>                                      /* GetObservable */
+#include <monitoring_read.h>                                 /* GetRecordForTime,MakeTimekey */
+#include <time_series.h>
+#include <stream_tail.h>
+#include <sequence.h>
 #include <actuator.h>
 #include <promises.h>
 #include <ornaments.h>
@@ -45,7 +49,7 @@
 #include <pipes.h>
 #include <matching.h>
 #include <string_lib.h>
-#include <regex.h>                                       /* StringMatchFull */
+#include <regex.h>                  /* CompileRegex,StringMatchFullWithPrecompiledRegex */
 #include <timeout.h>
 #include <constants.h>
 #include <time_classes.h>
@@ -55,57 +59,130 @@
 
 #define CF_DUNBAR_WORK 30
 
+/* Key in the time series DB marking that the old history DB was imported */
+#define TIME_SERIES_MIGRATED_KEY "MIGRATED_HISTORY"
+
+
+/* Regexes of a measurement promise, compiled once */
+typedef struct
+{
+    char *select_line_matching;
+    pcre *select_rx;
+    char *extraction_regex;
+    pcre *extraction_rx;
+} MeasurementPatterns;
 
 typedef struct
 {
     char *path;
     Item *output;
+    MeasurementPatterns patterns;
 } CustomMeasurement;
 
+/* Read position in a growing file, per measurement promise */
+typedef struct
+{
+    char *key;                                 /* handle and path */
+    StreamTail *tail;
+} MeasurementTail;
+
 static int MONITOR_RESTARTED = true;
 static CustomMeasurement ENTERPRISE_DATA[CF_DUNBAR_WORK];
+static Seq *MEASUREMENT_TAILS = NULL;          /* MeasurementTail */
 
-static void PutRecordForTime(CF_DB *db, time_t time, const Averages *values)
+/**
+ * Compile #regex into #rx unless it is already compiled from the same
+ * string (the policy may change).
+ */
+static void UpdatePattern(const char *regex, char **current, pcre **rx)
 {
-    char timekey[CF_MAXVARSIZE];
+    if (StringSafeEqual(regex, *current))
+    {
+        return;
+    }
 
-    MakeTimekey(time, timekey);
+    free(*current);
+    if (*rx != NULL)
+    {
+        pcre_free(*rx);
+    }
 
-    WriteDB(db, timekey, values, sizeof(Averages));
+    *current = SafeStringDuplicate(regex);
+    *rx = (regex != NULL) ? CompileRegex(regex) : NULL;
 }
 
-static void Nova_SaveFilePosition(const char *handle, const char *name, long fileptr)
+static const MeasurementPatterns *GetMeasurementPatterns(CustomMeasurement *m, const Attributes *a)
 {
-    CF_DB *dbp;
-    char *key = StringConcatenate(2, handle, name);
+    UpdatePattern(a->measure.select_line_matching,
+                  &(m->patterns.select_line_matching), &(m->patterns.select_rx));
+    UpdatePattern(a->measure.extraction_regex,
+                  &(m->patterns.extraction_regex), &(m->patterns.extraction_rx));
+    return &(m->patterns);
+}
 
-    if (!OpenDB(&dbp, dbid_static))
-    {
-        return;
-    }
+static bool PatternMatchesLine(const MeasurementPatterns *patterns, const char *line)
+{
+    return (patterns->select_rx != NULL &&
+            StringMatchFullWithPrecompiledRegex(patterns->select_rx, line));
+}
 
-    Log(LOG_LEVEL_VERBOSE, "Saving state for %s at %ld", key, fileptr);
-    WriteDB(dbp, key, &fileptr, sizeof(long));
-    CloseDB(dbp);
-    free(key);
+static void MeasurementTailDestroy(void *p)
+{
+    MeasurementTail *mt = p;
+    StreamTailCheckpoint(mt->tail, time(NULL), true);
+    StreamTailDestroy(mt->tail);
+    free(mt->key);
+    free(mt);
 }
 
-static long Nova_RestoreFilePosition(const char *handle, const char *name)
+/**
+ * Get the read position of the promise #handle in the growing file #path.
+ * Every promise has its own, even if they measure the same file.
+ */
+static StreamTail *GetMeasurementTail(const char *handle, const char *path)
 {
-    CF_DB *dbp;
-    long fileptr;
-    char *key = StringConcatenate(2, handle, name);
+    if (MEASUREMENT_TAILS == NULL)
+    {
+        MEASUREMENT_TAILS = SeqNew(CF_DUNBAR_WORK, MeasurementTailDestroy);
+    }
 
-    if (!OpenDB(&dbp, dbid_static))
+    char *key = StringConcatenate(2, handle, path);
+    const size_t length = SeqLength(MEASUREMENT_TAILS);
+    for (size_t i = 0; i < length; i++)
     {
-        return 0L;
+        MeasurementTail *mt = SeqAt(MEASUREMENT_TAILS, i);
+        if (StringEqual(mt->key, key))
+        {
+            free(key);
+            return mt->tail;
+        }
     }
 
-    ReadDB(dbp, key, &fileptr, sizeof(long));
-    Log(LOG_LEVEL_VERBOSE, "Resuming state for %s at %ld", key, fileptr);
-    CloseDB(dbp);
-    free(key);
-    return fileptr;
+    MeasurementTail *mt = xmalloc(sizeof(MeasurementTail));
+    mt->key = key;
+    mt->tail = StreamTailNew(path, key);
+    SeqAppend(MEASUREMENT_TAILS, mt);
+    return mt->tail;
+}
+
+/**
+ * Read only the lines appended to a growing file since the last sample of
+ * the promise #handle.
+ */
+static bool ReadGrowingFile(CustomMeasurement *m, const char *handle)
+{
+    StreamTail *tail = GetMeasurementTail(handle, m->path);
+    const bool ret = StreamTailRead(tail, &(m->output));
+    StreamTailCheckpoint(tail, time(NULL), false);
+    return ret;
+}
+
+void HistoryCloseStreams(void)
+{
+    /* Checkpoints the final positions, the lines read since the last
+     * checkpoint would be counted again after a restart otherwise */
+    SeqDestroy(MEASUREMENT_TAILS);
+    MEASUREMENT_TAILS = NULL;
 }
 
 static void Nova_DumpSlowlyVaryingObservations(void)
@@ -162,20 +239,153 @@ static void Nova_DumpSlowlyVaryingObservations(void)
     fclose(fout);
 }
 
+static bool IsSpareObservable(const char *name)
+{
+    return (name[0] == '\0' || StringStartsWith(name, "spare"));
+}
+
+static void PutRecordForTime(CF_DB *db, time_t time, const Averages *values)
+{
+    char timekey[CF_MAXVARSIZE];
+
+    MakeTimekey(time, timekey);
+
+    WriteDB(db, timekey, values, sizeof(Averages));
+}
+
 static void Nova_HistoryUpdate(time_t time, const Averages *newvals)
 {
     CF_DB *dbp;
 
-    if (!OpenDB(&dbp, dbid_history))
+    /* The old history DB is still read through GetRecordForTime(), keep it
+     * up to date next to the time series */
+    if (OpenDB(&dbp, dbid_history))
+    {
+        PutRecordForTime(dbp, time, newvals);
+        CloseDB(dbp);
+    }
+
+    if (!OpenDB(&dbp, dbid_timeseries))
     {
         return;
     }
 
-    PutRecordForTime(dbp, time, newvals);
+    TimeSeriesPrune(dbp, time);
 
     CloseDB(dbp);
 }
 
+void HistoryRecordObservations(const Averages *newvals)
+{
+    CF_DB *dbp;
+
+    if (!OpenDB(&dbp, dbid_timeseries))
+    {
+        return;
+    }
+
+    for (int i = 0; i < CF_OBSERVABLES; i++)
+    {
+        char name[CF_MAXVARSIZE] = "", desc[CF_MAXVARSIZE];
+        GetObservable(i, name, desc);
+
+        if (!IsSpareObservable(name))
+        {
+            TimeSeriesAppend(dbp, name, newvals->last_seen, newvals->Q[i].q);
+        }
+    }
+
+    CloseDB(dbp);
+}
+
+void HistoryRecordMeasurement(const char *handle, double value)
+{
+    CF_DB *dbp;
+
+    if (!OpenDB(&dbp, dbid_timeseries))
+    {
+        return;
+    }
+
+    TimeSeriesAppend(dbp, handle, time(NULL), value);
+
+    CloseDB(dbp);
+}
+
+void HistoryMigrate(void)
+{
+    CF_DB *series_db;
+
+    if (!OpenDB(&series_db, dbid_timeseries))
+    {
+        return;
+    }
+
+    if (HasKeyDB(series_db, TIME_SERIES_MIGRATED_KEY, sizeof(TIME_SERIES_MIGRATED_KEY)))
+    {
+        CloseDB(series_db);
+        return;
+    }
+
+    bool success = true;
+    CF_DB *history_db;
+    if (OpenDB(&history_db, dbid_history))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Importing the old monitoring history into the time series DB");
+
+        /* The old history has one record per shift (identified by the day,
+         * month, year modulo 3 and shift), so going through all the shifts
+         * of the last three years finds all of them, in chronological
+         * order. The shift three years back has the same key as the current
+         * one, so start right after it. Their values go to the hourly tier
+         * directly, the raw tier wouldn't keep them anyway. Stop at the last
+         * complete hour, the current one gets its average from the raw
+         * samples and an imported point would make the hourly tier reject
+         * it. */
+        const time_t now = time(NULL);
+        const time_t last = now - (now % SECONDS_PER_SHIFT);
+        const time_t end = now - (now % SECONDS_PER_HOUR);
+        size_t imported = 0;
+
+        for (time_t t = last - 3 * SECONDS_PER_YEAR + SECONDS_PER_SHIFT;
+             t < end; t += SECONDS_PER_SHIFT)
+        {
+            Averages av;
+            if (!GetRecordForTime(history_db, t, &av))
+            {
+                continue;
+            }
+
+            for (int i = 0; i < CF_OBSERVABLES; i++)
+            {
+                char name[CF_MAXVARSIZE] = "", desc[CF_MAXVARSIZE];
+                GetObservable(i, name, desc);
+
+                if (!IsSpareObservable(name) &&
+                    !TimeSeriesAppendToTier(series_db, name, TIME_SERIES_TIER_HOURLY, t, av.Q[i].q))
+                {
+                    success = false;
+                }
+            }
+            imported++;
+        }
+
+        CloseDB(history_db);
+        Log(LOG_LEVEL_VERBOSE, "Imported %zu records of the old monitoring history", imported);
+    }
+
+    if (!success)
+    {
+        /* Try again on the next start */
+        Log(LOG_LEVEL_ERR, "Failed to import the old monitoring history into the time series DB");
+    }
+    else if (!WriteDB(series_db, TIME_SERIES_MIGRATED_KEY, &CFSTARTTIME, sizeof(CFSTARTTIME)))
+    {
+        Log(LOG_LEVEL_ERR, "Failed to mark the old monitoring history as imported");
+    }
+    CloseDB(series_db);
+}
+
 static Item *NovaReSample(EvalContext *ctx, int slot, const Attributes *attr, const Promise *pp, PromiseResult *result)
 {
     assert(attr != NULL);
@@ -242,9 +452,10 @@ static Item *NovaReSample(EvalContext *ctx, int slot, const Attributes *attr, co
 
         /* Stream types */
 
-        if (a.measure.stream_type && strcmp(a.measure.stream_type, "file") == 0)
+        const bool is_file = (a.measure.stream_type && strcmp(a.measure.stream_type, "file") == 0);
+
+        if (is_file)
         {
-            long filepos = 0;
             struct stat sb;
 
             Log(LOG_LEVEL_VERBOSE, "Stream \"%s\" is a plain file", pp->promiser);
@@ -259,16 +470,9 @@ static Item *NovaReSample(EvalContext *ctx, int slot, const Attributes *attr, co
                 return NULL;
             }
 
-            fin = safe_fopen(pp->promiser, "r");
-
-            if (a.measure.growing)
+            if (!a.measure.growing)
             {
-                filepos = Nova_RestoreFilePosition(handle, pp->promiser);
-
-                if (sb.st_size >= filepos)
-                {
-                    fseek(fin, filepos, SEEK_SET);
-                }
+                fin = safe_fopen(pp->promiser, "r");
             }
         }
         else if (a.measure.stream_type && strcmp(a.measure.stream_type, "pipe") == 0)
@@ -316,57 +520,69 @@ static Item *NovaReSample(EvalContext *ctx, int slot, const Attributes *attr, co
             }
         }
 
-        /* generic file stream */
-
-        if (fin == NULL)
+        if (is_file && a.measure.growing)
         {
-            cfPS(ctx, LOG_LEVEL_ERR, PROMISE_RESULT_FAIL, pp, &a,
-                 "Couldn't open pipe to command '%s'. (cf_popen: %s)", pp->promiser, GetErrorStr());
-            *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
-            YieldCurrentLock(thislock);
-            MONITOR_RESTARTED = false;
-            return ENTERPRISE_DATA[slot].output;
+            /* Only the lines added since the last sample */
+            if (!ReadGrowingFile(&(ENTERPRISE_DATA[slot]), handle))
+            {
+                cfPS(ctx, LOG_LEVEL_ERR, PROMISE_RESULT_FAIL, pp, &a,
+                     "Couldn't read stream '%s'", pp->promiser);
+                *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
+            }
+            Log(LOG_LEVEL_VERBOSE, "Sampled %zu new lines of '%s'",
+                ListLen(ENTERPRISE_DATA[slot].output), pp->promiser);
         }
+        else
+        {
+            /* generic file stream */
 
-        size_t line_size = CF_BUFSIZE;
-        char *line = xmalloc(line_size);
+            if (fin == NULL)
+            {
+                cfPS(ctx, LOG_LEVEL_ERR, PROMISE_RESULT_FAIL, pp, &a,
+                     "Couldn't open pipe to command '%s'. (cf_popen: %s)", pp->promiser, GetErrorStr());
+                *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
+                YieldCurrentLock(thislock);
+                MONITOR_RESTARTED = false;
+                return ENTERPRISE_DATA[slot].output;
+            }
 
-        for (;;)
-        {
-            ssize_t res = CfReadLine(&line, &line_size, fin);
-            if (res == -1)
+            size_t line_size = CF_BUFSIZE;
+            char *line = xmalloc(line_size);
+
+            for (;;)
             {
-                if (!feof(fin))
-                {
-                    cfPS(ctx, LOG_LEVEL_ERR, PROMISE_RESULT_TIMEOUT, pp, &a, "Sample stream '%s'. (fread: %s)",
-                         pp->promiser, GetErrorStr());
-                    *result = PromiseResultUpdate(*result, PROMISE_RESULT_TIMEOUT);
-                    YieldCurrentLock(thislock);
-                    free(line);
-                    return ENTERPRISE_DATA[slot].output;
-                }
-                else
+                ssize_t res = CfReadLine(&line, &line_size, fin);
+                if (res == -1)
                 {
-                    break;
+                    if (!feof(fin))
+                    {
+                        cfPS(ctx, LOG_LEVEL_ERR, PROMISE_RESULT_TIMEOUT, pp, &a, "Sample stream '%s'. (fread: %s)",
+                             pp->promiser, GetErrorStr());
+                        *result = PromiseResultUpdate(*result, PROMISE_RESULT_TIMEOUT);
+                        YieldCurrentLock(thislock);
+                        free(line);
+                        return ENTERPRISE_DATA[slot].output;
+                    }
+                    else
+                    {
+                        break;
+                    }
                 }
-            }
-
-            AppendItem(&(ENTERPRISE_DATA[slot].output), line, NULL);
-            Log(LOG_LEVEL_INFO, "Sampling => %s", line);
-        }
 
-        free(line);
+                AppendItem(&(ENTERPRISE_DATA[slot].output), line, NULL);
+                Log(LOG_LEVEL_INFO, "Sampling => %s", line);
+            }
 
-        if (a.measure.stream_type && strcmp(a.measure.stream_type, "file") == 0)
-        {
-            long fileptr = ftell(fin);
+            free(line);
 
-            fclose(fin);
-            Nova_SaveFilePosition(handle, pp->promiser, fileptr);
-        }
-        else if (a.measure.stream_type && strcmp(a.measure.stream_type, "pipe") == 0)
-        {
-            cf_pclose(fin);
+            if (is_file)
+            {
+                fclose(fin);
+            }
+            else if (a.measure.stream_type && strcmp(a.measure.stream_type, "pipe") == 0)
+            {
+                cf_pclose(fin);
+            }
         }
     }
 
@@ -432,7 +648,13 @@ void HistoryUpdate(EvalContext *ctx, const Averages *const newvals)
     Nova_DumpSlowlyVaryingObservations();
 }
 
-static Item *NovaGetMeasurementStream(EvalContext *ctx, const Attributes *a, const Promise *pp, PromiseResult *result)
+/**
+ * Sample the stream of a measurement promise.
+ *
+ * @return the measurement with the sampled lines in ->output or %NULL if
+ *         there are too many measurements
+ */
+static CustomMeasurement *NovaGetMeasurementStream(EvalContext *ctx, const Attributes *a, const Promise *pp, PromiseResult *result)
 {
     int i;
 
@@ -441,7 +663,7 @@ static Item *NovaGetMeasurementStream(EvalContext *ctx, const Attributes *a, con
         if (StringEqual(ENTERPRISE_DATA[i].path, pp->promiser))
         {
             ENTERPRISE_DATA[i].output = NovaReSample(ctx, i, a, pp, result);
-            return ENTERPRISE_DATA[i].output;
+            return &(ENTERPRISE_DATA[i]);
         }
     }
 
@@ -452,7 +674,7 @@ static Item *NovaGetMeasurementStream(EvalContext *ctx, const Attributes *a, con
 
         ENTERPRISE_DATA[i].path = xstrdup(pp->promiser);
         ENTERPRISE_DATA[i].output = NovaReSample(ctx, i, a, pp, result);
-        return ENTERPRISE_DATA[i].output;
+        return &(ENTERPRISE_DATA[i]);
     }
     else
     {
@@ -461,9 +683,11 @@ static Item *NovaGetMeasurementStream(EvalContext *ctx, const Attributes *a, con
 }
 
 static PromiseResult NovaExtractValueFromStream(EvalContext *ctx, const char *handle,
-                                                Item *stream, const Attributes *a,
+                                                CustomMeasurement *m, const Attributes *a,
                                                 const Promise *pp, double *value_out)
 {
+    Item *stream = (m != NULL) ? m->output : NULL;
+    const MeasurementPatterns *patterns = (m != NULL) ? GetMeasurementPatterns(m, a) : NULL;
     char value[CF_MAXVARSIZE];
     int count = 1, found = false, match_count = 0, done = false;
     double real_val = 0;
@@ -479,7 +703,7 @@ static PromiseResult NovaExtractValueFromStream(EvalContext *ctx, const char *ha
             match_count++;
         }
 
-        if (a->measure.select_line_matching && StringMatchFull(a->measure.select_line_matching, ip->name))
+        if (PatternMatchesLine(patterns, ip->name))
         {
             Log(LOG_LEVEL_VERBOSE, "  Found regex '%s' matches line '%s'", a->measure.select_line_matching, ip->name);
             found = true;
@@ -493,7 +717,7 @@ static PromiseResult NovaExtractValueFromStream(EvalContext *ctx, const char *ha
                 case CF_DATA_TYPE_REAL:
                 case CF_DATA_TYPE_COUNTER:
 
-                    strncpy(value, ExtractFirstReference(a->measure.extraction_regex, match->name), CF_MAXVARSIZE - 1);
+                    strncpy(value, ExtractFirstReferenceWithPrecompiledRegex(patterns->extraction_rx, match->name), CF_MAXVARSIZE - 1);
 
                     if (strcmp(value, "CF_NOMATCH") == 0)
                     {
@@ -614,9 +838,11 @@ static PromiseResult NovaExtractValueFromStream(EvalContext *ctx, const char *ha
     return PROMISE_RESULT_NOOP;
 }
 
-static void NovaLogSymbolicValue(EvalContext *ctx, const char *handle, Item *stream,
+static void NovaLogSymbolicValue(EvalContext *ctx, const char *handle, CustomMeasurement *m,
                                  const Attributes *a, const Promise *pp, PromiseResult *result)
 {
+    Item *stream = (m != NULL) ? m->output : NULL;
+    const MeasurementPatterns *patterns = (m != NULL) ? GetMeasurementPatterns(m, a) : NULL;
     char value[CF_BUFSIZE], sdate[CF_MAXVARSIZE], filename[CF_BUFSIZE];
     int count = 1, found = false, match_count = 0;
     Item *ip, *match = NULL, *matches = NULL;
@@ -647,7 +873,7 @@ static void NovaLogSymbolicValue(EvalContext *ctx, const char *handle, Item *str
             if (a->measure.extraction_regex)
             {
                 Log(LOG_LEVEL_VERBOSE, "Now looking for a matching extractor \"%s\"", a->measure.extraction_regex);
-                strncpy(value, ExtractFirstReference(a->measure.extraction_regex, match->name), CF_MAXVARSIZE - 1);
+                strncpy(value, ExtractFirstReferenceWithPrecompiledRegex(patterns->extraction_rx, match->name), CF_MAXVARSIZE - 1);
                 Log(LOG_LEVEL_INFO, "Extracted value \"%s\" for promise \"%s\"", value, handle);
                 AppendItem(&matches, value, NULL);
             }
@@ -659,7 +885,7 @@ static void NovaLogSymbolicValue(EvalContext *ctx, const char *handle, Item *str
             break;
         }
 
-        if (a->measure.select_line_matching && StringMatchFull(a->measure.select_line_matching, ip->name))
+        if (PatternMatchesLine(patterns, ip->name))
         {
             Log(LOG_LEVEL_VERBOSE, "Found line %d by pattern...", count);
             found = true;
@@ -669,7 +895,7 @@ static void NovaLogSymbolicValue(EvalContext *ctx, const char *handle, Item *str
             if (a->measure.extraction_regex)
             {
                 Log(LOG_LEVEL_VERBOSE, "Now looking for a matching extractor \"%s\"", a->measure.extraction_regex);
-                strncpy(value, ExtractFirstReference(a->measure.extraction_regex, match->name), CF_MAXVARSIZE - 1);
+                strncpy(value, ExtractFirstReferenceWithPrecompiledRegex(patterns->extraction_rx, match->name), CF_MAXVARSIZE - 1);
                 Log(LOG_LEVEL_INFO, "Extracted value \"%s\" for promise \"%s\"", value, handle);
                 AppendItem(&matches, value, NULL);
             }
@@ -757,7 +983,7 @@ PromiseResult VerifyMeasurement(EvalContext *ctx, double *this,
                                 const Attributes *a, const Promise *pp)
 {
     const char *handle = PromiseGetHandle(pp);
-    Item *stream = NULL;
+    CustomMeasurement *measurement = NULL;
     int slot = 0;
     double new_value;
 
@@ -781,28 +1007,32 @@ PromiseResult VerifyMeasurement(EvalContext *ctx, double *this,
         /* First see if we can accommodate this measurement */
         Log(LOG_LEVEL_VERBOSE, "Promise '%s' is numerical in nature", handle);
 
-        stream = NovaGetMeasurementStream(ctx, a, pp, &result);
+        measurement = NovaGetMeasurementStream(ctx, a, pp, &result);
 
         if (strcmp(a->measure.history_type, "weekly") == 0)
         {
             if ((slot = NovaRegisterSlot(handle, pp->comment ? pp->comment : "User defined measure",
                                          a->measure.units ? a->measure.units : "unknown", 0.0f, 100.0f, true)) < 0)
             {
+                /* No slot left for the weekly averages, still keep the
+                 * history of the measurement */
+                result = PromiseResultUpdate(result, NovaExtractValueFromStream(ctx, handle, measurement, a, pp, &new_value));
+                HistoryRecordMeasurement(handle, new_value);
                 return result;
             }
 
-            result = PromiseResultUpdate(result, NovaExtractValueFromStream(ctx, handle, stream, a, pp, &this[slot]));
+            result = PromiseResultUpdate(result, NovaExtractValueFromStream(ctx, handle, measurement, a, pp, &this[slot]));
             Log(LOG_LEVEL_VERBOSE, "Setting Nova slot %d=%s to %lf", slot, handle, this[slot]);
         }
         else if (strcmp(a->measure.history_type, "log") == 0)
         {
             Log(LOG_LEVEL_VERBOSE, "Promise to log a numerical value");
-            NovaLogSymbolicValue(ctx, handle, stream, a, pp, &result);
+            NovaLogSymbolicValue(ctx, handle, measurement, a, pp, &result);
         }
         else                    /* static */
         {
             Log(LOG_LEVEL_VERBOSE, "Promise to store a static numerical value");
-            result = PromiseResultUpdate(result, NovaExtractValueFromStream(ctx, handle, stream, a, pp, &new_value));
+            result = PromiseResultUpdate(result, NovaExtractValueFromStream(ctx, handle, measurement, a, pp, &new_value));
             NovaNamedEvent(handle, new_value);
         }
         break;
@@ -810,8 +1040,8 @@ PromiseResult VerifyMeasurement(EvalContext *ctx, double *this,
     default:
 
         Log(LOG_LEVEL_VERBOSE, "Promise '%s' is symbolic in nature", handle);
-        stream = NovaGetMeasurementStream(ctx, a, pp, &result);
-        NovaLogSymbolicValue(ctx, handle, stream, a, pp, &result);
+        measurement = NovaGetMeasurementStream(ctx, a, pp, &result);
+        NovaLogSymbolicValue(ctx, handle, measurement, a, pp, &result);
         break;
     }
 
@@ -33,5 +33,13 @@ PromiseResult VerifyMeasurement(EvalContext *ctx, double *this,
                                 const Attributes *a, const Promise *pp);
 void HistoryUpdate(EvalContext *ctx, const Averages *newvals);
 
+/* Time series history, see time_series.h */
+void HistoryRecordObservations(const Averages *newvals);
+void HistoryRecordMeasurement(const char *handle, double value);
+void HistoryMigrate(void);
+
+/* Save the read positions of growing files and close them, at shutdown */
+void HistoryCloseStreams(void);
+
 
 #endif
@@ -23,111 +23,143 @@
 */
 
 #include <cf3.defs.h>
+#include <mon_cumulative.h>
+
+#include <map.h>
+#include <string_lib.h>                    /* StringHash, StringEqual */
 
 
 /*
  * Cumulative statistics support and conversion to instant values
+ *
+ * The previous value of every counter is kept in a hash map keyed by the
+ * (name, subname) pair, so that the lookup doesn't depend on the number of
+ * counters (disks, interfaces,...) being tracked.
  */
 
-typedef struct PrevValue_ PrevValue;
-
-struct PrevValue_
+typedef struct
 {
     char *name;
     char *subname;
     union
     {
-        unsigned u32;
-        unsigned long long u64;
+        uint32_t u32;
+        uint64_t u64;
     } value;
     time_t timestamp;
-    PrevValue *next;
-};
+} PrevValue;
 
 /* Globals */
 
-static PrevValue *values;
+static Map *values = NULL;
 
 /* Implementation */
 
-static PrevValue *AppendNewValue(const char *name, const char *subname, time_t timestamp)
+static unsigned PrevValueHash(const void *p, unsigned seed)
+{
+    const PrevValue *v = p;
+    return StringHash(v->subname, StringHash(v->name, seed));
+}
+
+static bool PrevValueEqual(const void *a, const void *b)
 {
-    PrevValue *v = xmalloc(sizeof(PrevValue));
+    const PrevValue *va = a;
+    const PrevValue *vb = b;
+    return StringEqual(va->name, vb->name) && StringEqual(va->subname, vb->subname);
+}
+
+static void PrevValueDestroy(void *p)
+{
+    PrevValue *v = p;
+    free(v->name);
+    free(v->subname);
+    free(v);
+}
+
+/**
+ * @return the entry with the previous value of the counter, #found is set to
+ *         false if the counter wasn't seen before and a new entry was added
+ */
+static PrevValue *GetPrevValue(const char *name, const char *subname, time_t timestamp, bool *found)
+{
+    if (values == NULL)
+    {
+        /* The entry is both the key and the value, so it is only destroyed
+         * as the key. */
+        values = MapNew(PrevValueHash, PrevValueEqual, PrevValueDestroy, NULL);
+    }
+
+    /* Only used for the lookup, the strings are not modified */
+    const PrevValue key = { .name = (char *) name, .subname = (char *) subname };
+    PrevValue *v = MapGet(values, &key);
+    if (v != NULL)
+    {
+        *found = true;
+        return v;
+    }
 
+    v = xcalloc(1, sizeof(PrevValue));
     v->name = xstrdup(name);
     v->subname = xstrdup(subname);
     v->timestamp = timestamp;
-    v->next = values;
-    values = v;
+    MapInsert(values, v, v);
+
+    *found = false;
     return v;
 }
 
 unsigned GetInstantUint32Value(const char *name, const char *subname, unsigned value, time_t timestamp)
 {
-    PrevValue *v;
-
-    for (v = values; v; v = v->next)
+    bool found;
+    PrevValue *v = GetPrevValue(name, subname, timestamp, &found);
+    if (!found)
     {
-        if (!strcmp(v->name, name) && !strcmp(v->subname, subname))
-        {
-            unsigned diff;
-            unsigned difft;
-
-            /* Check for wraparound */
-            if (value < v->value.u32)
-            {
-                diff = INT_MAX - v->value.u32 + value;
-            }
-            else
-            {
-                diff = value - v->value.u32;
-            }
-            difft = timestamp - v->timestamp;
-
-            v->value.u32 = value;
-            v->timestamp = timestamp;
-
-            if (difft != 0)
-            {
-                return diff / difft;
-            }
-            else
-            {
-                return (unsigned) -1;
-            }
-        }
+        v->value.u32 = value;
+        return (unsigned) -1;
     }
 
-    AppendNewValue(name, subname, timestamp)->value.u32 = value;
-    return (unsigned) -1;
+    /* Unsigned arithmetic is modulo 2^32, so this also handles the counter
+     * wrapping around (once) since the last sample. */
+    const uint32_t diff = (uint32_t) value - v->value.u32;
+    const time_t difft = timestamp - v->timestamp;
+
+    v->value.u32 = value;
+    v->timestamp = timestamp;
+
+    if (difft > 0)
+    {
+        return diff / difft;
+    }
+    else
+    {
+        return (unsigned) -1;
+    }
 }
 
 unsigned long long GetInstantUint64Value(const char *name, const char *subname, unsigned long long value,
                                          time_t timestamp)
 {
-    PrevValue *v;
-
-    for (v = values; v; v = v->next)
+    bool found;
+    PrevValue *v = GetPrevValue(name, subname, timestamp, &found);
+    if (!found)
     {
-        if (!strcmp(v->name, name) && !strcmp(v->subname, subname))
-        {
-            unsigned long long diff = value - v->value.u64;
-            unsigned difft = timestamp - v->timestamp;
-
-            v->value.u64 = value;
-            v->timestamp = timestamp;
-
-            if (difft != 0)
-            {
-                return diff / difft;
-            }
-            else
-            {
-                return (unsigned long long) -1;
-            }
-        }
+        v->value.u64 = value;
+        return (unsigned long long) -1;
     }
 
-    AppendNewValue(name, subname, timestamp)->value.u64 = value;
-    return (unsigned long long) -1;
+    /* See GetInstantUint32Value() */
+    const uint64_t diff = (uint64_t) value - v->value.u64;
+    const time_t difft = timestamp - v->timestamp;
+
+    v->value.u64 = value;
+    v->timestamp = timestamp;
+
+    if (difft > 0)
+    {
+        return diff / difft;
+    }
+    else
+    {
+        return (unsigned long long) -1;
+    }
 }
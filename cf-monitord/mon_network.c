@@ -33,10 +33,9 @@
 #include <file_lib.h> // SetUmask()
 #include <pipes.h>
 #include <known_dirs.h>
-
-#ifdef __linux__
-#include <proc_net_parsing.h>
-#endif
+#include <map.h>
+#include <string_lib.h>                  /* StringHash_untyped, StringEqual_untyped */
+#include <net_sockets.h>
 
 /* Globals */
 
@@ -77,7 +76,7 @@ static const Sock ECGSOCKS[] =     /* extended to map old to new using enum */
     {8080, "8080", "www-alt", ob_www_alt_in, ob_www_alt_out},
     {21, "21", "ftp", ob_ftp_in, ob_ftp_out},
     {22, "22", "ssh", ob_ssh_in, ob_ssh_out},
-    {433, "443", "wwws", ob_wwws_in, ob_wwws_out},
+    {443, "443", "wwws", ob_wwws_in, ob_wwws_out},
     {143, "143", "imap", ob_imap_in, ob_imap_out},
     {993, "993", "imaps", ob_imaps_in, ob_imaps_out},
     {389, "389", "ldap", ob_ldap_in, ob_ldap_out},
@@ -146,61 +145,182 @@ void MonNetworkInit(void)
 }
 
 /******************************************************************************/
+/* Aggregation of the sockets of one sample                                   */
+/******************************************************************************/
+
+/*
+ * Connections are only counted per port and per remote address as they are
+ * seen, so a host with a huge number of sockets doesn't need a list entry
+ * (and list walk) for each one of them.
+ */
 
-static void SetNetworkEntropyClasses(const char *service, const char *direction, const Item *list)
+typedef struct
 {
-    const Item *ip;
-    Item *addresses = NULL;
-    double entropy;
+    Map *addresses;                  /* remote address -> (size_t *) count */
+    Buffer *connections;             /* contents of the state file */
+} ServiceConnections;
 
-    for (ip = list; ip != NULL; ip = ip->next)
+typedef struct
+{
+    double *cf_this;
+    Map *incoming;                   /* listening ports (port -> NULL) */
+    Map *listening[cfn_unknown];     /* listening ports per socket type */
+    ServiceConnections in[ATTR];
+    ServiceConnections out[ATTR];
+} NetworkSample;
+
+static void NetworkSampleInit(NetworkSample *sample, double *cf_this)
+{
+    memset(sample, 0, sizeof(*sample));
+    sample->cf_this = cf_this;
+    sample->incoming = MapNew(StringHash_untyped, StringEqual_untyped, free, NULL);
+    for (size_t i = 0; i < cfn_unknown; i++)
     {
-        if (strlen(ip->name) > 0)
-        {
-            char local[CF_BUFSIZE];
-            char remote[CF_BUFSIZE];
-            char vbuff[CF_BUFSIZE];
-            char *sp;
+        sample->listening[i] = MapNew(StringHash_untyped, StringEqual_untyped, free, NULL);
+    }
+}
 
-            if (strncmp(ip->name, "tcp", 3) == 0)
-            {
-                sscanf(ip->name, "%*s %*s %*s %s %s", local, remote);   /* linux-like */
-            }
-            else
-            {
-                sscanf(ip->name, "%s %s", local, remote);       /* solaris-like */
-            }
+static void ServiceConnectionsDestroy(ServiceConnections *conns)
+{
+    if (conns->addresses != NULL)
+    {
+        MapDestroy(conns->addresses);
+    }
+    BufferDestroy(conns->connections);
+}
 
-            strncpy(vbuff, remote, CF_BUFSIZE - 1);
-            vbuff[CF_BUFSIZE-1] = '\0';
+static void NetworkSampleDestroy(NetworkSample *sample)
+{
+    MapDestroy(sample->incoming);
+    for (size_t i = 0; i < cfn_unknown; i++)
+    {
+        MapDestroy(sample->listening[i]);
+    }
+    for (size_t i = 0; i < ATTR; i++)
+    {
+        ServiceConnectionsDestroy(&sample->in[i]);
+        ServiceConnectionsDestroy(&sample->out[i]);
+    }
+}
 
-            for (sp = vbuff + strlen(vbuff) - 1; isdigit((int) *sp) && (sp > vbuff); sp--)
-            {
-            }
+/**
+ * Add #port to #list unless it's already in #seen, O(1) replacement of
+ * IdempPrependItem() keeping the same order of the list.
+ */
+static void PrependListeningPort(Item **list, Map *seen, const char *port, const char *addr)
+{
+    if (!MapHasKey(seen, port))
+    {
+        MapInsert(seen, xstrdup(port), NULL);
+        PrependItem(list, port, addr);
+    }
+}
 
-            *sp = '\0';
+static void ServiceConnectionsAdd(ServiceConnections *conns,
+                                  const char *remote_addr, const char *line)
+{
+    if (conns->addresses == NULL)
+    {
+        conns->addresses = MapNew(StringHash_untyped, StringEqual_untyped, free, free);
+        conns->connections = BufferNew();
+    }
 
-            if (!IsItemIn(addresses, vbuff))
-            {
-                AppendItem(&addresses, vbuff, "");
-            }
+    size_t *count = MapGet(conns->addresses, remote_addr);
+    if (count == NULL)
+    {
+        count = xcalloc(1, sizeof(size_t));
+        MapInsert(conns->addresses, xstrdup(remote_addr), count);
+    }
+    (*count)++;
+
+    BufferAppendString(conns->connections, line);
+    BufferAppendChar(conns->connections, '\n');
+}
 
-            IncrementItemListCounter(addresses, vbuff);
+/**
+ * @param local_port   port number or -1 if not known
+ * @param remote_port  port number or -1 if not known
+ * @param line         description of the socket for the state files
+ */
+static void NetworkSampleAdd(NetworkSample *sample, SocketType type, bool listening,
+                             const char *local_addr, long local_port,
+                             const char *remote_addr, long remote_port,
+                             const char *line)
+{
+    Log(LOG_LEVEL_DEBUG, "Saving socket info '%s:%ld:%ld [%d, %d]",
+        local_addr, local_port, remote_port, listening, type);
+
+    if (listening && local_port >= 0 && type != cfn_unknown)
+    {
+        char port_str[CF_MAX_PORT_LEN];
+        snprintf(port_str, sizeof(port_str), "%ld", local_port);
+
+        PrependListeningPort(&ALL_INCOMING, sample->incoming, port_str, NULL);
+
+        switch (type)
+        {
+        case cfn_tcp4:
+            PrependListeningPort(&MON_TCP4, sample->listening[type], port_str, local_addr);
+            break;
+        case cfn_tcp6:
+            PrependListeningPort(&MON_TCP6, sample->listening[type], port_str, local_addr);
+            break;
+        case cfn_udp4:
+            PrependListeningPort(&MON_UDP4, sample->listening[type], port_str, local_addr);
+            break;
+        case cfn_udp6:
+            PrependListeningPort(&MON_UDP6, sample->listening[type], port_str, local_addr);
+            break;
+        default:
+            debug_abort_if_reached();
+            break;
         }
     }
 
-    entropy = MonEntropyCalculate(addresses);
+    for (size_t i = 0; i < ATTR; i++)
+    {
+        if (local_port == ECGSOCKS[i].port)
+        {
+            sample->cf_this[ECGSOCKS[i].in]++;
+            ServiceConnectionsAdd(&sample->in[i], remote_addr, line);
+        }
+
+        if (remote_port == ECGSOCKS[i].port)
+        {
+            sample->cf_this[ECGSOCKS[i].out]++;
+            ServiceConnectionsAdd(&sample->out[i], remote_addr, line);
+        }
+    }
+}
+
+/******************************************************************************/
+
+static void SetNetworkEntropyClasses(const char *service, const char *direction,
+                                     const ServiceConnections *conns)
+{
+    Item *addresses = NULL;
+
+    if (conns->addresses != NULL)
+    {
+        MapIterator it = MapIteratorInit(conns->addresses);
+        MapKeyValue *item;
+        while ((item = MapIteratorNext(&it)) != NULL)
+        {
+            Item *ip = PrependItem(&addresses, item->key, "");
+            ip->counter = *((size_t *) item->value);
+        }
+    }
+
+    double entropy = MonEntropyCalculate(addresses);
     MonEntropyClassesSet(service, direction, entropy);
     DeleteItemList(addresses);
 }
 
 /******************************************************************************/
 
-static void SaveNetworkData(Item * const *in, Item * const *out);
-static void GetNetworkDataFromNetstat(FILE *fp, double *cf_this, Item **in, Item **out);
-#ifdef __linux__
-static bool GetNetworkDataFromProcNet(double *cf_this, Item **in, Item **out);
-#endif
+static void SaveNetworkData(const NetworkSample *sample);
+static void GetNetworkDataFromNetstat(FILE *fp, NetworkSample *sample);
+static bool GetNetworkDataFromSockets(NetworkSample *sample);
 
 static inline void ResetNetworkData()
 {
@@ -218,14 +338,12 @@ void MonNetworkGatherData(double *cf_this)
 {
     ResetNetworkData();
 
-    Item *in[ATTR] = {0};
-    Item *out[ATTR] = {0};
+    NetworkSample sample;
+    NetworkSampleInit(&sample, cf_this);
 
-#ifdef __linux__
-    /* On Linux, prefer parsing data from /proc/net with our custom code (more
-     * efficient), but fall back to netstat if proc parsing fails. */
-    if ((access("/proc/net/tcp", R_OK) != 0) || !GetNetworkDataFromProcNet(cf_this, in, out))
-#endif
+    /* Prefer getting the sockets from the kernel directly (sock_diag netlink
+     * or /proc/net on Linux), but fall back to netstat if that fails. */
+    if (!GetNetworkDataFromSockets(&sample))
     {
         char comm[PATH_MAX + 4] = {0}; /* path to the binary + " -an" */
         strncpy(comm, VNETSTAT[VSYSTEMHARDCLASS], (sizeof(comm) - 1));
@@ -235,6 +353,7 @@ void MonNetworkGatherData(double *cf_this)
             Log(LOG_LEVEL_VERBOSE,
                 "Cannot open '%s', aborting gathering of network data (monitoring)",
                 comm);
+            NetworkSampleDestroy(&sample);
             return;
         }
 
@@ -246,320 +365,106 @@ void MonNetworkGatherData(double *cf_this)
             Log(LOG_LEVEL_VERBOSE,
                 "Opening '%s' failed, aborting gathering of network data (monitoring)",
                 comm);
+            NetworkSampleDestroy(&sample);
             return;
         }
 
-        GetNetworkDataFromNetstat(pp, cf_this, in, out);
+        GetNetworkDataFromNetstat(pp, &sample);
         cf_pclose(pp);
     }
 
     /* Now save the state for ShowState()
        the state is not smaller than the last or at least 40 minutes
        older. This mirrors the persistence of the maxima classes */
-    SaveNetworkData(in, out);
+    SaveNetworkData(&sample);
+    NetworkSampleDestroy(&sample);
 }
 
 #ifdef __linux__
-static inline void SaveSocketInfo(const char *local_addr,
-                                  uint32_t local_port,
-                                  uint32_t remote_port,
-                                  SocketState state,
-                                  SocketType type,
-                                  const char *socket_info,
-                                  double *cf_this,
-                                  Item **in, Item **out)
+static const SocketType NET_SOCKET_TYPES[NET_SOCKET_TYPE_MAX] =
 {
-    Log(LOG_LEVEL_DEBUG, "Saving socket info '%s:%d:%d [%d, %d]",
-        local_addr, local_port, remote_port, state, type);
+    [NET_SOCKET_TCP4] = cfn_tcp4,
+    [NET_SOCKET_TCP6] = cfn_tcp6,
+    [NET_SOCKET_UDP4] = cfn_udp4,
+    [NET_SOCKET_UDP6] = cfn_udp6,
+};
 
-    if (state == SOCK_STATE_LISTEN)
-    {
-        char port_str[CF_MAX_PORT_LEN];
-        snprintf(port_str, sizeof(port_str), "%d", local_port);
+static void SampleSocket(const NetSocket *sock, void *data)
+{
+    NetworkSample *sample = data;
 
-        IdempPrependItem(&ALL_INCOMING, port_str, NULL);
+    char local_addr[INET6_ADDRSTRLEN];
+    char remote_addr[INET6_ADDRSTRLEN];
+    NetSocketAddressToString(sock, true, local_addr, sizeof(local_addr));
+    NetSocketAddressToString(sock, false, remote_addr, sizeof(remote_addr));
 
-        switch (type)
-        {
-        case cfn_tcp4:
-            IdempPrependItem(&MON_TCP4, port_str, local_addr);
-            break;
-        case cfn_tcp6:
-            IdempPrependItem(&MON_TCP6, port_str, local_addr);
-            break;
-        case cfn_udp4:
-            IdempPrependItem(&MON_UDP4, port_str, local_addr);
-            break;
-        case cfn_udp6:
-            IdempPrependItem(&MON_UDP6, port_str, local_addr);
-            break;
-        default:
-            debug_abort_if_reached();
-            break;
-        }
-    }
+    /* Only build the description if the socket belongs to a watched service */
+    char line[2 * INET6_ADDRSTRLEN + 64] = "";
     for (size_t i = 0; i < ATTR; i++)
     {
-        if (local_port == ECGSOCKS[i].port)
+        if (sock->local_port == ECGSOCKS[i].port || sock->remote_port == ECGSOCKS[i].port)
         {
-            cf_this[ECGSOCKS[i].in]++;
-            AppendItem(&in[i], socket_info, "");
-
-        }
-
-        if (remote_port == ECGSOCKS[i].port)
-        {
-            cf_this[ECGSOCKS[i].out]++;
-            AppendItem(&out[i], socket_info, "");
-
+            snprintf(line, sizeof(line), "%s %s:%u %s:%u %s",
+                     NetSocketTypeToString(sock->type),
+                     local_addr, sock->local_port, remote_addr, sock->remote_port,
+                     NetSocketStateToString(sock->state));
+            break;
         }
     }
-}
 
-static inline bool GetNetworkDataFromProcNetTCP(char local_addr[INET_ADDRSTRLEN],
-                                                char remote_addr[INET_ADDRSTRLEN],
-                                                char **buff, size_t *buff_size, Seq *lines,
-                                                double *cf_this, Item **in, Item **out)
-{
-    FILE *fp = fopen("/proc/net/tcp", "r");
-    if (fp == NULL)
-    {
-        Log(LOG_LEVEL_ERR, "Failed to open /proc/net/tcp for reading");
-        return false;
-    }
-    /* Read the header */
-    ssize_t ret = CfReadLine(buff, buff_size, fp);
-    if (ret == -1)
-    {
-        Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/tcp");
-        fclose(fp);
-        return false;
-    }
-
-    /* Read real data */
-    ret = CfReadLines(buff, buff_size, fp, lines);
-    if (ret < 0)
-    {
-        Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/tcp");
-        fclose(fp);
-        return false;
-    }
-    Log(LOG_LEVEL_VERBOSE, "Read %zu lines from /proc/net/tcp", ret);
-
-    uint32_t l_port, r_port;
-    SocketState state;
-    for (size_t i = 0; i < (size_t) ret; i++)
-    {
-        char *line = SeqAt(lines,i);
-        if (ParseIPv4SocketInfo(line, local_addr, &l_port, remote_addr, &r_port, &state))
-        {
-            SaveSocketInfo(local_addr, l_port, r_port,
-                           state, cfn_tcp4,
-                           line, cf_this, in, out);
-        }
-    }
-    fclose(fp);
-    SeqClear(lines);
-    return true;
+    NetworkSampleAdd(sample, NET_SOCKET_TYPES[sock->type],
+                     sock->state == NET_SOCKET_STATE_LISTEN,
+                     local_addr, sock->local_port,
+                     remote_addr, sock->remote_port,
+                     line);
 }
 
-static inline bool GetNetworkDataFromProcNetTCP6(char local_addr6[INET6_ADDRSTRLEN],
-                                                 char remote_addr6[INET6_ADDRSTRLEN],
-                                                 char **buff, size_t *buff_size, Seq *lines,
-                                                 double *cf_this, Item **in, Item **out)
+static bool GetNetworkDataFromSockets(NetworkSample *sample)
 {
-    FILE *fp = fopen("/proc/net/tcp6", "r");
-    if (fp == NULL)
-    {
-        /* IPv6 may be completely disabled in kernel so this should be handled gracefully. */
-        Log(LOG_LEVEL_VERBOSE, "Failed to read data from /proc/net/tcp6");
-        return true;
-    }
-    ssize_t ret = CfReadLine(buff, buff_size, fp);
-    if (ret == -1)
-    {
-        Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/tcp6");
-        fclose(fp);
-        return false;
-    }
+    const char *procdir_root = GetRelocatedProcdirRoot();
 
-    /* Read real data */
-    ret = CfReadLines(buff, buff_size, fp, lines);
-    if (ret < 0)
+    /* Nothing has been added to the sample yet if this fails so falling back
+     * to netstat doesn't count anything twice. */
+    if (!NetSocketsForEach(procdir_root, NET_SOCKET_TCP4, &SampleSocket, sample))
     {
-        Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/tcp6");
-        fclose(fp);
         return false;
     }
-    Log(LOG_LEVEL_VERBOSE, "Read %zu lines from /proc/net/tcp6", ret);
 
-    uint32_t l_port, r_port;
-    SocketState state;
-    for (size_t i = 0; i < (size_t) ret; i++)
+    if (!NetSocketsForEach(procdir_root, NET_SOCKET_UDP4, &SampleSocket, sample))
     {
-        char *line = SeqAt(lines,i);
-        if (ParseIPv6SocketInfo(line, local_addr6, &l_port, remote_addr6, &r_port, &state))
-        {
-            SaveSocketInfo(local_addr6, l_port, r_port,
-                           state, cfn_tcp6,
-                           line, cf_this, in, out);
-        }
+        Log(LOG_LEVEL_VERBOSE, "Failed to get UDP sockets information");
     }
-    fclose(fp);
-    SeqClear(lines);
-    return true;
-}
 
-static inline bool GetNetworkDataFromProcNetUDP(char local_addr[INET_ADDRSTRLEN],
-                                                char remote_addr[INET_ADDRSTRLEN],
-                                                char **buff, size_t *buff_size, Seq *lines,
-                                                double *cf_this, Item **in, Item **out)
-{
-    FILE *fp = fopen("/proc/net/udp", "r");
-    if (fp == NULL)
+    /* IPv6 may be completely disabled in kernel */
+    if (!NetSocketsForEach(procdir_root, NET_SOCKET_TCP6, &SampleSocket, sample))
     {
-        Log(LOG_LEVEL_ERR, "Failed to open /proc/net/udp for reading");
-        return false;
+        Log(LOG_LEVEL_VERBOSE, "Failed to get IPv6 TCP sockets information");
     }
-    /* Read the header */
-    ssize_t ret = CfReadLine(buff, buff_size, fp);
-    if (ret == -1)
+    if (!NetSocketsForEach(procdir_root, NET_SOCKET_UDP6, &SampleSocket, sample))
     {
-        Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/udp");
-        fclose(fp);
-        return false;
-    }
-
-    /* Read real data */
-    ret = CfReadLines(buff, buff_size, fp, lines);
-    if (ret < 0)
-    {
-        Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/udp");
-        fclose(fp);
-        return false;
-    }
-    Log(LOG_LEVEL_VERBOSE, "Read %zu lines from /proc/net/udp", ret);
-
-    uint32_t l_port, r_port;
-    SocketState state;
-    for (size_t i = 0; i < (size_t) ret; i++)
-    {
-        char *line = SeqAt(lines,i);
-        if (ParseIPv4SocketInfo(line, local_addr, &l_port, remote_addr, &r_port, &state))
-        {
-            SaveSocketInfo(local_addr, l_port, r_port,
-                           state, cfn_udp4,
-                           line, cf_this, in, out);
-        }
+        Log(LOG_LEVEL_VERBOSE, "Failed to get IPv6 UDP sockets information");
     }
-    fclose(fp);
-    SeqClear(lines);
     return true;
 }
-
-static inline bool GetNetworkDataFromProcNetUDP6(char local_addr6[INET6_ADDRSTRLEN],
-                                                 char remote_addr6[INET6_ADDRSTRLEN],
-                                                 char **buff, size_t *buff_size, Seq *lines,
-                                                 double *cf_this, Item **in, Item **out)
+#else  /* __linux__ */
+static bool GetNetworkDataFromSockets(ARG_UNUSED NetworkSample *sample)
 {
-    FILE *fp = fopen("/proc/net/udp6", "r");
-    if (fp == NULL)
-    {
-        /* IPv6 may be completely disabled in kernel so this should be handled gracefully. */
-        Log(LOG_LEVEL_VERBOSE, "Failed to read data from /proc/net/udp6");
-        return true;
-    }
-    ssize_t ret = CfReadLine(buff, buff_size, fp);
-    if (ret == -1)
-    {
-        Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/udp6");
-        fclose(fp);
-        return false;
-    }
-
-    /* Read real data */
-    ret = CfReadLines(buff, buff_size, fp, lines);
-    if (ret < 0)
-    {
-        Log(LOG_LEVEL_ERR, "Failed to read data from /proc/net/udp6");
-        fclose(fp);
-        return false;
-    }
-    Log(LOG_LEVEL_VERBOSE, "Read %zu lines from /proc/net/udp6", ret);
-
-    uint32_t l_port, r_port;
-    SocketState state;
-    for (size_t i = 0; i < (size_t) ret; i++)
-    {
-        char *line = SeqAt(lines,i);
-        if (ParseIPv6SocketInfo(line, local_addr6, &l_port, remote_addr6, &r_port, &state))
-        {
-            SaveSocketInfo(local_addr6, l_port, r_port,
-                           state, cfn_udp6,
-                           line, cf_this, in, out);
-        }
-    }
-    fclose(fp);
-    SeqClear(lines);
-    return true;
+    return false;
 }
+#endif  /* __linux__ */
 
-static bool GetNetworkDataFromProcNet(double *cf_this, Item **in, Item **out)
+static long ParsePort(const char *s)
 {
-    bool result = true;
-    Seq *lines = SeqNew(64, free);
-
-    size_t buff_size = 256;
-    char *buff = xmalloc(buff_size);
-
+    char *end;
+    long port = strtol(s, &end, 10);
+    if (end == s || *end != '\0')
     {
-        char local_addr[INET_ADDRSTRLEN];
-        char remote_addr[INET_ADDRSTRLEN];
-        if (!GetNetworkDataFromProcNetTCP(local_addr, remote_addr,
-                                          &buff, &buff_size, lines,
-                                          cf_this, in, out))
-        {
-            SeqDestroy(lines);
-            free(buff);
-            return false;
-        }
-        SeqClear(lines);
-        if (!GetNetworkDataFromProcNetUDP(local_addr, remote_addr,
-                                          &buff, &buff_size, lines,
-                                          cf_this, in, out))
-        {
-            SeqDestroy(lines);
-            free(buff);
-            return false;
-        }
-        SeqClear(lines);
-    }
-
-    {
-        char local_addr6[INET6_ADDRSTRLEN];
-        char remote_addr6[INET6_ADDRSTRLEN];
-        if (!GetNetworkDataFromProcNetTCP6(local_addr6, remote_addr6,
-                                           &buff, &buff_size, lines,
-                                           cf_this, in, out))
-        {
-            Log(LOG_LEVEL_VERBOSE, "Failed to get IPv6 TCP sockets information");
-        }
-        SeqClear(lines);
-        if (!GetNetworkDataFromProcNetUDP6(local_addr6, remote_addr6,
-                                           &buff, &buff_size, lines,
-                                           cf_this, in, out))
-        {
-            Log(LOG_LEVEL_VERBOSE, "Failed to get IPv6 UDP sockets information");
-        }
+        return -1;
     }
-
-    SeqDestroy(lines);
-    free(buff);
-    return result;
+    return port;
 }
-#endif  /* __linux__ */
 
-static void GetNetworkDataFromNetstat(FILE *fp, double *cf_this, Item **in, Item **out)
+static void GetNetworkDataFromNetstat(FILE *fp, NetworkSample *sample)
 {
     enum cf_netstat_type { cfn_new, cfn_old } type = cfn_new;
     SocketType packet = cfn_tcp4;
@@ -679,34 +584,6 @@ static void GetNetworkDataFromNetstat(FILE *fp, double *cf_this, Item **in, Item
 
         char *localport = sp;
 
-        if (strstr(vbuff, "LISTEN"))
-        {
-            // General bucket
-
-            IdempPrependItem(&ALL_INCOMING, sp, NULL);
-
-            // Categories the incoming ports by packet types
-
-            switch (packet)
-            {
-            case cfn_udp4:
-                IdempPrependItem(&MON_UDP4, sp, local);
-                break;
-            case cfn_udp6:
-                IdempPrependItem(&MON_UDP6, sp, local);
-                break;
-            case cfn_tcp4:
-                IdempPrependItem(&MON_TCP4, localport, local);
-                break;
-            case cfn_tcp6:
-                IdempPrependItem(&MON_TCP6, localport, local);
-                break;
-            default:
-                break;
-            }
-        }
-
-
         // Now look at outgoing
 
         for (sp = remote + strlen(remote) - 1; (sp >= remote) && (isdigit((int) *sp)); sp--)
@@ -715,86 +592,92 @@ static void GetNetworkDataFromNetstat(FILE *fp, double *cf_this, Item **in, Item
 
         sp++;
         char *remoteport = sp;
+        long remote_port = ParsePort(remoteport);
 
-        // Now look for the specific vital signs to count frequencies
-
-        for (size_t i = 0; i < ATTR; i++)
+        if (sp > remote)
         {
-            if (strcmp(localport, ECGSOCKS[i].portnr) == 0)
-            {
-                cf_this[ECGSOCKS[i].in]++;
-                AppendItem(&in[i], vbuff, "");
-
-            }
-
-            if (strcmp(remoteport, ECGSOCKS[i].portnr) == 0)
-            {
-                cf_this[ECGSOCKS[i].out]++;
-                AppendItem(&out[i], vbuff, "");
-
-            }
+            sp[-1] = '\0'; // Separate address from port number
         }
+
+        NetworkSampleAdd(sample, packet, (strstr(vbuff, "LISTEN") != NULL),
+                         local, ParsePort(localport),
+                         remote, remote_port,
+                         vbuff);
     }
     free(vbuff);
 }
 
-static void SaveNetworkData(Item * const *in, Item * const *out)
+static void SaveConnections(const char *filename, const ServiceConnections *conns)
 {
-    const char* const statedir = GetStateDir();
+    char new[CF_BUFSIZE];
+    snprintf(new, sizeof(new), "%s%s", filename, CF_EDITED);
+    unlink(new);                /* Just in case of races */
 
-    char vbuff[CF_BUFSIZE];
-    for (size_t i = 0; i < ATTR; i++)
+    const mode_t old_umask = SetUmask(0077);
+    FILE *fp = safe_fopen(new, "w");
+    RestoreUmask(old_umask);
+
+    if (fp == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't write file '%s'. (fopen: %s)", new, GetErrorStr());
+        return;
+    }
+
+    if (conns->connections != NULL)
     {
-        struct stat statbuf;
-        time_t now = time(NULL);
+        fwrite(BufferData(conns->connections), 1, BufferSize(conns->connections), fp);
+    }
 
-        Log(LOG_LEVEL_DEBUG, "save incoming '%s'", ECGSOCKS[i].name);
+    if (fclose(fp) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to close file '%s' while writing. (fclose: %s)", new, GetErrorStr());
+        return;
+    }
+
+    if (rename(new, filename) == -1)
+    {
+        Log(LOG_LEVEL_INFO, "Error while renaming file '%s' to '%s'. (rename: %s)", new, filename, GetErrorStr());
+    }
+}
 
-        snprintf(vbuff, CF_MAXVARSIZE, "%s%ccf_incoming.%s", statedir, FILE_SEPARATOR, ECGSOCKS[i].name);
+static void SaveServiceConnections(const char *service, const char *direction,
+                                   const ServiceConnections *conns, time_t now)
+{
+    char vbuff[CF_BUFSIZE];
+    snprintf(vbuff, CF_MAXVARSIZE, "%s%ccf_%s.%s",
+             GetStateDir(), FILE_SEPARATOR,
+             StringEqual(direction, "in") ? "incoming" : "outgoing", service);
 
-        if (stat(vbuff, &statbuf) != -1)
+    struct stat statbuf;
+    if (stat(vbuff, &statbuf) != -1)
+    {
+        const size_t size = (conns->connections != NULL) ? BufferSize(conns->connections) : 0;
+        if (size < (size_t) statbuf.st_size &&
+            now < statbuf.st_mtime + 40 * 60)
         {
-            if (ItemListSize(in[i]) < (size_t) statbuf.st_size &&
-                now < statbuf.st_mtime + 40 * 60)
-            {
-                Log(LOG_LEVEL_VERBOSE, "New state '%s' is smaller, retaining old for 40 mins longer", ECGSOCKS[i].name);
-                DeleteItemList(in[i]);
-                continue;
-            }
+            Log(LOG_LEVEL_VERBOSE, "New state '%s' is smaller, retaining old for 40 mins longer", service);
+            return;
         }
-
-        SetNetworkEntropyClasses(CanonifyName(ECGSOCKS[i].name), "in", in[i]);
-        const mode_t old_umask = SetUmask(0077);
-        RawSaveItemList(in[i], vbuff, NewLineMode_Unix);
-        RestoreUmask(old_umask);
-        DeleteItemList(in[i]);
-        Log(LOG_LEVEL_DEBUG, "Saved in netstat data in '%s'", vbuff);
     }
 
+    SetNetworkEntropyClasses(CanonifyName(service), direction, conns);
+    SaveConnections(vbuff, conns);
+    Log(LOG_LEVEL_DEBUG, "Saved %s netstat data in '%s'", direction, vbuff);
+}
+
+static void SaveNetworkData(const NetworkSample *sample)
+{
+    const time_t now = time(NULL);
+
     for (size_t i = 0; i < ATTR; i++)
     {
-        struct stat statbuf;
-        time_t now = time(NULL);
+        Log(LOG_LEVEL_DEBUG, "save incoming '%s'", ECGSOCKS[i].name);
+        SaveServiceConnections(ECGSOCKS[i].name, "in", &sample->in[i], now);
+    }
 
+    for (size_t i = 0; i < ATTR; i++)
+    {
         Log(LOG_LEVEL_DEBUG, "save outgoing '%s'", ECGSOCKS[i].name);
-        snprintf(vbuff, CF_MAXVARSIZE, "%s%ccf_outgoing.%s", statedir, FILE_SEPARATOR, ECGSOCKS[i].name);
-
-        if (stat(vbuff, &statbuf) != -1)
-        {
-            if (ItemListSize(out[i]) < (size_t) statbuf.st_size &&
-                now < statbuf.st_mtime + 40 * 60)
-            {
-                Log(LOG_LEVEL_VERBOSE, "New state '%s' is smaller, retaining old for 40 mins longer", ECGSOCKS[i].name);
-                DeleteItemList(out[i]);
-                continue;
-            }
-        }
-
-        SetNetworkEntropyClasses(CanonifyName(ECGSOCKS[i].name), "out", out[i]);
-        const mode_t old_umask = SetUmask(0077);
-        RawSaveItemList(out[i], vbuff, NewLineMode_Unix);
-        RestoreUmask(old_umask);
-        Log(LOG_LEVEL_DEBUG, "Saved out netstat data in '%s'", vbuff);
-        DeleteItemList(out[i]);
+        SaveServiceConnections(ECGSOCKS[i].name, "out", &sample->out[i], now);
     }
 }
@@ -31,41 +31,176 @@
 #include <pipes.h>
 #include <systype.h>
 #include <known_dirs.h>
+#include <processes_select.h>
+#include <map.h>
+#include <string_lib.h>                           /* StringHash, StringEqual */
+#include <buffer.h>
 
 #include <cf-windows-functions.h>
 
+/*
+ * The users running processes are collected in a set keyed by UID (or by the
+ * user name if the process table doesn't provide UIDs, i.e. when it comes from
+ * ps) and the cf_users state file is only rewritten if the set of users
+ * changed.
+ */
+
+typedef struct
+{
+    bool have_uid;
+    uid_t uid;
+    char *name;
+} ProcessUser;
+
+typedef struct
+{
+    Map *users;                 /* ProcessUser -> ProcessUser */
+    int root_procs;
+    int other_procs;
+} ProcessUsers;
+
+/* Globals */
+
+/* Contents of the cf_users file as last written */
+static char *USERS_FILE_CONTENTS = NULL;
+
 /* Prototypes */
 
 #ifndef __MINGW32__
-static bool GatherProcessUsers(Item **userList, int *userListSz, int *numRootProcs, int *numOtherProcs);
+static bool GatherProcessUsers(ProcessUsers *users);
 #endif
 
 /* Implementation */
 
-void MonProcessesGatherData(double *cf_this)
+static unsigned ProcessUserHash(const void *p, unsigned seed)
 {
-    Item *userList = NULL;
-    int numProcUsers = 0;
-    int numRootProcs = 0;
-    int numOtherProcs = 0;
+    const ProcessUser *user = p;
+    if (user->have_uid)
+    {
+        return (unsigned) user->uid ^ seed;
+    }
+    return StringHash(user->name, seed);
+}
 
-    if (!GatherProcessUsers(&userList, &numProcUsers, &numRootProcs, &numOtherProcs))
+static bool ProcessUserEqual(const void *a, const void *b)
+{
+    const ProcessUser *ua = a;
+    const ProcessUser *ub = b;
+    if (ua->have_uid && ub->have_uid)
     {
-        return;
+        return ua->uid == ub->uid;
     }
+    return StringEqual(ua->name, ub->name);
+}
+
+static void ProcessUserDestroy(void *p)
+{
+    ProcessUser *user = p;
+    free(user->name);
+    free(user);
+}
+
+/**
+ * @return the contents of the cf_users file -- the user names sorted, one per
+ *         line
+ */
+static char *ProcessUsersToString(const ProcessUsers *users)
+{
+    Seq *names = SeqNew(MapSize(users->users), NULL);
+
+    MapIterator it = MapIteratorInit(users->users);
+    MapKeyValue *item;
+    while ((item = MapIteratorNext(&it)) != NULL)
+    {
+        const ProcessUser *user = item->key;
+        SeqAppend(names, user->name);
+    }
+    SeqSort(names, StrCmpWrapper, NULL);
+
+    Buffer *buf = BufferNew();
+    const size_t n_names = SeqLength(names);
+    for (size_t i = 0; i < n_names; i++)
+    {
+        BufferAppendString(buf, SeqAt(names, i));
+        BufferAppendChar(buf, '\n');
+    }
+    SeqDestroy(names);
+
+    return BufferClose(buf);
+}
 
-    cf_this[ob_users] += numProcUsers;
-    cf_this[ob_rootprocs] += numRootProcs;
-    cf_this[ob_otherprocs] += numOtherProcs;
+static void SaveProcessUsers(const ProcessUsers *users)
+{
+    char filename[CF_MAXVARSIZE];
+    xsnprintf(filename, sizeof(filename), "%s/cf_users", GetStateDir());
+    MapName(filename);
 
-    char vbuff[CF_MAXVARSIZE];
-    xsnprintf(vbuff, sizeof(vbuff), "%s/cf_users", GetStateDir());
-    MapName(vbuff);
+    char *contents = ProcessUsersToString(users);
+    if (USERS_FILE_CONTENTS != NULL && StringEqual(contents, USERS_FILE_CONTENTS) &&
+        access(filename, F_OK) == 0)
+    {
+        Log(LOG_LEVEL_DEBUG, "Users in the process table unchanged, not rewriting '%s'", filename);
+        free(contents);
+        return;
+    }
+
+    char new[CF_BUFSIZE];
+    xsnprintf(new, sizeof(new), "%s%s", filename, CF_EDITED);
+    unlink(new);                /* Just in case of races */
 
     const mode_t old_umask = SetUmask(0077);
-    RawSaveItemList(userList, vbuff, NewLineMode_Unix);
+    FILE *fp = safe_fopen(new, "w");
     RestoreUmask(old_umask);
-    DeleteItemList(userList);
+    if (fp == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't write file '%s'. (fopen: %s)", new, GetErrorStr());
+        free(contents);
+        return;
+    }
+
+    const size_t len = strlen(contents);
+    if (fwrite(contents, 1, len, fp) != len)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't write file '%s'. (fwrite: %s)", new, GetErrorStr());
+        fclose(fp);
+        free(contents);
+        return;
+    }
+    if (fclose(fp) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to close file '%s' while writing. (fclose: %s)", new, GetErrorStr());
+        free(contents);
+        return;
+    }
+    if (rename(new, filename) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Error while renaming file '%s' to '%s'. (rename: %s)", new, filename, GetErrorStr());
+        free(contents);
+        return;
+    }
+
+    free(USERS_FILE_CONTENTS);
+    USERS_FILE_CONTENTS = contents;
+}
+
+void MonProcessesGatherData(double *cf_this)
+{
+    ProcessUsers users = {
+        .users = MapNew(ProcessUserHash, ProcessUserEqual, ProcessUserDestroy, NULL),
+    };
+
+    if (!GatherProcessUsers(&users))
+    {
+        MapDestroy(users.users);
+        return;
+    }
+
+    cf_this[ob_users] += MapSize(users.users);
+    cf_this[ob_rootprocs] += users.root_procs;
+    cf_this[ob_otherprocs] += users.other_procs;
+
+    SaveProcessUsers(&users);
+    MapDestroy(users.users);
 
     Log(LOG_LEVEL_VERBOSE, "(Users,root,other) = (%d,%d,%d)",
         (int) cf_this[ob_users], (int) cf_this[ob_rootprocs],
@@ -74,8 +209,95 @@ void MonProcessesGatherData(double *cf_this)
 
 #ifndef __MINGW32__
 
-static bool GatherProcessUsers(Item **userList, int *userListSz, int *numRootProcs, int *numOtherProcs)
+static void CountProcessUser(ProcessUsers *users, const char *name, const uid_t *uid)
+{
+    ProcessUser key = {
+        .have_uid = (uid != NULL),
+        .uid = (uid != NULL) ? *uid : 0,
+        .name = (char *) name,
+    };
+
+    if (!MapHasKey(users->users, &key))
+    {
+        ProcessUser *user = xmemdup(&key, sizeof(key));
+        user->name = xstrdup(name);
+        MapInsert(users->users, user, user);
+    }
+
+    const bool root = (uid != NULL) ? (*uid == 0) : StringEqual(name, "root");
+    if (root)
+    {
+        users->root_procs++;
+    }
+    else
+    {
+        users->other_procs++;
+    }
+}
+
+static void LogProcessUsers(const ProcessUsers *users)
+{
+    if (LogGetGlobalLevel() >= LOG_LEVEL_DEBUG)
+    {
+        char *s = ProcessUsersToString(users);
+        Log(LOG_LEVEL_DEBUG, "Users in the process table: (%s)", s);
+        free(s);
+    }
+}
+
+# ifdef __linux__
+/**
+ * Gather the process users from /proc directly, without spawning ps.
+ * @return false if the table could not be loaded (caller should fall back to ps)
+ */
+static bool GatherProcessUsersFromProc(ProcessUsers *users)
+{
+    char *names[CF_PROCCOLS];
+    char *legend = NULL;
+    Seq *entries = LoadProcessTableFromProc(names, &legend);
+    if (entries == NULL)
+    {
+        return false;
+    }
+    free(legend);
+
+    /* USER is the first column, see VPSOPTS for Linux, and its value is the
+     * UID */
+    assert(StringEqual(names[0], "USER"));
+
+    const size_t n_entries = SeqLength(entries);
+    for (size_t i = 0; i < n_entries; i++)
+    {
+        const ProcessTableEntry *entry = SeqAt(entries, i);
+        const char *user = entry->columns[0];
+        if (!NULL_OR_EMPTY(user))
+        {
+            const uid_t uid = entry->values[0];
+            CountProcessUser(users, user, entry->have_values[0] ? &uid : NULL);
+        }
+    }
+
+    for (int i = 0; names[i] != NULL; i++)
+    {
+        free(names[i]);
+    }
+    SeqDestroy(entries);
+
+    LogProcessUsers(users);
+    return true;
+}
+# endif /* __linux__ */
+
+static bool GatherProcessUsers(ProcessUsers *users)
 {
+# ifdef __linux__
+    if (GatherProcessUsersFromProc(users))
+    {
+        return true;
+    }
+    Log(LOG_LEVEL_VERBOSE, "Failed to load process table from /proc, falling back to ps");
+# endif
+
     char pscomm[CF_BUFSIZE];
     xsnprintf(pscomm, sizeof(pscomm), "%s %s",
               VPSCOMM[VPSHARDCLASS], VPSOPTS[VPSHARDCLASS]);
@@ -129,28 +351,10 @@ static bool GatherProcessUsers(Item **userList, int *userListSz, int *numRootPro
             continue;
         }
 
-        if (!IsItemIn(*userList, user))
-        {
-            PrependItem(userList, user, NULL);
-            (*userListSz)++;
-        }
-
-        if (strcmp(user, "root") == 0)
-        {
-            (*numRootProcs)++;
-        }
-        else
-        {
-            (*numOtherProcs)++;
-        }
+        CountProcessUser(users, user, NULL);
     }
 
-    if (LogGetGlobalLevel() >= LOG_LEVEL_DEBUG)
-    {
-        char *s = ItemList2CSV(*userList);
-        Log(LOG_LEVEL_DEBUG, "Users in the process table: (%s)", s);
-        free(s);
-    }
+    LogProcessUsers(users);
     cf_pclose(pp);
     free(vbuff);
     return true;
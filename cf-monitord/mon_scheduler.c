@@ -0,0 +1,337 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <mon_scheduler.h>
+
+#include <misc_lib.h>                                   /* xclock_gettime */
+#include <mutex.h>                                      /* ThreadLock */
+
+/* Probes are kept in a timer wheel: a probe due at time T is in the slot
+ * (T / MON_WHEEL_TICK) % MON_WHEEL_SLOTS and when the wheel is advanced,
+ * only the slots of the elapsed ticks are checked for probes that are due
+ * (probes due in a later round of the wheel just stay in their slot). */
+#define MON_WHEEL_TICK 5                                        /* seconds */
+#define MON_WHEEL_SLOTS 64
+
+#define MON_PROBES_MAX 32
+
+typedef struct MonProbe_
+{
+    char *name;
+    ProbeGatherData gather;
+    time_t interval;
+    MonProbeCost cost;
+
+    time_t deadline;
+    struct MonProbe_ *next;                 /* next probe in the wheel slot */
+
+    double values[CF_OBSERVABLES];          /* scratch space for gather() */
+
+    /* Protected by PROBES_LOCK */
+    double published[CF_OBSERVABLES];
+    bool owned[CF_OBSERVABLES];             /* observables set by the probe */
+    double max_latency;
+    double total_latency;
+    unsigned long runs;
+} MonProbe;
+
+typedef struct
+{
+    MonProbe *slots[MON_WHEEL_SLOTS];
+    time_t tick;                            /* last tick processed */
+} MonTimerWheel;
+
+static MonProbe PROBES[MON_PROBES_MAX];
+static size_t N_PROBES = 0;
+
+/* The main loop advances INLINE_WHEEL, the background thread
+ * BACKGROUND_WHEEL. */
+static MonTimerWheel INLINE_WHEEL = { { 0 } };
+static MonTimerWheel BACKGROUND_WHEEL = { { 0 } };
+
+static pthread_mutex_t PROBES_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t BACKGROUND_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t BACKGROUND_COND = PTHREAD_COND_INITIALIZER;
+static bool BACKGROUND_STOP = false;
+static bool BACKGROUND_RUNNING = false;
+static pthread_t BACKGROUND_THREAD;
+
+/*****************************************************************************/
+
+static void TimerWheelInit(MonTimerWheel *wheel, time_t now)
+{
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+    /* The slot of the current tick is checked on every advance */
+    wheel->tick = (now / MON_WHEEL_TICK) - 1;
+}
+
+static void TimerWheelSchedule(MonTimerWheel *wheel, MonProbe *probe)
+{
+    const size_t slot = (probe->deadline / MON_WHEEL_TICK) % MON_WHEEL_SLOTS;
+    probe->next = wheel->slots[slot];
+    wheel->slots[slot] = probe;
+}
+
+/**
+ * Advance #wheel to #now.
+ *
+ * @return list of probes (linked by ->next) which are due, removed from the wheel
+ */
+static MonProbe *TimerWheelAdvance(MonTimerWheel *wheel, time_t now)
+{
+    const time_t now_tick = now / MON_WHEEL_TICK;
+    time_t tick = wheel->tick;
+    if (now_tick - tick > MON_WHEEL_SLOTS)
+    {
+        /* No need to check any slot more than once */
+        tick = now_tick - MON_WHEEL_SLOTS;
+    }
+
+    MonProbe *due = NULL;
+    for (tick++; tick <= now_tick; tick++)
+    {
+        MonProbe **link = &(wheel->slots[tick % MON_WHEEL_SLOTS]);
+        while (*link != NULL)
+        {
+            MonProbe *probe = *link;
+            if (probe->deadline <= now)
+            {
+                *link = probe->next;
+                probe->next = due;
+                due = probe;
+            }
+            else
+            {
+                link = &(probe->next);
+            }
+        }
+    }
+
+    /* Probes due later in the current tick need to be checked next time */
+    wheel->tick = now_tick - 1;
+    return due;
+}
+
+/*****************************************************************************/
+
+static double Now(void)
+{
+    struct timespec ts;
+    xclock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void RunProbe(MonProbe *probe)
+{
+    memset(probe->values, 0, sizeof(probe->values));
+
+    const double start = Now();
+    (*probe->gather) (probe->values);
+    const double latency = Now() - start;
+
+    ThreadLock(&PROBES_LOCK);
+    for (int i = 0; i < CF_OBSERVABLES; i++)
+    {
+        if (probe->values[i] != 0.0)
+        {
+            probe->owned[i] = true;
+        }
+        if (probe->owned[i])
+        {
+            probe->published[i] = probe->values[i];
+        }
+    }
+    probe->max_latency = MAX(probe->max_latency, latency);
+    probe->total_latency += latency;
+    probe->runs++;
+    const double average = probe->total_latency / probe->runs;
+    const double max = probe->max_latency;
+    ThreadUnlock(&PROBES_LOCK);
+
+    Log(LOG_LEVEL_VERBOSE, "Probe '%s' took %.3fs (average %.3fs, max %.3fs)",
+        probe->name, latency, average, max);
+}
+
+/**
+ * Run the #due probes and schedule them again in #wheel.
+ */
+static void RunDueProbes(MonTimerWheel *wheel, MonProbe *due, time_t now)
+{
+    while (due != NULL)
+    {
+        MonProbe *probe = due;
+        due = due->next;
+
+        RunProbe(probe);
+
+        /* Allow running a tick early so that probes with the same interval as
+         * the main loop don't skip every other iteration because of jitter. */
+        probe->deadline = now + MAX(probe->interval - MON_WHEEL_TICK, 1);
+        TimerWheelSchedule(wheel, probe);
+    }
+}
+
+static void *BackgroundProbesThread(ARG_UNUSED void *arg)
+{
+    ThreadLock(&BACKGROUND_LOCK);
+    while (!BACKGROUND_STOP)
+    {
+        /* Wake up at the next tick */
+        struct timespec wakeup = { .tv_sec = ((time(NULL) / MON_WHEEL_TICK) + 1) * MON_WHEEL_TICK,
+                                   .tv_nsec = 0 };
+        pthread_cond_timedwait(&BACKGROUND_COND, &BACKGROUND_LOCK, &wakeup);
+        if (BACKGROUND_STOP)
+        {
+            break;
+        }
+        ThreadUnlock(&BACKGROUND_LOCK);
+
+        const time_t now = time(NULL);
+        MonProbe *due = TimerWheelAdvance(&BACKGROUND_WHEEL, now);
+        RunDueProbes(&BACKGROUND_WHEEL, due, now);
+
+        ThreadLock(&BACKGROUND_LOCK);
+    }
+    ThreadUnlock(&BACKGROUND_LOCK);
+
+    return NULL;
+}
+
+/*****************************************************************************/
+
+void MonProbeRegister(const char *name, ProbeGatherData gather,
+                      time_t interval, MonProbeCost cost)
+{
+    assert(name != NULL);
+    assert(gather != NULL);
+
+    if (N_PROBES == MON_PROBES_MAX)
+    {
+        Log(LOG_LEVEL_ERR, "Too many monitoring probes, not registering '%s'", name);
+        return;
+    }
+
+    MonProbe *probe = &(PROBES[N_PROBES]);
+    N_PROBES++;
+
+    memset(probe, 0, sizeof(MonProbe));
+    probe->name = xstrdup(name);
+    probe->gather = gather;
+    probe->interval = MAX(interval, 1);
+    probe->cost = cost;
+}
+
+void MonProbesStart(void)
+{
+    const time_t now = time(NULL);
+    TimerWheelInit(&INLINE_WHEEL, now);
+    TimerWheelInit(&BACKGROUND_WHEEL, now);
+
+    bool have_background = false;
+    for (size_t i = 0; i < N_PROBES; i++)
+    {
+        MonProbe *probe = &(PROBES[i]);
+
+        /* Gather the initial data synchronously, both kinds of probes are
+         * scheduled to run one interval later. */
+        if (probe->cost == MON_PROBE_COST_HIGH)
+        {
+            probe->next = NULL;
+            RunDueProbes(&BACKGROUND_WHEEL, probe, now);
+            have_background = true;
+        }
+        else
+        {
+            probe->deadline = now;
+            TimerWheelSchedule(&INLINE_WHEEL, probe);
+        }
+    }
+
+    if (!have_background)
+    {
+        return;
+    }
+
+    BACKGROUND_STOP = false;
+    int ret = pthread_create(&BACKGROUND_THREAD, NULL, BackgroundProbesThread, NULL);
+    if (ret != 0)
+    {
+        Log(LOG_LEVEL_ERR,
+            "Failed to create thread for monitoring probes, running all of them in the main loop (pthread_create: %s)",
+            GetErrorStrFromCode(ret));
+
+        /* Move the background probes to the main loop */
+        TimerWheelInit(&BACKGROUND_WHEEL, now);
+        for (size_t i = 0; i < N_PROBES; i++)
+        {
+            if (PROBES[i].cost == MON_PROBE_COST_HIGH)
+            {
+                PROBES[i].cost = MON_PROBE_COST_LOW;
+                TimerWheelSchedule(&INLINE_WHEEL, &(PROBES[i]));
+            }
+        }
+        return;
+    }
+    BACKGROUND_RUNNING = true;
+}
+
+void MonProbesStop(void)
+{
+    if (!BACKGROUND_RUNNING)
+    {
+        return;
+    }
+
+    ThreadLock(&BACKGROUND_LOCK);
+    BACKGROUND_STOP = true;
+    pthread_cond_signal(&BACKGROUND_COND);
+    ThreadUnlock(&BACKGROUND_LOCK);
+
+    pthread_join(BACKGROUND_THREAD, NULL);
+    BACKGROUND_RUNNING = false;
+}
+
+void MonProbesRun(time_t now)
+{
+    MonProbe *due = TimerWheelAdvance(&INLINE_WHEEL, now);
+    RunDueProbes(&INLINE_WHEEL, due, now);
+}
+
+void MonProbesCollect(double *cf_this)
+{
+    ThreadLock(&PROBES_LOCK);
+    for (size_t i = 0; i < N_PROBES; i++)
+    {
+        const MonProbe *probe = &(PROBES[i]);
+        for (int j = 0; j < CF_OBSERVABLES; j++)
+        {
+            if (probe->owned[j])
+            {
+                cf_this[j] += probe->published[j];
+            }
+        }
+    }
+    ThreadUnlock(&PROBES_LOCK);
+}
@@ -0,0 +1,80 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_MON_SCHEDULER_H
+#define CFENGINE_MON_SCHEDULER_H
+
+#include <cf3.defs.h>
+#include <probes.h>                      /* ProbeGatherData */
+
+/*
+ * Scheduling of cf-monitord probes.
+ *
+ * Every probe is registered with the interval in which it should run and its
+ * cost. Cheap probes are run from the main loop (MonProbesRun()) when they are
+ * due, expensive probes (which may block, e.g. by spawning ps or sensors) are
+ * run by a background thread so that they don't delay the other
+ * measurements. In both cases the values a probe gathers are only published
+ * into the observables by MonProbesCollect(), the last published values are
+ * used until the probe runs again.
+ *
+ * The time every probe takes is logged (with its average and maximum) at
+ * verbose level, it doesn't take any of the observable slots.
+ */
+
+typedef enum
+{
+    MON_PROBE_COST_LOW,         /* run in the main loop */
+    MON_PROBE_COST_HIGH,        /* run in the background */
+} MonProbeCost;
+
+/**
+ * Register a probe, to be called before MonProbesStart().
+ *
+ * @param name      name of the probe (used for logging)
+ * @param gather    callback storing the values in the given array of observables
+ * @param interval  in seconds
+ */
+void MonProbeRegister(const char *name, ProbeGatherData gather,
+                      time_t interval, MonProbeCost cost);
+
+/**
+ * Run all the probes once and start the background thread.
+ */
+void MonProbesStart(void);
+void MonProbesStop(void);
+
+/**
+ * Run the cheap probes that are due at #now.
+ */
+void MonProbesRun(time_t now);
+
+/**
+ * Add the last values published by the probes (and their latencies) to
+ * #cf_this.
+ */
+void MonProbesCollect(double *cf_this);
+
+#endif
@@ -0,0 +1,278 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <mon_stats.h>
+
+#include <math.h>
+
+
+void MonStatsInit(MonStats *stats)
+{
+    assert(stats != NULL);
+
+    for (int i = 0; i < CF_OBSERVABLES; i++)
+    {
+        stats->local.Q[i] = QDefinite(0.0);
+        stats->last_q[i] = 0.0;
+    }
+    stats->local.last_seen = 0;
+}
+
+/*
+    This function performs a weighted average of an old and a new measured
+    value. Weights depend on the age of the data. If one or both values
+    are "unreasonably" large (>9999999) they will be ignored.
+*/
+/* For a couple of weeks, learn eagerly. Otherwise variances will
+   be way too large. Then downplay newer data somewhat, and rely on
+   experience of a couple of months of data ... */
+
+double MonStatsWAverage(double new_val, double old_val, double age, double forget_rate)
+{
+    const double cf_sane_monitor_limit = 9999999.0;
+
+    // First do some database corruption self-healing
+    const bool old_bad = (old_val > cf_sane_monitor_limit);
+    const bool new_bad = (new_val > cf_sane_monitor_limit);
+    if (old_bad && new_bad)
+    {
+        return 0.0;
+    }
+    else if (old_bad)
+    {
+        return new_val;
+    }
+    else if (new_bad)
+    {
+        return old_val;
+    }
+
+    if ((old_val == 0) && (new_val == 0))
+    {
+        return 0.0;
+    }
+
+    // More aggressive learning for young database
+    const double weight_new = (age < 2.0) ? forget_rate : (1.0 - forget_rate);
+    const double weight_old = (age < 2.0) ? (1.0 - forget_rate) : forget_rate;
+
+    /*
+     * Average = (w1*v1 + w2*v2) / (w1 + w2)
+     *
+     * w1 + w2 always equals to 1, so we omit it for better precision and
+     * performance.
+     */
+
+    const double average = (weight_new * new_val + weight_old * old_val);
+
+    if (average < 0)
+    {
+        /* Accuracy lost - something wrong */
+        return 0.0;
+    }
+
+    return average;
+}
+
+double MonStatsRejectAnomaly(double new_val, double average, double variance,
+                             double localav, double localvar, double draw)
+{
+    if (average == 0)
+    {
+        return new_val;
+    }
+
+    if (new_val > MON_THRESHOLD_HIGH * 4.0)
+    {
+        return 0.0;
+    }
+
+    if (new_val > MON_THRESHOLD_HIGH)
+    {
+        return average;
+    }
+
+    const double delta_av = new_val - average;
+    if (delta_av * delta_av < MON_NOISE_THRESHOLD * MON_NOISE_THRESHOLD)
+    {
+        return new_val;
+    }
+
+/* This routine puts some inertia into the changes, so that the system
+   doesn't respond to every little change ...   IR and UV cutoff */
+
+    const double dev = sqrt(variance + localvar);     /* Geometrical average dev */
+    const double delta_local = new_val - localav;
+    const double delta = sqrt(delta_av * delta_av + delta_local * delta_local);
+
+    if ((delta > 4.0 * dev) &&  /* IR */
+        (draw >= 0.7))          /* 70% chance of using full value - as in learning policy */
+    {
+        return (delta_av > 0) ? (average + 2.0 * dev) : (average - 2.0 * dev);
+    }
+
+    return new_val;
+}
+
+void MonStatsUpdate(MonStats *stats, const double *cf_this, time_t now,
+                    Averages *slot, Averages *newvals,
+                    double wage, long iter, double forget_rate, double draw)
+{
+    assert(stats != NULL);
+    assert(cf_this != NULL);
+    assert(slot != NULL);
+    assert(newvals != NULL);
+
+    QPoint *const local = stats->local.Q;
+
+    newvals->last_seen = now;  // Record the freshness of this slot
+
+    for (int i = 0; i < CF_OBSERVABLES; i++)
+    {
+        QPoint *const old = &(slot->Q[i]);
+        QPoint *const new = &(newvals->Q[i]);
+
+        /* Overflow protection */
+        if (old->expect < 0)
+        {
+            old->expect = 0;
+        }
+        if (old->q < 0)
+        {
+            old->q = 0;
+        }
+        if (old->var < 0)
+        {
+            old->var = 0;
+        }
+
+        /* Discard any apparently anomalous behaviour before renormalizing */
+        const double this = MonStatsRejectAnomaly(cf_this[i], old->expect, old->var,
+                                                  local[i].expect, local[i].var, draw);
+
+        new->q = this;
+        local[i].q = this;
+
+        new->expect = MonStatsWAverage(this, old->expect, wage, forget_rate);
+        local[i].expect = MonStatsWAverage(new->expect, local[i].expect, iter, forget_rate);
+
+        // The value from the previous update gives the gradient
+        new->dq = (stats->last_q[i] > 0) ? (this - stats->last_q[i]) : 0.0;
+        local[i].dq = new->dq;
+        stats->last_q[i] = this;
+
+        const double delta2 = (this - old->expect) * (this - old->expect);
+
+        if (old->var > delta2 * 2.0)
+        {
+            /* Clean up past anomalies */
+            new->var = delta2;
+        }
+        else
+        {
+            new->var = MonStatsWAverage(delta2, old->var, wage, forget_rate);
+        }
+        local[i].var = MonStatsWAverage(new->var, local[i].var, iter, forget_rate);
+    }
+}
+
+void MonStatsClassify(const MonStats *stats, const double *cf_this,
+                      const Averages *av, MonStatsClass *classes)
+{
+    assert(stats != NULL);
+    assert(cf_this != NULL);
+    assert(av != NULL);
+    assert(classes != NULL);
+
+    const QPoint *const local = stats->local.Q;
+
+    for (int i = 0; i < CF_OBSERVABLES; i++)
+    {
+        const double delta = cf_this[i] - av->Q[i].expect;
+        const double sigma = sqrt(av->Q[i].var);
+        const double ldelta = cf_this[i] - local[i].expect;
+        const double lsigma = sqrt(local[i].var);
+
+        classes[i].sigma = sqrt(sigma * sigma + lsigma * lsigma);
+
+        if ((delta > 0) && (ldelta > 0))
+        {
+            classes[i].direction = MON_STATS_DIRECTION_HIGH;
+        }
+        else if ((delta < 0) && (ldelta < 0))
+        {
+            classes[i].direction = MON_STATS_DIRECTION_LOW;
+        }
+        else
+        {
+            classes[i].direction = MON_STATS_DIRECTION_NORMAL;
+        }
+
+        if ((sigma == 0.0) || (lsigma == 0.0))
+        {
+            /* No sigma variation .. can't measure class */
+            classes[i].level = MON_STATS_LEVEL_NONE;
+            continue;
+        }
+
+        const double dev = sqrt(delta * delta / (1.0 + sigma * sigma) +
+                                ldelta * ldelta / (1.0 + lsigma * lsigma));
+
+        if (fabs(delta) < MON_NOISE_THRESHOLD)       /* Arbitrary limits on sensitivity  */
+        {
+            classes[i].level = (dev > 2.0 * sqrt(2.0)) ?
+                MON_STATS_LEVEL_MICROANOMALY : MON_STATS_LEVEL_NOISE;
+        }
+        else if (dev > 3.0 * sqrt(2.0))
+        {
+            classes[i].level = MON_STATS_LEVEL_ANOMALY;
+        }
+        else if (dev > 2.0 * sqrt(2.0))
+        {
+            classes[i].level = MON_STATS_LEVEL_DEV2;
+        }
+        else if (dev > sqrt(2.0))
+        {
+            classes[i].level = MON_STATS_LEVEL_DEV1;
+        }
+        else
+        {
+            classes[i].level = MON_STATS_LEVEL_NORMAL;
+        }
+    }
+}
+
+const char *MonStatsDirectionToString(MonStatsDirection direction)
+{
+    switch (direction)
+    {
+    case MON_STATS_DIRECTION_HIGH:
+        return "high";
+    case MON_STATS_DIRECTION_LOW:
+        return "low";
+    default:
+        return "normal";
+    }
+}
@@ -0,0 +1,114 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_MON_STATS_H
+#define CFENGINE_MON_STATS_H
+
+#include <cf3.defs.h>                                       /* Averages */
+
+/*
+ * Anomaly statistics of cf-monitord.
+ *
+ * For every observable two exponentially weighted averages (and variances)
+ * are kept: the one of the current time slot of the week, which is stored in
+ * the observations DB, and the local one of this process. All the functions
+ * here work on all the observables at once and don't do any I/O, loading and
+ * storing the slot averages is left to the caller.
+ */
+
+#define MON_NOISE_THRESHOLD 6     /* number that does not warrant large anomaly status */
+#define MON_THRESHOLD_HIGH 1000000      /* samples should stay below this threshold */
+
+typedef struct
+{
+    Averages local;                       /* averages since the start */
+    double last_q[CF_OBSERVABLES];        /* for the gradients (dq) */
+} MonStats;
+
+typedef enum
+{
+    MON_STATS_DIRECTION_NORMAL,
+    MON_STATS_DIRECTION_HIGH,
+    MON_STATS_DIRECTION_LOW,
+} MonStatsDirection;
+
+typedef enum
+{
+    MON_STATS_LEVEL_NONE,         /* no variation yet, no classes */
+    MON_STATS_LEVEL_NOISE,        /* difference too small to measure */
+    MON_STATS_LEVEL_MICROANOMALY, /* small difference, but a lot of it */
+    MON_STATS_LEVEL_NORMAL,       /* within 1 sigma */
+    MON_STATS_LEVEL_DEV1,         /* over 1 sigma */
+    MON_STATS_LEVEL_DEV2,         /* over 2 sigma */
+    MON_STATS_LEVEL_ANOMALY,      /* over 3 sigma */
+} MonStatsLevel;
+
+typedef struct
+{
+    MonStatsDirection direction;
+    MonStatsLevel level;
+    double sigma;                         /* combined standard deviation */
+} MonStatsClass;
+
+void MonStatsInit(MonStats *stats);
+
+/**
+ * Weighted average of an old and a new value, the new value gets more weight
+ * while #age (in weeks) is less than 2.
+ */
+double MonStatsWAverage(double new_val, double old_val, double age, double forget_rate);
+
+/**
+ * Sanitize a new value #new_val given the slot and local averages.
+ *
+ * @param draw  random number from [0, 1) deciding whether big jumps are
+ *              accepted as they are or only partially
+ */
+double MonStatsRejectAnomaly(double new_val, double average, double variance,
+                             double localav, double localvar, double draw);
+
+/**
+ * Update the statistics with the values measured in this cycle.
+ *
+ * @param slot     the averages of the current time slot, negative (overflown)
+ *                 values are reset to 0 in place
+ * @param newvals  the new averages of the current time slot
+ * @param wage     age of the observations DB in weeks
+ * @param iter     number of previous updates of #stats
+ */
+void MonStatsUpdate(MonStats *stats, const double *cf_this, time_t now,
+                    Averages *slot, Averages *newvals,
+                    double wage, long iter, double forget_rate, double draw);
+
+/**
+ * Classify the values measured in this cycle against the slot (#av) and local
+ * averages, fills in one #classes entry per observable.
+ */
+void MonStatsClassify(const MonStats *stats, const double *cf_this,
+                      const Averages *av, MonStatsClass *classes);
+
+const char *MonStatsDirectionToString(MonStatsDirection direction);
+
+#endif
@@ -0,0 +1,317 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <stream_tail.h>
+
+#include <dbm_api.h>
+#include <file_lib.h>                                         /* safe_open */
+#include <item_lib.h>
+#include <buffer.h>
+
+/* Lines longer than this are split */
+#define STREAM_TAIL_MAX_LINE (256 * CF_BUFSIZE)
+
+struct StreamTail_
+{
+    char *path;
+    char *key;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    off_t offset;                       /* of the first byte not read yet */
+    Buffer *partial;                    /* incomplete last line */
+    time_t checkpointed;
+    off_t checkpointed_offset;
+};
+
+/* Stored in the DB, the offset comes first to stay compatible with the
+ * older format (just a long offset) */
+typedef struct
+{
+    long offset;
+    uint64_t dev;
+    uint64_t ino;
+} StreamTailCheckpointData;
+
+StreamTail *StreamTailNew(const char *path, const char *key)
+{
+    StreamTail *tail = xcalloc(1, sizeof(StreamTail));
+    tail->path = xstrdup(path);
+    tail->key = xstrdup(key);
+    tail->fd = -1;
+    tail->partial = BufferNew();
+    tail->checkpointed_offset = -1;
+    return tail;
+}
+
+void StreamTailDestroy(StreamTail *tail)
+{
+    if (tail != NULL)
+    {
+        if (tail->fd != -1)
+        {
+            close(tail->fd);
+        }
+        BufferDestroy(tail->partial);
+        free(tail->path);
+        free(tail->key);
+        free(tail);
+    }
+}
+
+/**
+ * @return the checkpointed offset if it is valid for the file described by
+ *         #sb, 0 otherwise
+ */
+static off_t RestoreOffset(const StreamTail *tail, const struct stat *sb)
+{
+    CF_DB *dbp;
+    if (!OpenDB(&dbp, dbid_static))
+    {
+        return 0;
+    }
+
+    off_t offset = 0;
+    const int size = ValueSizeDB(dbp, tail->key, strlen(tail->key) + 1);
+    if (size == sizeof(StreamTailCheckpointData))
+    {
+        StreamTailCheckpointData data;
+        if (ReadDB(dbp, tail->key, &data, sizeof(data)) &&
+            data.dev == (uint64_t) sb->st_dev && data.ino == (uint64_t) sb->st_ino)
+        {
+            offset = data.offset;
+        }
+    }
+    else if (size == sizeof(long))
+    {
+        long old_offset;
+        if (ReadDB(dbp, tail->key, &old_offset, sizeof(old_offset)))
+        {
+            offset = old_offset;
+        }
+    }
+    CloseDB(dbp);
+
+    if (offset < 0 || offset > sb->st_size)
+    {
+        offset = 0;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Resuming state for %s at %jd", tail->key, (intmax_t) offset);
+    return offset;
+}
+
+static bool TailOpen(StreamTail *tail, bool restore)
+{
+    assert(tail->fd == -1);
+
+    int fd = safe_open(tail->path, O_RDONLY);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Unable to open stream '%s' (open: %s)", tail->path, GetErrorStr());
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Unable to stat stream '%s' (fstat: %s)", tail->path, GetErrorStr());
+        close(fd);
+        return false;
+    }
+
+    const off_t offset = restore ? RestoreOffset(tail, &sb) : 0;
+    if (offset != 0 && lseek(fd, offset, SEEK_SET) == (off_t) -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Unable to seek in stream '%s' (lseek: %s)", tail->path, GetErrorStr());
+        close(fd);
+        return false;
+    }
+
+    tail->fd = fd;
+    tail->dev = sb.st_dev;
+    tail->ino = sb.st_ino;
+    tail->offset = offset;
+    BufferClear(tail->partial);
+    return true;
+}
+
+static void AddPartialLine(StreamTail *tail, Item **reversed_lines)
+{
+    PrependItem(reversed_lines, BufferData(tail->partial), NULL);
+    BufferClear(tail->partial);
+}
+
+/**
+ * Read everything available from the currently open file, adding complete
+ * lines to #reversed_lines (in reverse order).
+ */
+static bool ReadAvailable(StreamTail *tail, Item **reversed_lines)
+{
+    char buf[4 * CF_BUFSIZE];
+
+    for (;;)
+    {
+        const ssize_t n = read(tail->fd, buf, sizeof(buf));
+        if (n == 0)
+        {
+            return true;
+        }
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            Log(LOG_LEVEL_ERR, "Unable to read stream '%s' (read: %s)", tail->path, GetErrorStr());
+            return false;
+        }
+
+        tail->offset += n;
+
+        const char *start = buf;
+        const char *const end = buf + n;
+        const char *newline;
+        while ((newline = memchr(start, '\n', end - start)) != NULL)
+        {
+            BufferAppend(tail->partial, start, newline - start);
+            AddPartialLine(tail, reversed_lines);
+            start = newline + 1;
+        }
+        BufferAppend(tail->partial, start, end - start);
+
+        if (BufferSize(tail->partial) > STREAM_TAIL_MAX_LINE)
+        {
+            AddPartialLine(tail, reversed_lines);
+        }
+    }
+}
+
+bool StreamTailRead(StreamTail *tail, Item **lines)
+{
+    assert(tail != NULL);
+
+    if (tail->fd == -1 && !TailOpen(tail, true))
+    {
+        return false;
+    }
+
+    Item *reversed_lines = NULL;
+    bool ret = true;
+
+    struct stat sb;
+    if (stat(tail->path, &sb) == -1)
+    {
+        /* Probably being rotated, get what's left in the old file */
+        ret = ReadAvailable(tail, &reversed_lines);
+    }
+    else if (sb.st_dev != tail->dev || sb.st_ino != tail->ino)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Stream '%s' was rotated, reading the new file", tail->path);
+
+        ReadAvailable(tail, &reversed_lines);
+        if (BufferSize(tail->partial) > 0)
+        {
+            /* The old file is complete now */
+            AddPartialLine(tail, &reversed_lines);
+        }
+        close(tail->fd);
+        tail->fd = -1;
+
+        ret = TailOpen(tail, false) && ReadAvailable(tail, &reversed_lines);
+    }
+    else
+    {
+        if (sb.st_size < tail->offset)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Stream '%s' was truncated, reading from the beginning", tail->path);
+            if (lseek(tail->fd, 0, SEEK_SET) == (off_t) -1)
+            {
+                Log(LOG_LEVEL_ERR, "Unable to seek in stream '%s' (lseek: %s)", tail->path, GetErrorStr());
+                return false;
+            }
+            tail->offset = 0;
+            BufferClear(tail->partial);
+        }
+
+        ret = ReadAvailable(tail, &reversed_lines);
+    }
+
+    /* Lines were prepended, which is cheap even for many of them */
+    Item *new_lines = ReverseItemList(reversed_lines);
+    if (*lines == NULL)
+    {
+        *lines = new_lines;
+    }
+    else
+    {
+        Item *last = *lines;
+        while (last->next != NULL)
+        {
+            last = last->next;
+        }
+        last->next = new_lines;
+    }
+
+    return ret;
+}
+
+void StreamTailCheckpoint(StreamTail *tail, time_t now, bool force)
+{
+    assert(tail != NULL);
+
+    if (tail->fd == -1)
+    {
+        return;
+    }
+
+    /* Continue with the incomplete line next time */
+    const off_t offset = tail->offset - BufferSize(tail->partial);
+    if (offset == tail->checkpointed_offset ||
+        (!force && now - tail->checkpointed < STREAM_TAIL_CHECKPOINT_INTERVAL))
+    {
+        return;
+    }
+
+    CF_DB *dbp;
+    if (!OpenDB(&dbp, dbid_static))
+    {
+        return;
+    }
+
+    const StreamTailCheckpointData data = {
+        .offset = offset,
+        .dev = tail->dev,
+        .ino = tail->ino,
+    };
+
+    Log(LOG_LEVEL_VERBOSE, "Saving state for %s at %jd", tail->key, (intmax_t) offset);
+    if (WriteDB(dbp, tail->key, &data, sizeof(data)))
+    {
+        tail->checkpointed = now;
+        tail->checkpointed_offset = offset;
+    }
+    CloseDB(dbp);
+}
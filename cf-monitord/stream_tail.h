@@ -0,0 +1,67 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_STREAM_TAIL_H
+#define CFENGINE_STREAM_TAIL_H
+
+#include <cf3.defs.h>
+
+/*
+ * Incremental reading of growing files (logs) for measurement promises.
+ *
+ * The file is kept open between samples and only the bytes appended since
+ * the previous sample are read. Rotation (the path pointing to a new file)
+ * and truncation are detected, in the former case the rest of the old file is
+ * read before switching to the new one.
+ *
+ * The offset is kept in memory and only checkpointed to the DB periodically
+ * so that a restarted cf-monitord can continue where it left off.
+ */
+
+typedef struct StreamTail_ StreamTail;
+
+/**
+ * @param key  key to store the checkpoints under in the nova_static DB
+ */
+StreamTail *StreamTailNew(const char *path, const char *key);
+void StreamTailDestroy(StreamTail *tail);
+
+/**
+ * Append the complete lines added to the file since the last call to
+ * #lines. On the first call, the reading starts at the checkpointed offset.
+ *
+ * @return %false if the file could not be read
+ */
+bool StreamTailRead(StreamTail *tail, Item **lines);
+
+/**
+ * Save the current offset, unless it was saved less than
+ * STREAM_TAIL_CHECKPOINT_INTERVAL before #now (or #force is %true).
+ */
+void StreamTailCheckpoint(StreamTail *tail, time_t now, bool force);
+
+#define STREAM_TAIL_CHECKPOINT_INTERVAL (10 * SECONDS_PER_MINUTE)
+
+#endif
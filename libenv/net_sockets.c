@@ -0,0 +1,424 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <net_sockets.h>
+
+#include <alloc.h>
+#include <file_lib.h>                                   /* safe_fopen */
+#include <files_interfaces.h>                           /* CfReadLine */
+#include <logging.h>
+
+#ifdef __linux__
+# include <linux/netlink.h>
+# include <linux/sock_diag.h>
+# include <linux/inet_diag.h>
+#endif
+
+static const char *const NET_SOCKET_TYPE_NAMES[NET_SOCKET_TYPE_MAX] =
+{
+    [NET_SOCKET_TCP4] = "tcp",
+    [NET_SOCKET_TCP6] = "tcp6",
+    [NET_SOCKET_UDP4] = "udp",
+    [NET_SOCKET_UDP6] = "udp6",
+};
+
+bool NetSocketTypeIsIPv6(NetSocketType type)
+{
+    return (type == NET_SOCKET_TCP6 || type == NET_SOCKET_UDP6);
+}
+
+const char *NetSocketTypeToString(NetSocketType type)
+{
+    assert(type < NET_SOCKET_TYPE_MAX);
+    return NET_SOCKET_TYPE_NAMES[type];
+}
+
+const char *NetSocketStateToString(NetSocketState state)
+{
+    switch (state)
+    {
+    case NET_SOCKET_STATE_ESTABLISHED: return "ESTABLISHED";
+    case NET_SOCKET_STATE_SYN_SENT:    return "SYN_SENT";
+    case NET_SOCKET_STATE_SYN_RECV:
+    case NET_SOCKET_STATE_NEW_SYN_RECV: return "SYN_RECV";
+    case NET_SOCKET_STATE_FIN_WAIT1:   return "FIN_WAIT1";
+    case NET_SOCKET_STATE_FIN_WAIT2:   return "FIN_WAIT2";
+    case NET_SOCKET_STATE_TIME_WAIT:   return "TIME_WAIT";
+    case NET_SOCKET_STATE_CLOSE:       return "CLOSE";
+    case NET_SOCKET_STATE_CLOSE_WAIT:  return "CLOSE_WAIT";
+    case NET_SOCKET_STATE_LAST_ACK:    return "LAST_ACK";
+    case NET_SOCKET_STATE_LISTEN:      return "LISTEN";
+    case NET_SOCKET_STATE_CLOSING:     return "CLOSING";
+    default:                           return "UNKNOWN";
+    }
+}
+
+void NetSocketAddressToString(const NetSocket *sock, bool local, char *dst, size_t size)
+{
+    assert(sock != NULL);
+    assert(dst != NULL);
+
+    const uint32_t *addr = local ? sock->local_addr : sock->remote_addr;
+    const int family = NetSocketTypeIsIPv6(sock->type) ? AF_INET6 : AF_INET;
+    if (inet_ntop(family, addr, dst, size) == NULL)
+    {
+        dst[0] = '\0';
+    }
+}
+
+/*******************************************************************/
+/* /proc/net parsing                                               */
+/*******************************************************************/
+
+static const char *ParseHex(const char *s, size_t max_digits, uint32_t *value)
+{
+    uint32_t v = 0;
+    size_t i;
+    for (i = 0; i < max_digits; i++)
+    {
+        const char c = s[i];
+        if (c >= '0' && c <= '9')
+        {
+            v = (v << 4) | (c - '0');
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            v = (v << 4) | (c - 'A' + 10);
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            v = (v << 4) | (c - 'a' + 10);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (i == 0)
+    {
+        return NULL;
+    }
+    *value = v;
+    return s + i;
+}
+
+/**
+ * Parse the ADDR:PORT part of a /proc/net line. The kernel prints the
+ * address as 32-bit words in host byte order so converting them back gives
+ * the in-memory (network byte order) representation.
+ */
+static const char *ParseEndpoint(const char *s, bool ipv6, uint32_t addr[4], uint16_t *port)
+{
+    const size_t words = ipv6 ? 4 : 1;
+    for (size_t i = 0; i < words; i++)
+    {
+        const char *next = ParseHex(s, 8, &addr[i]);
+        if (next == NULL || next != s + 8)
+        {
+            return NULL;
+        }
+        s = next;
+    }
+
+    if (*s != ':')
+    {
+        return NULL;
+    }
+
+    uint32_t p;
+    s = ParseHex(s + 1, 4, &p);
+    if (s == NULL)
+    {
+        return NULL;
+    }
+    *port = p;
+    return s;
+}
+
+static const char *SkipSpaces(const char *s)
+{
+    while (*s == ' ')
+    {
+        s++;
+    }
+    return s;
+}
+
+/* Example data:
+ *   2: B400A8C0:9DAE 38420D1F:01BB 01 00000000:00000000 ... (IPv4)
+ *   0: 00000000000000000000000001000000:0277 00000000000000000000000000000000:0000 0A 00000000:00000000 ... (IPv6)
+ */
+static bool ParseProcNetLine(const char *line, NetSocketType type, NetSocket *sock)
+{
+    const char *s = strchr(line, ':');
+    if (s == NULL)
+    {
+        return false;
+    }
+
+    const bool ipv6 = NetSocketTypeIsIPv6(type);
+    memset(sock, 0, sizeof(*sock));
+    sock->type = type;
+
+    s = ParseEndpoint(SkipSpaces(s + 1), ipv6, sock->local_addr, &sock->local_port);
+    if (s == NULL)
+    {
+        return false;
+    }
+    s = ParseEndpoint(SkipSpaces(s), ipv6, sock->remote_addr, &sock->remote_port);
+    if (s == NULL)
+    {
+        return false;
+    }
+
+    uint32_t state;
+    if (ParseHex(SkipSpaces(s), 2, &state) == NULL)
+    {
+        return false;
+    }
+    sock->state = state;
+    return true;
+}
+
+static bool ProcNetForEach(const char *procdir_root, NetSocketType type,
+                           NetSocketFn fn, void *data)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/proc/net/%s",
+             procdir_root, NetSocketTypeToString(type));
+
+    FILE *fp = safe_fopen(path, "rt");
+    if (fp == NULL)
+    {
+        /* IPv6 may be completely disabled in kernel so this should be
+         * handled gracefully by the callers. */
+        Log(LOG_LEVEL_VERBOSE, "Failed to open '%s' for reading", path);
+        return false;
+    }
+
+    size_t line_size = CF_BUFSIZE;
+    char *line = xmalloc(line_size);
+
+    /* Skip the header */
+    if (CfReadLine(&line, &line_size, fp) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to read data from '%s'", path);
+        free(line);
+        fclose(fp);
+        return false;
+    }
+
+    size_t count = 0;
+    NetSocket sock;
+    while (CfReadLine(&line, &line_size, fp) != -1)
+    {
+        if (ParseProcNetLine(line, type, &sock))
+        {
+            fn(&sock, data);
+            count++;
+        }
+        else
+        {
+            Log(LOG_LEVEL_DEBUG, "Failed to parse line '%s' from '%s'", line, path);
+        }
+    }
+
+    const bool ok = !ferror(fp);
+    if (!ok)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to read data from '%s'", path);
+    }
+    Log(LOG_LEVEL_DEBUG, "Read %zu sockets from '%s'", count, path);
+
+    free(line);
+    fclose(fp);
+    return ok || count > 0;
+}
+
+/*******************************************************************/
+/* NETLINK_SOCK_DIAG                                               */
+/*******************************************************************/
+
+#ifdef __linux__
+
+#define SOCK_DIAG_BUFSIZE (32 * 1024)
+
+/**
+ * Sockets are only passed to #fn once the whole dump was received, so that
+ * a failed dump can be retried from /proc/net.
+ *
+ * @return number of sockets passed to #fn or -1 if the dump failed
+ */
+static ssize_t SockDiagForEach(NetSocketType type, NetSocketFn fn, void *data)
+{
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_DEBUG, "Failed to create NETLINK_SOCK_DIAG socket (socket: %s)",
+            GetErrorStr());
+        return -1;
+    }
+
+    const bool ipv6 = NetSocketTypeIsIPv6(type);
+    const bool tcp = (type == NET_SOCKET_TCP4 || type == NET_SOCKET_TCP6);
+
+    struct
+    {
+        struct nlmsghdr nlh;
+        struct inet_diag_req_v2 req;
+    } request = {
+        .nlh = {
+            .nlmsg_len = sizeof(request),
+            .nlmsg_type = SOCK_DIAG_BY_FAMILY,
+            .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+            .nlmsg_seq = 1,
+        },
+        .req = {
+            .sdiag_family = ipv6 ? AF_INET6 : AF_INET,
+            .sdiag_protocol = tcp ? IPPROTO_TCP : IPPROTO_UDP,
+            .idiag_states = ~0U,                    /* all states */
+        },
+    };
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+
+    if (sendto(fd, &request, sizeof(request), 0,
+               (struct sockaddr *) &kernel, sizeof(kernel)) == -1)
+    {
+        Log(LOG_LEVEL_DEBUG, "Failed to send sock_diag request (sendto: %s)",
+            GetErrorStr());
+        close(fd);
+        return -1;
+    }
+
+    /* long for the alignment of netlink messages */
+    long *buf = xmalloc(SOCK_DIAG_BUFSIZE);
+    size_t count = 0;
+    size_t size = 64;
+    NetSocket *socks = xmalloc(size * sizeof(NetSocket));
+    bool failed = false;
+    bool done = false;
+
+    while (!done && !failed)
+    {
+        ssize_t len = recv(fd, buf, SOCK_DIAG_BUFSIZE, 0);
+        if (len == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (len <= 0)
+        {
+            Log(LOG_LEVEL_DEBUG, "Failed to receive sock_diag data (recv: %s)",
+                GetErrorStr());
+            failed = true;
+            break;
+        }
+
+        for (const struct nlmsghdr *h = (struct nlmsghdr *) buf;
+             NLMSG_OK(h, len);
+             h = NLMSG_NEXT(h, len))
+        {
+            if (h->nlmsg_type == NLMSG_DONE)
+            {
+                done = true;
+                break;
+            }
+            if (h->nlmsg_type == NLMSG_ERROR)
+            {
+                /* e.g. ENOENT if the udp_diag module is not available */
+                const struct nlmsgerr *err = NLMSG_DATA(h);
+                Log(LOG_LEVEL_DEBUG, "sock_diag request for %s sockets failed: %s",
+                    NetSocketTypeToString(type), GetErrorStrFromCode(-err->error));
+                failed = true;
+                break;
+            }
+            if (h->nlmsg_type != SOCK_DIAG_BY_FAMILY ||
+                h->nlmsg_len < NLMSG_LENGTH(sizeof(struct inet_diag_msg)))
+            {
+                continue;
+            }
+
+            if (count == size)
+            {
+                size *= 2;
+                socks = xrealloc(socks, size * sizeof(NetSocket));
+            }
+
+            const struct inet_diag_msg *msg = NLMSG_DATA(h);
+            NetSocket *sock = &socks[count++];
+            sock->type = type;
+            sock->state = msg->idiag_state;
+            sock->local_port = ntohs(msg->id.idiag_sport);
+            sock->remote_port = ntohs(msg->id.idiag_dport);
+            memcpy(sock->local_addr, msg->id.idiag_src, sizeof(sock->local_addr));
+            memcpy(sock->remote_addr, msg->id.idiag_dst, sizeof(sock->remote_addr));
+        }
+    }
+
+    free(buf);
+    close(fd);
+
+    if (failed)
+    {
+        /* An incomplete list is no good, e.g. for the LISTEN ports */
+        Log(LOG_LEVEL_VERBOSE, "sock_diag dump of %s sockets failed after %zu sockets",
+            NetSocketTypeToString(type), count);
+        free(socks);
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        fn(&socks[i], data);
+    }
+    free(socks);
+    return count;
+}
+
+#endif /* __linux__ */
+
+bool NetSocketsForEach(const char *procdir_root, NetSocketType type,
+                       NetSocketFn fn, void *data)
+{
+    assert(procdir_root != NULL);
+    assert(type < NET_SOCKET_TYPE_MAX);
+    assert(fn != NULL);
+
+#ifdef __linux__
+    if (procdir_root[0] == '\0')
+    {
+        ssize_t count = SockDiagForEach(type, fn, data);
+        if (count >= 0)
+        {
+            Log(LOG_LEVEL_DEBUG, "Got %zd %s sockets via sock_diag",
+                count, NetSocketTypeToString(type));
+            return true;
+        }
+        Log(LOG_LEVEL_DEBUG, "Falling back to /proc/net/%s", NetSocketTypeToString(type));
+    }
+#endif
+
+    return ProcNetForEach(procdir_root, type, fn, data);
+}
@@ -0,0 +1,104 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_NET_SOCKETS_H
+#define CFENGINE_NET_SOCKETS_H
+
+#include <platform.h>
+
+/*
+ * Enumeration of the TCP/UDP sockets of the host.
+ *
+ * On Linux the sockets are dumped from the kernel via the NETLINK_SOCK_DIAG
+ * netlink family, falling back to parsing /proc/net/{tcp,tcp6,udp,udp6}
+ * (e.g. when the udp_diag module is not loaded or when the proc directory is
+ * relocated for testing). Sockets are passed to a callback one by one so that
+ * callers can aggregate whatever they need without keeping the (potentially
+ * very long) list of all sockets in memory.
+ */
+
+typedef enum
+{
+    NET_SOCKET_TCP4 = 0,
+    NET_SOCKET_TCP6,
+    NET_SOCKET_UDP4,
+    NET_SOCKET_UDP6,
+    NET_SOCKET_TYPE_MAX,
+} NetSocketType;
+
+/* Socket states as used by the Linux kernel (see include/net/tcp_states.h) */
+typedef enum
+{
+    NET_SOCKET_STATE_UNKNOWN = 0,
+    NET_SOCKET_STATE_ESTABLISHED,
+    NET_SOCKET_STATE_SYN_SENT,
+    NET_SOCKET_STATE_SYN_RECV,
+    NET_SOCKET_STATE_FIN_WAIT1,
+    NET_SOCKET_STATE_FIN_WAIT2,
+    NET_SOCKET_STATE_TIME_WAIT,
+    NET_SOCKET_STATE_CLOSE,
+    NET_SOCKET_STATE_CLOSE_WAIT,
+    NET_SOCKET_STATE_LAST_ACK,
+    NET_SOCKET_STATE_LISTEN,
+    NET_SOCKET_STATE_CLOSING,
+    NET_SOCKET_STATE_NEW_SYN_RECV, /* request sockets, only from sock_diag */
+} NetSocketState;
+
+typedef struct
+{
+    NetSocketType type;
+    NetSocketState state;
+    uint16_t local_port;
+    uint16_t remote_port;
+    /* In network byte order (struct in_addr/in6_addr compatible), only the
+     * first word is used for IPv4 */
+    uint32_t local_addr[4];
+    uint32_t remote_addr[4];
+} NetSocket;
+
+typedef void (*NetSocketFn)(const NetSocket *sock, void *data);
+
+/**
+ * Call #fn for every socket of the given type.
+ *
+ * @param procdir_root  prefix of the /proc directory ("" for the real one),
+ *                      netlink is only used if it is empty
+ * @return false if no information about sockets of the given type could be
+ *         obtained
+ */
+bool NetSocketsForEach(const char *procdir_root, NetSocketType type,
+                       NetSocketFn fn, void *data);
+
+bool NetSocketTypeIsIPv6(NetSocketType type);
+const char *NetSocketTypeToString(NetSocketType type);
+const char *NetSocketStateToString(NetSocketState state);
+
+/**
+ * Write the textual form of the local/remote address of #sock to #dst
+ * (#size should be at least INET6_ADDRSTRLEN).
+ */
+void NetSocketAddressToString(const NetSocket *sock, bool local, char *dst, size_t size);
+
+#endif
@@ -39,6 +39,7 @@
 #include <ip_address.h>
 #include <file_lib.h>
 #include <cleanup.h>
+#include <net_sockets.h>
 
 #ifdef HAVE_SYS_JAIL_H
 # include <sys/jail.h>
@@ -1134,47 +1135,51 @@ static JsonElement *NetworkingIPv6AddressesTiebreaker(JsonElement *prev_item, Js
 
 /*******************************************************************/
 
-static const char* GetPortStateString(ARG_LINUX_ONLY int state)
+static JsonElement *NetSocketEndpointToJson(const NetSocket *sock, bool local)
 {
-# if defined (__linux__)
-    switch (state)
+    const uint32_t *addr = local ? sock->local_addr : sock->remote_addr;
+    const uint16_t port = local ? sock->local_port : sock->remote_port;
+
+    JsonElement *endpoint = JsonObjectCreate(2);
+    char buf[INET6_ADDRSTRLEN];
+
+    if (NetSocketTypeIsIPv6(sock->type))
     {
-    case TCP_ESTABLISHED: return "ESTABLISHED";
-    case TCP_SYN_SENT:    return "SYN_SENT";
-    case TCP_SYN_RECV:    return "SYN_RECV";
-    case TCP_FIN_WAIT1:   return "FIN_WAIT1";
-    case TCP_FIN_WAIT2:   return "FIN_WAIT2";
-    case TCP_TIME_WAIT:   return "TIME_WAIT";
-    case TCP_CLOSE:       return "CLOSE";
-    case TCP_CLOSE_WAIT:  return "CLOSE_WAIT";
-    case TCP_LAST_ACK:    return "LAST_ACK";
-    case TCP_LISTEN:      return "LISTEN";
-    case TCP_CLOSING:     return "CLOSING";
+        // use the same representation as for the other addresses parsed
+        // from the hex strings in /proc
+        xsnprintf(buf, sizeof(buf), "%08X%08X%08X%08X:%04X",
+                  addr[0], addr[1], addr[2], addr[3], port);
+        IPAddress *ip = ParsedIPAddressHex(buf);
+        Buffer *address = NULL;
+        if (ip != NULL)
+        {
+            address = IPAddressGetAddress(ip);
+            IPAddressDestroy(&ip);
+        }
+        JsonObjectAppendString(endpoint, "address", (address != NULL) ? BufferData(address) : "");
+        BufferDestroy(address);
+    }
+    else
+    {
+        NetSocketAddressToString(sock, local, buf, sizeof(buf));
+        JsonObjectAppendString(endpoint, "address", buf);
     }
 
-# endif
-    return "UNKNOWN";
+    xsnprintf(buf, sizeof(buf), "%u", port);
+    JsonObjectAppendString(endpoint, "port", buf);
+
+    return endpoint;
 }
 
-// used in evalfunction.c but defined here so
-// JsonRewriteParsedIPAddress() etc. can stay local
-void NetworkingPortsPostProcessInfo(ARG_UNUSED void *passed_ctx, void *json)
+static void NetworkingConnectionAppend(const NetSocket *sock, void *data)
 {
-    JsonElement *conn = json;
-
-    if (conn != NULL)
-    {
-        JsonRewriteParsedIPAddress(conn, "raw_local", "local", true);
-        JsonRewriteParsedIPAddress(conn, "raw_remote", "remote", true);
-
-        long num_state = JsonExtractParsedNumber(conn, "raw_state", "temp_state", false, false);
+    JsonElement *connections = data;
 
-        if (JsonObjectGetAsString(conn, "temp_state") != NULL)
-        {
-            JsonObjectRemoveKey(conn, "temp_state");
-            JsonObjectAppendString(conn, "state", GetPortStateString(num_state));
-        }
-    }
+    JsonElement *conn = JsonObjectCreate(3);
+    JsonObjectAppendElement(conn, "local", NetSocketEndpointToJson(sock, true));
+    JsonObjectAppendElement(conn, "remote", NetSocketEndpointToJson(sock, false));
+    JsonObjectAppendString(conn, "state", NetSocketStateToString(sock->state));
+    JsonArrayAppendObject(connections, conn);
 }
 
 /*******************************************************************/
@@ -1496,43 +1501,25 @@ void GetNetworkingInfo(EvalContext *ctx)
     BufferDestroy(pbuf);
 }
 
-JsonElement* GetNetworkingConnections(EvalContext *ctx)
+JsonElement* GetNetworkingConnections(ARG_UNUSED EvalContext *ctx)
 {
     const char *procdir_root = GetRelocatedProcdirRoot();
-    JsonElement *json = JsonObjectCreate(5);
-    const char* ports_regex = "^\\s*\\d+:\\s+(?<raw_local>[0-9A-F:]+)\\s+(?<raw_remote>[0-9A-F:]+)\\s+(?<raw_state>[0-9]+)";
+    JsonElement *json = JsonObjectCreate(NET_SOCKET_TYPE_MAX);
 
-    JsonElement *data = NULL;
-    Buffer *pbuf = BufferNew();
-
-    BufferPrintf(pbuf, "%s/proc/net/tcp", procdir_root);
-    data = GetProcFileInfo(ctx, BufferData(pbuf), NULL, NULL, &NetworkingPortsPostProcessInfo, NULL, ports_regex);
-    if (data != NULL)
-    {
-        JsonObjectAppendElement(json, "tcp", data);
-    }
-
-    BufferPrintf(pbuf, "%s/proc/net/tcp6", procdir_root);
-    data = GetProcFileInfo(ctx, BufferData(pbuf), NULL, NULL, &NetworkingPortsPostProcessInfo, NULL, ports_regex);
-    if (data != NULL)
-    {
-        JsonObjectAppendElement(json, "tcp6", data);
-    }
-
-    BufferPrintf(pbuf, "%s/proc/net/udp", procdir_root);
-    data = GetProcFileInfo(ctx, BufferData(pbuf), NULL, NULL, &NetworkingPortsPostProcessInfo, NULL, ports_regex);
-    if (data != NULL)
-    {
-        JsonObjectAppendElement(json, "udp", data);
-    }
-
-    BufferPrintf(pbuf, "%s/proc/net/udp6", procdir_root);
-    data = GetProcFileInfo(ctx, BufferData(pbuf), NULL, NULL, &NetworkingPortsPostProcessInfo, NULL, ports_regex);
-    if (data != NULL)
+    const NetSocketType types[] = { NET_SOCKET_TCP4, NET_SOCKET_TCP6,
+                                    NET_SOCKET_UDP4, NET_SOCKET_UDP6 };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
     {
-        JsonObjectAppendElement(json, "udp6", data);
+        JsonElement *data = JsonArrayCreate(64);
+        if (NetSocketsForEach(procdir_root, types[i], &NetworkingConnectionAppend, data))
+        {
+            JsonObjectAppendArray(json, NetSocketTypeToString(types[i]), data);
+        }
+        else
+        {
+            JsonDestroy(data);
+        }
     }
-    BufferDestroy(pbuf);
 
     if (JsonLength(json) < 1)
     {
@@ -451,6 +451,12 @@ DirectoryRecursion GetRecursionConstraints(const EvalContext *ctx, const Promise
     r.include_dirs = PromiseGetConstraintAsList(ctx, "include_dirs", pp);
     r.exclude_dirs = PromiseGetConstraintAsList(ctx, "exclude_dirs", pp);
     r.include_basedir = PromiseGetConstraintAsBoolean(ctx, "include_basedir", pp);
+    r.scan_threads = PromiseGetConstraintAsInt(ctx, "scan_threads", pp);
+
+    if (r.scan_threads == CF_NOINT)
+    {
+        r.scan_threads = 0;
+    }
     return r;
 }
 
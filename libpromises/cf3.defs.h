@@ -95,6 +95,7 @@
 #define CF_ENV_FILE      "env_data"
 
 #define CF_DB_REPAIR_TRIGGER "db_repair_required"
+#define CF_DB_CONFIG_FILE "db_config.json"
 
 #define CF_SAVED ".cfsaved"
 #define CF_EDITED ".cfedited"
@@ -902,6 +903,7 @@ typedef struct
     int include_basedir;
     Rlist *include_dirs;
     Rlist *exclude_dirs;
+    int scan_threads;
 } DirectoryRecursion;
 
 /*************************************************************************/
@@ -26,7 +26,7 @@
 #include <map.h>
 #include <alloc.h>
 #include <string_lib.h> /* String*() */
-#include <regex.h>      /* CompileRegex,StringMatchFullWithPrecompiledRegex */
+#include <regex_cache.h> /* RegexCacheGet,CachedRegexMatchFull */
 #include <files_names.h>
 
 
@@ -174,10 +174,7 @@ Class *ClassTableGet(const ClassTable *table, const char *ns, const char *name)
 
 Class *ClassTableMatch(const ClassTable *table, const char *regex)
 {
-    ClassTableIterator *it = ClassTableIteratorNew(table, NULL, true, true);
-    Class *cls = NULL;
-
-    pcre *pattern = CompileRegex(regex);
+    CachedRegex *pattern = RegexCacheGet(regex);
     if (pattern == NULL)
     {
         // TODO: perhaps pcre has can give more info on this error?
@@ -185,18 +182,21 @@ Class *ClassTableMatch(const ClassTable *table, const char *regex)
         return NULL;
     }
 
+    ClassTableIterator *it = ClassTableIteratorNew(table, NULL, true, true);
+    Class *cls = NULL;
+
     while ((cls = ClassTableIteratorNext(it)))
     {
         bool matched;
         if (cls->ns)
         {
             char *class_expr = ClassRefToString(cls->ns, cls->name);
-            matched = StringMatchFullWithPrecompiledRegex(pattern, class_expr);
+            matched = CachedRegexMatchFull(pattern, class_expr);
             free(class_expr);
         }
         else
         {
-            matched = StringMatchFullWithPrecompiledRegex(pattern, cls->name);
+            matched = CachedRegexMatchFull(pattern, cls->name);
         }
 
         if (matched)
@@ -205,7 +205,7 @@ Class *ClassTableMatch(const ClassTable *table, const char *regex)
         }
     }
 
-    pcre_free(pattern);
+    RegexCacheRelease(pattern);
 
     ClassTableIteratorDestroy(it);
     return cls;
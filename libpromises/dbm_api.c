@@ -52,9 +52,13 @@ struct DBHandle_
     /* Actual database-specific data */
     DBPriv *priv;
 
+    /* Number of OpenDB() calls not matched by CloseDB() yet. Changes from and
+     * to 0 (opening and closing .priv) are only done with .lock held, other
+     * changes are lock-free where atomics are available, see RefcountAdd*(). */
     int refcount;
 
-    /* This lock protects initialization of .priv element, and .refcount manipulation */
+    /* This lock protects initialization of .priv element, and .refcount
+     * changes from and to 0 */
     pthread_mutex_t lock;
 
     /* Record when the DB was opened (to check if possible corruptions are
@@ -93,6 +97,77 @@ static pthread_once_t db_shutdown_once = PTHREAD_ONCE_INIT; /* GLOBAL_T */
 
 /******************************************************************************/
 
+/*
+ * Threaded daemons (cf-serverd) open and close the same few DBs all the time
+ * from many threads. Once a DB is open, the handle registry is only read and
+ * the refcount is only changed between non-zero values, which is done with
+ * atomic operations without taking any lock if the compiler supports them.
+ * Handles are never freed before exit, so a pointer to a handle obtained
+ * without the lock stays valid.
+ */
+#if defined(__ATOMIC_ACQUIRE) && defined(__ATOMIC_RELEASE)
+# define DB_HANDLE_LOCK_FREE 1
+
+# define AtomicLoadPtr(ptr)         __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+# define AtomicStorePtr(ptr, val)   __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
+static inline int RefcountGet(DBHandle *handle)
+{
+    return __atomic_load_n(&handle->refcount, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Change the refcount by #delta. Always done with handle->lock held.
+ * @return the new refcount
+ */
+static inline int RefcountAdd(DBHandle *handle, int delta)
+{
+    return __atomic_add_fetch(&handle->refcount, delta, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * Change the refcount by #delta if it doesn't change it from or to 0.
+ * @return whether the refcount was changed
+ */
+static inline bool RefcountAddIfOpen(DBHandle *handle, int delta)
+{
+    int count = __atomic_load_n(&handle->refcount, __ATOMIC_ACQUIRE);
+    while (count > 0 && (count + delta) > 0)
+    {
+        if (__atomic_compare_exchange_n(&handle->refcount, &count, count + delta,
+                                        true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            return true;
+        }
+        /* count was updated to the current value, try again */
+    }
+    return false;
+}
+
+#else  /* no atomics, everything is done with the locks held */
+
+# define AtomicLoadPtr(ptr)         (*(ptr))
+# define AtomicStorePtr(ptr, val)   (*(ptr) = (val))
+
+static inline int RefcountGet(DBHandle *handle)
+{
+    return handle->refcount;
+}
+
+static inline int RefcountAdd(DBHandle *handle, int delta)
+{
+    handle->refcount += delta;
+    return handle->refcount;
+}
+
+static inline bool RefcountAddIfOpen(ARG_UNUSED DBHandle *handle, ARG_UNUSED int delta)
+{
+    return false;
+}
+#endif
+
+/******************************************************************************/
+
 // Only append to the end, keep in sync with dbid enum in dbm_api.h
 static const char *const DB_PATHS_STATEDIR[] = {
     [dbid_classes] = "cf_classes",
@@ -119,6 +194,7 @@ static const char *const DB_PATHS_STATEDIR[] = {
     [dbid_packages_installed] = "packages_installed",
     [dbid_packages_updates] = "packages_updates",
     [dbid_cookies] = "nova_cookies",
+    [dbid_timeseries] = "cf_timeseries",
 };
 
 /*
@@ -199,33 +275,48 @@ char *DBIdToPath(dbid id)
     return native_filename;
 }
 
-static
-bool IsSubHandle(DBHandle *handle, dbid id, const char *name)
+static DBHandle *FindSubHandle(DynamicDBHandles *handles_list, const char *sub_path)
 {
-    char *sub_path = DBIdToSubPath(id, name);
-    bool result = StringEqual(handle->filename, sub_path);
-    free(sub_path);
-    return result;
+    while (handles_list != NULL)
+    {
+        if (StringEqual(handles_list->handle->filename, sub_path))
+        {
+            return handles_list->handle;
+        }
+        handles_list = handles_list->next;
+    }
+    return NULL;
 }
 
 static DBHandle *DBHandleGetSubDB(dbid id, const char *name)
 {
+    char *sub_path = DBIdToSubPath(id, name);
+    DBHandle *handle;
+
+#ifdef DB_HANDLE_LOCK_FREE
+    /* The list is only ever prepended to (until exit), so it can be searched
+     * without the lock. */
+    handle = FindSubHandle(AtomicLoadPtr(&db_dynamic_handles), sub_path);
+    if (handle != NULL)
+    {
+        free(sub_path);
+        return handle;
+    }
+#endif
+
     ThreadLock(&db_handles_lock);
 
     DynamicDBHandles *handles_list = db_dynamic_handles;
-
-    while (handles_list)
+    handle = FindSubHandle(handles_list, sub_path);
+    if (handle != NULL)
     {
-        if (IsSubHandle(handles_list->handle, id, name))
-        {
-            ThreadUnlock(&db_handles_lock);
-            return handles_list->handle;
-        }
-        handles_list = handles_list->next;
+        ThreadUnlock(&db_handles_lock);
+        free(sub_path);
+        return handle;
     }
 
-    DBHandle *handle = xcalloc(1, sizeof(DBHandle));
-    handle->filename = DBIdToSubPath(id, name);
+    handle = xcalloc(1, sizeof(DBHandle));
+    handle->filename = sub_path;
     handle->subname = SafeStringDuplicate(name);
 
     /* Initialize mutexes as error-checking ones. */
@@ -239,7 +330,7 @@ static DBHandle *DBHandleGetSubDB(dbid id, const char *name)
     handles_list = xcalloc(1, sizeof(DynamicDBHandles));
     handles_list->handle = handle;
     handles_list->next = db_dynamic_handles;
-    db_dynamic_handles = handles_list;
+    AtomicStorePtr(&db_dynamic_handles, handles_list);
 
     ThreadUnlock(&db_handles_lock);
 
@@ -250,17 +341,25 @@ static DBHandle *DBHandleGet(int id)
 {
     assert(id >= 0 && id < dbid_max);
 
+#ifdef DB_HANDLE_LOCK_FREE
+    /* .filename is only set once the handle is fully initialized */
+    if (AtomicLoadPtr(&db_handles[id].filename) != NULL)
+    {
+        return &db_handles[id];
+    }
+#endif
+
     ThreadLock(&db_handles_lock);
     if (db_handles[id].filename == NULL)
     {
-        db_handles[id].filename = DBIdToPath(id);
-
         /* Initialize mutexes as error-checking ones. */
         pthread_mutexattr_t attr;
         pthread_mutexattr_init(&attr);
         pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
         pthread_mutex_init(&db_handles[id].lock, &attr);
         pthread_mutexattr_destroy(&attr);
+
+        AtomicStorePtr(&db_handles[id].filename, DBIdToPath(id));
     }
 
     ThreadUnlock(&db_handles_lock);
@@ -282,7 +381,7 @@ void CloseDBInstance(DBHandle *handle)
         ThreadUnlock(&handle->lock);
         return;
     }
-    while (handle->refcount > 0 && count < 1000)
+    while (RefcountGet(handle) > 0 && count < 1000)
     {
         ThreadUnlock(&handle->lock);
 
@@ -298,11 +397,11 @@ void CloseDBInstance(DBHandle *handle)
     /* Keep mutex locked. */
 
     /* If we exited because of timeout make sure we Log() it. */
-    if (handle->refcount != 0)
+    if (RefcountGet(handle) != 0)
     {
         Log(LOG_LEVEL_ERR,
                 "Database %s refcount is still not zero (%d), forcing CloseDB()!",
-                handle->filename, handle->refcount);
+                handle->filename, RefcountGet(handle));
         DBPrivCloseDB(handle->priv);
     }
     else /* TODO: can we clean this up unconditionally ? */
@@ -372,6 +471,13 @@ bool OpenDBInstance(DBHandle **dbp, dbid id, DBHandle *handle)
 {
     assert(handle != NULL);
 
+    /* Fast path: the DB is already open, just take another reference. */
+    if (!handle->frozen && RefcountAddIfOpen(handle, 1))
+    {
+        *dbp = handle;
+        return true;
+    }
+
     ThreadLock(&handle->lock);
     if (handle->frozen)
     {
@@ -379,7 +485,7 @@ bool OpenDBInstance(DBHandle **dbp, dbid id, DBHandle *handle)
         ThreadUnlock(&handle->lock);
         return false;
     }
-    if (handle->refcount == 0)
+    if (RefcountGet(handle) == 0)
     {
         FileLock lock = EMPTY_FILE_LOCK;
         if (DBPathLock(&lock, handle->filename))
@@ -413,7 +519,7 @@ bool OpenDBInstance(DBHandle **dbp, dbid id, DBHandle *handle)
 
     if (handle->priv)
     {
-        handle->refcount++;
+        RefcountAdd(handle, 1);
         *dbp = handle;
 
         /* Only register shutdown handler if any database was opened
@@ -469,10 +575,48 @@ time_t GetDBOpenTimestamp(const DBHandle *handle)
     return handle->open_tstamp;
 }
 
+/**
+ * @return how many times the (open) DB was resized since it was opened
+ */
+unsigned int GetDBMapResizes(DBHandle *handle)
+{
+    assert(handle != NULL);
+    assert(handle->priv != NULL);
+    return DBPrivGetMapResizes(handle->priv);
+}
+
+/**
+ * Commit the changes made by this thread so far, the DB stays open.
+ *
+ * @return false if they were not all recorded
+ */
+bool CommitDB(DBHandle *handle)
+{
+    assert(handle != NULL);
+
+    if (handle->frozen)
+    {
+        return false;
+    }
+    return DBPrivCommit(handle->priv);
+}
+
 void CloseDB(DBHandle *handle)
 {
     assert(handle != NULL);
 
+    /* Fast path: other references remain, the DB stays open. The
+     * transaction of this thread is committed while we still hold our
+     * reference. */
+    if (!handle->frozen && RefcountGet(handle) > 1)
+    {
+        DBPrivCommit(handle->priv);
+        if (RefcountAddIfOpen(handle, -1))
+        {
+            return;
+        }
+    }
+
     /* Skip in case of nested locking, for example signal handler.
      * DB behaviour becomes erratic otherwise (CFE-1996). */
     ThreadLock(&handle->lock);
@@ -486,20 +630,17 @@ void CloseDB(DBHandle *handle)
     }
     DBPrivCommit(handle->priv);
 
-    if (handle->refcount < 1)
+    if (RefcountGet(handle) < 1)
     {
         Log(LOG_LEVEL_ERR,
                 "Trying to close database which is not open: %s",
                 handle->filename);
     }
-    else
+    else if (RefcountAdd(handle, -1) == 0)
     {
-        handle->refcount--;
-        if (handle->refcount == 0)
-        {
-            DBPrivCloseDB(handle->priv);
-            handle->open_tstamp = -1;
-        }
+        /* Nobody can take a new reference without the lock now. */
+        DBPrivCloseDB(handle->priv);
+        handle->open_tstamp = -1;
     }
 
     ThreadUnlock(&handle->lock);
@@ -621,6 +762,14 @@ bool DeleteDBCursor(DBCursor *cursor)
     return true;
 }
 
+bool ScanDBSnapshot(DBHandle *handle, DBSnapshotCallback callback, void *data)
+{
+    assert(handle != NULL);
+    assert(callback != NULL);
+
+    return DBPrivScanSnapshot(handle->priv, callback, data);
+}
+
 static bool DBPathLock(FileLock *lock, const char *filename)
 {
     char *filename_lock;
@@ -662,48 +811,45 @@ static void DBPathMoveBroken(const char *filename)
     free(filename_broken);
 }
 
+static bool LoadEntryToStringMap(const void *key, int key_size,
+                                 const void *value, int value_size,
+                                 void *data)
+{
+    StringMap *db_map = data;
+
+    /* key is not necessarily NUL-terminated in the DB's memory */
+    char *key_str = xstrndup(key, key_size);
+
+    if (value_size == 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Invalid entry (key='%s') in database.", key_str);
+        free(key_str);
+        return true;
+    }
+
+    StringMapInsert(db_map, key_str, xmemdup(value, value_size));
+
+    return true;
+}
+
 StringMap *LoadDatabaseToStringMap(dbid database_id)
 {
     CF_DB *db_conn = NULL;
-    CF_DBC *db_cursor = NULL;
-    char *key = NULL;
-    void *value = NULL;
-    int key_size = 0;
-    int value_size = 0;
 
     if (!OpenDB(&db_conn, database_id))
     {
         return NULL;
     }
 
-    if (!NewDBCursor(db_conn, &db_cursor))
+    StringMap *db_map = StringMapNew();
+    if (!ScanDBSnapshot(db_conn, LoadEntryToStringMap, db_map))
     {
         Log(LOG_LEVEL_ERR, "Unable to scan db");
+        StringMapDestroy(db_map);
         CloseDB(db_conn);
         return NULL;
     }
 
-    StringMap *db_map = StringMapNew();
-    while (NextDB(db_cursor, &key, &key_size, &value, &value_size))
-    {
-        if (!key)
-        {
-            continue;
-        }
-
-        if (!value)
-        {
-            Log(LOG_LEVEL_VERBOSE, "Invalid entry (key='%s') in database.", key);
-            continue;
-        }
-
-        void *val = xcalloc(1, value_size);
-        val = memcpy(val, value, value_size);
-
-        StringMapInsert(db_map, xstrdup(key), val);
-    }
-
-    DeleteDBCursor(db_cursor);
     CloseDB(db_conn);
 
     return db_map;
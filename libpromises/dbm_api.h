@@ -58,6 +58,7 @@ typedef enum
     dbid_packages_installed, //new package promise installed packages list
     dbid_packages_updates,   //new package promise list of available updates
     dbid_cookies, // Enterprise reporting cookies for duplicate host detection
+    dbid_timeseries, // cf-monitord history, see time_series.h
 
     dbid_max
 } dbid;
@@ -73,10 +74,12 @@ void DBSetMaximumConcurrentTransactions(int max_txn);
 bool OpenDB(CF_DB **dbp, dbid db);
 bool OpenSubDB(DBHandle **dbp, dbid id, const char *sub_name);
 bool CleanDB(DBHandle *handle);
+bool CommitDB(DBHandle *handle);
 void CloseDB(CF_DB *dbp);
 
 DBHandle *GetDBHandleFromFilename(const char *db_file_name);
 time_t GetDBOpenTimestamp(const DBHandle *handle);
+unsigned int GetDBMapResizes(DBHandle *handle);
 
 bool HasKeyDB(CF_DB *dbp, const char *key, int key_size);
 int ValueSizeDB(CF_DB *dbp, const char *key, int key_size);
@@ -104,6 +107,15 @@ bool DBCursorDeleteEntry(CF_DBC *cursor);
 bool DBCursorWriteEntry(CF_DBC *cursor, const void *value, int value_size);
 bool DeleteDBCursor(CF_DBC *dbcp);
 
+/*
+ * Read-only alternative to cursors for reporting and scanning code. Unlike
+ * NewDBCursor() it doesn't take a write transaction (so it doesn't block or
+ * get blocked by writers) and it doesn't copy the records.
+ *
+ * Don't use any DB operations on the same database from the callback.
+ */
+bool ScanDBSnapshot(CF_DB *dbp, DBSnapshotCallback callback, void *data);
+
 char *DBIdToPath(dbid id);
 char *DBIdToSubPath(dbid id, const char *subdb_name);
 
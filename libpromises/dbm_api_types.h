@@ -27,4 +27,13 @@
 
 typedef bool (*OverwriteCondition) (void *value, size_t value_size, void *data);
 
+/**
+ * Callback used by ScanDBSnapshot(). @key and @value point directly to the
+ * database's storage and are only valid for the duration of the call (and
+ * not necessarily aligned). Return false to stop the scan.
+ */
+typedef bool (*DBSnapshotCallback) (const void *key, int key_size,
+                                    const void *value, int value_size,
+                                    void *data);
+
 #endif /* CFENGINE_DBM_API_TYPES_H */
@@ -41,6 +41,8 @@
 #include <repair.h>
 #include <global_mutex.h> /* cf_db_corruption_lock */
 #include <mutex.h>
+#include <json.h>
+#include <files_names.h>      /* ReadLastNode() */
 #include <time.h>               /* time() */
 
 // Shared between threads.
@@ -52,6 +54,13 @@ struct DBPriv_
     // We set this to the transaction address when a thread creates a
     // transaction, and back to 0x0 when it is destroyed.
     pthread_key_t txn_key;
+    // Number of transactions (being) opened by all threads, the map can only
+    // be resized when there are none.
+    int active_txns;
+    pthread_mutex_t txn_count_lock;
+    // Limit for growing the map on MDB_MAP_FULL.
+    size_t max_map_size;
+    unsigned int map_resizes;
 };
 
 // Not shared between threads.
@@ -61,6 +70,15 @@ typedef struct DBTxn_
     // Whether txn is a read/write (true) or read-only (false) transaction.
     bool rw_txn;
     bool cursor_open;
+    // Whether anything was written in txn, i.e. whether aborting it loses
+    // more than the write being done.
+    bool modified;
+    // Whether a transaction with changes was aborted since the last commit,
+    // reported by DBPrivCommit().
+    bool discarded;
+    // For keeping the count of active transactions right in
+    // DestroyTransaction().
+    DBPriv *db;
 } DBTxn;
 
 struct DBCursorPriv_
@@ -88,6 +106,81 @@ static inline void CheckLMDBCorrupted(int rc, MDB_env *env)
     }
 }
 
+static inline void TxnStarted(DBPriv *const db)
+{
+    pthread_mutex_lock(&db->txn_count_lock);
+    db->active_txns++;
+    pthread_mutex_unlock(&db->txn_count_lock);
+}
+
+static inline void TxnFinished(DBPriv *const db)
+{
+    pthread_mutex_lock(&db->txn_count_lock);
+    assert(db->active_txns > 0);
+    db->active_txns--;
+    pthread_mutex_unlock(&db->txn_count_lock);
+}
+
+/**
+ * Set the size of the memory map, 0 means adopting the size set by another
+ * process. LMDB requires that there are no active transactions in this
+ * process, so this fails if any other thread is using the DB.
+ */
+static bool ResizeMap(DBPriv *const db, const size_t new_size)
+{
+    bool resized = false;
+
+    pthread_mutex_lock(&db->txn_count_lock);
+    if (db->active_txns == 0)
+    {
+        const int rc = mdb_env_set_mapsize(db->env, new_size);
+        if (rc == MDB_SUCCESS)
+        {
+            db->map_resizes++;
+            resized = true;
+        }
+        else
+        {
+            Log(LOG_LEVEL_ERR, "Could not set mapsize for database %s: %s",
+                (char *) mdb_env_get_userctx(db->env), mdb_strerror(rc));
+        }
+    }
+    pthread_mutex_unlock(&db->txn_count_lock);
+
+    return resized;
+}
+
+/**
+ * Like mdb_txn_begin(), but also keeps track of the transaction and handles
+ * the map being grown by another process.
+ *
+ * @note The transaction has to be ended with TxnFinished() after
+ *       committing/aborting it.
+ */
+static int BeginTransaction(DBPriv *const db, const unsigned int flags, MDB_txn **const txn)
+{
+    /* Counted before it's actually open so that a thread waiting for the
+     * write lock in mdb_txn_begin() prevents others from resizing the map. */
+    TxnStarted(db);
+    int rc = mdb_txn_begin(db->env, NULL, flags, txn);
+    if (rc == MDB_MAP_RESIZED)
+    {
+        TxnFinished(db);
+        if (ResizeMap(db, 0))
+        {
+            Log(LOG_LEVEL_VERBOSE, "Map of database '%s' was grown by another process",
+                (char *) mdb_env_get_userctx(db->env));
+        }
+        TxnStarted(db);
+        rc = mdb_txn_begin(db->env, NULL, flags, txn);
+    }
+    if (rc != MDB_SUCCESS)
+    {
+        TxnFinished(db);
+    }
+    return rc;
+}
+
 static int GetReadTransaction(DBPriv *const db, DBTxn **const txn)
 {
     assert(db != NULL);
@@ -99,12 +192,13 @@ static int GetReadTransaction(DBPriv *const db, DBTxn **const txn)
     if (db_txn == NULL)
     {
         db_txn = xcalloc(1, sizeof(DBTxn));
+        db_txn->db = db;
         pthread_setspecific(db->txn_key, db_txn);
     }
 
     if (db_txn->txn == NULL)
     {
-        rc = mdb_txn_begin(db->env, NULL, MDB_RDONLY, &db_txn->txn);
+        rc = BeginTransaction(db, MDB_RDONLY, &db_txn->txn);
         if (rc != MDB_SUCCESS)
         {
             Log(LOG_LEVEL_ERR, "Unable to open read transaction in '%s': %s",
@@ -128,12 +222,14 @@ static int GetWriteTransaction(DBPriv *const db, DBTxn **const txn)
     if (db_txn == NULL)
     {
         db_txn = xcalloc(1, sizeof(DBTxn));
+        db_txn->db = db;
         pthread_setspecific(db->txn_key, db_txn);
     }
 
     if (db_txn->txn != NULL && !db_txn->rw_txn)
     {
         rc = mdb_txn_commit(db_txn->txn);
+        TxnFinished(db);
         CheckLMDBCorrupted(rc, db->env);
         if (rc != MDB_SUCCESS)
         {
@@ -145,11 +241,12 @@ static int GetWriteTransaction(DBPriv *const db, DBTxn **const txn)
 
     if (db_txn->txn == NULL)
     {
-        rc = mdb_txn_begin(db->env, NULL, 0, &db_txn->txn);
+        rc = BeginTransaction(db, 0, &db_txn->txn);
         CheckLMDBCorrupted(rc, db->env);
         if (rc == MDB_SUCCESS)
         {
             db_txn->rw_txn = true;
+            db_txn->modified = false;
         }
         else
         {
@@ -173,10 +270,24 @@ static void AbortTransaction(DBPriv *const db)
         if (db_txn->txn != NULL)
         {
             mdb_txn_abort(db_txn->txn);
+            TxnFinished(db);
         }
 
-        pthread_setspecific(db->txn_key, NULL);
-        free(db_txn);
+        if (db_txn->modified || db_txn->discarded)
+        {
+            /* Keep the object around until the commit reports the lost
+             * changes, further operations start a new transaction. */
+            db_txn->txn = NULL;
+            db_txn->rw_txn = false;
+            db_txn->cursor_open = false;
+            db_txn->modified = false;
+            db_txn->discarded = true;
+        }
+        else
+        {
+            pthread_setspecific(db->txn_key, NULL);
+            free(db_txn);
+        }
     }
 }
 
@@ -188,6 +299,7 @@ static void DestroyTransaction(void *const ptr)
     {
         UnexpectedError("Transaction still open when terminating thread!");
         mdb_txn_abort(db_txn->txn);
+        TxnFinished(db_txn->db);
     }
     free(db_txn);
 }
@@ -201,11 +313,218 @@ const char *DBPrivGetFileExtension(void)
 #define LMDB_MAXSIZE    104857600
 #endif
 
+/* How big the map of a DB can grow on MDB_MAP_FULL by default. */
+#ifndef LMDB_MAXSIZE_LIMIT
+#define LMDB_MAXSIZE_LIMIT (16 * (size_t) LMDB_MAXSIZE)
+#endif
+
 void DBPrivSetMaximumConcurrentTransactions(const int max_txn)
 {
     DB_MAX_READERS = max_txn;
 }
 
+/******************************************************************************/
+
+typedef enum
+{
+    LMDB_SYNC_DEFAULT,          /* see DBPrivOpenDB() */
+    LMDB_SYNC_ON,
+    LMDB_SYNC_OFF,
+} LMDBSyncMode;
+
+typedef struct
+{
+    size_t map_size;
+    size_t max_map_size;
+    LMDBSyncMode sync;
+    int max_readers;
+} LMDBTuning;
+
+static JsonElement *DB_CONFIG = NULL; /* GLOBAL_X */
+static pthread_once_t db_config_once = PTHREAD_ONCE_INIT; /* GLOBAL_T */
+
+/**
+ * Load the per-database tuning from $(workdir)/db_config.json, e.g.:
+ *
+ * {
+ *   "default":     { "max_map_size_mb": 1024 },
+ *   "cf_lastseen": { "map_size_mb": 512, "max_map_size_mb": 4096, "sync": false },
+ *   "cf_lock":     { "map_size_mb": 16, "max_readers": 64 }
+ * }
+ *
+ * Databases are identified by their file names without the extension.
+ */
+static void LoadDBConfig(void)
+{
+    char *config_file = StringFormat("%s%c%s", GetWorkDir(), FILE_SEPARATOR,
+                                     CF_DB_CONFIG_FILE);
+    JsonElement *config = NULL;
+    const JsonParseError err = JsonParseFile(config_file, CF_BUFSIZE * 4, &config);
+    if (err == JSON_PARSE_OK && JsonGetType(config) == JSON_TYPE_OBJECT)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Loaded database configuration from '%s'",
+            config_file);
+        DB_CONFIG = config;
+    }
+    else
+    {
+        if (err != JSON_PARSE_ERROR_NO_SUCH_FILE)
+        {
+            Log(LOG_LEVEL_ERR, "Could not load database configuration from '%s': %s",
+                config_file, (err != JSON_PARSE_OK) ? JsonParseErrorToString(err)
+                                                    : "not a JSON object");
+        }
+        if (config != NULL)
+        {
+            JsonDestroy(config);
+        }
+    }
+    free(config_file);
+}
+
+static bool GetConfigInteger(const JsonElement *section, const char *key, long *value)
+{
+    JsonElement *element = JsonObjectGet(section, key);
+    if (element == NULL)
+    {
+        return false;
+    }
+    if (JsonGetElementType(element) != JSON_ELEMENT_TYPE_PRIMITIVE ||
+        JsonGetPrimitiveType(element) != JSON_PRIMITIVE_TYPE_INTEGER ||
+        JsonPrimitiveGetAsInteger(element) <= 0)
+    {
+        Log(LOG_LEVEL_ERR, "Invalid value for '%s' in %s, expected positive integer",
+            key, CF_DB_CONFIG_FILE);
+        return false;
+    }
+    *value = JsonPrimitiveGetAsInteger(element);
+    return true;
+}
+
+static void ApplyDBConfigSection(LMDBTuning *const tuning, const char *const name)
+{
+    JsonElement *section = JsonObjectGet(DB_CONFIG, name);
+    if (section == NULL)
+    {
+        return;
+    }
+    if (JsonGetType(section) != JSON_TYPE_OBJECT)
+    {
+        Log(LOG_LEVEL_ERR, "Invalid configuration for '%s' in %s, expected object",
+            name, CF_DB_CONFIG_FILE);
+        return;
+    }
+
+    long value;
+    if (GetConfigInteger(section, "map_size_mb", &value))
+    {
+        tuning->map_size = (size_t) value * 1024 * 1024;
+    }
+    if (GetConfigInteger(section, "max_map_size_mb", &value))
+    {
+        tuning->max_map_size = (size_t) value * 1024 * 1024;
+    }
+    if (GetConfigInteger(section, "max_readers", &value))
+    {
+        tuning->max_readers = MIN(value, INT_MAX);
+    }
+
+    JsonElement *sync = JsonObjectGet(section, "sync");
+    if (sync != NULL)
+    {
+        if (JsonGetElementType(sync) == JSON_ELEMENT_TYPE_PRIMITIVE &&
+            JsonGetPrimitiveType(sync) == JSON_PRIMITIVE_TYPE_BOOL)
+        {
+            tuning->sync = JsonPrimitiveGetAsBool(sync) ? LMDB_SYNC_ON : LMDB_SYNC_OFF;
+        }
+        else
+        {
+            Log(LOG_LEVEL_ERR, "Invalid value for 'sync' in %s, expected boolean",
+                CF_DB_CONFIG_FILE);
+        }
+    }
+}
+
+static void GetDBTuning(const char *const dbpath, LMDBTuning *const tuning)
+{
+    tuning->map_size = LMDB_MAXSIZE;
+    tuning->max_map_size = LMDB_MAXSIZE_LIMIT;
+    tuning->sync = LMDB_SYNC_DEFAULT;
+    tuning->max_readers = DB_MAX_READERS;
+
+    pthread_once(&db_config_once, LoadDBConfig);
+    if (DB_CONFIG != NULL)
+    {
+        const char *const file_name = ReadLastNode(dbpath);
+        char *db_name = xstrdup(file_name);
+        char *extension = strrchr(db_name, '.');
+        if (extension != NULL)
+        {
+            *extension = '\0';
+        }
+
+        ApplyDBConfigSection(tuning, "default");
+        ApplyDBConfigSection(tuning, db_name);
+        free(db_name);
+    }
+
+    if (tuning->max_map_size < tuning->map_size)
+    {
+        tuning->max_map_size = tuning->map_size;
+    }
+}
+
+/**
+ * Grow the map of a DB after a write failed with MDB_MAP_FULL.
+ *
+ * The failed write transaction of this thread is aborted first (LMDB doesn't
+ * allow anything else with it), so all its uncommitted changes are lost the
+ * same way as with any other failed write. The write can only be retried if
+ * it was the first one in the transaction (#retry), otherwise the caller has
+ * to redo the whole transaction.
+ */
+static bool GrowMap(DBPriv *const db, const bool retry)
+{
+    const char *const db_path = mdb_env_get_userctx(db->env);
+
+    AbortTransaction(db);
+    if (!retry)
+    {
+        Log(LOG_LEVEL_ERR, "Uncommitted changes to database %s were discarded, "
+            "it is full", db_path);
+    }
+
+    MDB_envinfo info;
+    int rc = mdb_env_info(db->env, &info);
+    if (rc != MDB_SUCCESS)
+    {
+        Log(LOG_LEVEL_ERR, "Could not get info about database %s: %s",
+            db_path, mdb_strerror(rc));
+        return false;
+    }
+
+    const size_t old_size = info.me_mapsize;
+    if (old_size >= db->max_map_size)
+    {
+        Log(LOG_LEVEL_ERR, "Database %s is full and its size (%zu bytes) reached the maximum, "
+            "consider increasing 'max_map_size_mb' in %s",
+            db_path, old_size, CF_DB_CONFIG_FILE);
+        return false;
+    }
+
+    const size_t new_size = MIN(old_size * 2, db->max_map_size);
+    if (!ResizeMap(db, new_size))
+    {
+        Log(LOG_LEVEL_ERR, "Database %s is full and it cannot be grown now "
+            "(in use by other threads)", db_path);
+        return false;
+    }
+
+    Log(LOG_LEVEL_NOTICE, "Grew the map of database %s from %zu to %zu bytes (resize #%u)",
+        db_path, old_size, new_size, db->map_resizes);
+    return true;
+}
+
 static int LmdbEnvOpen(
     MDB_env *const env,
     const char *const path,
@@ -495,6 +814,10 @@ DBPriv *DBPrivOpenDB(const char *const dbpath, const dbid id)
     DBPriv *const db = xcalloc(1, sizeof(DBPriv));
     MDB_txn *txn = NULL;
 
+    LMDBTuning tuning;
+    GetDBTuning(dbpath, &tuning);
+    db->max_map_size = tuning.max_map_size;
+
     int rc = pthread_key_create(&db->txn_key, &DestroyTransaction);
     if (rc)
     {
@@ -503,6 +826,7 @@ DBPriv *DBPrivOpenDB(const char *const dbpath, const dbid id)
         free(db);
         return NULL;
     }
+    pthread_mutex_init(&db->txn_count_lock, NULL);
 
     rc = mdb_env_create(&db->env);
     if (rc)
@@ -523,16 +847,16 @@ DBPriv *DBPrivOpenDB(const char *const dbpath, const dbid id)
         Log(LOG_LEVEL_WARNING, "Could not set the corruption handler for '%s'",
             dbpath);
     }
-    rc = mdb_env_set_mapsize(db->env, LMDB_MAXSIZE);
+    rc = mdb_env_set_mapsize(db->env, tuning.map_size);
     if (rc)
     {
         Log(LOG_LEVEL_ERR, "Could not set mapsize for database %s: %s",
               dbpath, mdb_strerror(rc));
         goto err;
     }
-    if (DB_MAX_READERS > 0)
+    if (tuning.max_readers > 0)
     {
-        rc = mdb_env_set_maxreaders(db->env, DB_MAX_READERS);
+        rc = mdb_env_set_maxreaders(db->env, tuning.max_readers);
         if (rc)
         {
             Log(LOG_LEVEL_ERR, "Could not set maxreaders for database %s: %s",
@@ -542,12 +866,17 @@ DBPriv *DBPrivOpenDB(const char *const dbpath, const dbid id)
     }
 
     unsigned int open_flags = MDB_NOSUBDIR;
+    if (tuning.sync == LMDB_SYNC_OFF)
+    {
+        open_flags |= MDB_NOSYNC;
+    }
 #if !defined(_AIX) && !defined(__sun)
     /* The locks and lastseen (on hubs) DBs are heavily used and using
      * MDB_NOSYNC increases performance. However, AIX and Solaris often suffer
      * from some serious issues with consistency (ENT-4002) so it's better to
      * sacrifice some performance there in favor of stability. */
-    if (id == dbid_locks || (GetAmPolicyHub() && id == dbid_lastseen))
+    else if (tuning.sync == LMDB_SYNC_DEFAULT &&
+             (id == dbid_locks || (GetAmPolicyHub() && id == dbid_lastseen)))
     {
         open_flags |= MDB_NOSYNC;
     }
@@ -576,7 +905,7 @@ DBPriv *DBPrivOpenDB(const char *const dbpath, const dbid id)
         }
         goto err;
     }
-    if (DB_MAX_READERS > 0)
+    if (tuning.max_readers > 0)
     {
         int max_readers;
         rc = mdb_env_get_maxreaders(db->env, &max_readers);
@@ -586,7 +915,7 @@ DBPriv *DBPrivOpenDB(const char *const dbpath, const dbid id)
                 dbpath, mdb_strerror(rc));
             goto err;
         }
-        if (max_readers < DB_MAX_READERS)
+        if (max_readers < tuning.max_readers)
         {
             // LMDB will only reinitialize maxreaders if no database handles are
             // open, including in other processes, which is how we might end up
@@ -649,6 +978,7 @@ err:
         mdb_env_close(db->env);
     }
     pthread_key_delete(db->txn_key);
+    pthread_mutex_destroy(&db->txn_count_lock);
     free(db);
     if (rc == MDB_INVALID)
     {
@@ -664,6 +994,8 @@ void DBPrivCloseDB(DBPriv *db)
     /* Abort LMDB transaction of the current thread. There should only be some
      * transaction open when the signal handler or atexit() hook is called. */
     AbortTransaction(db);
+    free(pthread_getspecific(db->txn_key));
+    pthread_setspecific(db->txn_key, NULL);
 
     char *db_path = mdb_env_get_userctx(db->env);
     if (db_path)
@@ -676,9 +1008,21 @@ void DBPrivCloseDB(DBPriv *db)
     }
 
     pthread_key_delete(db->txn_key);
+    pthread_mutex_destroy(&db->txn_count_lock);
     free(db);
 }
 
+unsigned int DBPrivGetMapResizes(DBPriv *const db)
+{
+    assert(db != NULL);
+
+    pthread_mutex_lock(&db->txn_count_lock);
+    const unsigned int map_resizes = db->map_resizes;
+    pthread_mutex_unlock(&db->txn_count_lock);
+
+    return map_resizes;
+}
+
 #define EMPTY_DB 0
 
 bool DBPrivClean(DBPriv *db)
@@ -697,27 +1041,46 @@ bool DBPrivClean(DBPriv *db)
     assert(txn != NULL);
     assert(!txn->cursor_open);
 
-    return (mdb_drop(txn->txn, db->dbi, EMPTY_DB) != 0);
+    const int drop_rc = mdb_drop(txn->txn, db->dbi, EMPTY_DB);
+    CheckLMDBCorrupted(drop_rc, db->env);
+    if (drop_rc != MDB_SUCCESS)
+    {
+        Log(LOG_LEVEL_ERR, "Could not clean database '%s': %s",
+            (char *) mdb_env_get_userctx(db->env), mdb_strerror(drop_rc));
+        AbortTransaction(db);
+        return false;
+    }
+
+    txn->modified = true;
+    return true;
 }
 
-void DBPrivCommit(DBPriv *db)
+bool DBPrivCommit(DBPriv *db)
 {
     assert(db != NULL);
 
+    bool success = true;
     DBTxn *db_txn = pthread_getspecific(db->txn_key);
     if (db_txn != NULL && db_txn->txn != NULL)
     {
         assert(!db_txn->cursor_open);
         const int rc = mdb_txn_commit(db_txn->txn);
+        TxnFinished(db);
         CheckLMDBCorrupted(rc, db->env);
         if (rc != MDB_SUCCESS)
         {
             Log(LOG_LEVEL_ERR, "Could not commit database transaction to '%s': %s",
                 (char *) mdb_env_get_userctx(db->env), mdb_strerror(rc));
+            success = false;
         }
     }
+    if (db_txn != NULL && db_txn->discarded)
+    {
+        success = false;
+    }
     pthread_setspecific(db->txn_key, NULL);
     free(db_txn);
+    return success;
 }
 
 bool DBPrivHasKey(DBPriv *db, const void *key, int key_size)
@@ -843,7 +1206,25 @@ bool DBPrivWrite(
         data.mv_size = value_size;
         rc = mdb_put(txn->txn, db->dbi, &mkey, &data, 0);
         CheckLMDBCorrupted(rc, db->env);
-        if (rc != MDB_SUCCESS)
+        if (rc == MDB_MAP_FULL)
+        {
+            const bool retry = !txn->modified;
+            if (GrowMap(db, retry) && retry)
+            {
+                /* Retry in a new transaction with the bigger map */
+                rc = GetWriteTransaction(db, &txn);
+                if (rc == MDB_SUCCESS)
+                {
+                    rc = mdb_put(txn->txn, db->dbi, &mkey, &data, 0);
+                    CheckLMDBCorrupted(rc, db->env);
+                }
+            }
+        }
+        if (rc == MDB_SUCCESS)
+        {
+            txn->modified = true;
+        }
+        else
         {
             Log(LOG_LEVEL_ERR, "Could not write database entry to '%s': %s",
                 (char *) mdb_env_get_userctx(db->env), mdb_strerror(rc));
@@ -915,6 +1296,15 @@ bool DBPrivOverwrite(DBPriv *db, const char *key, int key_size, const void *valu
     new_data.mv_size = value_size;
     rc = mdb_put(txn->txn, db->dbi, &mkey, &new_data, 0);
     CheckLMDBCorrupted(rc, db->env);
+    if (rc == MDB_MAP_FULL)
+    {
+        const bool retry = !txn->modified;
+        if (GrowMap(db, retry) && retry)
+        {
+            /* The condition has to be re-evaluated in the new transaction. */
+            return DBPrivOverwrite(db, key, key_size, value, value_size, Condition, data);
+        }
+    }
     if (rc != MDB_SUCCESS)
     {
         Log(LOG_LEVEL_ERR, "Could not write database entry to '%s': %s",
@@ -941,7 +1331,11 @@ bool DBPrivDelete(DBPriv *const db, const void *const key, const int key_size)
         mkey.mv_size = key_size;
         rc = mdb_del(txn->txn, db->dbi, &mkey, NULL);
         CheckLMDBCorrupted(rc, db->env);
-        if (rc == MDB_NOTFOUND)
+        if (rc == MDB_SUCCESS)
+        {
+            txn->modified = true;
+        }
+        else if (rc == MDB_NOTFOUND)
         {
             Log(LOG_LEVEL_DEBUG, "Entry not found in '%s': %s",
                 (char *) mdb_env_get_userctx(db->env), mdb_strerror(rc));
@@ -976,6 +1370,8 @@ DBCursorPriv *DBPrivOpenCursor(DBPriv *const db)
             cursor->db = db;
             cursor->mc = mc;
             txn->cursor_open = true;
+            /* Entries can be changed through the cursor */
+            txn->modified = true;
         }
         else
         {
@@ -1130,6 +1526,83 @@ void DBPrivCloseCursor(DBCursorPriv *const cursor)
     free(cursor);
 }
 
+bool DBPrivScanSnapshot(
+    DBPriv *const db, const DBSnapshotCallback callback, void *const data)
+{
+    assert(db != NULL);
+    assert(callback != NULL);
+
+    /* LMDB only allows one transaction per thread, so if this thread already
+     * has one open (e.g. from a previous ReadDB()), scan in that one.
+     * Otherwise use a short-lived read-only transaction which doesn't block
+     * (nor is blocked by) writers and is released right after the scan. */
+    MDB_txn *txn = NULL;
+    bool own_txn = false;
+    int rc;
+
+    DBTxn *db_txn = pthread_getspecific(db->txn_key);
+    if (db_txn != NULL && db_txn->txn != NULL)
+    {
+        assert(!db_txn->cursor_open);
+        txn = db_txn->txn;
+    }
+    else
+    {
+        rc = BeginTransaction(db, MDB_RDONLY, &txn);
+        CheckLMDBCorrupted(rc, db->env);
+        if (rc != MDB_SUCCESS)
+        {
+            Log(LOG_LEVEL_ERR, "Unable to open read transaction in '%s': %s",
+                (char *) mdb_env_get_userctx(db->env), mdb_strerror(rc));
+            return false;
+        }
+        own_txn = true;
+    }
+
+    MDB_cursor *mc;
+    rc = mdb_cursor_open(txn, db->dbi, &mc);
+    CheckLMDBCorrupted(rc, db->env);
+    if (rc != MDB_SUCCESS)
+    {
+        Log(LOG_LEVEL_ERR, "Could not open cursor in '%s': %s",
+            (char *) mdb_env_get_userctx(db->env), mdb_strerror(rc));
+        if (own_txn)
+        {
+            mdb_txn_abort(txn);
+            TxnFinished(db);
+        }
+        return false;
+    }
+
+    MDB_val mkey, mdata;
+    while ((rc = mdb_cursor_get(mc, &mkey, &mdata, MDB_NEXT)) == MDB_SUCCESS)
+    {
+        assert(mkey.mv_size <= INT_MAX);
+        assert(mdata.mv_size <= INT_MAX);
+        if (!callback(mkey.mv_data, mkey.mv_size,
+                      mdata.mv_data, mdata.mv_size, data))
+        {
+            rc = MDB_NOTFOUND;
+            break;
+        }
+    }
+    CheckLMDBCorrupted(rc, db->env);
+    if (rc != MDB_NOTFOUND)
+    {
+        Log(LOG_LEVEL_ERR, "Could not advance cursor in '%s': %s",
+            (char *) mdb_env_get_userctx(db->env), mdb_strerror(rc));
+    }
+
+    mdb_cursor_close(mc);
+    if (own_txn)
+    {
+        mdb_txn_abort(txn);
+        TxnFinished(db);
+    }
+
+    return (rc == MDB_NOTFOUND);
+}
+
 char *DBPrivDiagnose(const char *const dbpath)
 {
     return StringFormat("Unable to diagnose LMDB file (not implemented) for '%s'", dbpath);
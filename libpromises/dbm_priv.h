@@ -51,9 +51,21 @@ void DBPrivSetMaximumConcurrentTransactions(int max_txn);
  */
 DBPriv *DBPrivOpenDB(const char *dbpath, dbid id);
 void DBPrivCloseDB(DBPriv *hdbp);
-void DBPrivCommit(DBPriv *hdbp);
+/*
+ * Commit the transaction of the calling thread. Returns false if it failed or
+ * if updates made since the last commit were lost when a failed operation
+ * aborted the transaction.
+ */
+bool DBPrivCommit(DBPriv *hdbp);
 bool DBPrivClean(DBPriv *hdbp);
 
+/*
+ * Number of times the DB was resized (grown on a full map or adopting the
+ * size set by another process) since it was opened, 0 for backends without
+ * resizing.
+ */
+unsigned int DBPrivGetMapResizes(DBPriv *hdbp);
+
 bool DBPrivHasKey(DBPriv *db, const void *key, int key_size);
 int DBPrivGetValueSize(DBPriv *db, const void *key, int key_size);
 
@@ -78,6 +90,12 @@ bool DBPrivDeleteCursorEntry(DBCursorPriv *cursor);
 bool DBPrivWriteCursorEntry(DBCursorPriv *cursor, const void *value, int value_size);
 void DBPrivCloseCursor(DBCursorPriv *cursor);
 
+/*
+ * Iterate over a consistent, read-only view of the database, calling
+ * @callback for every entry without copying keys or values.
+ */
+bool DBPrivScanSnapshot(DBPriv *db, DBSnapshotCallback callback, void *data);
+
 /**
  * @brief Check a database file for consistency
  * @param dbpath Path to database file
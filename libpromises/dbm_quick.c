@@ -115,6 +115,11 @@ void DBPrivSetMaximumConcurrentTransactions(ARG_UNUSED int max_txn)
 {
 }
 
+unsigned int DBPrivGetMapResizes(ARG_UNUSED DBPriv *db)
+{
+    return 0;
+}
+
 DBPriv *DBPrivOpenDB(const char *filename, ARG_UNUSED dbid id)
 {
     DBPriv *db = xcalloc(1, sizeof(DBPriv));
@@ -178,8 +183,9 @@ void DBPrivCloseDB(DBPriv *db)
     free(db);
 }
 
-void DBPrivCommit(ARG_UNUSED DBPriv *db)
+bool DBPrivCommit(ARG_UNUSED DBPriv *db)
 {
+    return true;
 }
 
 bool DBPrivClean(DBPriv *db)
@@ -429,6 +435,30 @@ void DBPrivCloseCursor(DBCursorPriv *cursor)
     UnlockCursor(db);
 }
 
+bool DBPrivScanSnapshot(DBPriv *db, DBSnapshotCallback callback, void *data)
+{
+    /* No MVCC here, so just hold the cursor lock for the whole scan. */
+    DBCursorPriv *cursor = DBPrivOpenCursor(db);
+    if (cursor == NULL)
+    {
+        return false;
+    }
+
+    void *key;
+    void *value;
+    int key_size, value_size;
+    while (DBPrivAdvanceCursor(cursor, &key, &key_size, &value, &value_size))
+    {
+        if (!callback(key, key_size, value, value_size, data))
+        {
+            break;
+        }
+    }
+
+    DBPrivCloseCursor(cursor);
+    return true;
+}
+
 char *DBPrivDiagnose(const char *dbpath)
 {
     return StringFormat("Unable to diagnose QuickDB file (not implemented) for '%s'", dbpath);
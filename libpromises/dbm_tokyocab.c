@@ -165,6 +165,11 @@ void DBPrivSetMaximumConcurrentTransactions(ARG_UNUSED int max_txn)
 {
 }
 
+unsigned int DBPrivGetMapResizes(ARG_UNUSED DBPriv *db)
+{
+    return 0;
+}
+
 DBPriv *DBPrivOpenDB(const char *dbpath, ARG_UNUSED dbid id)
 {
     DBPriv *db = xcalloc(1, sizeof(DBPriv));
@@ -217,8 +222,9 @@ void DBPrivCloseDB(DBPriv *db)
     free(db);
 }
 
-void DBPrivCommit(ARG_UNUSED DBPriv *db)
+bool DBPrivCommit(ARG_UNUSED DBPriv *db)
 {
+    return true;
 }
 
 bool DBPrivClean(DBPriv *db)
@@ -430,6 +436,30 @@ void DBPrivCloseCursor(DBCursorPriv *cursor)
 }
 
 
+bool DBPrivScanSnapshot(DBPriv *db, DBSnapshotCallback callback, void *data)
+{
+    /* No MVCC here, so just hold the cursor lock for the whole scan. */
+    DBCursorPriv *cursor = DBPrivOpenCursor(db);
+    if (cursor == NULL)
+    {
+        return false;
+    }
+
+    void *key;
+    void *value;
+    int key_size, value_size;
+    while (DBPrivAdvanceCursor(cursor, &key, &key_size, &value, &value_size))
+    {
+        if (!callback(key, key_size, value, value_size, data))
+        {
+            break;
+        }
+    }
+
+    DBPrivCloseCursor(cursor);
+    return true;
+}
+
 char *DBPrivDiagnose(const char *dbpath)
 {
 #define SWAB64(num) \
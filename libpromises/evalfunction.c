@@ -67,6 +67,7 @@
 #include <json-utils.h>
 #include <known_dirs.h>
 #include <mustache.h>
+#include <mustache_template.h>
 #include <processes_select.h>
 #include <sysinfo.h>
 #include <string_sequence.h>
@@ -2331,7 +2332,11 @@ static FnCallResult FnCallReturnsZero(ARG_UNUSED EvalContext *ctx, ARG_UNUSED co
 
     snprintf(comm, CF_BUFSIZE, "%s", RlistScalarValue(finalargs));
 
-    if (ShellCommandReturnsZero(comm, shelltype))
+    const bool returned_zero = ShellCommandReturnsZero(comm, shelltype);
+    /* The command may have started or stopped processes. */
+    InvalidateProcessTable();
+
+    if (returned_zero)
     {
         Log(LOG_LEVEL_VERBOSE, "%s ran '%s' successfully and it returned zero", fp->name, RlistScalarValue(finalargs));
         return FnReturnContext(true);
@@ -2418,7 +2423,12 @@ static FnCallResult FnCallExecResult(ARG_UNUSED EvalContext *ctx, ARG_UNUSED con
 
     int exit_code;
 
-    if (GetExecOutput(command, &buffer, &buffer_size, shelltype, output_select, &exit_code))
+    const bool ran = GetExecOutput(command, &buffer, &buffer_size, shelltype,
+                                   output_select, &exit_code);
+    /* The command may have started or stopped processes. */
+    InvalidateProcessTable();
+
+    if (ran)
     {
         Log(LOG_LEVEL_VERBOSE, "%s ran '%s' successfully", fp->name, command);
         if (StringEqual(function, "execresult"))
@@ -3418,6 +3428,7 @@ static JsonElement* ExecJSON_Pipe(const char *cmd, JsonElement *container)
 
     /* If script returns non 0 status */
     int close = cf_pclose_full_duplex(&io);
+    InvalidateProcessTable();
     if (close != EXIT_SUCCESS)
     {
         Log(LOG_LEVEL_VERBOSE,
@@ -3936,7 +3947,31 @@ static FnCallResult FnCallMergeData(EvalContext *ctx, ARG_UNUSED const Policy *p
     assert(false);
 }
 
-JsonElement *DefaultTemplateData(const EvalContext *ctx, const char *wantbundle)
+static bool TemplateDataHasVariable(const MustacheTemplateRefs *refs,
+                                    const char *scope_key, const char *lval_key)
+{
+    char *key = StringConcatenate(3, scope_key, ".", lval_key);
+    bool found = StringSetContains(refs->vars, key);
+    free(key);
+    return found;
+}
+
+static void TemplateDataAppendClass(JsonElement *classes, const MustacheTemplateRefs *refs, const Class *cls)
+{
+    char *key = ClassRefToString(cls->ns, cls->name);
+    if (refs == NULL || refs->all_classes || StringSetContains(refs->classes, key))
+    {
+        JsonObjectAppendBool(classes, key, true);
+    }
+    free(key);
+}
+
+/**
+ * The classes and variables as JSON, limited to the ones in #refs unless
+ * it's NULL.
+ */
+static JsonElement *TemplateData(const EvalContext *ctx, const char *wantbundle,
+                                 const MustacheTemplateRefs *refs)
 {
     JsonElement *hash = JsonObjectCreate(30);
     JsonElement *classes = NULL;
@@ -3951,24 +3986,48 @@ JsonElement *DefaultTemplateData(const EvalContext *ctx, const char *wantbundle)
         JsonObjectAppendObject(hash, "classes", classes);
         JsonObjectAppendObject(hash, "vars", bundles);
 
-        ClassTableIterator *it = EvalContextClassTableIteratorNewGlobal(ctx, NULL, true, true);
-        Class *cls;
-        while ((cls = ClassTableIteratorNext(it)))
+        if (refs == NULL || refs->all_classes)
         {
-            char *key = ClassRefToString(cls->ns, cls->name);
-            JsonObjectAppendBool(classes, key, true);
-            free(key);
-        }
-        ClassTableIteratorDestroy(it);
+            ClassTableIterator *it = EvalContextClassTableIteratorNewGlobal(ctx, NULL, true, true);
+            Class *cls;
+            while ((cls = ClassTableIteratorNext(it)))
+            {
+                TemplateDataAppendClass(classes, refs, cls);
+            }
+            ClassTableIteratorDestroy(it);
 
-        it = EvalContextClassTableIteratorNewLocal(ctx);
-        while ((cls = ClassTableIteratorNext(it)))
+            it = EvalContextClassTableIteratorNewLocal(ctx);
+            while (it != NULL && (cls = ClassTableIteratorNext(it)))
+            {
+                TemplateDataAppendClass(classes, refs, cls);
+            }
+            ClassTableIteratorDestroy(it);
+        }
+        else
         {
-            char *key = ClassRefToString(cls->ns, cls->name);
-            JsonObjectAppendBool(classes, key, true);
-            free(key);
+            /* Look up just the referenced classes */
+            StringSetIterator it = StringSetIteratorInit(refs->classes);
+            const char *name;
+            while ((name = StringSetIteratorNext(&it)) != NULL)
+            {
+                ClassRef ref = ClassRefParse(name);
+                const Class *cls = EvalContextClassGet(ctx, ref.ns, ref.name);
+                if (cls != NULL)
+                {
+                    TemplateDataAppendClass(classes, refs, cls);
+                }
+                ClassRefDestroy(ref);
+            }
         }
-        ClassTableIteratorDestroy(it);
+    }
+
+    /* Bundle names (without namespaces) for skipping variables before making
+     * any strings for them */
+    const char *wantscope = NULL;
+    if (!want_all_bundles)
+    {
+        const char *colon = strchr(wantbundle, ':');
+        wantscope = (colon != NULL) ? colon + 1 : wantbundle;
     }
 
     {
@@ -3977,12 +4036,25 @@ JsonElement *DefaultTemplateData(const EvalContext *ctx, const char *wantbundle)
         while ((var = VariableTableIteratorNext(it)))
         {
             const VarRef *var_ref = VariableGetRef(var);
+
+            if ((wantscope != NULL && !StringEqual(var_ref->scope, wantscope)) ||
+                (refs != NULL && !StringSetContains(refs->scopes, var_ref->scope)))
+            {
+                continue;
+            }
+
             // TODO: need to get a CallRef, this is bad
             char *scope_key = ClassRefToString(var_ref->ns, var_ref->scope);
 
             JsonElement *scope_obj = NULL;
+            bool whole_bundle = true;
             if (want_all_bundles)
             {
+                if (refs != NULL && !StringSetContains(refs->bundles, scope_key))
+                {
+                    whole_bundle = false;
+                }
+
                 scope_obj = JsonObjectGetAsObject(bundles, scope_key);
                 if (!scope_obj)
                 {
@@ -3995,31 +4067,46 @@ JsonElement *DefaultTemplateData(const EvalContext *ctx, const char *wantbundle)
                 scope_obj = hash;
             }
 
-            free(scope_key);
-
             if (scope_obj != NULL)
             {
                 char *lval_key = VarRefToString(var_ref, false);
-                Rval var_rval = VariableGetRval(var, true);
                 // don't collect mangled refs
-                if (strchr(lval_key, CF_MANGLED_SCOPE) == NULL)
+                if (strchr(lval_key, CF_MANGLED_SCOPE) == NULL &&
+                    (whole_bundle || TemplateDataHasVariable(refs, scope_key, lval_key)))
                 {
+                    Rval var_rval = VariableGetRval(var, true);
                     JsonObjectAppendElement(scope_obj, lval_key, RvalToJson(var_rval));
                 }
                 free(lval_key);
             }
+
+            free(scope_key);
         }
         VariableTableIteratorDestroy(it);
     }
 
-    Writer *w = StringWriter();
-    JsonWrite(w, hash, 0);
-    Log(LOG_LEVEL_DEBUG, "Generated DefaultTemplateData '%s'", StringWriterData(w));
-    WriterClose(w);
+    if (WouldLog(LOG_LEVEL_DEBUG))
+    {
+        Writer *w = StringWriter();
+        JsonWrite(w, hash, 0);
+        Log(LOG_LEVEL_DEBUG, "Generated DefaultTemplateData '%s'", StringWriterData(w));
+        WriterClose(w);
+    }
 
     return hash;
 }
 
+JsonElement *DefaultTemplateData(const EvalContext *ctx, const char *wantbundle)
+{
+    return TemplateData(ctx, wantbundle, NULL);
+}
+
+JsonElement *MustacheTemplateData(const EvalContext *ctx, const MustacheTemplateRefs *refs)
+{
+    assert(refs != NULL);
+    return TemplateData(ctx, NULL, refs->all ? NULL : refs);
+}
+
 static FnCallResult FnCallDatastate(EvalContext *ctx,
                                     ARG_UNUSED const Policy *policy,
                                     ARG_UNUSED const FnCall *fp,
@@ -7663,7 +7750,9 @@ static FnCallResult FnCallStringMustache(EvalContext *ctx, ARG_UNUSED const Poli
     else
     {
         allocated = true;
-        json = DefaultTemplateData(ctx, NULL);
+        MustacheTemplateRefs *refs = MustacheTemplateRefsNew(mustache_template);
+        json = MustacheTemplateData(ctx, refs);
+        MustacheTemplateRefsDestroy(refs);
     }
 
     Buffer *result = BufferNew();
@@ -8371,7 +8460,12 @@ static FnCallResult FnCallProcessExists(ARG_UNUSED EvalContext *ctx, ARG_UNUSED
 
     // ps is unused because attrselect = false below
     Item *matched = SelectProcesses(regex, &ps, false);
-    ClearProcessTable();
+    if (THIS_AGENT_TYPE != AGENT_TYPE_AGENT)
+    {
+        /* Only cf-agent manages the snapshot (see InvalidateProcessTable()),
+         * other agents would keep an outdated process table. */
+        ClearProcessTable();
+    }
 
     if (is_context_processexists)
     {
@@ -8562,6 +8656,8 @@ static bool ExecModule(EvalContext *ctx, char *command)
     }
     bool atend = feof(pp);
     cf_pclose(pp);
+    /* The module may have started or stopped processes. */
+    InvalidateProcessTable();
     free(line);
     StringSetDestroy(tags);
 
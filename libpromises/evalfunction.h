@@ -29,6 +29,7 @@
 #include <rlist.h>
 #include <set.h>
 #include <fncall.h>
+#include <mustache_template.h>                        /* MustacheTemplateRefs */
 
 FnCallResult FnCallHostInNetgroup(EvalContext *ctx, const Policy *policy, const FnCall *fp, const Rlist *finalargs);
 
@@ -41,4 +42,10 @@ FnCallResult FnCallGroupExists(EvalContext *ctx, const Policy *policy, const FnC
 FnCallResult FnCallUserExists(EvalContext *ctx, const Policy *policy, const FnCall *fp, const Rlist *finalargs);
 
 JsonElement *DefaultTemplateData(const EvalContext *ctx, const char *wantbundle);
+
+/**
+ * DefaultTemplateData(ctx, NULL) with only the classes and variables in
+ * #refs, see MustacheTemplateRefsNew().
+ */
+JsonElement *MustacheTemplateData(const EvalContext *ctx, const MustacheTemplateRefs *refs);
 #endif
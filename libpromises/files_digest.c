@@ -0,0 +1,276 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <files_digest.h>
+
+#include <alloc.h>
+#include <logging.h>
+#include <mutex.h>                                /* ThreadLock */
+#include <file_lib.h>                             /* safe_open, FullRead */
+#include <hash.h>                                 /* HashDigestFromId */
+
+#define HASH_FILE_BLOCK_SIZE (256 * 1024)
+
+/* How many blocks the reading can be ahead of the slowest digest thread */
+#define HASH_FILE_BUFFERS 2
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;               /* a block was read or hashed */
+    unsigned char *buffers[HASH_FILE_BUFFERS];
+    size_t lengths[HASH_FILE_BUFFERS];
+    size_t read;                       /* blocks read so far */
+    bool end;                          /* no more blocks will be read */
+} HashPipeline;
+
+typedef struct
+{
+    HashPipeline *pipeline;
+    EVP_MD_CTX *context;
+    size_t hashed;                     /* blocks hashed so far */
+} HashWorker;
+
+static void *HashWorkerThread(void *arg)
+{
+    HashWorker *worker = arg;
+    HashPipeline *pipeline = worker->pipeline;
+
+    ThreadLock(&pipeline->lock);
+    while (true)
+    {
+        while ((worker->hashed == pipeline->read) && !pipeline->end)
+        {
+            pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+        }
+        if (worker->hashed == pipeline->read)
+        {
+            break;
+        }
+
+        /* The block is not overwritten before it is hashed by all workers */
+        const size_t i = worker->hashed % HASH_FILE_BUFFERS;
+        ThreadUnlock(&pipeline->lock);
+
+        EVP_DigestUpdate(worker->context, pipeline->buffers[i], pipeline->lengths[i]);
+
+        ThreadLock(&pipeline->lock);
+        worker->hashed++;
+        pthread_cond_broadcast(&pipeline->cond);
+    }
+    ThreadUnlock(&pipeline->lock);
+
+    return NULL;
+}
+
+static bool HashSerial(int fd, EVP_MD_CTX **contexts, size_t n_contexts)
+{
+    unsigned char *buffer = xmalloc(HASH_FILE_BLOCK_SIZE);
+    ssize_t n_read;
+    while ((n_read = FullRead(fd, buffer, HASH_FILE_BLOCK_SIZE)) > 0)
+    {
+        for (size_t i = 0; i < n_contexts; i++)
+        {
+            EVP_DigestUpdate(contexts[i], buffer, n_read);
+        }
+    }
+    free(buffer);
+    return (n_read == 0);
+}
+
+/**
+ * Read the file in this thread, updating the first digest, while the other
+ * digests are updated by threads of their own.
+ */
+static bool HashParallel(int fd, EVP_MD_CTX **contexts, size_t n_contexts)
+{
+    assert(n_contexts > 1);
+
+    HashPipeline pipeline = { .read = 0, .end = false };
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.cond, NULL);
+    for (size_t i = 0; i < HASH_FILE_BUFFERS; i++)
+    {
+        pipeline.buffers[i] = xmalloc(HASH_FILE_BLOCK_SIZE);
+    }
+
+    /* Digests which don't get a thread are updated by this one */
+    EVP_MD_CTX *own[n_contexts];
+    size_t n_own = 0;
+    own[n_own++] = contexts[0];
+
+    HashWorker workers[n_contexts - 1];
+    pthread_t tids[n_contexts - 1];
+    size_t n_workers = 0;
+    for (size_t i = 1; i < n_contexts; i++)
+    {
+        workers[n_workers] = (HashWorker) { .pipeline = &pipeline, .context = contexts[i], .hashed = 0 };
+        int ret = pthread_create(&tids[n_workers], NULL, HashWorkerThread, &workers[n_workers]);
+        if (ret == 0)
+        {
+            n_workers++;
+        }
+        else
+        {
+            Log(LOG_LEVEL_VERBOSE, "Failed to start a thread for hashing (pthread_create: %s)",
+                GetErrorStrFromCode(ret));
+            own[n_own++] = contexts[i];
+        }
+    }
+
+    ssize_t n_read;
+    size_t block = 0;
+    while (true)
+    {
+        /* Wait for the buffer to be hashed by all workers */
+        ThreadLock(&pipeline.lock);
+        for (size_t i = 0; i < n_workers; i++)
+        {
+            while (workers[i].hashed + HASH_FILE_BUFFERS <= block)
+            {
+                pthread_cond_wait(&pipeline.cond, &pipeline.lock);
+            }
+        }
+        ThreadUnlock(&pipeline.lock);
+
+        const size_t b = block % HASH_FILE_BUFFERS;
+        n_read = FullRead(fd, pipeline.buffers[b], HASH_FILE_BLOCK_SIZE);
+        if (n_read <= 0)
+        {
+            break;
+        }
+        pipeline.lengths[b] = n_read;
+
+        ThreadLock(&pipeline.lock);
+        pipeline.read = ++block;
+        pthread_cond_broadcast(&pipeline.cond);
+        ThreadUnlock(&pipeline.lock);
+
+        for (size_t i = 0; i < n_own; i++)
+        {
+            EVP_DigestUpdate(own[i], pipeline.buffers[b], n_read);
+        }
+    }
+
+    ThreadLock(&pipeline.lock);
+    pipeline.end = true;
+    pthread_cond_broadcast(&pipeline.cond);
+    ThreadUnlock(&pipeline.lock);
+
+    for (size_t i = 0; i < n_workers; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+
+    for (size_t i = 0; i < HASH_FILE_BUFFERS; i++)
+    {
+        free(pipeline.buffers[i]);
+    }
+    pthread_cond_destroy(&pipeline.cond);
+    pthread_mutex_destroy(&pipeline.lock);
+
+    return (n_read == 0);
+}
+
+bool HashFileMulti(const char *filename, const HashMethod *types, size_t n_types,
+                   unsigned char digests[][EVP_MAX_MD_SIZE + 1])
+{
+    assert(filename != NULL);
+    assert(types != NULL);
+    assert(n_types > 0);
+
+    EVP_MD_CTX **contexts = xcalloc(n_types, sizeof(EVP_MD_CTX *));
+    bool success = true;
+    for (size_t i = 0; success && (i < n_types); i++)
+    {
+        const EVP_MD *md = HashDigestFromId(types[i]);
+        if (md == NULL)
+        {
+            Log(LOG_LEVEL_ERR,
+                "Could not determine function for file hashing (type=%d)",
+                (int) types[i]);
+            success = false;
+        }
+        else if ((contexts[i] = EVP_MD_CTX_new()) == NULL)
+        {
+            Log(LOG_LEVEL_ERR, "Could not allocate openssl hash context");
+            success = false;
+        }
+        else
+        {
+            EVP_DigestInit(contexts[i], md);
+        }
+    }
+
+    int fd = -1;
+    if (success && (fd = safe_open(filename, O_RDONLY | O_BINARY)) == -1)
+    {
+        Log(LOG_LEVEL_INFO, "Cannot open file for hashing '%s'. (open: %s)",
+            filename, GetErrorStr());
+        success = false;
+    }
+
+    if (success)
+    {
+#ifdef HAVE_POSIX_FADVISE
+        /* Bigger read-ahead, the file is read only once from start to end */
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        struct stat sb;
+        if ((n_types > 1) && (fstat(fd, &sb) == 0) &&
+            (sb.st_size >= HASH_FILE_PARALLEL_MIN_SIZE))
+        {
+            success = HashParallel(fd, contexts, n_types);
+        }
+        else
+        {
+            success = HashSerial(fd, contexts, n_types);
+        }
+
+        if (!success)
+        {
+            Log(LOG_LEVEL_INFO, "Cannot read file for hashing '%s'. (read: %s)",
+                filename, GetErrorStr());
+        }
+        close(fd);
+    }
+
+    for (size_t i = 0; i < n_types; i++)
+    {
+        if (contexts[i] != NULL)
+        {
+            if (success)
+            {
+                unsigned int md_len;
+                EVP_DigestFinal(contexts[i], digests[i], &md_len);
+            }
+            EVP_MD_CTX_free(contexts[i]);
+        }
+    }
+    free(contexts);
+
+    return success;
+}
@@ -0,0 +1,45 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_FILES_DIGEST_H
+#define CFENGINE_FILES_DIGEST_H
+
+#include <cf3.defs.h>
+
+/* Files at least this big get one thread per extra digest in HashFileMulti() */
+#define HASH_FILE_PARALLEL_MIN_SIZE (4 * 1024 * 1024)
+
+/**
+ * Compute the digests of the content of #filename for all the #n_types hash
+ * #types in a single pass over the file. If the file is big enough, the
+ * digests after the first one are computed by their own threads while the
+ * file is being read.
+ *
+ * @return false if the file could not be read, #digests are undefined then
+ */
+bool HashFileMulti(const char *filename, const HashMethod *types, size_t n_types,
+                   unsigned char digests[][EVP_MAX_MD_SIZE + 1]);
+
+#endif
@@ -92,6 +92,52 @@ bool FileWriteOver(char *filename, char *contents)
     return res;
 }
 
+bool FileContentEquals(const char *filename, const char *data, size_t length,
+                       bool text_mode)
+{
+    assert(filename != NULL);
+    assert(data != NULL || length == 0);
+
+    int fd = safe_open(filename, O_RDONLY | (text_mode ? O_TEXT : O_BINARY));
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    /* In text mode on Windows the file is longer than the data by the
+     * carriage returns, so only compare the sizes where they are comparable. */
+#ifdef __MINGW32__
+    const bool check_size = !text_mode;
+#else
+    const bool check_size = true;
+#endif
+
+    struct stat sb;
+    if (check_size &&
+        (fstat(fd, &sb) == -1 || (uintmax_t) sb.st_size != (uintmax_t) length))
+    {
+        close(fd);
+        return false;
+    }
+
+    /* Compare chunk by chunk so that a mismatch is found without reading the
+     * rest of the file (and nothing has to be hashed). */
+    char buf[CF_BUFSIZE * 8];
+    size_t offset = 0;
+    bool equal = true;
+    ssize_t n_read;
+    while (equal && (n_read = FullRead(fd, buf, sizeof(buf))) > 0)
+    {
+        equal = ((size_t) n_read <= length - offset) &&
+                (memcmp(buf, data + offset, n_read) == 0);
+        offset += n_read;
+    }
+
+    equal = equal && (n_read == 0) && (offset == length);
+    close(fd);
+    return equal;
+}
+
 
 /*********************************************************************/
 
@@ -491,12 +537,47 @@ bool LoadFileAsItemList(Item **liststart, const char *file, EditDefaults edits,
     return result;
 }
 
-bool TraverseDirectoryTreeInternal(const char *base_path,
-                                   const char *current_path,
-                                   int (*callback)(const char *, const struct stat *, void *),
-                                   void *user_data)
+mode_t DirentFileType(ARG_UNUSED const struct dirent *dirp)
 {
-    Dir *dirh = DirOpen(base_path);
+#ifdef HAVE_STRUCT_DIRENT_D_TYPE
+    switch (dirp->d_type)
+    {
+    case DT_REG:
+        return S_IFREG;
+    case DT_DIR:
+        return S_IFDIR;
+    case DT_LNK:
+        return S_IFLNK;
+    case DT_FIFO:
+        return S_IFIFO;
+    case DT_SOCK:
+        return S_IFSOCK;
+    case DT_CHR:
+        return S_IFCHR;
+    case DT_BLK:
+        return S_IFBLK;
+    default:
+        return 0;
+    }
+#else
+    return 0;
+#endif
+}
+
+typedef struct
+{
+    int (*callback)(const char *, const struct stat *, void *);
+    void *user_data;
+    bool stat_files;            /* whether the callback needs the stat of files */
+    size_t files;
+    size_t stats_avoided;
+} TraversalState;
+
+static bool TraverseDirectoryTreeInternal(const char *base_path,
+                                          const char *current_path,
+                                          TraversalState *state)
+{
+    Dir *dirh = DirOpen(current_path);
     if (!dirh)
     {
         if (errno == ENOENT)
@@ -520,6 +601,19 @@ bool TraverseDirectoryTreeInternal(const char *base_path,
         char sub_path[CF_BUFSIZE];
         snprintf(sub_path, CF_BUFSIZE, "%s" FILE_SEPARATOR_STR "%s", current_path, dirp->d_name);
 
+        /* Don't stat files if the type from readdir() is all we need */
+        const mode_t type = DirentFileType(dirp);
+        if (!state->stat_files && (type != 0) && !S_ISDIR(type) && !S_ISLNK(type))
+        {
+            state->files++;
+            state->stats_avoided++;
+            if (state->callback(sub_path, NULL, state->user_data) == -1)
+            {
+                failed = true;
+            }
+            continue;
+        }
+
         struct stat lsb;
         if (lstat(sub_path, &lsb) == -1)
         {
@@ -537,14 +631,15 @@ bool TraverseDirectoryTreeInternal(const char *base_path,
         {
             if (S_ISDIR(lsb.st_mode))
             {
-                if (!TraverseDirectoryTreeInternal(base_path, sub_path, callback, user_data))
+                if (!TraverseDirectoryTreeInternal(base_path, sub_path, state))
                 {
                     failed = true;
                 }
             }
             else
             {
-                if (callback(sub_path, &lsb, user_data) == -1)
+                state->files++;
+                if (state->callback(sub_path, &lsb, state->user_data) == -1)
                 {
                     failed = true;
                 }
@@ -560,7 +655,8 @@ bool TraverseDirectoryTree(const char *path,
                            int (*callback)(const char *, const struct stat *, void *),
                            void *user_data)
 {
-    return TraverseDirectoryTreeInternal(path, path, callback, user_data);
+    TraversalState state = { .callback = callback, .user_data = user_data, .stat_files = true };
+    return TraverseDirectoryTreeInternal(path, path, &state);
 }
 
 typedef struct
@@ -571,6 +667,7 @@ typedef struct
     unsigned char **digest;
 } HashDirectoryTreeState;
 
+/* sb is NULL unless the file had to be stat'ed for its type */
 int HashDirectoryTreeCallback(const char *filename, ARG_UNUSED const struct stat *sb, void *user_data)
 {
     HashDirectoryTreeState *state = user_data;
@@ -616,7 +713,12 @@ bool HashDirectoryTree(const char *path,
     state.extensions_filter = extensions_filter;
     state.crypto_context = crypto_context;
 
-    return TraverseDirectoryTree(path, HashDirectoryTreeCallback, &state);
+    TraversalState traversal = { .callback = HashDirectoryTreeCallback, .user_data = &state,
+                                 .stat_files = false };
+    bool ret = TraverseDirectoryTreeInternal(path, path, &traversal);
+    Log(LOG_LEVEL_DEBUG, "Hashed directory tree '%s': %zu files, %zu lstat() calls avoided",
+        path, traversal.files, traversal.stats_avoided);
+    return ret;
 }
 
 void RotateFiles(const char *name, int number)
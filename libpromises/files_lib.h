@@ -31,6 +31,14 @@
 void PurgeItemList(Item **list, char *name);
 bool FileWriteOver(char *filename, char *contents);
 
+/**
+ * @return true if #filename exists and its content is exactly #data
+ * @note   Sizes are compared first and the content is then compared in
+ *         chunks, so a differing file is usually not read at all.
+ */
+bool FileContentEquals(const char *filename, const char *data, size_t length,
+                       bool text_mode);
+
 bool LoadFileAsItemList(Item **liststart, const char *file, EditDefaults edits, bool only_checks);
 
 /**
@@ -55,6 +63,12 @@ void RotateFiles(const char *name, int number);
 void CreateEmptyFile(char *name);
 
 
+/**
+ * @return the file type of the directory entry #dirp (S_IFMT bits of
+ *         st_mode) as reported by readdir(), 0 if it is not known
+ */
+mode_t DirentFileType(const struct dirent *dirp);
+
 /**
  * @brief This is a somewhat simpler version of nftw that support user_data.
  *        Callback function must return 0 to indicate success, -1 for failure.
@@ -604,28 +604,64 @@ clean:
 }
 
 /*****************************************************************************/
+typedef struct
+{
+    StringMap *entries;
+    Seq *hostkeys;
+} LastSeenQualityScan;
+
+static bool LoadLastSeenQualityEntry(const void *key, int key_size,
+                                     const void *value, int value_size,
+                                     void *data)
+{
+    LastSeenQualityScan *scan = data;
+    const char *const key_str = key;
+
+    /* Only "keyhost" and quality entries are needed, skip "a" entries (and
+     * the version) without copying them. */
+    if (key_size < 1 || value_size == 0 ||
+        (key_str[0] != 'k' && key_str[0] != 'q'))
+    {
+        return true;
+    }
+
+    if (key_str[0] == 'k')
+    {
+        SeqAppend(scan->hostkeys, xstrndup(key_str + 1, key_size - 1));
+    }
+
+    StringMapInsert(scan->entries, xstrndup(key_str, key_size),
+                    xmemdup(value, value_size));
+    return true;
+}
+
 bool ScanLastSeenQuality(LastSeenQualityCallback callback, void *ctx)
 {
-    StringMap *lastseen_db = LoadDatabaseToStringMap(dbid_lastseen);
-    if (!lastseen_db)
+    DBHandle *db;
+    if (!OpenDB(&db, dbid_lastseen))
     {
         return false;
     }
-    MapIterator it = MapIteratorInit(lastseen_db->impl);
-    MapKeyValue *item;
 
-    Seq *hostkeys = SeqNew(100, free);
-    while ((item = MapIteratorNext(&it)) != NULL)
-    {
-        char *key = item->key;
-        /* Only look for "keyhost" entries */
-        if (key[0] != 'k')
-        {
-            continue;
-        }
+    LastSeenQualityScan scan = {
+        .entries = StringMapNew(),
+        .hostkeys = SeqNew(100, free),
+    };
 
-        SeqAppend(hostkeys, xstrdup(key + 1));
+    /* Collect everything in one read-only pass and release the DB before
+     * calling the callbacks. */
+    bool scanned = ScanDBSnapshot(db, LoadLastSeenQualityEntry, &scan);
+    CloseDB(db);
+
+    StringMap *lastseen_db = scan.entries;
+    Seq *hostkeys = scan.hostkeys;
+    if (!scanned)
+    {
+        StringMapDestroy(lastseen_db);
+        SeqDestroy(hostkeys);
+        return false;
     }
+
     for (size_t i = 0; i < SeqLength(hostkeys); ++i)
     {
         const char *hostkey = SeqAt(hostkeys, i);
@@ -673,38 +709,27 @@ bool ScanLastSeenQuality(LastSeenQualityCallback callback, void *ctx)
 
 /*****************************************************************************/
 
+static bool CountHostKeyEntry(const void *key, int key_size,
+                              ARG_UNUSED const void *value, int value_size,
+                              void *data)
+{
+    /* Only look for valid "hostkey" entries */
+    if (key_size > 0 && ((const char *) key)[0] == 'k' && value_size > 0)
+    {
+        (*(int *) data)++;
+    }
+    return true;
+}
+
 int LastSeenHostKeyCount(void)
 {
     CF_DB *dbp;
-    CF_DBC *dbcp;
-    QPoint entry;
-    char *key;
-    void *value;
-    int ksize, vsize;
 
     int count = 0;
 
     if (OpenDB(&dbp, dbid_lastseen))
     {
-        memset(&entry, 0, sizeof(entry));
-
-        if (NewDBCursor(dbp, &dbcp))
-        {
-            while (NextDB(dbcp, &key, &ksize, &value, &vsize))
-            {
-                /* Only look for valid "hostkey" entries */
-
-                if ((key[0] != 'k') || (value == NULL))
-                {
-                    continue;
-                }
-
-                count++;
-            }
-
-            DeleteDBCursor(dbcp);
-        }
-
+        ScanDBSnapshot(dbp, CountHostKeyEntry, &count);
         CloseDB(dbp);
     }
 
@@ -28,15 +28,16 @@
 #include <eval_context.h>
 #include <string_lib.h>                                   /* StringFromLong */
 #include <regex.h>                                        /* CompileRegex */
+#include <regex_cache.h>                                  /* RegexCacheGet */
 
 
 /* Sets variables */
-static bool RegExMatchSubString(EvalContext *ctx, pcre *rx, const char *teststring, int *start, int *end)
+static bool RegExMatchSubString(EvalContext *ctx, const CachedRegex *crx, const char *teststring, int *start, int *end)
 {
     int ovector[OVECCOUNT];
     int rc = 0;
 
-    if ((rc = pcre_exec(rx, NULL, teststring, strlen(teststring), 0, 0, ovector, OVECCOUNT)) >= 0)
+    if ((rc = CachedRegexExec(crx, teststring, strlen(teststring), ovector, OVECCOUNT)) >= 0)
     {
         *start = ovector[0];
         *end = ovector[1];
@@ -64,17 +65,16 @@ static bool RegExMatchSubString(EvalContext *ctx, pcre *rx, const char *teststri
         *end = 0;
     }
 
-    pcre_free(rx);
     return rc >= 0;
 }
 
 /* Sets variables */
-static bool RegExMatchFullString(EvalContext *ctx, pcre *rx, const char *teststring)
+static bool RegExMatchFullString(EvalContext *ctx, const CachedRegex *crx, const char *teststring)
 {
     int match_start;
     int match_len;
 
-    if (RegExMatchSubString(ctx, rx, teststring, &match_start, &match_len))
+    if (RegExMatchSubString(ctx, crx, teststring, &match_start, &match_len))
     {
         return ((size_t) match_start == 0) && ((size_t) match_len == strlen(teststring));
     }
@@ -86,27 +86,30 @@ static bool RegExMatchFullString(EvalContext *ctx, pcre *rx, const char *teststr
 
 bool FullTextMatch(EvalContext *ctx, const char *regexp, const char *teststring)
 {
-    pcre *rx;
-
     if (strcmp(regexp, teststring) == 0)
     {
         return true;
     }
 
-    rx = CompileRegex(regexp);
-    if (rx == NULL)
+    CachedRegex *crx = RegexCacheGet(regexp);
+    if (crx == NULL)
     {
         return false;
     }
 
-    if (RegExMatchFullString(ctx, rx, teststring))
+    bool matched = RegExMatchFullString(ctx, crx, teststring);
+    RegexCacheRelease(crx);
+    return matched;
+}
+
+bool FullTextMatchCached(EvalContext *ctx, const char *regexp, const CachedRegex *crx, const char *teststring)
+{
+    if (strcmp(regexp, teststring) == 0)
     {
         return true;
     }
-    else
-    {
-        return false;
-    }
+
+    return (crx != NULL) && RegExMatchFullString(ctx, crx, teststring);
 }
 
 bool ValidateRegEx(const char *regex)
@@ -120,19 +123,18 @@ bool ValidateRegEx(const char *regex)
 
 bool BlockTextMatch(EvalContext *ctx, const char *regexp, const char *teststring, int *start, int *end)
 {
-    pcre *rx = CompileRegex(regexp);
-
-    if (rx == NULL)
+    CachedRegex *crx = RegexCacheGet(regexp);
+    if (crx == NULL)
     {
         return false;
     }
 
-    if (RegExMatchSubString(ctx, rx, teststring, start, end))
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    bool matched = RegExMatchSubString(ctx, crx, teststring, start, end);
+    RegexCacheRelease(crx);
+    return matched;
+}
+
+bool BlockTextMatchCached(EvalContext *ctx, const CachedRegex *crx, const char *teststring, int *start, int *end)
+{
+    return (crx != NULL) && RegExMatchSubString(ctx, crx, teststring, start, end);
 }
@@ -26,9 +26,14 @@
 #define CFENGINE_MATCH_SCOPE_H
 
 #include <cf3.defs.h>
+#include <regex_cache.h>                                      /* CachedRegex */
 
 bool FullTextMatch(EvalContext *ctx, const char *regptr, const char *cmpptr); /* Sets variables */
+/* FullTextMatch() with #crx = RegexCacheGet(regptr), for matching many strings */
+bool FullTextMatchCached(EvalContext *ctx, const char *regptr, const CachedRegex *crx, const char *cmpptr); /* Sets variables */
 bool BlockTextMatch(EvalContext *ctx, const char *regexp, const char *teststring, int *s, int *e); /* Sets variables */
+/* BlockTextMatch() with #crx = RegexCacheGet(regexp), for matching many strings */
+bool BlockTextMatchCached(EvalContext *ctx, const CachedRegex *crx, const char *teststring, int *s, int *e); /* Sets variables */
 bool ValidateRegEx(const char *regex); /* Pure */
 
 #endif
@@ -33,6 +33,7 @@
 #include <misc_lib.h>
 #include <rlist.h>
 #include <regex.h>                          /* CompileRegex,StringMatchFull */
+#include <regex_cache.h>                    /* RegexCacheMatchFull */
 #include <string_lib.h>
 
 
@@ -61,8 +62,6 @@ static char *FirstBackReference(pcre *rx, const char *teststring)
         }
     }
 
-    free(rx);
-
     return backreference;
 }
 
@@ -84,6 +83,24 @@ char *ExtractFirstReference(const char *regexp, const char *teststring)
     }
 
     backreference = FirstBackReference(rx, teststring);
+    free(rx);
+
+    if (strlen(backreference) == 0)
+    {
+        strlcpy(backreference, "CF_NOMATCH", CF_MAXVARSIZE);
+    }
+
+    return backreference;
+}
+
+char *ExtractFirstReferenceWithPrecompiledRegex(pcre *rx, const char *teststring)
+{
+    if ((rx == NULL) || (teststring == NULL))
+    {
+        return "";
+    }
+
+    char *backreference = FirstBackReference(rx, teststring);
 
     if (strlen(backreference) == 0)
     {
@@ -248,9 +265,10 @@ bool IsRegexItemIn(const EvalContext *ctx, const Item *list, const char *regex)
             return true;
         }
 
-        /* Make it commutative */
+        /* Make it commutative, the list items are arbitrary data so they
+         * are not cached as patterns */
 
-        if (StringMatchFull(regex, ptr->name) || StringMatchFull(ptr->name, regex))
+        if (RegexCacheMatchFull(regex, ptr->name) || StringMatchFull(ptr->name, regex))
         {
             return true;
         }
@@ -26,11 +26,13 @@
 #define CFENGINE_MATCHING_H
 
 #include <cf3.defs.h>
+#include <regex.h>                                              /* pcre */
 
 bool IsRegex(const char *str); /* Pure */
 bool IsRegexItemIn(const EvalContext *ctx, const Item *list, const char *regex); /* Uses context */
 
 char *ExtractFirstReference(const char *regexp, const char *teststring); /* Pure, not thread-safe */
+char *ExtractFirstReferenceWithPrecompiledRegex(pcre *rx, const char *teststring); /* Pure, not thread-safe */
 
 bool IsPathRegex(const char *str); /* Pure */
 bool HasRegexMetaChars(const char *string);
@@ -34,6 +34,7 @@
 #include <var_expressions.h> // StringContainsUnresolved(), StringIsBareNonScalarRef()
 #include <map.h>             // Map*
 #include <locks.h>           // AcquireLock()
+#include <processes_select.h> // InvalidateProcessTable()
 
 static Map *custom_modules = NULL;
 
@@ -1297,6 +1298,8 @@ PromiseResult EvaluateCustomPromise(EvalContext *ctx, const Promise *pp)
     if (valid)
     {
         result = PromiseModule_Evaluate(module, ctx, pp);
+        /* The module may have started or stopped processes. */
+        InvalidateProcessTable();
     }
     else
     {
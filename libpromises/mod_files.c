@@ -196,6 +196,7 @@ static const ConstraintSyntax depth_search_constraints[] =
     ConstraintSyntaxNewBool("include_basedir", "true/false include the start/root dir of the search results", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewStringList("include_dirs", ".*", "List of regexes of directory names to include in depth search", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBool("rmdeadlinks", "true/false remove links that point to nowhere. Default value: false", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewInt("scan_threads", "0,64", "Number of threads reading subdirectories ahead of the search. Default value: 0 (none)", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBool("traverse_links", "true/false traverse symbolic links to directories. Default value: false", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBool("xdev", "When true files and directories on different devices from the promiser will be excluded from depth_search results. Default value: false", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewNull()
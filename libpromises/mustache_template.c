@@ -0,0 +1,299 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <mustache_template.h>
+
+#include <alloc.h>
+#include <file_lib.h>                             /* safe_open, FileReadFromFd */
+#include <map.h>                                  /* TYPED_MAP_* */
+#include <string_lib.h>                           /* StringEqual */
+#include <writer.h>
+#include <logging.h>
+
+#include <ctype.h>                                         /* isspace */
+
+static void RefsAddScope(MustacheTemplateRefs *refs, const char *scope_key)
+{
+    const char *colon = strchr(scope_key, ':');
+    StringSetAdd(refs->scopes, xstrdup((colon != NULL) ? colon + 1 : scope_key));
+}
+
+/**
+ * Record what the name in a mustache tag refers to. Names are looked up in
+ * the enclosing sections first, but only "vars" and "classes" (and "-top-")
+ * can be found at the top level, so every other name can be ignored.
+ */
+static void RefsAddTag(MustacheTemplateRefs *refs, const char *tag, size_t len)
+{
+    while (len > 0 && isspace((unsigned char) *tag))
+    {
+        tag++;
+        len--;
+    }
+
+    if (len == 0)
+    {
+        return;
+    }
+
+    switch (*tag)
+    {
+    case '!':                   /* comment */
+    case '/':                   /* same name as the opening tag */
+    case '>':                   /* partials are not supported */
+        return;
+    case '=':                   /* the tags can't be found with other delimiters */
+        refs->all = true;
+        return;
+    case '#':
+    case '^':
+    case '&':
+    case '{':
+    case '%':
+    case '$':
+        tag++;
+        len--;
+        break;
+    default:
+        break;
+    }
+
+    while (len > 0 && isspace((unsigned char) *tag))
+    {
+        tag++;
+        len--;
+    }
+    while (len > 0 && isspace((unsigned char) tag[len - 1]))
+    {
+        len--;
+    }
+
+    char *name = xstrndup(tag, len);
+    char *components[3] = { NULL, NULL, NULL };
+    char *next = name;
+    for (int i = 0; i < 3 && next != NULL; i++)
+    {
+        components[i] = next;
+        next = strchr(next, '.');
+        if (next != NULL)
+        {
+            *next = '\0';
+            next++;
+        }
+    }
+
+    if (StringEqual(components[0], "-top-"))
+    {
+        refs->all = true;
+    }
+    else if (StringEqual(components[0], "classes"))
+    {
+        if (components[1] == NULL)
+        {
+            refs->all_classes = true;
+        }
+        else
+        {
+            StringSetAdd(refs->classes, xstrdup(components[1]));
+        }
+    }
+    else if (StringEqual(components[0], "vars"))
+    {
+        if (components[1] == NULL)
+        {
+            refs->all = true;
+        }
+        else if (components[2] == NULL)
+        {
+            StringSetAdd(refs->bundles, xstrdup(components[1]));
+            RefsAddScope(refs, components[1]);
+        }
+        else
+        {
+            StringSetAdd(refs->vars, StringConcatenate(3, components[1], ".", components[2]));
+            RefsAddScope(refs, components[1]);
+        }
+    }
+
+    free(name);
+}
+
+MustacheTemplateRefs *MustacheTemplateRefsNew(const char *text)
+{
+    MustacheTemplateRefs *refs = xcalloc(1, sizeof(MustacheTemplateRefs));
+    refs->classes = StringSetNew();
+    refs->bundles = StringSetNew();
+    refs->vars = StringSetNew();
+    refs->scopes = StringSetNew();
+
+    const char *tag = strstr(text, "{{");
+    while (tag != NULL && !refs->all)
+    {
+        tag += 2;
+        const char *end = strstr(tag, "}}");
+        if (end == NULL)
+        {
+            /* Not a valid template, let the rendering report it */
+            break;
+        }
+
+        RefsAddTag(refs, tag, end - tag);
+        tag = strstr(end + 2, "{{");
+    }
+
+    return refs;
+}
+
+void MustacheTemplateRefsDestroy(MustacheTemplateRefs *refs)
+{
+    if (refs != NULL)
+    {
+        StringSetDestroy(refs->classes);
+        StringSetDestroy(refs->bundles);
+        StringSetDestroy(refs->vars);
+        StringSetDestroy(refs->scopes);
+        free(refs);
+    }
+}
+
+MustacheTemplate *MustacheTemplateNew(const char *text, size_t length)
+{
+    assert(text != NULL);
+
+    MustacheTemplate *template = xmalloc(sizeof(MustacheTemplate));
+    template->text = xstrndup(text, length);
+    template->length = length;
+    template->refs = MustacheTemplateRefsNew(template->text);
+
+    return template;
+}
+
+void MustacheTemplateDestroy(MustacheTemplate *template)
+{
+    if (template != NULL)
+    {
+        MustacheTemplateRefsDestroy(template->refs);
+        free(template->text);
+        free(template);
+    }
+}
+
+/* Template cache */
+
+typedef struct
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    time_t ctime;
+    MustacheTemplate *template;
+} CachedTemplate;
+
+static void CachedTemplateDestroy(void *p)
+{
+    CachedTemplate *cached = p;
+    MustacheTemplateDestroy(cached->template);
+    free(cached);
+}
+
+TYPED_MAP_DECLARE(TemplateCache, char *, CachedTemplate *)
+
+TYPED_MAP_DEFINE(TemplateCache, char *, CachedTemplate *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 CachedTemplateDestroy)
+
+static TemplateCacheMap *TEMPLATE_CACHE = NULL; /* GLOBAL_X */
+
+static bool CachedTemplateIsFresh(const CachedTemplate *cached, const struct stat *sb)
+{
+    return (cached->dev == sb->st_dev && cached->ino == sb->st_ino &&
+            cached->size == sb->st_size && cached->mtime == sb->st_mtime &&
+            cached->ctime == sb->st_ctime);
+}
+
+const MustacheTemplate *MustacheTemplateLoad(const char *path)
+{
+    assert(path != NULL);
+
+    int fd = safe_open(path, O_RDONLY | O_TEXT);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Could not stat template file '%s' (fstat: %s)",
+            path, GetErrorStr());
+        close(fd);
+        return NULL;
+    }
+
+    if (TEMPLATE_CACHE == NULL)
+    {
+        TEMPLATE_CACHE = TemplateCacheMapNew();
+    }
+
+    CachedTemplate *cached = TemplateCacheMapGet(TEMPLATE_CACHE, path);
+    if (cached != NULL && CachedTemplateIsFresh(cached, &sb))
+    {
+        close(fd);
+        return cached->template;
+    }
+
+    Writer *w = FileReadFromFd(fd, SIZE_MAX, NULL);
+    close(fd);
+    if (w == NULL)
+    {
+        return NULL;
+    }
+
+    Log(LOG_LEVEL_DEBUG, "Loaded mustache template '%s'", path);
+
+    cached = xmalloc(sizeof(CachedTemplate));
+    cached->dev = sb.st_dev;
+    cached->ino = sb.st_ino;
+    cached->size = sb.st_size;
+    cached->mtime = sb.st_mtime;
+    cached->ctime = sb.st_ctime;
+    cached->template = MustacheTemplateNew(StringWriterData(w), StringWriterLength(w));
+    WriterClose(w);
+
+    TemplateCacheMapInsert(TEMPLATE_CACHE, xstrdup(path), cached);
+    return cached->template;
+}
+
+void MustacheTemplateCacheClear(void)
+{
+    if (TEMPLATE_CACHE != NULL)
+    {
+        TemplateCacheMapDestroy(TEMPLATE_CACHE);
+        TEMPLATE_CACHE = NULL;
+    }
+}
@@ -0,0 +1,77 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_MUSTACHE_TEMPLATE_H
+#define CFENGINE_MUSTACHE_TEMPLATE_H
+
+#include <platform.h>
+#include <set.h>                                               /* StringSet */
+
+/**
+ * The parts of the DefaultTemplateData() a mustache template refers to, see
+ * MustacheTemplateData().
+ */
+typedef struct
+{
+    bool all;                   /* everything is (or may be) needed */
+    bool all_classes;
+    StringSet *classes;         /* class names as in "classes" */
+    StringSet *bundles;         /* bundles needed as a whole, as in "vars" */
+    StringSet *vars;            /* "<bundle>.<variable>" */
+    StringSet *scopes;          /* bundle names without namespaces */
+} MustacheTemplateRefs;
+
+typedef struct
+{
+    char *text;
+    size_t length;
+    MustacheTemplateRefs *refs;
+} MustacheTemplate;
+
+/**
+ * Scan the tags of the mustache template #text for the vars.<bundle>,
+ * vars.<bundle>.<variable> and classes.<class> names it uses.
+ */
+MustacheTemplateRefs *MustacheTemplateRefsNew(const char *text);
+void MustacheTemplateRefsDestroy(MustacheTemplateRefs *refs);
+
+/**
+ * @param text  copied into the new template
+ */
+MustacheTemplate *MustacheTemplateNew(const char *text, size_t length);
+void MustacheTemplateDestroy(MustacheTemplate *template);
+
+/**
+ * Load the template from the file #path. Templates are kept in memory for
+ * the whole run and only read (and scanned) again once the file changes, so
+ * rendering the same template for many files reads it once.
+ *
+ * @return the cached template, valid until the next call for the same path
+ *         or MustacheTemplateCacheClear(), or NULL if the file can't be read
+ */
+const MustacheTemplate *MustacheTemplateLoad(const char *path);
+void MustacheTemplateCacheClear(void);
+
+#endif
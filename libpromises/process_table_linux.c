@@ -0,0 +1,604 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <cf3.defs.h>
+
+#include <processes_select.h>
+#include <file_lib.h>                 /* safe_open(), safe_fopen(), FullRead() */
+#include <string_lib.h>
+#include <writer.h>
+#include <unix.h>                     /* GetUserName() */
+#include <dirent.h>
+
+/* Reading the process table from /proc/<pid>/{stat,status,cmdline}, producing
+ * the same columns as 'ps -eo user:30,pid,ppid,pgid,pcpu,pmem,vsz,ni,rss:9,
+ * tname,nlwp,stime,etime,time,args' (VPSOPTS[PLATFORM_CONTEXT_LINUX]). */
+
+typedef enum
+{
+    PROC_COL_USER,
+    PROC_COL_PID,
+    PROC_COL_PPID,
+    PROC_COL_PGID,
+    PROC_COL_PCPU,
+    PROC_COL_PMEM,
+    PROC_COL_VSZ,
+    PROC_COL_NI,
+    PROC_COL_RSS,
+    PROC_COL_TT,
+    PROC_COL_NLWP,
+    PROC_COL_STIME,
+    PROC_COL_ELAPSED,
+    PROC_COL_TIME,
+    PROC_COL_COMMAND,
+    PROC_COL_MAX
+} ProcColumn;
+
+static const struct
+{
+    const char *name;
+    int width;                  /* negative for left-aligned columns */
+} PROC_COLUMNS[PROC_COL_MAX] = {
+    [PROC_COL_USER]    = { "USER",    -30 },
+    [PROC_COL_PID]     = { "PID",       7 },
+    [PROC_COL_PPID]    = { "PPID",      7 },
+    [PROC_COL_PGID]    = { "PGID",      7 },
+    [PROC_COL_PCPU]    = { "%CPU",      4 },
+    [PROC_COL_PMEM]    = { "%MEM",      4 },
+    [PROC_COL_VSZ]     = { "VSZ",       6 },
+    [PROC_COL_NI]      = { "NI",        3 },
+    [PROC_COL_RSS]     = { "RSS",       9 },
+    [PROC_COL_TT]      = { "TT",       -8 },
+    [PROC_COL_NLWP]    = { "NLWP",      4 },
+    [PROC_COL_STIME]   = { "STIME",     5 },
+    [PROC_COL_ELAPSED] = { "ELAPSED",  11 },
+    [PROC_COL_TIME]    = { "TIME",      8 },
+    [PROC_COL_COMMAND] = { "COMMAND",   0 },
+};
+
+/* Longest command line we read, like ps' default limit on Linux. */
+#define PROC_CMDLINE_MAX (128 * 1024)
+
+typedef struct
+{
+    long clock_ticks;
+    long page_kb;
+    unsigned long long mem_total_kb;
+    time_t boot_time;
+    double uptime;
+    time_t now;
+    Seq *users;                 /* cache of UserName items */
+} ProcSystemInfo;
+
+typedef struct
+{
+    uid_t uid;
+    char *name;
+} UserName;
+
+static void UserNameDestroy(void *ptr)
+{
+    UserName *user = ptr;
+    free(user->name);
+    free(user);
+}
+
+/**
+ * Read a (small) /proc file into #buf, NUL-terminated.
+ * @return number of bytes read or -1 in case of error
+ */
+static ssize_t ReadProcFile(const char *path, char *buf, size_t buf_size)
+{
+    int fd = safe_open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    ssize_t res = FullRead(fd, buf, buf_size - 1);
+    close(fd);
+    if (res < 0)
+    {
+        return -1;
+    }
+    buf[res] = '\0';
+    return res;
+}
+
+static bool GetProcSystemInfo(ProcSystemInfo *info)
+{
+    char buf[CF_BUFSIZE];
+
+    info->clock_ticks = sysconf(_SC_CLK_TCK);
+    info->page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    if (info->clock_ticks <= 0 || info->page_kb <= 0)
+    {
+        return false;
+    }
+
+    if (ReadProcFile("/proc/uptime", buf, sizeof(buf)) <= 0 ||
+        sscanf(buf, "%lf", &info->uptime) != 1)
+    {
+        return false;
+    }
+
+    info->mem_total_kb = 0;
+    if (ReadProcFile("/proc/meminfo", buf, sizeof(buf)) > 0)
+    {
+        const char *mem_total = strstr(buf, "MemTotal:");
+        if (mem_total != NULL)
+        {
+            sscanf(mem_total, "MemTotal: %llu", &info->mem_total_kb);
+        }
+    }
+
+    /* /proc/stat can be big on systems with many CPUs, btime is after the
+     * per-CPU lines so read it line by line. */
+    FILE *stat = safe_fopen("/proc/stat", "r");
+    if (stat == NULL)
+    {
+        return false;
+    }
+    long long btime = -1;
+    while (fgets(buf, sizeof(buf), stat) != NULL)
+    {
+        if (sscanf(buf, "btime %lld", &btime) == 1)
+        {
+            break;
+        }
+    }
+    fclose(stat);
+    if (btime < 0)
+    {
+        return false;
+    }
+    info->boot_time = (time_t) btime;
+    info->now = time(NULL);
+    info->users = SeqNew(16, UserNameDestroy);
+
+    return true;
+}
+
+static const char *GetUserNameCached(ProcSystemInfo *info, uid_t uid)
+{
+    const size_t n_users = SeqLength(info->users);
+    for (size_t i = 0; i < n_users; i++)
+    {
+        const UserName *user = SeqAt(info->users, i);
+        if (user->uid == uid)
+        {
+            return user->name;
+        }
+    }
+
+    UserName *user = xmalloc(sizeof(UserName));
+    user->uid = uid;
+
+    char name[CF_SMALLBUF];
+    if (GetUserName(uid, name, sizeof(name), LOG_LEVEL_DEBUG))
+    {
+        user->name = xstrdup(name);
+    }
+    else
+    {
+        /* ps also shows the numeric UID if there's no name for it */
+        user->name = StringFormat("%ju", (uintmax_t) uid);
+    }
+    SeqAppend(info->users, user);
+
+    return user->name;
+}
+
+static void FormatTTY(char *buf, size_t buf_size, unsigned long tty_nr)
+{
+    const unsigned long major = (tty_nr >> 8) & 0xfff;
+    const unsigned long minor = (tty_nr & 0xff) | ((tty_nr >> 12) & 0xfff00);
+
+    if (tty_nr == 0)
+    {
+        strlcpy(buf, "?", buf_size);
+    }
+    else if (major >= 136 && major <= 143)
+    {
+        snprintf(buf, buf_size, "pts/%lu", minor + (major - 136) * 256);
+    }
+    else if (major == 4 && minor < 64)
+    {
+        snprintf(buf, buf_size, "tty%lu", minor);
+    }
+    else if (major == 4)
+    {
+        snprintf(buf, buf_size, "ttyS%lu", minor - 64);
+    }
+    else
+    {
+        /* ps looks other devices up in /dev, not worth it */
+        strlcpy(buf, "?", buf_size);
+    }
+}
+
+/* [dd-]hh:mm:ss, as the TIME column of ps */
+static void FormatTimeCounter(char *buf, size_t buf_size, unsigned long seconds)
+{
+    const unsigned long days = seconds / SECONDS_PER_DAY;
+    seconds %= SECONDS_PER_DAY;
+    if (days > 0)
+    {
+        snprintf(buf, buf_size, "%lu-%02lu:%02lu:%02lu", days,
+                 seconds / 3600, (seconds % 3600) / 60, seconds % 60);
+    }
+    else
+    {
+        snprintf(buf, buf_size, "%02lu:%02lu:%02lu",
+                 seconds / 3600, (seconds % 3600) / 60, seconds % 60);
+    }
+}
+
+/* [[dd-]hh:]mm:ss, as the ELAPSED column of ps */
+static void FormatElapsed(char *buf, size_t buf_size, unsigned long seconds)
+{
+    const unsigned long days = seconds / SECONDS_PER_DAY;
+    seconds %= SECONDS_PER_DAY;
+    if (days > 0)
+    {
+        snprintf(buf, buf_size, "%lu-%02lu:%02lu:%02lu", days,
+                 seconds / 3600, (seconds % 3600) / 60, seconds % 60);
+    }
+    else if (seconds >= 3600)
+    {
+        snprintf(buf, buf_size, "%02lu:%02lu:%02lu",
+                 seconds / 3600, (seconds % 3600) / 60, seconds % 60);
+    }
+    else
+    {
+        snprintf(buf, buf_size, "%02lu:%02lu", seconds / 60, seconds % 60);
+    }
+}
+
+/* HH:MM for processes started in the last 24 hours, MmmDD for this year,
+ * YYYY otherwise, as the STIME column of ps */
+static void FormatStartTime(char *buf, size_t buf_size, time_t start, time_t now)
+{
+    struct tm start_tm, now_tm;
+    localtime_r(&start, &start_tm);
+    localtime_r(&now, &now_tm);
+
+    const char *format;
+    if ((now - start) < SECONDS_PER_DAY)
+    {
+        format = "%H:%M";
+    }
+    else if (start_tm.tm_year == now_tm.tm_year)
+    {
+        format = "%b%d";
+    }
+    else
+    {
+        format = "%Y";
+    }
+
+    if (strftime(buf, buf_size, format, &start_tm) == 0)
+    {
+        strlcpy(buf, "-", buf_size);
+    }
+}
+
+/**
+ * Get the command line as ps shows it: arguments separated by spaces, or the
+ * task name in brackets if there are none (kernel threads, zombies).
+ */
+static char *GetProcCommand(pid_t pid, const char *comm, char state)
+{
+    char path[64];
+    xsnprintf(path, sizeof(path), "/proc/%jd/cmdline", (intmax_t) pid);
+
+    char *cmdline = NULL;
+    ssize_t len = -1;
+    int fd = safe_open(path, O_RDONLY);
+    if (fd != -1)
+    {
+        cmdline = xmalloc(PROC_CMDLINE_MAX);
+        len = FullRead(fd, cmdline, PROC_CMDLINE_MAX - 1);
+        close(fd);
+    }
+
+    if (len <= 0)
+    {
+        free(cmdline);
+        return StringFormat("[%s]%s", comm, (state == 'Z') ? " <defunct>" : "");
+    }
+
+    /* Arguments are NUL-separated (and terminated) */
+    while (len > 0 && cmdline[len - 1] == '\0')
+    {
+        len--;
+    }
+    for (ssize_t i = 0; i < len; i++)
+    {
+        if (cmdline[i] == '\0' || cmdline[i] == '\n' || cmdline[i] == '\t')
+        {
+            cmdline[i] = ' ';
+        }
+    }
+    cmdline[len] = '\0';
+
+    return xrealloc(cmdline, len + 1);
+}
+
+static void SetColumn(ProcessTableEntry *entry, ProcColumn column, const char *value)
+{
+    entry->columns[column] = xstrdup(value);
+}
+
+static void SetNumericColumn(ProcessTableEntry *entry, ProcColumn column,
+                             const char *value, long numeric_value)
+{
+    entry->columns[column] = xstrdup(value);
+    entry->values[column] = numeric_value;
+    entry->have_values[column] = true;
+}
+
+static char *RenderLine(char **columns)
+{
+    Writer *w = StringWriter();
+    for (int i = 0; i < PROC_COL_MAX; i++)
+    {
+        if (i > 0)
+        {
+            WriterWriteChar(w, ' ');
+        }
+        if (i == PROC_COL_MAX - 1)
+        {
+            WriterWrite(w, columns[i]);
+        }
+        else
+        {
+            WriterWriteF(w, "%*s", PROC_COLUMNS[i].width, columns[i]);
+        }
+    }
+    return StringWriterClose(w);
+}
+
+static int ProcessTableEntryPidCompare(const void *a, const void *b,
+                                       ARG_UNUSED void *data)
+{
+    const ProcessTableEntry *entry_a = a;
+    const ProcessTableEntry *entry_b = b;
+    return (entry_a->pid > entry_b->pid) - (entry_a->pid < entry_b->pid);
+}
+
+static ProcessTableEntry *LoadProcessEntry(ProcSystemInfo *info, pid_t pid)
+{
+    char path[64];
+    char buf[CF_BUFSIZE];
+
+    xsnprintf(path, sizeof(path), "/proc/%jd/stat", (intmax_t) pid);
+    ssize_t len = ReadProcFile(path, buf, sizeof(buf));
+    if (len <= 0)
+    {
+        /* Process exited in the meantime */
+        return NULL;
+    }
+
+    /* <pid> (<comm>) <state> ..., comm can contain anything */
+    char *comm_start = strchr(buf, '(');
+    char *comm_end = memrchr(buf, ')', len);
+    if (comm_start == NULL || comm_end == NULL || comm_end < comm_start)
+    {
+        return NULL;
+    }
+    *comm_end = '\0';
+    const char *comm = comm_start + 1;
+
+    char state;
+    int ppid, pgrp;
+    unsigned long tty_nr;
+    unsigned long utime, stime;
+    long nice, num_threads;
+    unsigned long long starttime;
+    unsigned long vsize;
+    long rss;
+    if (sscanf(comm_end + 1,
+               " %c"            /* state */
+               " %d"            /* ppid */
+               " %d"            /* pgrp */
+               " %*d"           /* session */
+               " %lu"           /* tty_nr */
+               " %*d"           /* tpgid */
+               " %*u"           /* flags */
+               " %*u %*u %*u %*u" /* minflt cminflt majflt cmajflt */
+               " %lu %lu"       /* utime stime */
+               " %*d %*d"       /* cutime cstime */
+               " %*d"           /* priority */
+               " %ld"           /* nice */
+               " %ld"           /* num_threads */
+               " %*d"           /* itrealvalue */
+               " %llu"          /* starttime */
+               " %lu"           /* vsize */
+               " %ld",          /* rss */
+               &state, &ppid, &pgrp, &tty_nr, &utime, &stime, &nice,
+               &num_threads, &starttime, &vsize, &rss) != 11)
+    {
+        Log(LOG_LEVEL_DEBUG, "Failed to parse '%s'", path);
+        return NULL;
+    }
+
+    xsnprintf(path, sizeof(path), "/proc/%jd/status", (intmax_t) pid);
+    if (ReadProcFile(path, buf, sizeof(buf)) <= 0)
+    {
+        return NULL;
+    }
+    const char *uid_line = strstr(buf, "\nUid:");
+    unsigned long euid;
+    if (uid_line == NULL || sscanf(uid_line, "\nUid: %*u %lu", &euid) != 1)
+    {
+        Log(LOG_LEVEL_DEBUG, "Failed to get UID from '%s'", path);
+        return NULL;
+    }
+
+    ProcessTableEntry *entry = xcalloc(1, sizeof(ProcessTableEntry));
+    entry->pid = pid;
+
+    const unsigned long cpu_seconds = (utime + stime) / info->clock_ticks;
+    const double started = (double) starttime / info->clock_ticks;
+    const double running = MAX(info->uptime - started, 0.0);
+    const time_t start_time = info->boot_time + (time_t) started;
+    const unsigned long vsz_kb = vsize / 1024;
+    const unsigned long rss_kb = MAX(rss, 0) * info->page_kb;
+
+    char value[64];
+    /* The numeric value of the USER column is the UID */
+    SetNumericColumn(entry, PROC_COL_USER, GetUserNameCached(info, (uid_t) euid), euid);
+
+    xsnprintf(value, sizeof(value), "%jd", (intmax_t) pid);
+    SetNumericColumn(entry, PROC_COL_PID, value, pid);
+    xsnprintf(value, sizeof(value), "%d", ppid);
+    SetNumericColumn(entry, PROC_COL_PPID, value, ppid);
+    xsnprintf(value, sizeof(value), "%d", pgrp);
+    SetNumericColumn(entry, PROC_COL_PGID, value, pgrp);
+
+    /* ps computes %CPU over the whole lifetime of the process */
+    const double pcpu = (running > 0) ? ((utime + stime) * 100.0 /
+                                         info->clock_ticks / running) : 0.0;
+    xsnprintf(value, sizeof(value), "%.1f", pcpu);
+    SetColumn(entry, PROC_COL_PCPU, value);
+    const double pmem = (info->mem_total_kb > 0) ?
+        (rss_kb * 100.0 / info->mem_total_kb) : 0.0;
+    xsnprintf(value, sizeof(value), "%.1f", pmem);
+    SetColumn(entry, PROC_COL_PMEM, value);
+
+    xsnprintf(value, sizeof(value), "%lu", vsz_kb);
+    SetNumericColumn(entry, PROC_COL_VSZ, value, vsz_kb);
+    xsnprintf(value, sizeof(value), "%ld", nice);
+    SetNumericColumn(entry, PROC_COL_NI, value, nice);
+    xsnprintf(value, sizeof(value), "%lu", rss_kb);
+    SetNumericColumn(entry, PROC_COL_RSS, value, rss_kb);
+
+    FormatTTY(value, sizeof(value), tty_nr);
+    SetColumn(entry, PROC_COL_TT, value);
+
+    xsnprintf(value, sizeof(value), "%ld", num_threads);
+    SetNumericColumn(entry, PROC_COL_NLWP, value, num_threads);
+
+    FormatStartTime(value, sizeof(value), start_time, info->now);
+    SetNumericColumn(entry, PROC_COL_STIME, value, start_time);
+    FormatElapsed(value, sizeof(value), (unsigned long) running);
+    SetNumericColumn(entry, PROC_COL_ELAPSED, value, (long) running);
+    FormatTimeCounter(value, sizeof(value), cpu_seconds);
+    SetNumericColumn(entry, PROC_COL_TIME, value, cpu_seconds);
+
+    /* Always read again, processes can change their command line
+     * (setproctitle()) without changing anything else. */
+    entry->columns[PROC_COL_COMMAND] = GetProcCommand(pid, comm, state);
+
+    entry->line = RenderLine(entry->columns);
+
+    return entry;
+}
+
+static bool IsPidDirName(const char *name)
+{
+    if (*name == '\0')
+    {
+        return false;
+    }
+    for (; *name != '\0'; name++)
+    {
+        if (!isdigit((unsigned char) *name))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void ProcessTableEntryDestroy_untyped(void *entry)
+{
+    ProcessTableEntryDestroy(entry);
+}
+
+Seq *LoadProcessTableFromProc(char **names, char **legend)
+{
+    assert(names != NULL);
+    assert(legend != NULL);
+
+    ProcSystemInfo info;
+    if (!GetProcSystemInfo(&info))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Failed to get system information from /proc");
+        return NULL;
+    }
+
+    DIR *proc = opendir("/proc");
+    if (proc == NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Failed to open /proc (opendir: %s)", GetErrorStr());
+        SeqDestroy(info.users);
+        return NULL;
+    }
+
+    Seq *entries = SeqNew(512, ProcessTableEntryDestroy_untyped);
+
+    const struct dirent *dirp;
+    while ((dirp = readdir(proc)) != NULL)
+    {
+        if (!IsPidDirName(dirp->d_name))
+        {
+            continue;
+        }
+        ProcessTableEntry *entry = LoadProcessEntry(&info, (pid_t) atoi(dirp->d_name));
+        if (entry != NULL)
+        {
+            SeqAppend(entries, entry);
+        }
+    }
+    closedir(proc);
+    SeqDestroy(info.users);
+
+    /* /proc is listed in PID order, but that's not guaranteed */
+    SeqSort(entries, ProcessTableEntryPidCompare, NULL);
+
+    if (SeqLength(entries) == 0)
+    {
+        /* At least we should be there, something is wrong (hidepid?) */
+        Log(LOG_LEVEL_VERBOSE, "No processes found in /proc");
+        SeqDestroy(entries);
+        return NULL;
+    }
+
+    char *header[PROC_COL_MAX];
+    for (int i = 0; i < PROC_COL_MAX; i++)
+    {
+        header[i] = (char *) PROC_COLUMNS[i].name;
+        names[i] = xstrdup(PROC_COLUMNS[i].name);
+    }
+    for (int i = PROC_COL_MAX; i < CF_PROCCOLS; i++)
+    {
+        names[i] = NULL;
+    }
+    *legend = RenderLine(header);
+
+    Log(LOG_LEVEL_VERBOSE, "Loaded %zu processes from /proc", SeqLength(entries));
+
+    return entries;
+}
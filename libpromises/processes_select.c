@@ -32,7 +32,7 @@
 #include <matching.h>
 #include <systype.h>
 #include <string_lib.h>                                         /* Chop */
-#include <regex.h> /* CompileRegex,StringMatchWithPrecompiledRegex,StringMatchFull */
+#include <regex.h> /* CompileRegex,StringMatch[Full]WithPrecompiledRegex */
 #include <item_lib.h>
 #include <file_lib.h>   // SetUmask(), RestoreUmask()
 #include <pipes.h>
@@ -55,6 +55,22 @@
 #endif
 TABLE_STORAGE Item *PROCESSTABLE = NULL;
 
+/* PROCESSTABLE split into columns, see GetProcessTableEntries() */
+static Seq *PROCESS_ENTRIES = NULL;                       /* GLOBAL_X */
+static char *PROCESS_COLUMN_NAMES[CF_PROCCOLS] = { 0 };   /* GLOBAL_X */
+/* When the process table was loaded (0 if unknown) */
+static time_t PROCESS_TABLE_TIME = 0;                     /* GLOBAL_X */
+/* Increased every time the process table is (re)loaded, for logging */
+static unsigned long PROCESS_TABLE_GENERATION = 0;        /* GLOBAL_X */
+static bool PROCESS_TABLE_INVALID = false;                /* GLOBAL_X */
+
+typedef enum
+{
+    PROCESS_COLUMN_INTEGER,
+    PROCESS_COLUMN_TIME_COUNTER, /* [dd-]hh:mm[:ss], e.g. TIME */
+    PROCESS_COLUMN_TIME_ABS,     /* absolute time, e.g. STIME */
+} ProcessColumnType;
+
 typedef enum
 {
     /*
@@ -116,8 +132,6 @@ static const char *UCB_STYLE_PS_ARGS = "axwww";
 static const PsColumnAlgorithm UCB_STYLE_PS_COLUMN_ALGORITHM = PCA_ZombieSkipEmptyColumns;
 #endif
 
-static bool SelectProcRangeMatch(char *name1, char *name2, int min, int max, char **names, char **line);
-static bool SelectProcRegexMatch(const char *name1, const char *name2, const char *regex, bool anchored, char **colNames, char **line);
 static bool SplitProcLine(const char *proc,
                           time_t pstime,
                           char **names,
@@ -125,8 +139,6 @@ static bool SplitProcLine(const char *proc,
                           int *end,
                           PsColumnAlgorithm pca,
                           char **line);
-static bool SelectProcTimeCounterRangeMatch(char *name1, char *name2, time_t min, time_t max, char **names, char **line);
-static bool SelectProcTimeAbsRangeMatch(char *name1, char *name2, time_t min, time_t max, char **names, char **line);
 static int GetProcColumnIndex(const char *name1, const char *name2, char **names);
 static void GetProcessColumnNames(const char *proc, char **names, int *start, int *end);
 static int ExtractPid(char *psentry, char **names, int *end);
@@ -134,252 +146,101 @@ static void ApplyPlatformExtraTable(char **names, char **columns);
 
 /***************************************************************************/
 
-static bool SelectProcess(const char *procentry,
-                          time_t pstime,
-                          char **names,
-                          int *start,
-                          int *end,
-                          const char *process_regex,
-                          const ProcessSelect *a,
-                          bool attrselect)
+void ProcessTableEntryDestroy(ProcessTableEntry *entry)
 {
-    bool result = true;
-    char *column[CF_PROCCOLS];
-    Rlist *rp;
-
-    assert(process_regex);
-    assert(a != NULL);
-
-    StringSet *process_select_attributes = StringSetNew();
-
-    memset(column, 0, sizeof(column));
-
-    if (!SplitProcLine(procentry, pstime, names, start, end,
-                       PS_COLUMN_ALGORITHM[VPSHARDCLASS], column))
-    {
-        result = false;
-        goto cleanup;
-    }
-
-    ApplyPlatformExtraTable(names, column);
-
-    for (int i = 0; names[i] != NULL; i++)
-    {
-        LogDebug(LOG_MOD_PS, "In SelectProcess, COL[%s] = '%s'",
-                 names[i], column[i]);
-    }
-
-    if (!SelectProcRegexMatch("CMD", "COMMAND", process_regex, false, names, column))
-    {
-        result = false;
-        goto cleanup;
-    }
-
-    if (!attrselect)
-    {
-        // If we are not considering attributes, then the matching is done.
-        goto cleanup;
-    }
-
-    for (rp = a->owner; rp != NULL; rp = rp->next)
-    {
-        if (rp->val.type == RVAL_TYPE_FNCALL)
-        {
-            Log(LOG_LEVEL_VERBOSE,
-                "Function call '%s' in process_select body was not resolved, skipping",
-                RlistFnCallValue(rp)->name);
-        }
-        else if (SelectProcRegexMatch("USER", "UID", RlistScalarValue(rp), true, names, column))
-        {
-            StringSetAdd(process_select_attributes, xstrdup("process_owner"));
-            break;
-        }
-    }
-
-    if (SelectProcRangeMatch("PID", "PID", a->min_pid, a->max_pid, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("pid"));
-    }
-
-    if (SelectProcRangeMatch("PPID", "PPID", a->min_ppid, a->max_ppid, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("ppid"));
-    }
-
-    if (SelectProcRangeMatch("PGID", "PGID", a->min_pgid, a->max_pgid, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("pgid"));
-    }
-
-    if (SelectProcRangeMatch("VSZ", "SZ", a->min_vsize, a->max_vsize, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("vsize"));
-    }
-
-    if (SelectProcRangeMatch("RSS", "RSS", a->min_rsize, a->max_rsize, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("rsize"));
-    }
-
-    if (SelectProcTimeCounterRangeMatch("TIME", "TIME", a->min_ttime, a->max_ttime, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("ttime"));
-    }
-
-    if (SelectProcTimeAbsRangeMatch
-        ("STIME", "START", a->min_stime, a->max_stime, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("stime"));
-    }
-
-    if (SelectProcRangeMatch("NI", "PRI", a->min_pri, a->max_pri, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("priority"));
-    }
-
-    if (SelectProcRangeMatch("NLWP", "NLWP", a->min_thread, a->max_thread, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("threads"));
-    }
-
-    if (SelectProcRegexMatch("S", "STAT", a->status, true, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("status"));
-    }
-
-    if (SelectProcRegexMatch("CMD", "COMMAND", a->command, true, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("command"));
-    }
-
-    if (SelectProcRegexMatch("TTY", "TTY", a->tty, true, names, column))
-    {
-        StringSetAdd(process_select_attributes, xstrdup("tty"));
-    }
-
-    if (!a->process_result)
+    if (entry != NULL)
     {
-        if (StringSetSize(process_select_attributes) == 0)
-        {
-            result = EvalProcessResult("", process_select_attributes);
-        }
-        else
+        free(entry->line);
+        for (int i = 0; i < CF_PROCCOLS; i++)
         {
-            Writer *w = StringWriter();
-            StringSetIterator iter = StringSetIteratorInit(process_select_attributes);
-            char *attr = StringSetIteratorNext(&iter);
-            WriterWrite(w, attr);
-
-            while ((attr = StringSetIteratorNext(&iter)))
-            {
-                WriterWriteChar(w, '.');
-                WriterWrite(w, attr);
-            }
-
-            result = EvalProcessResult(StringWriterData(w), process_select_attributes);
-            WriterClose(w);
+            free(entry->columns[i]);
         }
+        free(entry);
     }
-    else
-    {
-        result = EvalProcessResult(a->process_result, process_select_attributes);
-    }
-
-cleanup:
-    StringSetDestroy(process_select_attributes);
-
-    for (int i = 0; column[i] != NULL; i++)
-    {
-        free(column[i]);
-    }
-
-    return result;
 }
 
-Item *SelectProcesses(const char *process_name, const ProcessSelect *a, bool attrselect)
+static void ProcessTableEntryDestroy_untyped(void *entry)
 {
-    assert(a != NULL);
-    const Item *processes = PROCESSTABLE;
-    Item *result = NULL;
+    ProcessTableEntryDestroy(entry);
+}
 
-    if (processes == NULL)
+/**
+ * Get the entries of the loaded process table, splitting the lines of
+ * PROCESSTABLE into columns only once per loaded table (unless the table was
+ * loaded with the columns already split).
+ *
+ * @return %NULL if no process table is loaded
+ */
+static Seq *GetProcessTableEntries(void)
+{
+    if (PROCESS_ENTRIES != NULL)
     {
-        return result;
+        return PROCESS_ENTRIES;
+    }
+    if (PROCESSTABLE == NULL)
+    {
+        return NULL;
     }
 
-    char *names[CF_PROCCOLS];
     int start[CF_PROCCOLS];
     int end[CF_PROCCOLS];
+    GetProcessColumnNames(PROCESSTABLE->name, PROCESS_COLUMN_NAMES, start, end);
 
-    GetProcessColumnNames(processes->name, names, start, end);
-
-    /* TODO: use actual time of ps-run, as time(NULL) may be later. */
-    time_t pstime = time(NULL);
+    const time_t pstime = (PROCESS_TABLE_TIME != 0) ? PROCESS_TABLE_TIME : time(NULL);
 
-    for (Item *ip = processes->next; ip != NULL; ip = ip->next)
+    PROCESS_ENTRIES = SeqNew(512, ProcessTableEntryDestroy_untyped);
+    for (const Item *ip = PROCESSTABLE->next; ip != NULL; ip = ip->next)
     {
         if (NULL_OR_EMPTY(ip->name))
         {
             continue;
         }
 
-        if (!SelectProcess(ip->name, pstime, names, start, end, process_name, a, attrselect))
-        {
-            continue;
-        }
-
-        pid_t pid = ExtractPid(ip->name, names, end);
-
-        if (pid == -1)
+        ProcessTableEntry *entry = xcalloc(1, sizeof(ProcessTableEntry));
+        if (!SplitProcLine(ip->name, pstime, PROCESS_COLUMN_NAMES, start, end,
+                           PS_COLUMN_ALGORITHM[VPSHARDCLASS], entry->columns))
         {
-            Log(LOG_LEVEL_VERBOSE, "Unable to extract pid while looking for %s", process_name);
+            Log(LOG_LEVEL_VERBOSE, "Could not split process line '%s'", ip->name);
+            ProcessTableEntryDestroy(entry);
             continue;
         }
 
-        PrependItem(&result, ip->name, "");
-        result->counter = (int)pid;
-    }
+        ApplyPlatformExtraTable(PROCESS_COLUMN_NAMES, entry->columns);
 
-    for (int i = 0; i < CF_PROCCOLS; i++)
-    {
-        free(names[i]);
+        entry->pid = ExtractPid(ip->name, PROCESS_COLUMN_NAMES, end);
+        entry->line = xstrdup(ip->name);
+        SeqAppend(PROCESS_ENTRIES, entry);
     }
 
-    return result;
+    return PROCESS_ENTRIES;
 }
 
-static bool SelectProcRangeMatch(char *name1, char *name2, int min, int max, char **names, char **line)
-{
-    int i;
-    long value;
+static long TimeCounter2Int(const char *s);
+static time_t TimeAbs2Int(const char *s);
 
-    if ((min == CF_NOINT) || (max == CF_NOINT))
-    {
-        return false;
-    }
-
-    if ((i = GetProcColumnIndex(name1, name2, names)) != -1)
+/**
+ * Get the numeric value of column #i of #entry, parsing it (once) if the
+ * process table didn't provide it.
+ */
+static long GetProcessColumnValue(ProcessTableEntry *entry, int i, ProcessColumnType type)
+{
+    if (!entry->have_values[i])
     {
-        value = IntFromString(line[i]);
-
-        if (value == CF_NOINT)
-        {
-            Log(LOG_LEVEL_INFO, "Failed to extract a valid integer from '%s' => '%s' in process list", names[i],
-                  line[i]);
-            return false;
-        }
-
-        if ((min <= value) && (value <= max))
-        {
-            return true;
-        }
-        else
+        switch (type)
         {
-            return false;
+        case PROCESS_COLUMN_INTEGER:
+            entry->values[i] = IntFromString(entry->columns[i]);
+            break;
+        case PROCESS_COLUMN_TIME_COUNTER:
+            entry->values[i] = TimeCounter2Int(entry->columns[i]);
+            break;
+        case PROCESS_COLUMN_TIME_ABS:
+            entry->values[i] = (long) TimeAbs2Int(entry->columns[i]);
+            break;
         }
+        entry->have_values[i] = true;
     }
-
-    return false;
+    return entry->values[i];
 }
 
 /***************************************************************************/
@@ -428,46 +289,6 @@ static long TimeCounter2Int(const char *s)
     return ((days * 24 + hours) * 60 + minutes) * 60 + seconds;
 }
 
-static bool SelectProcTimeCounterRangeMatch(char *name1, char *name2, time_t min, time_t max, char **names, char **line)
-{
-    if ((min == CF_NOINT) || (max == CF_NOINT))
-    {
-        return false;
-    }
-
-    int i = GetProcColumnIndex(name1, name2, names);
-    if (i != -1)
-    {
-        time_t value = (time_t) TimeCounter2Int(line[i]);
-
-        if (value == CF_NOINT)
-        {
-            Log(LOG_LEVEL_INFO,
-                "Failed to extract a valid integer from %s => '%s' in process list",
-                names[i], line[i]);
-            return false;
-        }
-
-        if ((min <= value) && (value <= max))
-        {
-            Log(LOG_LEVEL_VERBOSE, "Selection filter matched counter range"
-                " '%s/%s' = '%s' in [%jd,%jd] (= %jd secs)",
-                  name1, name2, line[i], (intmax_t)min, (intmax_t)max, (intmax_t)value);
-            return true;
-        }
-        else
-        {
-            LogDebug(LOG_MOD_PS, "Selection filter REJECTED counter range"
-                     " '%s/%s' = '%s' in [%jd,%jd] (= %jd secs)",
-                     name1, name2, line[i],
-                     (intmax_t) min, (intmax_t) max, (intmax_t) value);
-            return false;
-        }
-    }
-
-    return false;
-}
-
 static time_t TimeAbs2Int(const char *s)
 {
     if (s == NULL)
@@ -537,71 +358,435 @@ static time_t TimeAbs2Int(const char *s)
     return mktime(&tm);
 }
 
-static bool SelectProcTimeAbsRangeMatch(char *name1, char *name2, time_t min, time_t max, char **names, char **line)
+/***************************************************************************/
+
+/* A process_select body (and the promiser regex) is compiled once per
+ * SelectProcesses() call into a "program" with the columns resolved, the
+ * regular expressions compiled and the ranges as numbers, which is then
+ * evaluated against all the entries of the process table. */
+
+typedef enum
+{
+    PROCESS_ATTR_PROCESS_OWNER,
+    PROCESS_ATTR_PID,
+    PROCESS_ATTR_PPID,
+    PROCESS_ATTR_PGID,
+    PROCESS_ATTR_VSIZE,
+    PROCESS_ATTR_RSIZE,
+    PROCESS_ATTR_TTIME,
+    PROCESS_ATTR_STIME,
+    PROCESS_ATTR_PRIORITY,
+    PROCESS_ATTR_THREADS,
+    PROCESS_ATTR_STATUS,
+    PROCESS_ATTR_COMMAND,
+    PROCESS_ATTR_TTY,
+    PROCESS_ATTR_MAX
+} ProcessAttribute;
+
+/* The names used in process_result expressions */
+static const char *const PROCESS_ATTRIBUTE_NAMES[PROCESS_ATTR_MAX] =
+{
+    [PROCESS_ATTR_PROCESS_OWNER] = "process_owner",
+    [PROCESS_ATTR_PID]           = "pid",
+    [PROCESS_ATTR_PPID]          = "ppid",
+    [PROCESS_ATTR_PGID]          = "pgid",
+    [PROCESS_ATTR_VSIZE]         = "vsize",
+    [PROCESS_ATTR_RSIZE]         = "rsize",
+    [PROCESS_ATTR_TTIME]         = "ttime",
+    [PROCESS_ATTR_STIME]         = "stime",
+    [PROCESS_ATTR_PRIORITY]      = "priority",
+    [PROCESS_ATTR_THREADS]       = "threads",
+    [PROCESS_ATTR_STATUS]        = "status",
+    [PROCESS_ATTR_COMMAND]       = "command",
+    [PROCESS_ATTR_TTY]           = "tty",
+};
+
+typedef struct
+{
+    ProcessAttribute attribute;
+    int column;
+    bool is_regex;
+    /* ranges */
+    ProcessColumnType type;
+    long min;
+    long max;
+    /* regexes (any of them matching the whole column value) */
+    pcre **regexes;
+    size_t n_regexes;
+} ProcessFilter;
+
+typedef enum
+{
+    PROCESS_RESULT_ANY,         /* no process_result, any attribute matching */
+    PROCESS_RESULT_NONE,        /* empty or invalid process_result */
+    PROCESS_RESULT_EXPRESSION,
+} ProcessResultMode;
+
+typedef struct
 {
-    int i;
-    time_t value;
+    char **names;
+    pcre *process_regex;        /* the promiser, not anchored */
+    int command_column;
+    bool attrselect;
+    ProcessFilter filters[PROCESS_ATTR_MAX];
+    size_t n_filters;
+    ProcessResultMode result_mode;
+    Expression *result;
+} ProcessSelectProgram;
+
+static ProcessFilter *AddProcessFilter(ProcessSelectProgram *program, ProcessAttribute attribute,
+                                       const char *name1, const char *name2)
+{
+    const int column = GetProcColumnIndex(name1, name2, program->names);
+    if (column == -1)
+    {
+        /* Never matches */
+        return NULL;
+    }
+
+    ProcessFilter *filter = &(program->filters[program->n_filters]);
+    program->n_filters++;
+
+    memset(filter, 0, sizeof(ProcessFilter));
+    filter->attribute = attribute;
+    filter->column = column;
+    return filter;
+}
 
+static void AddProcessRangeFilter(ProcessSelectProgram *program, ProcessAttribute attribute,
+                                  const char *name1, const char *name2,
+                                  ProcessColumnType type, long min, long max)
+{
     if ((min == CF_NOINT) || (max == CF_NOINT))
     {
-        return false;
+        return;
+    }
+
+    ProcessFilter *filter = AddProcessFilter(program, attribute, name1, name2);
+    if (filter != NULL)
+    {
+        filter->type = type;
+        filter->min = min;
+        filter->max = max;
+    }
+}
+
+static void AddProcessRegexFilter(ProcessSelectProgram *program, ProcessAttribute attribute,
+                                  const char *name1, const char *name2, const char *regex)
+{
+    if (regex == NULL)
+    {
+        return;
     }
 
-    if ((i = GetProcColumnIndex(name1, name2, names)) != -1)
+    pcre *rx = CompileRegex(regex);
+    if (rx == NULL)
     {
-        value = TimeAbs2Int(line[i]);
+        /* Never matches */
+        return;
+    }
+
+    ProcessFilter *filter = AddProcessFilter(program, attribute, name1, name2);
+    if (filter == NULL)
+    {
+        pcre_free(rx);
+        return;
+    }
+
+    filter->is_regex = true;
+    filter->regexes = xmalloc(sizeof(pcre *));
+    filter->regexes[0] = rx;
+    filter->n_regexes = 1;
+}
 
-        if (value == CF_NOINT)
+static void AddProcessOwnerFilter(ProcessSelectProgram *program, const Rlist *owners)
+{
+    ProcessFilter *filter = NULL;
+    for (const Rlist *rp = owners; rp != NULL; rp = rp->next)
+    {
+        if (rp->val.type == RVAL_TYPE_FNCALL)
         {
-            Log(LOG_LEVEL_INFO, "Failed to extract a valid integer from %c => '%s' in process list", name1[i],
-                  line[i]);
-            return false;
+            Log(LOG_LEVEL_VERBOSE,
+                "Function call '%s' in process_select body was not resolved, skipping",
+                RlistFnCallValue(rp)->name);
+            continue;
+        }
+
+        if (filter == NULL)
+        {
+            filter = AddProcessFilter(program, PROCESS_ATTR_PROCESS_OWNER, "USER", "UID");
+            if (filter == NULL)
+            {
+                return;
+            }
+            filter->is_regex = true;
         }
 
-        if ((min <= value) && (value <= max))
+        pcre *rx = CompileRegex(RlistScalarValue(rp));
+        if (rx != NULL)
         {
-            Log(LOG_LEVEL_VERBOSE, "Selection filter matched absolute '%s/%s' = '%s(%jd)' in [%jd,%jd]", name1, name2, line[i], (intmax_t)value,
-                  (intmax_t)min, (intmax_t)max);
-            return true;
+            filter->regexes = xrealloc(filter->regexes,
+                                       (filter->n_regexes + 1) * sizeof(pcre *));
+            filter->regexes[filter->n_regexes] = rx;
+            filter->n_regexes++;
+        }
+    }
+}
+
+static void ProcessSelectProgramDestroy(ProcessSelectProgram *program)
+{
+    if (program->process_regex != NULL)
+    {
+        pcre_free(program->process_regex);
+    }
+    for (size_t i = 0; i < program->n_filters; i++)
+    {
+        for (size_t j = 0; j < program->filters[i].n_regexes; j++)
+        {
+            pcre_free(program->filters[i].regexes[j]);
+        }
+        free(program->filters[i].regexes);
+    }
+    FreeExpression(program->result);
+}
+
+/**
+ * @return false if nothing can match (e.g. invalid #process_regex)
+ */
+static bool ProcessSelectProgramCompile(ProcessSelectProgram *program, char **names,
+                                        const char *process_regex,
+                                        const ProcessSelect *a, bool attrselect)
+{
+    assert(process_regex != NULL);
+    assert(a != NULL);
+
+    memset(program, 0, sizeof(ProcessSelectProgram));
+    program->names = names;
+    program->attrselect = attrselect;
+
+    program->command_column = GetProcColumnIndex("CMD", "COMMAND", names);
+    if (program->command_column == -1)
+    {
+        return false;
+    }
+
+    program->process_regex = CompileRegex(process_regex);
+    if (program->process_regex == NULL)
+    {
+        return false;
+    }
+
+    if (!attrselect)
+    {
+        return true;
+    }
+
+    AddProcessOwnerFilter(program, a->owner);
+    AddProcessRangeFilter(program, PROCESS_ATTR_PID, "PID", "PID",
+                          PROCESS_COLUMN_INTEGER, a->min_pid, a->max_pid);
+    AddProcessRangeFilter(program, PROCESS_ATTR_PPID, "PPID", "PPID",
+                          PROCESS_COLUMN_INTEGER, a->min_ppid, a->max_ppid);
+    AddProcessRangeFilter(program, PROCESS_ATTR_PGID, "PGID", "PGID",
+                          PROCESS_COLUMN_INTEGER, a->min_pgid, a->max_pgid);
+    AddProcessRangeFilter(program, PROCESS_ATTR_VSIZE, "VSZ", "SZ",
+                          PROCESS_COLUMN_INTEGER, a->min_vsize, a->max_vsize);
+    AddProcessRangeFilter(program, PROCESS_ATTR_RSIZE, "RSS", "RSS",
+                          PROCESS_COLUMN_INTEGER, a->min_rsize, a->max_rsize);
+    AddProcessRangeFilter(program, PROCESS_ATTR_TTIME, "TIME", "TIME",
+                          PROCESS_COLUMN_TIME_COUNTER, a->min_ttime, a->max_ttime);
+    AddProcessRangeFilter(program, PROCESS_ATTR_STIME, "STIME", "START",
+                          PROCESS_COLUMN_TIME_ABS, a->min_stime, a->max_stime);
+    AddProcessRangeFilter(program, PROCESS_ATTR_PRIORITY, "NI", "PRI",
+                          PROCESS_COLUMN_INTEGER, a->min_pri, a->max_pri);
+    AddProcessRangeFilter(program, PROCESS_ATTR_THREADS, "NLWP", "NLWP",
+                          PROCESS_COLUMN_INTEGER, a->min_thread, a->max_thread);
+    AddProcessRegexFilter(program, PROCESS_ATTR_STATUS, "S", "STAT", a->status);
+    AddProcessRegexFilter(program, PROCESS_ATTR_COMMAND, "CMD", "COMMAND", a->command);
+    AddProcessRegexFilter(program, PROCESS_ATTR_TTY, "TTY", "TTY", a->tty);
+
+    if (a->process_result == NULL)
+    {
+        program->result_mode = PROCESS_RESULT_ANY;
+    }
+    else if (StringEqual(a->process_result, ""))
+    {
+        /* nothing to evaluate */
+        program->result_mode = PROCESS_RESULT_NONE;
+    }
+    else
+    {
+        ParseResult res = ParseExpression(a->process_result, 0, strlen(a->process_result));
+        if (res.result == NULL)
+        {
+            Log(LOG_LEVEL_ERR, "Syntax error in expression '%s'", a->process_result);
+            program->result_mode = PROCESS_RESULT_NONE;
         }
         else
         {
-            return false;
+            program->result_mode = PROCESS_RESULT_EXPRESSION;
+            program->result = res.result;
+        }
+    }
+
+    return true;
+}
+
+static bool ProcessFilterMatch(const ProcessSelectProgram *program, const ProcessFilter *filter,
+                               ProcessTableEntry *entry)
+{
+    const int i = filter->column;
+    const char *column = entry->columns[i];
+    if (column == NULL)
+    {
+        return false;
+    }
+
+    if (filter->is_regex)
+    {
+        for (size_t j = 0; j < filter->n_regexes; j++)
+        {
+            if (StringMatchFullWithPrecompiledRegex(filter->regexes[j], column))
+            {
+                return true;
+            }
         }
+        return false;
+    }
+
+    const long value = GetProcessColumnValue(entry, i, filter->type);
+    if (value == CF_NOINT)
+    {
+        Log(LOG_LEVEL_INFO, "Failed to extract a valid integer from '%s' => '%s' in process list",
+            program->names[i], column);
+        return false;
     }
 
+    if ((filter->min <= value) && (value <= filter->max))
+    {
+        if (filter->type != PROCESS_COLUMN_INTEGER)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Selection filter matched time range"
+                " '%s' = '%s' in [%ld,%ld] (= %ld)",
+                program->names[i], column, filter->min, filter->max, value);
+        }
+        return true;
+    }
     return false;
 }
 
-/***************************************************************************/
+static ExpressionValue EvalProcessAttribute(const char *token, void *param)
+{
+    const unsigned int *matched = param;
+    for (int i = 0; i < PROCESS_ATTR_MAX; i++)
+    {
+        if (StringEqual(token, PROCESS_ATTRIBUTE_NAMES[i]))
+        {
+            return (ExpressionValue) ((*matched & (1U << i)) != 0);
+        }
+    }
+    return EXPRESSION_VALUE_FALSE;
+}
+
+static char *EvalProcessVarRef(ARG_UNUSED const char *varname, ARG_UNUSED VarRefType type,
+                               ARG_UNUSED void *param)
+{
+    /* Variables are expanded before the process_select body is used. */
+    return NULL;
+}
 
-static bool SelectProcRegexMatch(const char *name1, const char *name2,
-                                 const char *regex, bool anchored,
-                                 char **colNames, char **line)
+static bool ProcessSelectProgramMatch(const ProcessSelectProgram *program,
+                                      ProcessTableEntry *entry)
 {
-    int i;
+    for (int i = 0; program->names[i] != NULL; i++)
+    {
+        LogDebug(LOG_MOD_PS, "In SelectProcess, COL[%s] = '%s'",
+                 program->names[i], entry->columns[i]);
+    }
 
-    if (regex == NULL)
+    const char *command = entry->columns[program->command_column];
+    size_t s, e;
+    if (command == NULL ||
+        !StringMatchWithPrecompiledRegex(program->process_regex, command, &s, &e))
     {
         return false;
     }
 
-    if ((i = GetProcColumnIndex(name1, name2, colNames)) != -1)
+    if (!program->attrselect)
+    {
+        // If we are not considering attributes, then the matching is done.
+        return true;
+    }
+
+    unsigned int matched = 0;
+    for (size_t i = 0; i < program->n_filters; i++)
     {
-        if (anchored)
+        const ProcessFilter *filter = &(program->filters[i]);
+        if (ProcessFilterMatch(program, filter, entry))
         {
-            return StringMatchFull(regex, line[i]);
+            matched |= 1U << filter->attribute;
         }
-        else
+    }
+
+    switch (program->result_mode)
+    {
+    case PROCESS_RESULT_ANY:
+        /* Same as all the matching attributes ANDed */
+        return (matched != 0);
+    case PROCESS_RESULT_NONE:
+        return false;
+    case PROCESS_RESULT_EXPRESSION:
+        return (EvalExpression(program->result, &EvalProcessAttribute,
+                               &EvalProcessVarRef, &matched) == EXPRESSION_VALUE_TRUE);
+    }
+
+    return false;
+}
+
+Item *SelectProcesses(const char *process_name, const ProcessSelect *a, bool attrselect)
+{
+    assert(a != NULL);
+    Item *result = NULL;
+
+    Seq *entries = GetProcessTableEntries();
+    if (entries == NULL)
+    {
+        return result;
+    }
+
+    ProcessSelectProgram program;
+    if (!ProcessSelectProgramCompile(&program, PROCESS_COLUMN_NAMES, process_name, a, attrselect))
+    {
+        ProcessSelectProgramDestroy(&program);
+        return result;
+    }
+
+    const size_t n_entries = SeqLength(entries);
+    for (size_t i = 0; i < n_entries; i++)
+    {
+        ProcessTableEntry *entry = SeqAt(entries, i);
+
+        if (!ProcessSelectProgramMatch(&program, entry))
         {
-            size_t s, e;
-            return StringMatch(regex, line[i], &s, &e);
+            continue;
+        }
+
+        if (entry->pid == -1)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Unable to extract pid while looking for %s", process_name);
+            continue;
         }
+
+        PrependItem(&result, entry->line, "");
+        result->counter = (int) entry->pid;
     }
 
-    return false;
+    ProcessSelectProgramDestroy(&program);
+    return result;
 }
 
+
+/***************************************************************************/
+
 static void PrintStringIndexLine(int prefix_spaces, int len)
 {
     char arrow_str[CF_BUFSIZE];
@@ -969,60 +1154,35 @@ static int GetProcColumnIndex(const char *name1, const char *name2, char **names
 
 bool IsProcessNameRunning(char *procNameRegex)
 {
-    char *colHeaders[CF_PROCCOLS];
-    int start[CF_PROCCOLS] = { 0 };
-    int end[CF_PROCCOLS] = { 0 };
-    bool matched = false;
-    int i;
-
-    memset(colHeaders, 0, sizeof(colHeaders));
-
-    if (PROCESSTABLE == NULL)
+    Seq *entries = GetProcessTableEntries();
+    if (entries == NULL)
     {
         Log(LOG_LEVEL_ERR, "IsProcessNameRunning: PROCESSTABLE is empty");
         return false;
     }
-    /* TODO: use actual time of ps-run, not time(NULL), which may be later. */
-    time_t pstime = time(NULL);
 
-    GetProcessColumnNames(PROCESSTABLE->name, colHeaders, start, end);
-
-    for (const Item *ip = PROCESSTABLE->next; !matched && ip != NULL; ip = ip->next) // iterate over ps lines
+    const int column = GetProcColumnIndex("CMD", "COMMAND", PROCESS_COLUMN_NAMES);
+    if (column == -1)
     {
-        char *lineSplit[CF_PROCCOLS];
-        memset(lineSplit, 0, sizeof(lineSplit));
-
-        if (NULL_OR_EMPTY(ip->name))
-        {
-            continue;
-        }
-
-        if (!SplitProcLine(ip->name, pstime, colHeaders, start, end,
-                           PS_COLUMN_ALGORITHM[VPSHARDCLASS], lineSplit))
-        {
-            Log(LOG_LEVEL_ERR, "IsProcessNameRunning: Could not split process line '%s'", ip->name);
-            goto loop_cleanup;
-        }
-
-        ApplyPlatformExtraTable(colHeaders, lineSplit);
-
-        if (SelectProcRegexMatch("CMD", "COMMAND", procNameRegex, true, colHeaders, lineSplit))
-        {
-            matched = true;
-        }
+        return false;
+    }
 
-   loop_cleanup:
-        for (i = 0; lineSplit[i] != NULL; i++)
-        {
-            free(lineSplit[i]);
-        }
+    pcre *rx = CompileRegex(procNameRegex);
+    if (rx == NULL)
+    {
+        return false;
     }
 
-    for (i = 0; colHeaders[i] != NULL; i++)
+    bool matched = false;
+    const size_t n_entries = SeqLength(entries);
+    for (size_t i = 0; !matched && i < n_entries; i++)
     {
-        free(colHeaders[i]);
+        const ProcessTableEntry *entry = SeqAt(entries, i);
+        matched = (entry->columns[column] != NULL &&
+                   StringMatchFullWithPrecompiledRegex(rx, entry->columns[column]));
     }
 
+    pcre_free(rx);
     return matched;
 }
 
@@ -1557,6 +1717,98 @@ static inline void ApplyPlatformExtraTable(ARG_UNUSED char **names, ARG_UNUSED c
 #endif
 
 #ifndef _WIN32
+static void SaveProcessTable(void)
+{
+    char filename[CF_MAXVARSIZE];
+    snprintf(filename, sizeof(filename), "%s%ccf_procs", GetStateDir(), FILE_SEPARATOR);
+    RawSaveItemList(PROCESSTABLE, filename, NewLineMode_Unix);
+}
+
+/**
+ * Save the root processes (with the first other process prepended, which is
+ * the legend) and the other processes for cf-agent's "-n" reporting.
+ *
+ * @note Eats both lists.
+ */
+static void SaveRootAndOtherProcesses(Item *rootprocs, Item *otherprocs)
+{
+    const char *const statedir = GetStateDir();
+    char filename[CF_MAXVARSIZE];
+
+    if (otherprocs)
+    {
+        PrependItem(&rootprocs, otherprocs->name, NULL);
+    }
+
+    // TODO: Change safe_fopen() to default to 0600, then remove this.
+    const mode_t old_umask = SetUmask(0077);
+
+    snprintf(filename, sizeof(filename), "%s%ccf_rootprocs", statedir, FILE_SEPARATOR);
+    RawSaveItemList(rootprocs, filename, NewLineMode_Unix);
+    DeleteItemList(rootprocs);
+
+    snprintf(filename, sizeof(filename), "%s%ccf_otherprocs", statedir, FILE_SEPARATOR);
+    RawSaveItemList(otherprocs, filename, NewLineMode_Unix);
+    DeleteItemList(otherprocs);
+
+    RestoreUmask(old_umask);
+}
+
+static void SplitRootProcesses(Item **rootprocs, Item **otherprocs)
+{
+    CopyList(rootprocs, PROCESSTABLE);
+    CopyList(otherprocs, PROCESSTABLE);
+
+    while (DeleteItemNotContaining(rootprocs, "root"))
+    {
+    }
+
+    while (DeleteItemContaining(otherprocs, "root"))
+    {
+    }
+}
+
+# ifdef __linux__
+/**
+ * Load the process table directly from /proc instead of running ps(1).
+ *
+ * PROCESSTABLE gets the same ps-like lines (with a legend) as with ps, but the
+ * columns are already split (and partly typed) so they don't need to be
+ * parsed back from the lines.
+ */
+static bool LoadProcessTableNative(void)
+{
+    char *legend = NULL;
+    const time_t now = time(NULL);
+    Seq *entries = LoadProcessTableFromProc(PROCESS_COLUMN_NAMES, &legend);
+    if (entries == NULL)
+    {
+        return false;
+    }
+
+    PROCESS_ENTRIES = entries;
+    PROCESS_TABLE_TIME = now;
+
+    const size_t n_entries = SeqLength(entries);
+    for (size_t i = n_entries; i > 0; i--)
+    {
+        const ProcessTableEntry *entry = SeqAt(entries, i - 1);
+        PrependItem(&PROCESSTABLE, entry->line, "");
+    }
+    PrependItem(&PROCESSTABLE, legend, "");
+    free(legend);
+
+    SaveProcessTable();
+
+    Item *rootprocs = NULL;
+    Item *otherprocs = NULL;
+    SplitRootProcesses(&rootprocs, &otherprocs);
+    SaveRootAndOtherProcesses(rootprocs, otherprocs);
+
+    return true;
+}
+# endif /* __linux__ */
+
 bool LoadProcessTable()
 {
     FILE *prp;
@@ -1565,11 +1817,25 @@ bool LoadProcessTable()
     Item *otherprocs = NULL;
 
 
-    if (PROCESSTABLE)
+    if (PROCESSTABLE && !PROCESS_TABLE_INVALID)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Reusing cached process table (generation %lu)",
+            PROCESS_TABLE_GENERATION);
+        return true;
+    }
+
+    ClearProcessTable();
+
+# ifdef __linux__
+    if (LoadProcessTableNative())
     {
-        Log(LOG_LEVEL_VERBOSE, "Reusing cached process table");
+        PROCESS_TABLE_GENERATION++;
+        Log(LOG_LEVEL_VERBOSE, "Observed process table in /proc (generation %lu)",
+            PROCESS_TABLE_GENERATION);
         return true;
     }
+    Log(LOG_LEVEL_VERBOSE, "Failed to load process table from /proc, falling back to ps");
+# endif
 
     LoadPlatformExtraTable();
 
@@ -1581,6 +1847,7 @@ bool LoadProcessTable()
 
     Log(LOG_LEVEL_VERBOSE, "Observe process table with %s", pscomm);
 
+    PROCESS_TABLE_TIME = time(NULL);
     if ((prp = cf_popen(pscomm, "r", false)) == NULL)
     {
         Log(LOG_LEVEL_ERR, "Couldn't open the process list with command '%s'. (popen: %s)", pscomm, GetErrorStr());
@@ -1624,6 +1891,8 @@ bool LoadProcessTable()
                 Log(LOG_LEVEL_ERR, "Unable to read process list with command '%s'. (fread: %s)", pscomm, GetErrorStr());
                 cf_pclose(prp);
                 free(vbuff);
+                DeleteItemList(PROCESSTABLE);
+                PROCESSTABLE = NULL;
                 return false;
             }
             else
@@ -1653,19 +1922,17 @@ bool LoadProcessTable()
         }
 
 # endif
-        AppendItem(&PROCESSTABLE, vbuff, "");
+        /* Prepend and reverse below, appending is O(n) */
+        PrependItem(&PROCESSTABLE, vbuff, "");
 
         header = false;
     }
 
     cf_pclose(prp);
+    PROCESSTABLE = ReverseItemList(PROCESSTABLE);
 
 /* Now save the data */
-    const char* const statedir = GetStateDir();
-
-    snprintf(vbuff, CF_MAXVARSIZE, "%s%ccf_procs", statedir, FILE_SEPARATOR);
-
-    RawSaveItemList(PROCESSTABLE, vbuff, NewLineMode_Unix);
+    SaveProcessTable();
 
 # ifdef HAVE_GETZONEID
     if (global_zone) /* pidlist and rootpidlist are empty if we're not in the global zone */
@@ -1688,36 +1955,13 @@ bool LoadProcessTable()
     else
 # endif
     {
-        CopyList(&rootprocs, PROCESSTABLE);
-        CopyList(&otherprocs, PROCESSTABLE);
-
-        while (DeleteItemNotContaining(&rootprocs, "root"))
-        {
-        }
-
-        while (DeleteItemContaining(&otherprocs, "root"))
-        {
-        }
-    }
-    if (otherprocs)
-    {
-        PrependItem(&rootprocs, otherprocs->name, NULL);
+        SplitRootProcesses(&rootprocs, &otherprocs);
     }
-
-    // TODO: Change safe_fopen() to default to 0600, then remove this.
-    const mode_t old_umask = SetUmask(0077);
-
-    snprintf(vbuff, CF_MAXVARSIZE, "%s%ccf_rootprocs", statedir, FILE_SEPARATOR);
-    RawSaveItemList(rootprocs, vbuff, NewLineMode_Unix);
-    DeleteItemList(rootprocs);
-
-    snprintf(vbuff, CF_MAXVARSIZE, "%s%ccf_otherprocs", statedir, FILE_SEPARATOR);
-    RawSaveItemList(otherprocs, vbuff, NewLineMode_Unix);
-    DeleteItemList(otherprocs);
-
-    RestoreUmask(old_umask);
+    SaveRootAndOtherProcesses(rootprocs, otherprocs);
 
     free(vbuff);
+
+    PROCESS_TABLE_GENERATION++;
     return true;
 }
 # endif
@@ -1728,4 +1972,24 @@ void ClearProcessTable(void)
 
     DeleteItemList(PROCESSTABLE);
     PROCESSTABLE = NULL;
+
+    SeqDestroy(PROCESS_ENTRIES);
+    PROCESS_ENTRIES = NULL;
+    for (int i = 0; i < CF_PROCCOLS; i++)
+    {
+        free(PROCESS_COLUMN_NAMES[i]);
+        PROCESS_COLUMN_NAMES[i] = NULL;
+    }
+    PROCESS_TABLE_TIME = 0;
+    PROCESS_TABLE_INVALID = false;
+}
+
+void InvalidateProcessTable(void)
+{
+    if (PROCESSTABLE != NULL && !PROCESS_TABLE_INVALID)
+    {
+        Log(LOG_LEVEL_DEBUG, "Invalidating process table (generation %lu)",
+            PROCESS_TABLE_GENERATION);
+        PROCESS_TABLE_INVALID = true;
+    }
 }
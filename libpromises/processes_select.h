@@ -26,14 +26,58 @@
 #define CFENGINE_PROCESSES_SELECT_H
 
 #include <cf3.defs.h>
+#include <sequence.h>
 
 #ifdef _WIN32
 extern Item *PROCESSTABLE;
 #endif
 
+/**
+ * A process from the process table with the columns of the ps legend (see
+ * GetProcessTableLegend()) split out.
+ */
+typedef struct
+{
+    pid_t pid;
+    char *line;                     /* the whole (ps-like) line */
+    char *columns[CF_PROCCOLS];     /* in the order of the legend, NULL-terminated */
+    long values[CF_PROCCOLS];       /* numeric values of the columns (the
+                                     * UID for USER if loaded from /proc)... */
+    bool have_values[CF_PROCCOLS];  /* ...where already known/parsed */
+} ProcessTableEntry;
+
+void ProcessTableEntryDestroy(ProcessTableEntry *entry);
+
+#ifdef __linux__
+/**
+ * Read the process table directly from /proc instead of running ps. The
+ * columns and their formats are the same as with the ps options used on
+ * Linux (see VPSOPTS).
+ *
+ * @param names   [out] column names (CF_PROCCOLS items, NULL-terminated)
+ * @param legend  [out] header line matching the entries' lines
+ * @return a sequence of ProcessTableEntry items sorted by PID or %NULL in case
+ *         of error
+ */
+Seq *LoadProcessTableFromProc(char **names, char **legend);
+#endif
+
+/**
+ * Load the process table snapshot (if not loaded yet or invalidated).
+ *
+ * The snapshot is kept until ClearProcessTable() is called or until it is
+ * invalidated by InvalidateProcessTable() in which case it is reloaded by the
+ * next LoadProcessTable() call.
+ */
 bool LoadProcessTable(void);
 void ClearProcessTable(void);
 
+/**
+ * Mark the process table snapshot as out of date, e.g. after sending signals
+ * to processes or running commands.
+ */
+void InvalidateProcessTable(void);
+
 Item *SelectProcesses(const char *process_name, const ProcessSelect *a, bool attrselect);
 bool IsProcessNameRunning(char *procNameRegex);
 
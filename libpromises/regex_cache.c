@@ -0,0 +1,330 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <regex_cache.h>
+
+#include <alloc.h>
+#include <logging.h>
+#include <map.h>                                  /* TYPED_MAP_* */
+#include <mutex.h>                                /* ThreadLock */
+#include <string_lib.h>                           /* StringEqual */
+
+/* Enough for the regexes of a large edit_line bundle, a compiled regex is
+ * typically a few hundred bytes. */
+#define REGEX_CACHE_SIZE 256
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+# define REGEX_STUDY_OPTIONS PCRE_STUDY_JIT_COMPILE
+#else
+# define REGEX_STUDY_OPTIONS 0
+#endif
+
+struct CachedRegex_
+{
+    char *pattern;
+    pcre *rx;
+    pcre_extra *extra;
+    unsigned int refs;
+    bool cached;                /* false if it didn't fit into the cache */
+    CachedRegex *prev;          /* LRU list, most recently used first */
+    CachedRegex *next;
+};
+
+static void CachedRegexDestroy(void *p)
+{
+    CachedRegex *crx = p;
+    if (crx != NULL)
+    {
+#ifdef PCRE_STUDY_JIT_COMPILE
+        pcre_free_study(crx->extra);
+#else
+        pcre_free(crx->extra);
+#endif
+        pcre_free(crx->rx);
+        free(crx->pattern);
+        free(crx);
+    }
+}
+
+TYPED_MAP_DECLARE(RegexCache, char *, CachedRegex *)
+
+TYPED_MAP_DEFINE(RegexCache, char *, CachedRegex *,
+                 StringHash_untyped,
+                 StringEqual_untyped,
+                 free,
+                 CachedRegexDestroy)
+
+static pthread_mutex_t REGEX_CACHE_LOCK = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP; /* GLOBAL_T */
+static RegexCacheMap *REGEX_CACHE = NULL;          /* GLOBAL_X, protected by the lock */
+static CachedRegex *LRU_HEAD = NULL;               /* GLOBAL_X */
+static CachedRegex *LRU_TAIL = NULL;               /* GLOBAL_X */
+static size_t CACHE_SIZE = 0;                      /* GLOBAL_X */
+static size_t HITS = 0;                            /* GLOBAL_X */
+static size_t MISSES = 0;                          /* GLOBAL_X */
+
+static void LRUUnlink(CachedRegex *crx)
+{
+    if (crx->prev != NULL)
+    {
+        crx->prev->next = crx->next;
+    }
+    else
+    {
+        LRU_HEAD = crx->next;
+    }
+
+    if (crx->next != NULL)
+    {
+        crx->next->prev = crx->prev;
+    }
+    else
+    {
+        LRU_TAIL = crx->prev;
+    }
+
+    crx->prev = NULL;
+    crx->next = NULL;
+}
+
+static void LRUPushFront(CachedRegex *crx)
+{
+    crx->prev = NULL;
+    crx->next = LRU_HEAD;
+    if (LRU_HEAD != NULL)
+    {
+        LRU_HEAD->prev = crx;
+    }
+    LRU_HEAD = crx;
+    if (LRU_TAIL == NULL)
+    {
+        LRU_TAIL = crx;
+    }
+}
+
+/**
+ * Evict the least recently used regex that is not in use.
+ * @return false if all cached regexes are in use
+ */
+static bool EvictOne(void)
+{
+    for (CachedRegex *crx = LRU_TAIL; crx != NULL; crx = crx->prev)
+    {
+        if (crx->refs == 0)
+        {
+            LRUUnlink(crx);
+            RegexCacheMapRemove(REGEX_CACHE, crx->pattern); /* destroys crx */
+            CACHE_SIZE--;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Call with the lock held. */
+static CachedRegex *Lookup(const char *pattern)
+{
+    if (REGEX_CACHE == NULL)
+    {
+        return NULL;
+    }
+
+    CachedRegex *crx = RegexCacheMapGet(REGEX_CACHE, pattern);
+    if (crx != NULL)
+    {
+        crx->refs++;
+        if (crx != LRU_HEAD)
+        {
+            LRUUnlink(crx);
+            LRUPushFront(crx);
+        }
+    }
+    return crx;
+}
+
+CachedRegex *RegexCacheGet(const char *pattern)
+{
+    assert(pattern != NULL);
+
+    ThreadLock(&REGEX_CACHE_LOCK);
+    CachedRegex *crx = Lookup(pattern);
+    if (crx != NULL)
+    {
+        HITS++;
+        ThreadUnlock(&REGEX_CACHE_LOCK);
+        return crx;
+    }
+    MISSES++;
+    ThreadUnlock(&REGEX_CACHE_LOCK);
+
+    /* Compile without holding the lock, other threads may be matching. */
+    pcre *rx = CompileRegex(pattern);
+    if (rx == NULL)
+    {
+        return NULL;
+    }
+
+    const char *errorstr = NULL;
+    pcre_extra *extra = pcre_study(rx, REGEX_STUDY_OPTIONS, &errorstr);
+    if (errorstr != NULL)
+    {
+        Log(LOG_LEVEL_DEBUG, "Could not study regular expression '%s' (pcre_study: %s)",
+            pattern, errorstr);
+    }
+
+    crx = xcalloc(1, sizeof(CachedRegex));
+    crx->pattern = xstrdup(pattern);
+    crx->rx = rx;
+    crx->extra = extra;
+    crx->refs = 1;
+
+    ThreadLock(&REGEX_CACHE_LOCK);
+    CachedRegex *other = Lookup(pattern);
+    if (other != NULL)
+    {
+        /* Another thread compiled the same regex in the meantime. */
+        ThreadUnlock(&REGEX_CACHE_LOCK);
+        CachedRegexDestroy(crx);
+        return other;
+    }
+
+    if (REGEX_CACHE == NULL)
+    {
+        REGEX_CACHE = RegexCacheMapNew();
+    }
+
+    if (CACHE_SIZE < REGEX_CACHE_SIZE || EvictOne())
+    {
+        crx->cached = true;
+        RegexCacheMapInsert(REGEX_CACHE, xstrdup(pattern), crx);
+        LRUPushFront(crx);
+        CACHE_SIZE++;
+    }
+    ThreadUnlock(&REGEX_CACHE_LOCK);
+
+    return crx;
+}
+
+void RegexCacheRelease(CachedRegex *crx)
+{
+    if (crx == NULL)
+    {
+        return;
+    }
+
+    ThreadLock(&REGEX_CACHE_LOCK);
+    assert(crx->refs > 0);
+    crx->refs--;
+    const bool destroy = (!crx->cached && crx->refs == 0);
+    ThreadUnlock(&REGEX_CACHE_LOCK);
+
+    if (destroy)
+    {
+        CachedRegexDestroy(crx);
+    }
+}
+
+int CachedRegexExec(const CachedRegex *crx, const char *str, size_t len,
+                    int *ovector, int ovecsize)
+{
+    assert(crx != NULL);
+    assert(str != NULL);
+
+    int rc = pcre_exec(crx->rx, crx->extra, str, len, 0, 0, ovector, ovecsize);
+
+#ifdef PCRE_ERROR_JIT_STACKLIMIT
+    if ((rc == PCRE_ERROR_JIT_STACKLIMIT) && (crx->extra != NULL))
+    {
+        /* The default JIT stack (32K) is not enough for long subjects or a
+         * lot of backtracking, the interpreter has no such limit. */
+        pcre_extra no_jit = *(crx->extra);
+        no_jit.flags &= ~PCRE_EXTRA_EXECUTABLE_JIT;
+        rc = pcre_exec(crx->rx, &no_jit, str, len, 0, 0, ovector, ovecsize);
+    }
+#endif
+
+    return rc;
+}
+
+bool CachedRegexMatchFull(const CachedRegex *crx, const char *str)
+{
+    assert(crx != NULL);
+    assert(str != NULL);
+
+    int ovector[OVECCOUNT] = { 0 };
+    const size_t len = strlen(str);
+    if (CachedRegexExec(crx, str, len, ovector, OVECCOUNT) >= 0)
+    {
+        return (ovector[0] == 0) && ((size_t) ovector[1] == len);
+    }
+    return false;
+}
+
+bool RegexCacheMatchFull(const char *pattern, const char *str)
+{
+    CachedRegex *crx = RegexCacheGet(pattern);
+    if (crx == NULL)
+    {
+        return false;
+    }
+
+    const bool matched = CachedRegexMatchFull(crx, str);
+    RegexCacheRelease(crx);
+    return matched;
+}
+
+void RegexCacheGetStats(size_t *hits, size_t *misses)
+{
+    ThreadLock(&REGEX_CACHE_LOCK);
+    *hits = HITS;
+    *misses = MISSES;
+    ThreadUnlock(&REGEX_CACHE_LOCK);
+}
+
+void RegexCacheLogStats(void)
+{
+    size_t hits, misses;
+    RegexCacheGetStats(&hits, &misses);
+    if (hits + misses > 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Regex cache: %zu hits, %zu misses (%.1f%% hit rate)",
+            hits, misses, (100.0 * hits) / (hits + misses));
+    }
+}
+
+void RegexCacheClear(void)
+{
+    ThreadLock(&REGEX_CACHE_LOCK);
+    if (REGEX_CACHE != NULL)
+    {
+        RegexCacheMapDestroy(REGEX_CACHE);
+        REGEX_CACHE = NULL;
+    }
+    LRU_HEAD = NULL;
+    LRU_TAIL = NULL;
+    CACHE_SIZE = 0;
+    HITS = 0;
+    MISSES = 0;
+    ThreadUnlock(&REGEX_CACHE_LOCK);
+}
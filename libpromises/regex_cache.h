@@ -0,0 +1,65 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_REGEX_CACHE_H
+#define CFENGINE_REGEX_CACHE_H
+
+#include <platform.h>
+#include <regex.h>                                   /* pcre, CompileRegex */
+
+/**
+ * Bounded LRU cache of compiled (and studied, JIT-compiled where PCRE
+ * supports it) regular expressions shared by all threads. Meant for the
+ * places that match the same pattern over and over, e.g. against every line
+ * of a file being edited, which would otherwise compile it on every call.
+ *
+ * Patterns are compiled with the same options as CompileRegex().
+ */
+typedef struct CachedRegex_ CachedRegex;
+
+/**
+ * @return the compiled #pattern or NULL if it is not a valid regular
+ *         expression (the error is logged), release with RegexCacheRelease()
+ */
+CachedRegex *RegexCacheGet(const char *pattern);
+void RegexCacheRelease(CachedRegex *crx);
+
+/**
+ * pcre_exec() with the study data of the cached regex
+ */
+int CachedRegexExec(const CachedRegex *crx, const char *str, size_t len,
+                    int *ovector, int ovecsize);
+bool CachedRegexMatchFull(const CachedRegex *crx, const char *str);
+
+/**
+ * Cached equivalent of StringMatchFull()
+ */
+bool RegexCacheMatchFull(const char *pattern, const char *str);
+
+void RegexCacheGetStats(size_t *hits, size_t *misses);
+void RegexCacheLogStats(void);
+void RegexCacheClear(void);
+
+#endif
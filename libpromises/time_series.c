@@ -0,0 +1,270 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <time_series.h>
+
+#include <alloc.h>
+#include <buffer.h>
+#include <logging.h>
+
+typedef struct
+{
+    time_t block_span;
+    time_t retention;
+} TimeSeriesTierInfo;
+
+static const TimeSeriesTierInfo TIERS[TIME_SERIES_TIER_MAX] =
+{
+    [TIME_SERIES_TIER_RAW] = { SECONDS_PER_SHIFT, SECONDS_PER_WEEK + SECONDS_PER_DAY },
+    [TIME_SERIES_TIER_HOURLY] = { SECONDS_PER_WEEK, 3 * SECONDS_PER_YEAR },
+};
+
+static time_t TierResolution(TimeSeriesTier tier)
+{
+    return (tier == TIME_SERIES_TIER_RAW) ? TIME_SERIES_RAW_RESOLUTION : SECONDS_PER_HOUR;
+}
+
+static time_t BlockStart(TimeSeriesTier tier, time_t time)
+{
+    return time - (time % TIERS[tier].block_span);
+}
+
+static void MakeKey(char *key, size_t key_size, const char *name, TimeSeriesTier tier, time_t start)
+{
+    xsnprintf(key, key_size, "%s@%d@%jd", name, (int) tier, (intmax_t) start);
+}
+
+bool TimeSeriesParseKey(const char *key, char **name, TimeSeriesTier *tier, time_t *start)
+{
+    const char *start_sep = strrchr(key, '@');
+    if (start_sep == NULL || start_sep == key)
+    {
+        return false;
+    }
+
+    const char *tier_sep = start_sep - 1;
+    while (tier_sep > key && *tier_sep != '@')
+    {
+        tier_sep--;
+    }
+    if (tier_sep == key)
+    {
+        return false;
+    }
+
+    int tier_value;
+    intmax_t start_value;
+    char end;
+    if (sscanf(tier_sep + 1, "%d@%jd%c", &tier_value, &start_value, &end) != 2 ||
+        tier_value < 0 || tier_value >= TIME_SERIES_TIER_MAX)
+    {
+        return false;
+    }
+
+    *name = xstrndup(key, tier_sep - key);
+    *tier = tier_value;
+    *start = start_value;
+    return true;
+}
+
+/**
+ * @return the block stored under #key or %NULL if there is none (or it is
+ *         not valid)
+ */
+static Buffer *ReadBlock(CF_DB *db, const char *key)
+{
+    const int size = ValueSizeDB(db, key, strlen(key) + 1);
+    if (size <= 0)
+    {
+        return NULL;
+    }
+
+    char *data = xmalloc(size);
+    TimeSeriesBlockHeader header;
+    if (!ReadDB(db, key, data, size) || !TimeSeriesBlockGetHeader(data, size, &header))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Ignoring invalid time series block '%s'", key);
+        free(data);
+        return NULL;
+    }
+
+    Buffer *block = BufferNewFrom(data, size);
+    free(data);
+    return block;
+}
+
+/**
+ * @param new_block  set to %true if a new block was started
+ */
+static bool AppendToTier(CF_DB *db, const char *name, TimeSeriesTier tier,
+                         time_t time, double value, bool *new_block)
+{
+    time -= time % TierResolution(tier);
+
+    char key[CF_BUFSIZE];
+    MakeKey(key, sizeof(key), name, tier, BlockStart(tier, time));
+
+    Buffer *block = ReadBlock(db, key);
+    *new_block = (block == NULL);
+    if (block == NULL)
+    {
+        block = TimeSeriesBlockNew();
+    }
+
+    if (!TimeSeriesBlockAppend(block, time, value))
+    {
+        /* There already is a point for this time (or a later one) */
+        BufferDestroy(block);
+        return true;
+    }
+
+    const bool ret = WriteDB(db, key, BufferData(block), BufferSize(block));
+    BufferDestroy(block);
+    return ret;
+}
+
+/**
+ * Add the hourly averages of the raw points in #block to the hourly tier.
+ */
+static void Downsample(CF_DB *db, const char *name, const Buffer *block)
+{
+    size_t count;
+    TimeSeriesPoint *points = TimeSeriesBlockDecode(BufferData(block), BufferSize(block), &count);
+    if (points == NULL)
+    {
+        return;
+    }
+
+    size_t i = 0;
+    while (i < count)
+    {
+        const time_t hour = points[i].time - (points[i].time % SECONDS_PER_HOUR);
+        double sum = 0.0;
+        size_t n = 0;
+        for (; i < count && points[i].time < hour + SECONDS_PER_HOUR; i++)
+        {
+            sum += points[i].value;
+            n++;
+        }
+
+        bool new_block;
+        AppendToTier(db, name, TIME_SERIES_TIER_HOURLY, hour, sum / n, &new_block);
+    }
+
+    free(points);
+}
+
+/**
+ * Downsample the last raw block before the one starting at #start, it is
+ * complete now.
+ */
+static void DownsamplePreviousBlock(CF_DB *db, const char *name, time_t start)
+{
+    const TimeSeriesTierInfo *const raw = &(TIERS[TIME_SERIES_TIER_RAW]);
+
+    /* There may be a gap, e.g. if cf-monitord wasn't running */
+    for (time_t prev = start - raw->block_span; prev > start - raw->retention; prev -= raw->block_span)
+    {
+        char key[CF_BUFSIZE];
+        MakeKey(key, sizeof(key), name, TIME_SERIES_TIER_RAW, prev);
+
+        Buffer *block = ReadBlock(db, key);
+        if (block != NULL)
+        {
+            Downsample(db, name, block);
+            BufferDestroy(block);
+            return;
+        }
+    }
+}
+
+bool TimeSeriesAppendToTier(CF_DB *db, const char *name, TimeSeriesTier tier,
+                            time_t time, double value)
+{
+    assert(db != NULL);
+    assert(name != NULL);
+
+    bool new_block;
+    return AppendToTier(db, name, tier, time, value, &new_block);
+}
+
+bool TimeSeriesAppend(CF_DB *db, const char *name, time_t time, double value)
+{
+    assert(db != NULL);
+    assert(name != NULL);
+
+    bool new_block;
+    if (!AppendToTier(db, name, TIME_SERIES_TIER_RAW, time, value, &new_block))
+    {
+        return false;
+    }
+
+    if (new_block)
+    {
+        DownsamplePreviousBlock(db, name, BlockStart(TIME_SERIES_TIER_RAW, time));
+    }
+    return true;
+}
+
+size_t TimeSeriesPrune(CF_DB *db, time_t now)
+{
+    assert(db != NULL);
+
+    CF_DBC *cursor;
+    if (!NewDBCursor(db, &cursor))
+    {
+        Log(LOG_LEVEL_ERR, "Unable to scan the time series DB");
+        return 0;
+    }
+
+    size_t removed = 0;
+    char *key;
+    void *value;
+    int key_size, value_size;
+    while (NextDB(cursor, &key, &key_size, &value, &value_size))
+    {
+        char *name;
+        TimeSeriesTier tier;
+        time_t start;
+        if (key_size == 0 || key[key_size - 1] != '\0' ||
+            !TimeSeriesParseKey(key, &name, &tier, &start))
+        {
+            continue;
+        }
+        free(name);
+
+        if (start + TIERS[tier].block_span <= now - TIERS[tier].retention)
+        {
+            if (DBCursorDeleteEntry(cursor))
+            {
+                removed++;
+            }
+        }
+    }
+    DeleteDBCursor(cursor);
+
+    Log(LOG_LEVEL_VERBOSE, "Removed %zu expired time series blocks", removed);
+    return removed;
+}
@@ -0,0 +1,87 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_TIME_SERIES_H
+#define CFENGINE_TIME_SERIES_H
+
+#include <cf3.defs.h>
+#include <dbm_api.h>
+#include <time_series_block.h>
+
+/*
+ * Monitoring history stored as compressed time series (one per observable or
+ * measurement) in the cf_timeseries DB.
+ *
+ * Every series is kept in two tiers:
+ *  - raw samples at the sampling interval of cf-monitord, kept for a bit more
+ *    than a week
+ *  - hourly averages, kept for three years
+ *
+ * The points are stored in blocks of consecutive points (see
+ * time_series_block.h), each block is one DB record with the key
+ * "<series>@<tier>@<start of the block>".
+ */
+
+/* cf-monitord samples every 2.5 minutes */
+#define TIME_SERIES_RAW_RESOLUTION 150
+
+typedef enum
+{
+    TIME_SERIES_TIER_RAW,
+    TIME_SERIES_TIER_HOURLY,
+    TIME_SERIES_TIER_MAX
+} TimeSeriesTier;
+
+/**
+ * Add a sample to the series #name. Samples have to be added in
+ * chronological order.
+ *
+ * @return %false in case of a DB error
+ */
+bool TimeSeriesAppend(CF_DB *db, const char *name, time_t time, double value);
+
+/**
+ * Add a sample directly to the given tier of the series #name, without
+ * downsampling (e.g. for importing old data).
+ */
+bool TimeSeriesAppendToTier(CF_DB *db, const char *name, TimeSeriesTier tier,
+                            time_t time, double value);
+
+/**
+ * Remove blocks which are past the retention period of their tier.
+ *
+ * @return number of removed blocks
+ */
+size_t TimeSeriesPrune(CF_DB *db, time_t now);
+
+/**
+ * Parse a DB key of a time series block.
+ *
+ * @param name  set to the series name (to be freed by the caller)
+ * @return %false if #key is not a block key
+ */
+bool TimeSeriesParseKey(const char *key, char **name, TimeSeriesTier *tier, time_t *start);
+
+#endif
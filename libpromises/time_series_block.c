@@ -0,0 +1,272 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <time_series_block.h>
+
+#include <alloc.h>
+
+#define XOR_ZERO_MARKER 0xFF                 /* value equal to the previous one */
+
+/* Encoding helpers */
+
+static void AppendVarint(Buffer *block, uint64_t value)
+{
+    unsigned char bytes[10];
+    size_t n = 0;
+    do
+    {
+        bytes[n] = value & 0x7F;
+        value >>= 7;
+        if (value != 0)
+        {
+            bytes[n] |= 0x80;
+        }
+        n++;
+    } while (value != 0);
+
+    BufferAppend(block, (const char *) bytes, n);
+}
+
+static uint64_t ZigZagEncode(int64_t value)
+{
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static int64_t ZigZagDecode(uint64_t value)
+{
+    return (int64_t) (value >> 1) ^ -((int64_t) (value & 1));
+}
+
+static uint64_t DoubleToBits(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double BitsToDouble(uint64_t bits)
+{
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void AppendXor(Buffer *block, uint64_t xor)
+{
+    if (xor == 0)
+    {
+        const char marker = (char) XOR_ZERO_MARKER;
+        BufferAppend(block, &marker, 1);
+        return;
+    }
+
+    int leading = 0;
+    while ((xor >> (56 - 8 * leading)) == 0)
+    {
+        leading++;
+    }
+    int trailing = 0;
+    while (((xor >> (8 * trailing)) & 0xFF) == 0)
+    {
+        trailing++;
+    }
+
+    unsigned char bytes[9];
+    size_t n = 0;
+    bytes[n++] = (leading << 4) | trailing;
+    for (int i = 7 - leading; i >= trailing; i--)
+    {
+        bytes[n++] = (xor >> (8 * i)) & 0xFF;
+    }
+
+    BufferAppend(block, (const char *) bytes, n);
+}
+
+/* Decoding helpers, return false on truncated data */
+
+static bool ReadVarint(const unsigned char **pos, const unsigned char *end, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (*pos >= end)
+        {
+            return false;
+        }
+        const unsigned char byte = **pos;
+        (*pos)++;
+        *value |= (uint64_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ReadXor(const unsigned char **pos, const unsigned char *end, uint64_t *xor)
+{
+    if (*pos >= end)
+    {
+        return false;
+    }
+    const unsigned char control = **pos;
+    (*pos)++;
+
+    *xor = 0;
+    if (control == XOR_ZERO_MARKER)
+    {
+        return true;
+    }
+
+    const int leading = control >> 4;
+    const int trailing = control & 0x0F;
+    if (leading + trailing > 7)
+    {
+        return false;
+    }
+
+    for (int i = 7 - leading; i >= trailing; i--)
+    {
+        if (*pos >= end)
+        {
+            return false;
+        }
+        *xor |= (uint64_t) (**pos) << (8 * i);
+        (*pos)++;
+    }
+    return true;
+}
+
+/*****************************************************************************/
+
+Buffer *TimeSeriesBlockNew(void)
+{
+    const TimeSeriesBlockHeader header = { .version = TIME_SERIES_BLOCK_VERSION };
+
+    Buffer *block = BufferNew();
+    BufferAppend(block, (const char *) &header, sizeof(header));
+    return block;
+}
+
+bool TimeSeriesBlockGetHeader(const void *data, size_t size, TimeSeriesBlockHeader *header)
+{
+    if (size < sizeof(TimeSeriesBlockHeader))
+    {
+        return false;
+    }
+
+    /* data may not be aligned (e.g. pointing directly into the DB) */
+    memcpy(header, data, sizeof(TimeSeriesBlockHeader));
+    return (header->version == TIME_SERIES_BLOCK_VERSION);
+}
+
+bool TimeSeriesBlockAppend(Buffer *block, time_t time, double value)
+{
+    TimeSeriesBlockHeader header;
+    if (!TimeSeriesBlockGetHeader(BufferData(block), BufferSize(block), &header))
+    {
+        return false;
+    }
+
+    if (header.count == 0)
+    {
+        header.first_time = time;
+        header.last_delta = 0;
+    }
+    else
+    {
+        if (time <= header.last_time)
+        {
+            return false;
+        }
+        const int64_t delta = time - header.last_time;
+        AppendVarint(block, ZigZagEncode(delta - header.last_delta));
+        header.last_delta = delta;
+    }
+
+    const uint64_t bits = DoubleToBits(value);
+    AppendXor(block, bits ^ header.last_bits);
+
+    header.last_bits = bits;
+    header.last_time = time;
+    header.count++;
+
+    /* The buffer may have been reallocated by the appends above */
+    memcpy((char *) BufferData(block), &header, sizeof(header));
+    return true;
+}
+
+TimeSeriesPoint *TimeSeriesBlockDecode(const void *data, size_t size, size_t *count)
+{
+    TimeSeriesBlockHeader header;
+    if (!TimeSeriesBlockGetHeader(data, size, &header))
+    {
+        return NULL;
+    }
+
+    const unsigned char *pos = (const unsigned char *) data + sizeof(header);
+    const unsigned char *const end = (const unsigned char *) data + size;
+
+    /* Every point takes at least one byte, don't trust the count blindly */
+    if (header.count > (size_t) (end - pos))
+    {
+        return NULL;
+    }
+
+    TimeSeriesPoint *points = xmalloc(MAX(header.count, 1) * sizeof(TimeSeriesPoint));
+
+    int64_t time = header.first_time;
+    int64_t delta = 0;
+    uint64_t bits = 0;
+    for (uint32_t i = 0; i < header.count; i++)
+    {
+        if (i > 0)
+        {
+            uint64_t dod;
+            if (!ReadVarint(&pos, end, &dod))
+            {
+                free(points);
+                return NULL;
+            }
+            delta += ZigZagDecode(dod);
+            time += delta;
+        }
+
+        uint64_t xor;
+        if (!ReadXor(&pos, end, &xor))
+        {
+            free(points);
+            return NULL;
+        }
+        bits ^= xor;
+
+        points[i].time = time;
+        points[i].value = BitsToDouble(bits);
+    }
+
+    *count = header.count;
+    return points;
+}
@@ -0,0 +1,91 @@
+/*
+  Copyright 2022 Northern.tech AS
+
+  This file is part of CFEngine 3 - written and maintained by Northern.tech AS.
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the
+  Free Software Foundation; version 3.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_TIME_SERIES_BLOCK_H
+#define CFENGINE_TIME_SERIES_BLOCK_H
+
+#include <platform.h>
+#include <buffer.h>
+
+/*
+ * Compressed blocks of (time, value) points, as stored in the time-series DB.
+ *
+ * A block is a fixed header followed by the points, each encoded as the
+ * delta-of-delta of its timestamp (zigzag varint) and the XOR of its value
+ * with the previous value (only the non-zero bytes are stored). Regularly
+ * sampled, slowly changing series thus take around 2-4 bytes per point.
+ *
+ * The header holds the state needed to append to the block without decoding
+ * it.
+ *
+ * This file only depends on libutils so that it can be used by cf-check.
+ */
+
+#define TIME_SERIES_BLOCK_VERSION 1
+
+typedef struct
+{
+    time_t time;
+    double value;
+} TimeSeriesPoint;
+
+typedef struct
+{
+    uint32_t version;
+    uint32_t count;
+    int64_t first_time;
+    int64_t last_time;
+    int64_t last_delta;
+    uint64_t last_bits;                        /* of the last value */
+} TimeSeriesBlockHeader;
+
+/**
+ * Create an empty block.
+ */
+Buffer *TimeSeriesBlockNew(void);
+
+/**
+ * @return %true if #data looks like a valid block, in which case #header is
+ *         filled in
+ */
+bool TimeSeriesBlockGetHeader(const void *data, size_t size, TimeSeriesBlockHeader *header);
+
+/**
+ * Append a point to #block.
+ *
+ * @return %false if #time is not later than the last point in the block
+ */
+bool TimeSeriesBlockAppend(Buffer *block, time_t time, double value);
+
+/**
+ * Decode all the points in a block.
+ *
+ * @param count  set to the number of points
+ * @return array of points (to be freed by the caller) or %NULL if the block is
+ *         invalid
+ */
+TimeSeriesPoint *TimeSeriesBlockDecode(const void *data, size_t size, size_t *count);
+
+#endif
@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <cf3.defs.h>
+#include <known_dirs.h>
+#include <misc_lib.h>                                  /* xsnprintf */
+
+#include <dbm_api.h>
+#include <load_timer.h>
+
+
+/* Throughput benchmark for the db_concurrent_test scenario: every thread
+ * works on its own range of keys in the same DB, but instead of doing it once
+ * each thread repeatedly does OpenDB(), ReadDB() (and every WRITE_EVERY-th
+ * time also WriteDB()) and CloseDB() -- the same pattern as cf-serverd worker
+ * threads checking lastseen/locks -- for a given number of seconds.
+ *
+ * Two rounds are run, one where the DB is only kept open by the worker
+ * threads and one where the main thread holds an extra reference, like
+ * daemons that keep DBs open for their whole lifetime. */
+
+#define MAX_THREADS 1000
+#define DB_ID dbid_classes
+#define KEYS_PER_THREAD 2000
+#define WRITE_EVERY 20
+
+#define STATUS_SUCCESS 0
+#define STATUS_FAILED_OPEN 1
+#define STATUS_FAILED_READ 2
+#define STATUS_FAILED_WRITE 3
+
+char CFWORKDIR[CF_BUFSIZE];
+
+static volatile bool DONE;
+
+typedef struct
+{
+    int base;
+    unsigned long ops;
+} ThreadData;
+
+static void tests_setup(void)
+{
+    static char env[] = /* Needs to be static for putenv() */
+        "CFENGINE_TEST_OVERRIDE_WORKDIR=/tmp/db_concurrent_load.XXXXXX";
+
+    char *workdir = strchr(env, '=') + 1; /* start of the path */
+    assert(workdir - 1 && workdir[0] == '/');
+
+    mkdtemp(workdir);
+    strlcpy(CFWORKDIR, workdir, CF_BUFSIZE);
+    putenv(env);
+    mkdir(GetStateDir(), (S_IRWXU | S_IRWXG | S_IRWXO));
+}
+
+static void Cleanup(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+}
+
+static bool WriteTestData(int numthreads)
+{
+    CF_DB *db;
+    if (!OpenDB(&db, DB_ID))
+    {
+        return false;
+    }
+
+    char key[256];
+    char val[256];
+    for (int i = 0; i < numthreads * KEYS_PER_THREAD; i++)
+    {
+        xsnprintf(key, sizeof(key), "foo%d", i);
+        xsnprintf(val, sizeof(val), "bar%d", i);
+        if (!WriteDB(db, key, val, strlen(val) + 1))
+        {
+            CloseDB(db);
+            return false;
+        }
+    }
+
+    CloseDB(db);
+    return true;
+}
+
+static void *contend(void *arg)
+{
+    ThreadData *data = arg;
+    char key[256];
+    char val[256];
+    int i = 0;
+
+    while (!DONE)
+    {
+        CF_DB *db;
+        if (!OpenDB(&db, DB_ID))
+        {
+            return (void *) STATUS_FAILED_OPEN;
+        }
+
+        const int n = data->base * KEYS_PER_THREAD + (i % KEYS_PER_THREAD);
+        xsnprintf(key, sizeof(key), "foo%d", n);
+        if (!ReadDB(db, key, val, sizeof(val)))
+        {
+            CloseDB(db);
+            return (void *) STATUS_FAILED_READ;
+        }
+        if ((i % WRITE_EVERY) == 0 && !WriteDB(db, key, val, strlen(val) + 1))
+        {
+            CloseDB(db);
+            return (void *) STATUS_FAILED_WRITE;
+        }
+
+        CloseDB(db);
+        data->ops++;
+        i++;
+    }
+
+    return (void *) STATUS_SUCCESS;
+}
+
+static int RunRound(const char *name, int numthreads, unsigned int duration)
+{
+    static ThreadData data[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    int failures = 0;
+
+    DONE = false;
+
+    const double start = Now();
+
+    for (int i = 0; i < numthreads; i++)
+    {
+        data[i].base = i;
+        data[i].ops = 0;
+        int ret = pthread_create(&tids[i], NULL, &contend, &data[i]);
+        if (ret != 0)
+        {
+            fprintf(stderr, "Unable to create thread: %s\n", strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sleep(duration);
+    DONE = true;
+
+    unsigned long total = 0;
+    for (int i = 0; i < numthreads; i++)
+    {
+        uintptr_t status;
+        pthread_join(tids[i], (void **) &status);
+        if (status != STATUS_SUCCESS)
+        {
+            fprintf(stderr, "Thread %d failed with status %lu\n",
+                    i, (unsigned long) status);
+            failures++;
+        }
+        total += data[i].ops;
+    }
+
+    const double elapsed = Now() - start;
+
+    printf("%-12s %4d threads: %10lu OpenDB/ReadDB/CloseDB cycles in %.2fs, "
+           "%.0f cycles/s\n", name, numthreads, total, elapsed, total / elapsed);
+
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: db_concurrent_load <num_threads> <seconds>\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const int numthreads = atoi(argv[1]);
+    const int duration = atoi(argv[2]);
+    if (numthreads < 1 || numthreads > MAX_THREADS || duration < 1)
+    {
+        fprintf(stderr, "Invalid arguments, expected 1-%d threads and at least 1 second\n",
+                MAX_THREADS);
+        exit(EXIT_FAILURE);
+    }
+
+    /* To clean up after databases are closed */
+    atexit(&Cleanup);
+
+    tests_setup();
+
+    if (!WriteTestData(numthreads))
+    {
+        fprintf(stderr, "Unable to write test data\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int failures = RunRound("transient", numthreads, duration);
+
+    CF_DB *db;
+    if (!OpenDB(&db, DB_ID))
+    {
+        fprintf(stderr, "Unable to open DB\n");
+        exit(EXIT_FAILURE);
+    }
+    failures += RunRound("held open", numthreads, duration);
+    CloseDB(db);
+
+    exit(failures);
+}
+
+/* Stub out */
+
+void FatalError(ARG_UNUSED const EvalContext *ctx, char *fmt, ...)
+{
+    if (fmt)
+    {
+        va_list ap;
+        char buf[CF_BUFSIZE] = "";
+
+        va_start(ap, fmt);
+        vsnprintf(buf, CF_BUFSIZE - 1, fmt, ap);
+        va_end(ap);
+        Log(LOG_LEVEL_ERR, "Fatal CFEngine error: %s", buf);
+    }
+    else
+    {
+        Log(LOG_LEVEL_ERR, "Fatal CFEngine error (no description)");
+    }
+
+    exit(EXIT_FAILURE);
+}
+
+const char *const DAY_TEXT[] = {};
+const char *const MONTH_TEXT[] = {};
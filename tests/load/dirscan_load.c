@@ -0,0 +1,211 @@
+#include <cf3.defs.h>
+#include <alloc.h>
+#include <misc_lib.h>                                  /* xsnprintf */
+#include <string_lib.h>                                /* StringEqual */
+#include <files_dirscan.h>
+#include <load_timer.h>
+
+
+/* Benchmark for the directory walk of files promises with depth_search: a
+ * tree of FANOUT^DEPTH directories with FILES_PER_DIR files each is walked
+ * the way DepthSearch() does it -- every entry stat'ed, subdirectories
+ * descended into in order -- without and with a DirScanPool reading
+ * subdirectories ahead.
+ *
+ * By default the tree is walked once untimed, so that both kinds of walks
+ * are timed on a warm cache, and then alternately ROUNDS times, keeping
+ * the best time of each. This mostly shows the overhead of the pool. For
+ * the interesting case run it on a big tree on NFS, or as root with "cold"
+ * to drop the caches before every walk:
+ *
+ *   dirscan_load <threads> <path> [cold] */
+
+#define FANOUT 8
+#define DEPTH 3
+#define FILES_PER_DIR 50
+#define DEFAULT_THREADS 8
+#define ROUNDS 3
+
+static char TREE[CF_BUFSIZE];
+
+static void MakeTree(const char *path, int depth)
+{
+    char child[CF_BUFSIZE];
+    for (int i = 0; i < FILES_PER_DIR; i++)
+    {
+        xsnprintf(child, sizeof(child), "%s/file%d", path, i);
+        FILE *fp = fopen(child, "w");
+        if (fp != NULL)
+        {
+            fclose(fp);
+        }
+    }
+
+    if (depth == 0)
+    {
+        return;
+    }
+    for (int i = 0; i < FANOUT; i++)
+    {
+        xsnprintf(child, sizeof(child), "%s/dir%d", path, i);
+        mkdir(child, 0700);
+        MakeTree(child, depth - 1);
+    }
+}
+
+static void Cleanup(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", TREE);
+    system(cmd);
+}
+
+static size_t Walk(const DirScan *dir, DirScanPool *pool)
+{
+    const size_t length = DirScanLength(dir);
+    DirScanRequest **read_ahead = xcalloc(length + 1, sizeof(DirScanRequest *));
+    size_t next = 0;
+    size_t count = 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        const char *name = DirScanAt(dir, i)->name;
+        if (pool != NULL)
+        {
+            for (next = MAX(next, i + 1); next < length; next++)
+            {
+                const DirScanEntry *entry = DirScanAt(dir, next);
+                if (entry->dir && entry->name[0] != '.')
+                {
+                    read_ahead[next] = DirScanPoolSubmit(pool, dir, entry->name);
+                    if (read_ahead[next] == NULL)
+                    {
+                        break;
+                    }
+                }
+            }
+        }
+
+        struct stat sb;
+        if (name[0] == '.' || DirScanStat(dir, name, &sb, false) == -1)
+        {
+            continue;
+        }
+        count++;
+
+        if (S_ISDIR(sb.st_mode))
+        {
+            DirScan *subdir = (read_ahead[i] != NULL) ?
+                DirScanRequestTake(read_ahead[i]) :
+                DirScanOpenAt(dir, name, false, pool != NULL);
+            read_ahead[i] = NULL;
+            if (subdir != NULL)
+            {
+                count += Walk(subdir, pool);
+                DirScanClose(subdir);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < length; i++)
+    {
+        DirScanRequestCancel(read_ahead[i]);
+    }
+    free(read_ahead);
+    return count;
+}
+
+static void DropCaches(void)
+{
+    sync();
+    FILE *fp = fopen("/proc/sys/vm/drop_caches", "w");
+    if (fp == NULL || fputs("3\n", fp) == EOF || fclose(fp) == EOF)
+    {
+        fprintf(stderr, "Unable to drop the caches (need to be root): %s\n",
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static double Run(const char *path, int threads, bool cold, size_t *count)
+{
+    if (cold)
+    {
+        DropCaches();
+    }
+
+    const double start = Now();
+    DirScanPool *pool = (threads > 0) ? DirScanPoolNew(threads, false) : NULL;
+    DirScan *dir = DirScanOpen(path);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Unable to open '%s': %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    *count = Walk(dir, pool);
+    DirScanClose(dir);
+    DirScanPoolDestroy(pool);
+    return Now() - start;
+}
+
+int main(int argc, char **argv)
+{
+    int threads = DEFAULT_THREADS;
+    if (argc > 1)
+    {
+        threads = atoi(argv[1]);
+        if (threads < 1)
+        {
+            fprintf(stderr, "Usage: dirscan_load [<threads> [<path> [cold]]]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const char *path = TREE;
+    if (argc > 2)
+    {
+        path = argv[2];
+    }
+    else
+    {
+        xsnprintf(TREE, sizeof(TREE), "/tmp/dirscan_load.XXXXXX");
+        if (mkdtemp(TREE) == NULL)
+        {
+            fprintf(stderr, "Unable to create a temporary directory\n");
+            exit(EXIT_FAILURE);
+        }
+        atexit(&Cleanup);
+        MakeTree(TREE, DEPTH);
+    }
+
+    const bool cold = (argc > 3) && StringEqual(argv[3], "cold");
+
+    size_t sequential_count, pool_count;
+    if (!cold)
+    {
+        Run(path, 0, false, &sequential_count);
+    }
+
+    double sequential = 0.0;
+    double pooled = 0.0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        const double s = Run(path, 0, cold, &sequential_count);
+        const double p = Run(path, threads, cold, &pool_count);
+        if (sequential_count != pool_count)
+        {
+            fprintf(stderr, "Walked %zu entries with the pool, expected %zu\n",
+                    pool_count, sequential_count);
+            exit(EXIT_FAILURE);
+        }
+        sequential = (round == 0) ? s : MIN(sequential, s);
+        pooled = (round == 0) ? p : MIN(pooled, p);
+    }
+
+    printf("%zu entries under '%s', %s cache, best of %d\n", sequential_count,
+           path, cold ? "cold" : "warm", ROUNDS);
+    printf("no read ahead:            %.4fs\n", sequential);
+    printf("read ahead (%2d threads):  %.4fs\n", threads, pooled);
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <cf3.defs.h>
+#include <misc_lib.h>                                  /* xsnprintf */
+#include <item_lib.h>
+#include <string_lib.h>                                /* StringEqual */
+#include <files_editline_index.h>
+#include <load_timer.h>
+
+
+/* Benchmark for the checks insert_lines promises do on every agent run: an
+ * /etc/hosts-like file of NUM_LINES lines is edited by NUM_PROMISES promises
+ * of lines already present in it (the converged state), each checking
+ * whether its line exists in the file before inserting it.
+ *
+ * Reported are walking the Item list for every promise, as edit_line used
+ * to do, and looking the line up in the EditLineIndex. One in every
+ * INSERT_EVERY promises is made to insert a new line, which invalidates the
+ * index. */
+
+#define NUM_LINES 50000
+#define NUM_PROMISES 500
+#define INSERT_EVERY 50
+
+static Item *MakeFile(void)
+{
+    Item *lines = NULL;
+    for (int i = NUM_LINES - 1; i >= 0; i--)
+    {
+        char line[CF_BUFSIZE];
+        xsnprintf(line, sizeof(line), "10.%d.%d.%d\thost%d.example.com host%d",
+                  (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff, i, i);
+        PrependItem(&lines, line, NULL);
+    }
+    return lines;
+}
+
+static bool LinearContains(const Item *begin, const Item *end, const char *line)
+{
+    for (const Item *ip = begin; ip != end && ip != NULL; ip = ip->next)
+    {
+        if (StringEqual(ip->name, line))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void Promise(int i, char *line, size_t size)
+{
+    if (i % INSERT_EVERY == 0)
+    {
+        xsnprintf(line, size, "192.168.%d.%d\tnew%d.example.com", i >> 8, i & 0xff, i);
+    }
+    else
+    {
+        const int n = (i * 7919) % NUM_LINES;
+        xsnprintf(line, size, "10.%d.%d.%d\thost%d.example.com host%d",
+                  (n >> 16) & 0xff, (n >> 8) & 0xff, n & 0xff, n, n);
+    }
+}
+
+int main(void)
+{
+    char line[CF_BUFSIZE];
+
+    Item *lines = MakeFile();
+    double start = Now();
+    size_t inserted = 0;
+    for (int i = 0; i < NUM_PROMISES; i++)
+    {
+        Promise(i, line, sizeof(line));
+        if (!LinearContains(lines, NULL, line))
+        {
+            AppendItem(&lines, line, NULL);
+            inserted++;
+        }
+    }
+    const double linear = Now() - start;
+    DeleteItemList(lines);
+
+    lines = MakeFile();
+    EditLineIndex *index = EditLineIndexNew();
+    start = Now();
+    size_t indexed_inserted = 0;
+    for (int i = 0; i < NUM_PROMISES; i++)
+    {
+        Promise(i, line, sizeof(line));
+        if (!EditLineIndexRegionContains(index, lines, lines, NULL, line))
+        {
+            InsertAfter(&lines, EditLineIndexLast(index, lines), line);
+            EditLineIndexInvalidate(index);
+            indexed_inserted++;
+        }
+    }
+    const double indexed = Now() - start;
+    EditLineIndexDestroy(index);
+    DeleteItemList(lines);
+
+    if (inserted != indexed_inserted)
+    {
+        fprintf(stderr, "Inserted %zu lines with the index, expected %zu\n",
+                indexed_inserted, inserted);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%d promises on a %d line file, %zu lines inserted\n",
+           NUM_PROMISES, NUM_LINES, inserted);
+    printf("linear scan: %.4fs\n", linear);
+    printf("line index:  %.4fs\n", indexed);
+
+    return 0;
+}
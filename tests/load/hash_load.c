@@ -0,0 +1,151 @@
+#include <cf3.defs.h>
+#include <alloc.h>
+#include <misc_lib.h>                                  /* xsnprintf */
+#include <hash.h>
+#include <files_lib.h>                                 /* TraverseDirectoryTree */
+#include <files_digest.h>
+#include <load_timer.h>
+
+
+/* Benchmark for the hashing done by files promises with changes and
+ * "hash => best": every file of a tree is hashed with MD5 and SHA1, once
+ * with a HashFile() call per digest and once with both digests computed by
+ * HashFileMulti() in a single pass.
+ *
+ * The generated tree (NUM_FILES files of FILE_SIZE bytes) is in the page
+ * cache, so this mostly shows the CPU side. For the I/O side run it on a big
+ * tree (e.g. 10 GB) with cold caches:
+ *
+ *   hash_load <path> */
+
+#define NUM_FILES 32
+#define FILE_SIZE (8 * 1024 * 1024)
+
+static const HashMethod TYPES[] = { HASH_METHOD_MD5, HASH_METHOD_SHA1 };
+#define NUM_TYPES (sizeof(TYPES) / sizeof(TYPES[0]))
+
+static char TREE[CF_BUFSIZE];
+
+typedef struct
+{
+    bool multi;
+    size_t files;
+    uintmax_t bytes;
+    unsigned char check[EVP_MAX_MD_SIZE + 1];  /* XOR of all the digests */
+} HashRun;
+
+static void MakeTree(const char *path)
+{
+    char *data = xmalloc(FILE_SIZE);
+    for (size_t i = 0; i < FILE_SIZE; i++)
+    {
+        data[i] = (char) (i * 7919 % 251);
+    }
+
+    char file[CF_BUFSIZE];
+    for (int i = 0; i < NUM_FILES; i++)
+    {
+        xsnprintf(file, sizeof(file), "%s/file%d", path, i);
+        FILE *fp = fopen(file, "w");
+        if (fp == NULL || fwrite(data, 1, FILE_SIZE - i, fp) != (size_t) (FILE_SIZE - i))
+        {
+            fprintf(stderr, "Unable to write '%s'\n", file);
+            exit(EXIT_FAILURE);
+        }
+        fclose(fp);
+    }
+    free(data);
+}
+
+static void Cleanup(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", TREE);
+    system(cmd);
+}
+
+static int HashCallback(const char *path, const struct stat *sb, void *user_data)
+{
+    HashRun *run = user_data;
+    if (!S_ISREG(sb->st_mode))
+    {
+        return 0;
+    }
+
+    unsigned char digests[NUM_TYPES][EVP_MAX_MD_SIZE + 1] = { { 0 } };
+    if (run->multi)
+    {
+        if (!HashFileMulti(path, TYPES, NUM_TYPES, digests))
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < NUM_TYPES; i++)
+        {
+            HashFile(path, digests[i], TYPES[i], false);
+        }
+    }
+
+    for (size_t i = 0; i < NUM_TYPES; i++)
+    {
+        for (size_t j = 0; j < sizeof(run->check); j++)
+        {
+            run->check[j] ^= digests[i][j];
+        }
+    }
+    run->files++;
+    run->bytes += sb->st_size;
+    return 0;
+}
+
+static double Run(const char *path, HashRun *run)
+{
+    const double start = Now();
+    if (!TraverseDirectoryTree(path, HashCallback, run))
+    {
+        fprintf(stderr, "Unable to hash the files under '%s'\n", path);
+        exit(EXIT_FAILURE);
+    }
+    return Now() - start;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = TREE;
+    if (argc > 1)
+    {
+        path = argv[1];
+    }
+    else
+    {
+        xsnprintf(TREE, sizeof(TREE), "/tmp/hash_load.XXXXXX");
+        if (mkdtemp(TREE) == NULL)
+        {
+            fprintf(stderr, "Unable to create a temporary directory\n");
+            exit(EXIT_FAILURE);
+        }
+        atexit(&Cleanup);
+        MakeTree(TREE);
+    }
+
+    HashRun separate = { .multi = false };
+    HashRun multi = { .multi = true };
+    const double separate_time = Run(path, &separate);
+    const double multi_time = Run(path, &multi);
+
+    if (separate.files != multi.files ||
+        memcmp(separate.check, multi.check, sizeof(separate.check)) != 0)
+    {
+        fprintf(stderr, "Digests from HashFileMulti() differ from HashFile()\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const double mb = separate.bytes / (1024.0 * 1024.0);
+    printf("%zu files, %.0f MB under '%s'\n", separate.files, mb, path);
+    printf("HashFile() per digest:  %.3fs (%.0f MB/s)\n", separate_time, mb / separate_time);
+    printf("HashFileMulti():        %.3fs (%.0f MB/s)\n", multi_time, mb / multi_time);
+
+    return 0;
+}
@@ -0,0 +1,10 @@
+#include <platform.h>
+#include <misc_lib.h>                                  /* xclock_gettime */
+#include <load_timer.h>
+
+double Now(void)
+{
+    struct timespec ts;
+    xclock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
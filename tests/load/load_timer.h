@@ -0,0 +1,9 @@
+#ifndef CFENGINE_LOAD_TIMER_H
+#define CFENGINE_LOAD_TIMER_H
+
+/**
+ * @return seconds on a monotonic clock, for timing the load tests
+ */
+double Now(void);
+
+#endif
@@ -0,0 +1,154 @@
+#include <cf3.defs.h>
+#include <misc_lib.h>                                  /* xsnprintf */
+#include <eval_context.h>
+#include <evalfunction.h>                              /* DefaultTemplateData */
+#include <mustache.h>
+#include <mustache_template.h>
+#include <buffer.h>
+#include <load_timer.h>
+
+
+/* Benchmark for rendering mustache templates the way files promises do: a
+ * template of about TEMPLATE_SIZE bytes (a mix of scalar variables and a
+ * section over a data container of NUM_ENTRIES objects) is rendered ROUNDS
+ * times against an EvalContext with NUM_VARIABLES variables in NUM_BUNDLES
+ * bundles.
+ *
+ * Reported separately are loading the template (from the file the first
+ * time, from the cache after), collecting the template data (all of it as
+ * before, only what the template refers to now) and the rendering itself. */
+
+#define TEMPLATE_SIZE (1024 * 1024)
+#define NUM_ENTRIES 10000
+#define NUM_VARIABLES 40000
+#define NUM_BUNDLES 200
+#define ROUNDS 10
+
+static void PutVariables(EvalContext *ctx)
+{
+    for (int i = 0; i < NUM_VARIABLES; i++)
+    {
+        char ref_str[CF_MAXVARSIZE], value[CF_MAXVARSIZE];
+        xsnprintf(ref_str, sizeof(ref_str), "default:bundle%d.var%d", i % NUM_BUNDLES, i);
+        xsnprintf(value, sizeof(value), "value of variable %d", i);
+
+        VarRef *ref = VarRefParse(ref_str);
+        EvalContextVariablePut(ctx, ref, value, CF_DATA_TYPE_STRING, NULL);
+        VarRefDestroy(ref);
+    }
+
+    JsonElement *data = JsonArrayCreate(NUM_ENTRIES);
+    for (int i = 0; i < NUM_ENTRIES; i++)
+    {
+        char name[64];
+        xsnprintf(name, sizeof(name), "entry%d", i);
+
+        JsonElement *entry = JsonObjectCreate(2);
+        JsonObjectAppendString(entry, "name", name);
+        JsonObjectAppendInteger(entry, "value", i);
+        JsonArrayAppendObject(data, entry);
+    }
+
+    VarRef *ref = VarRefParse("default:bench.data");
+    EvalContextVariablePut(ctx, ref, data, CF_DATA_TYPE_CONTAINER, NULL);
+    VarRefDestroy(ref);
+    JsonDestroy(data);
+}
+
+static void WriteTemplate(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Unable to create template file '%s'\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    fputs("{{#vars.bench.data}}\n{{name}} = {{value}}\n{{/vars.bench.data}}\n", f);
+
+    long size = 0;
+    for (int i = 0; size < TEMPLATE_SIZE; i++)
+    {
+        const int var = (i * 7919) % NUM_VARIABLES;
+        int written = fprintf(f, "line %d: {{vars.bundle%d.var%d}}"
+                              "{{#classes.any}} (any){{/classes.any}}\n",
+                              i, var % NUM_BUNDLES, var);
+        size += written;
+    }
+
+    fclose(f);
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/mustache_load.XXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        fprintf(stderr, "Unable to create temporary directory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char path[PATH_MAX];
+    xsnprintf(path, sizeof(path), "%s/template.mustache", dir);
+    WriteTemplate(path);
+
+    EvalContext *ctx = EvalContextNew();
+    EvalContextClassPutHard(ctx, "any", "");
+    PutVariables(ctx);
+
+    double load = 0.0, first_load = 0.0, full_data = 0.0, data = 0.0, render = 0.0;
+    size_t output_size = 0;
+
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        double start = Now();
+        const MustacheTemplate *template = MustacheTemplateLoad(path);
+        if (template == NULL)
+        {
+            fprintf(stderr, "Unable to load template '%s'\n", path);
+            exit(EXIT_FAILURE);
+        }
+        if (i == 0)
+        {
+            first_load = Now() - start;
+        }
+        else
+        {
+            load += Now() - start;
+        }
+
+        start = Now();
+        JsonElement *all = DefaultTemplateData(ctx, NULL);
+        full_data += Now() - start;
+        JsonDestroy(all);
+
+        start = Now();
+        JsonElement *template_data = MustacheTemplateData(ctx, template->refs);
+        data += Now() - start;
+
+        start = Now();
+        Buffer *output = BufferNew();
+        if (!MustacheRender(output, template->text, template_data))
+        {
+            fprintf(stderr, "Unable to render template '%s'\n", path);
+            exit(EXIT_FAILURE);
+        }
+        render += Now() - start;
+
+        output_size = BufferSize(output);
+        BufferDestroy(output);
+        JsonDestroy(template_data);
+    }
+
+    printf("template load:   %.4fs first, %.6fs cached\n", first_load, load / (ROUNDS - 1));
+    printf("template data:   %.4fs all variables, %.4fs referenced only\n",
+           full_data / ROUNDS, data / ROUNDS);
+    printf("render:          %.4fs per round, %zu bytes output\n", render / ROUNDS, output_size);
+
+    MustacheTemplateCacheClear();
+    EvalContextDestroy(ctx);
+    unlink(path);
+    rmdir(dir);
+
+    return 0;
+}
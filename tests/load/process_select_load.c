@@ -0,0 +1,142 @@
+#include <cf3.defs.h>
+#include <misc_lib.h>                                  /* xsnprintf */
+#include <load_timer.h>
+
+#include <processes_select.c>
+
+
+/* Benchmark for SelectProcesses() over a synthetic process table in the
+ * Linux ps format with NUM_PROCESSES processes. A couple of typical
+ * processes promises (the promiser only and with process_select bodies using
+ * ranges, regexes and process_result) are evaluated against the table
+ * ROUNDS times each.
+ *
+ * The first round also includes splitting of the table into columns, which
+ * only happens once per loaded table. */
+
+#define NUM_PROCESSES 50000
+#define ROUNDS 20
+
+static const char *USERS[] = { "root", "daemon", "www-data", "postgres", "alice" };
+static const char *COMMANDS[] = {
+    "/usr/sbin/sshd -D",
+    "/usr/lib/postgresql/14/bin/postgres -D /var/lib/postgresql/14/main",
+    "nginx: worker process",
+    "/usr/bin/python3 /usr/local/bin/app.py --workers 4",
+    "[kworker/0:1-events]",
+    "/var/cfengine/bin/cf-serverd --no-fork",
+};
+
+#define LINE_FORMAT "%-30s %7s %7s %7s %4s %4s %6s %3s %9s %-8s %4s %5s %11s %8s %s"
+
+static void LoadSyntheticProcessTable(void)
+{
+    const time_t now = time(NULL);
+    char line[CF_BUFSIZE];
+
+    xsnprintf(line, sizeof(line), LINE_FORMAT,
+              "USER", "PID", "PPID", "PGID", "%CPU", "%MEM", "VSZ", "NI", "RSS",
+              "TT", "NLWP", "STIME", "ELAPSED", "TIME", "COMMAND");
+    PrependItem(&PROCESSTABLE, line, "");
+
+    for (int i = 0; i < NUM_PROCESSES; i++)
+    {
+        const int elapsed = (i * 37) % 86400;
+        const int cpu = (i * 13) % 3600;
+        const time_t started = now - elapsed;
+        struct tm tm;
+        localtime_r(&started, &tm);
+
+        char pid[16], ppid[16], pcpu[16], pmem[16], vsz[16], ni[16], rss[16];
+        char nlwp[16], stime[16], etime[16], ttime[16];
+        xsnprintf(pid, sizeof(pid), "%d", i + 1);
+        xsnprintf(ppid, sizeof(ppid), "%d", (i == 0) ? 0 : 1 + (i % 100));
+        xsnprintf(pcpu, sizeof(pcpu), "%.1f", (i % 100) / 10.0);
+        xsnprintf(pmem, sizeof(pmem), "%.1f", (i % 50) / 10.0);
+        xsnprintf(vsz, sizeof(vsz), "%d", 10000 + (i % 1000) * 100);
+        xsnprintf(ni, sizeof(ni), "%d", (i % 40) - 20);
+        xsnprintf(rss, sizeof(rss), "%d", 1000 + (i % 500) * 10);
+        xsnprintf(nlwp, sizeof(nlwp), "%d", 1 + (i % 16));
+        xsnprintf(stime, sizeof(stime), "%02d:%02d", tm.tm_hour, tm.tm_min);
+        xsnprintf(etime, sizeof(etime), "%02d:%02d:%02d",
+                  elapsed / 3600, (elapsed / 60) % 60, elapsed % 60);
+        xsnprintf(ttime, sizeof(ttime), "%02d:%02d:%02d",
+                  cpu / 3600, (cpu / 60) % 60, cpu % 60);
+
+        xsnprintf(line, sizeof(line), LINE_FORMAT,
+                  USERS[i % (sizeof(USERS) / sizeof(USERS[0]))],
+                  pid, ppid, pid, pcpu, pmem, vsz, ni, rss,
+                  (i % 7 == 0) ? "pts/0" : "?", nlwp, stime, etime, ttime,
+                  COMMANDS[i % (sizeof(COMMANDS) / sizeof(COMMANDS[0]))]);
+        PrependItem(&PROCESSTABLE, line, "");
+    }
+
+    PROCESSTABLE = ReverseItemList(PROCESSTABLE);
+    PROCESS_TABLE_TIME = now;
+}
+
+static void RunSelect(const char *name, const char *process_regex,
+                      const ProcessSelect *a, bool attrselect)
+{
+    size_t matches = 0;
+    double first = 0.0;
+    const double start = Now();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        Item *selected = SelectProcesses(process_regex, a, attrselect);
+        matches = ListLen(selected);
+        DeleteItemList(selected);
+        if (i == 0)
+        {
+            first = Now() - start;
+        }
+    }
+    const double elapsed = Now() - start;
+
+    printf("%-20s %6zu matches, first round %.3fs, %.3fs per round after, %.0f processes/s\n",
+           name, matches, first, (elapsed - first) / (ROUNDS - 1),
+           NUM_PROCESSES * (ROUNDS - 1) / (elapsed - first));
+}
+
+int main(void)
+{
+    VPSHARDCLASS = PLATFORM_CONTEXT_LINUX;
+    CFSTARTTIME = time(NULL);
+
+    LoadSyntheticProcessTable();
+
+    ProcessSelect plain = PROCESS_SELECT_INIT;
+    RunSelect("promiser only", "postgres", &plain, false);
+
+    /* Drop the split table again to see the first round cost again */
+    SeqDestroy(PROCESS_ENTRIES);
+    PROCESS_ENTRIES = NULL;
+
+    Rlist *owners = NULL;
+    RlistAppendScalar(&owners, "root");
+    RlistAppendScalar(&owners, "www-.*");
+
+    ProcessSelect ranges = PROCESS_SELECT_INIT;
+    ranges.owner = owners;
+    ranges.min_vsize = 20000;
+    ranges.max_vsize = 80000;
+    ranges.min_ttime = 0;
+    ranges.max_ttime = 1800;
+    ranges.min_thread = 4;
+    ranges.max_thread = 12;
+    ranges.tty = "pts/.*";
+    ranges.process_result = "process_owner.vsize.(ttime|threads).!tty";
+    RunSelect("process_select", ".*", &ranges, true);
+
+    ProcessSelect stime = PROCESS_SELECT_INIT;
+    stime.min_stime = CFSTARTTIME - 3600;
+    stime.max_stime = CFSTARTTIME;
+    stime.command = ".*sshd.*";
+    stime.process_result = "stime.command";
+    RunSelect("stime+command", "sshd", &stime, true);
+
+    RlistDestroy(owners);
+    ClearProcessTable();
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <cf3.defs.h>
+#include <misc_lib.h>                                  /* xsnprintf */
+#include <eval_context.h>
+#include <item_lib.h>
+#include <match_scope.h>                               /* FullTextMatch */
+#include <regex.h>                                     /* CompileRegex */
+#include <regex_cache.h>
+#include <load_timer.h>
+
+
+/* Benchmark for the regex matching edit_line promises do when editing a file
+ * of NUM_LINES lines: every one of NUM_PATTERNS patterns (like the promisers
+ * of delete_lines or the select_line_matching of replace_patterns) is matched
+ * against every line.
+ *
+ * Reported are compiling the regex for every line, as FullTextMatch() used to
+ * do, and FullTextMatch() with the regex cache. */
+
+#define NUM_LINES 100000
+#define NUM_PATTERNS 10
+
+static Item *MakeFile(void)
+{
+    Item *lines = NULL;
+    Item *last = NULL;
+    for (int i = 0; i < NUM_LINES; i++)
+    {
+        char line[CF_BUFSIZE];
+        xsnprintf(line, sizeof(line), "option%d = value %d # comment %d", i % 1000, i, i * 7919);
+        Item *ip = xcalloc(1, sizeof(Item));
+        ip->name = xstrdup(line);
+        if (last == NULL)
+        {
+            lines = ip;
+        }
+        else
+        {
+            last->next = ip;
+        }
+        last = ip;
+    }
+    return lines;
+}
+
+static size_t MatchUncached(const Item *lines, const char *pattern)
+{
+    size_t matches = 0;
+    for (const Item *ip = lines; ip != NULL; ip = ip->next)
+    {
+        pcre *rx = CompileRegex(pattern);
+        if (rx != NULL)
+        {
+            matches += StringMatchFullWithPrecompiledRegex(rx, ip->name);
+            pcre_free(rx);
+        }
+    }
+    return matches;
+}
+
+static size_t MatchCached(EvalContext *ctx, const Item *lines, const char *pattern)
+{
+    size_t matches = 0;
+    for (const Item *ip = lines; ip != NULL; ip = ip->next)
+    {
+        matches += FullTextMatch(ctx, pattern, ip->name);
+    }
+    return matches;
+}
+
+int main(void)
+{
+    Item *lines = MakeFile();
+    EvalContext *ctx = EvalContextNew();
+
+    double uncached = 0.0, cached = 0.0;
+    for (int i = 0; i < NUM_PATTERNS; i++)
+    {
+        char pattern[CF_MAXVARSIZE];
+        xsnprintf(pattern, sizeof(pattern), "option%d\\s*=\\s*(.*)#.*", i * 97);
+
+        double start = Now();
+        size_t expected = MatchUncached(lines, pattern);
+        uncached += Now() - start;
+
+        start = Now();
+        size_t matches = MatchCached(ctx, lines, pattern);
+        cached += Now() - start;
+
+        if (matches != expected)
+        {
+            fprintf(stderr, "Pattern '%s' matched %zu lines, expected %zu\n",
+                    pattern, matches, expected);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t hits, misses;
+    RegexCacheGetStats(&hits, &misses);
+
+    printf("%d patterns x %d lines\n", NUM_PATTERNS, NUM_LINES);
+    printf("compiled per line: %.4fs\n", uncached);
+    printf("regex cache:       %.4fs (%zu hits, %zu misses)\n", cached, hits, misses);
+
+    RegexCacheClear();
+    EvalContextDestroy(ctx);
+    DeleteItemList(lines);
+
+    return 0;
+}
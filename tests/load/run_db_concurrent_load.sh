@@ -0,0 +1,5 @@
+#!/bin/sh -e
+echo "Starting run_db_concurrent_load.sh test"
+for threads in 1 10; do
+  ./db_concurrent_load $threads 2
+done
@@ -0,0 +1,3 @@
+#!/bin/sh -e
+echo "Starting run_dirscan_load.sh test"
+./dirscan_load
@@ -0,0 +1,3 @@
+#!/bin/sh -e
+echo "Starting run_editline_load.sh test"
+./editline_load
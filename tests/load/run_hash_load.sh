@@ -0,0 +1,3 @@
+#!/bin/sh -e
+echo "Starting run_hash_load.sh test"
+./hash_load
@@ -0,0 +1,3 @@
+#!/bin/sh -e
+echo "Starting run_mustache_load.sh test"
+./mustache_load
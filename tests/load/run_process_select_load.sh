@@ -0,0 +1,3 @@
+#!/bin/sh -e
+echo "Starting run_process_select_load.sh test"
+./process_select_load
@@ -0,0 +1,3 @@
+#!/bin/sh -e
+echo "Starting run_regex_cache_load.sh test"
+./regex_cache_load
@@ -177,6 +177,249 @@ static void test_migration(void)
     CloseDB(db);
 }
 
+static void test_content_record(void)
+{
+    char path[PATH_MAX];
+    xsnprintf(path, sizeof(path), "%s/rendered", GetWorkDir());
+    FILE *f = fopen(path, "w");
+    assert_true(f != NULL);
+    fputs("content", f);
+    fclose(f);
+
+    struct stat sb;
+    assert_int_equal(stat(path, &sb), 0);
+
+    unsigned char digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+    unsigned char other_digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+    HashString("content", strlen("content"), digest, HASH_METHOD_MD5);
+    HashString("other", strlen("other"), other_digest, HASH_METHOD_MD5);
+
+    assert_false(FileChangesContentKnown(path, &sb, HASH_METHOD_MD5, digest));
+
+    /* Recorded in the same second as the file was modified, not trusted. */
+    FileChangesRecordContent(path, &sb, HASH_METHOD_MD5, digest);
+    CF_DB *db;
+    char key[strlen(path) + 3];
+    xsnprintf(key, sizeof(key), "R_%s", path);
+    ContentValue value;
+    assert_true(OpenDB(&db, dbid_changes));
+    assert_true(ReadDB(db, key, &value, sizeof(value)));
+    if (value.recorded <= sb.st_ctime)
+    {
+        assert_false(FileChangesContentKnown(path, &sb, HASH_METHOD_MD5, digest));
+    }
+
+    /* Pretend the content was verified later. */
+    value.recorded = MAX(sb.st_mtime, sb.st_ctime) + 1;
+    assert_true(WriteDB(db, key, &value, sizeof(value)));
+    CloseDB(db);
+
+    assert_true(FileChangesContentKnown(path, &sb, HASH_METHOD_MD5, digest));
+    assert_false(FileChangesContentKnown(path, &sb, HASH_METHOD_MD5, other_digest));
+    assert_false(FileChangesContentKnown(path, &sb, HASH_METHOD_SHA256, digest));
+
+    struct stat changed = sb;
+    changed.st_size++;
+    assert_false(FileChangesContentKnown(path, &changed, HASH_METHOD_MD5, digest));
+    changed = sb;
+    changed.st_ino++;
+    assert_false(FileChangesContentKnown(path, &changed, HASH_METHOD_MD5, digest));
+
+    assert_true(OpenDB(&db, dbid_changes));
+    RemoveAllFileTraces(db, path);
+    CloseDB(db);
+    assert_false(FileChangesContentKnown(path, &sb, HASH_METHOD_MD5, digest));
+}
+
+static void test_hashes_record(void)
+{
+    char path[PATH_MAX];
+    xsnprintf(path, sizeof(path), "%s/hashed", GetWorkDir());
+    FILE *f = fopen(path, "w");
+    assert_true(f != NULL);
+    fputs("content", f);
+    fclose(f);
+
+    struct stat sb;
+    assert_int_equal(stat(path, &sb), 0);
+
+    const HashMethod types[] = { HASH_METHOD_MD5, HASH_METHOD_SHA1 };
+    unsigned char digests[2][EVP_MAX_MD_SIZE + 1] = { { 0 } };
+    HashString("content", strlen("content"), digests[0], HASH_METHOD_MD5);
+    HashString("content", strlen("content"), digests[1], HASH_METHOD_SHA1);
+
+    /* Not recorded unless the stored hashes are the digests */
+    CF_DB *db;
+    assert_true(OpenDB(&db, dbid_changes));
+    WriteHash(db, HASH_METHOD_MD5, path, digests[0]);
+    CloseDB(db);
+    FileChangesRecordHashes(path, &sb, HASH_METHOD_BEST, types, 2, digests);
+    char key[strlen(path) + 3];
+    xsnprintf(key, sizeof(key), "I_%s", path);
+    assert_true(OpenDB(&db, dbid_changes));
+    assert_false(HasKeyDB(db, key, sizeof(key)));
+    WriteHash(db, HASH_METHOD_SHA1, path, digests[1]);
+    CloseDB(db);
+
+    FileChangesRecordHashes(path, &sb, HASH_METHOD_BEST, types, 2, digests);
+    ContentValue value;
+    assert_true(OpenDB(&db, dbid_changes));
+    assert_true(ReadDB(db, key, &value, sizeof(value)));
+
+    /* Pretend the file was hashed later than it was modified. */
+    value.recorded = MAX(sb.st_mtime, sb.st_ctime) + 1;
+    assert_true(WriteDB(db, key, &value, sizeof(value)));
+    CloseDB(db);
+
+    assert_true(FileChangesHashesKnown(path, &sb, HASH_METHOD_BEST));
+    assert_false(FileChangesHashesKnown(path, &sb, HASH_METHOD_SHA1));
+
+    struct stat changed = sb;
+    changed.st_mtime++;
+    assert_false(FileChangesHashesKnown(path, &changed, HASH_METHOD_BEST));
+
+    assert_true(OpenDB(&db, dbid_changes));
+    RemoveAllFileTraces(db, path);
+    CloseDB(db);
+    assert_false(FileChangesHashesKnown(path, &sb, HASH_METHOD_BEST));
+}
+
+static void test_directory_list_updates(void)
+{
+    const char *path = "/list";
+    char key[] = "D_/list";
+    char updates_key[] = "U_/list";
+
+    Seq *files = SeqNew(64, free);
+    for (int i = 0; i < 64; i++)
+    {
+        SeqAppend(files, StringFormat("file%02d", i));
+    }
+
+    CF_DB *db;
+    bool change;
+    assert_true(OpenDB(&db, dbid_changes));
+    assert_true(FileChangesSetDirectoryList(db, path, files, &change));
+    assert_true(change);
+    assert_true(FileChangesSetDirectoryList(db, path, files, &change));
+    assert_false(change);
+    assert_false(HasKeyDB(db, updates_key, sizeof(updates_key)));
+    const int base_size = ValueSizeDB(db, key, sizeof(key));
+
+    /* Small changes are only stored as updates of the full list */
+    SeqRemove(files, 10);
+    SeqAppend(files, xstrdup("file10a"));
+    SeqSort(files, StrCmpWrapper, NULL);
+    assert_true(FileChangesSetDirectoryList(db, path, files, &change));
+    assert_true(change);
+    assert_int_equal(ValueSizeDB(db, key, sizeof(key)), base_size);
+    assert_true(HasKeyDB(db, updates_key, sizeof(updates_key)));
+
+    Seq *stored = SeqNew(64, free);
+    assert_true(GetDirectoryListFromDatabase(db, path, stored));
+    assert_int_equal(SeqLength(stored), SeqLength(files));
+    for (size_t i = 0; i < SeqLength(files); i++)
+    {
+        assert_string_equal(SeqAt(stored, i), SeqAt(files, i));
+    }
+    SeqClear(stored);
+
+    assert_true(FileChangesSetDirectoryList(db, path, files, &change));
+    assert_false(change);
+
+    /* Big ones replace the full list */
+    SeqRemoveRange(files, 0, 31);
+    assert_true(FileChangesSetDirectoryList(db, path, files, &change));
+    assert_true(change);
+    assert_false(HasKeyDB(db, updates_key, sizeof(updates_key)));
+    assert_true(GetDirectoryListFromDatabase(db, path, stored));
+    assert_int_equal(SeqLength(stored), 32);
+    assert_string_equal(SeqAt(stored, 0), "file32");
+
+    SeqClear(files);
+    assert_true(FileChangesSetDirectoryList(db, path, files, &change));
+    assert_true(change);
+    assert_false(HasKeyDB(db, key, sizeof(key)));
+    CloseDB(db);
+
+    SeqDestroy(stored);
+    SeqDestroy(files);
+}
+
+static void test_stat_value(void)
+{
+    struct stat sb;
+    assert_int_equal(stat(GetWorkDir(), &sb), 0);
+
+    CF_DB *db;
+    StatValue value;
+    char key[] = "S_/stat";
+    assert_true(OpenDB(&db, dbid_changes));
+
+    /* As written by older versions */
+    assert_true(WriteDB(db, key, &sb, sizeof(sb)));
+    assert_true(ReadStatValue(db, key, &value));
+    assert_true(value.ino == (uintmax_t) sb.st_ino);
+    assert_true(value.mtime == sb.st_mtime);
+    assert_true(value.mode == sb.st_mode);
+
+    StatValue stored;
+    StatToStatValue(&sb, &stored);
+    assert_true(WriteDB(db, key, &stored, sizeof(stored)));
+    memset(&value, 0, sizeof(value));
+    assert_true(ReadStatValue(db, key, &value));
+    assert_memory_equal(&value, &stored, sizeof(value));
+    CloseDB(db);
+}
+
+static void test_batch(void)
+{
+    FileChangesBatchBegin();
+    FileChangesBatchBegin();
+
+    const char key[] = "D_/batch";
+    CF_DB *db;
+    assert_true(OpenChangesDB(&db));
+    assert_true(ChangesWrite(db, key, sizeof(key), "file", sizeof("file")));
+    CloseChangesDB(db);
+
+    /* Only collected so far, but visible to the changes functions */
+    assert_true(OpenDB(&db, dbid_changes));
+    assert_false(HasKeyDB(db, key, sizeof(key)));
+    CloseDB(db);
+    Seq *files = SeqNew(1, free);
+    assert_true(FileChangesGetDirectoryList("/batch", files));
+    assert_int_equal(SeqLength(files), 1);
+    assert_string_equal(SeqAt(files, 0), "file");
+    SeqClear(files);
+
+    /* Written by the outermost batch */
+    assert_true(FileChangesBatchEnd());
+    assert_true(CHANGES_BATCH != NULL);
+    assert_true(FileChangesBatchEnd());
+    assert_true(CHANGES_BATCH == NULL);
+    assert_int_equal(CHANGES_BATCH_DEPTH, 0);
+
+    assert_true(OpenDB(&db, dbid_changes));
+    assert_true(HasKeyDB(db, key, sizeof(key)));
+    CloseDB(db);
+
+    /* Deletions too */
+    FileChangesBatchBegin();
+    assert_true(OpenChangesDB(&db));
+    assert_true(ChangesDelete(db, key, sizeof(key)));
+    assert_false(ChangesDelete(db, key, sizeof(key)));
+    CloseChangesDB(db);
+    assert_true(FileChangesGetDirectoryList("/batch", files));
+    assert_int_equal(SeqLength(files), 0);
+    assert_true(FileChangesBatchEnd());
+
+    assert_true(OpenDB(&db, dbid_changes));
+    assert_false(HasKeyDB(db, key, sizeof(key)));
+    CloseDB(db);
+    SeqDestroy(files);
+}
+
 static void test_teardown(void)
 {
     DeleteDirectoryTree(GetWorkDir());
@@ -189,6 +432,11 @@ int main()
         {
             unit_test(test_setup),
             unit_test(test_migration),
+            unit_test(test_content_record),
+            unit_test(test_hashes_record),
+            unit_test(test_directory_list_updates),
+            unit_test(test_stat_value),
+            unit_test(test_batch),
             unit_test(test_teardown),
         };
 
@@ -24,6 +24,14 @@ void tests_setup(void)
     strlcpy(CFWORKDIR, workdir, CF_BUFSIZE);
     putenv(env);
     mkdir(GetStateDir(), (S_IRWXU | S_IRWXG | S_IRWXO));
+
+    /* Small map for test_map_growth(), read when the first DB is opened */
+    char config_file[CF_BUFSIZE];
+    xsnprintf(config_file, sizeof(config_file), "%s/%s", workdir, CF_DB_CONFIG_FILE);
+    FILE *config = fopen(config_file, "w");
+    assert(config != NULL);
+    fputs("{ \"cf_state\": { \"map_size_mb\": 1, \"max_map_size_mb\": 8 } }\n", config);
+    fclose(config);
 }
 
 void tests_teardown(void)
@@ -133,6 +141,111 @@ void test_iter_delete_entry(void)
     CloseDB(db);
 }
 
+static bool CountSnapshotEntry(const void *key, int key_size,
+                               const void *value, int value_size,
+                               void *data)
+{
+    assert_int_equal(value_size, 3);
+    if ((size_t) key_size == strlen("snapshot_b") + 1 &&
+        memcmp(key, "snapshot_b", key_size) == 0)
+    {
+        assert_memory_equal(value, "def", 3);
+    }
+    (*(int *) data)++;
+    return true;
+}
+
+static bool StopSnapshotScan(ARG_UNUSED const void *key, ARG_UNUSED int key_size,
+                             ARG_UNUSED const void *value, ARG_UNUSED int value_size,
+                             void *data)
+{
+    (*(int *) data)++;
+    return false;
+}
+
+void test_snapshot_scan(void)
+{
+    CF_DB *db;
+    assert_int_equal(OpenDB(&db, dbid_cache), true);
+
+    assert_int_equal(WriteDB(db, "snapshot_a", "abc", 3), true);
+    assert_int_equal(WriteDB(db, "snapshot_b", "def", 3), true);
+    assert_int_equal(WriteDB(db, "snapshot_c", "ghi", 3), true);
+    CloseDB(db);
+
+    assert_int_equal(OpenDB(&db, dbid_cache), true);
+    int count = 0;
+    assert_int_equal(ScanDBSnapshot(db, CountSnapshotEntry, &count), true);
+    assert_int_equal(count, 3);
+
+    /* Scanning within an already open transaction works too. */
+    char value[4];
+    assert_int_equal(ReadDB(db, "snapshot_a", value, 3), true);
+    count = 0;
+    assert_int_equal(ScanDBSnapshot(db, CountSnapshotEntry, &count), true);
+    assert_int_equal(count, 3);
+
+    /* Callback can stop the scan early. */
+    count = 0;
+    assert_int_equal(ScanDBSnapshot(db, StopSnapshotScan, &count), true);
+    assert_int_equal(count, 1);
+
+    CloseDB(db);
+}
+
+#ifdef LMDB
+void test_map_growth(void)
+{
+    static char value[256 * 1024];
+    memset(value, 'x', sizeof(value));
+    char key[32];
+
+    /* Keeps the DB (and its resize counter) open, every CloseDB() of the
+     * other handle commits. */
+    CF_DB *held;
+    assert_true(OpenDB(&held, dbid_state));
+    assert_int_equal(GetDBMapResizes(held), 0);
+
+    /* A full map is grown and the write is retried if it is the only one in
+     * the transaction */
+    CF_DB *db;
+    for (int i = 0; (i < 16) && (GetDBMapResizes(held) == 0); i++)
+    {
+        assert_true(OpenDB(&db, dbid_state));
+        xsnprintf(key, sizeof(key), "single%d", i);
+        assert_true(WriteDB(db, key, value, sizeof(value)));
+        CloseDB(db);
+    }
+    assert_int_equal(GetDBMapResizes(held), 1);
+
+    /* Otherwise the whole transaction is lost and the write fails */
+    assert_true(OpenDB(&db, dbid_state));
+    int n_written = 0;
+    while ((n_written < 32) && (GetDBMapResizes(held) == 1))
+    {
+        xsnprintf(key, sizeof(key), "batch%d", n_written);
+        if (!WriteDB(db, key, value, sizeof(value)))
+        {
+            break;
+        }
+        n_written++;
+    }
+    assert_true(n_written > 0);
+    assert_int_equal(GetDBMapResizes(held), 2);
+    assert_false(HasKeyDB(db, "batch0", strlen("batch0") + 1));
+    assert_true(HasKeyDB(db, "single0", strlen("single0") + 1));
+
+    /* Redone in the bigger map, the commit still reports the lost changes */
+    assert_true(WriteDB(db, "batch0", value, sizeof(value)));
+    assert_false(CommitDB(db));
+    assert_true(HasKeyDB(db, "batch0", strlen("batch0") + 1));
+    assert_true(CommitDB(db));
+    CloseDB(db);
+    assert_int_equal(GetDBMapResizes(held), 2);
+    CloseDB(held);
+}
+#endif /* LMDB */
+
 #if defined(HAVE_LIBTOKYOCABINET) || defined(HAVE_LIBQDBM) || defined(HAVE_LIBLMDB)
 static void CreateGarbage(const char *filename)
 {
@@ -236,6 +349,10 @@ int main()
             unit_test(test_read_write),
             unit_test(test_iter_modify_entry),
             unit_test(test_iter_delete_entry),
+            unit_test(test_snapshot_scan),
+#ifdef LMDB
+            unit_test(test_map_growth),
+#endif
             unit_test(test_recreate),
             unit_test(test_old_workdir_db_location),
         };
@@ -122,6 +122,70 @@ static void test_basename(void)
     basename_single_testcase("//a//b///c.csv////", ".csv", "c");
 }
 
+static void PutTestVariable(EvalContext *ctx, const char *ref_str, const char *value)
+{
+    VarRef *ref = VarRefParse(ref_str);
+    EvalContextVariablePut(ctx, ref, value, CF_DATA_TYPE_STRING, NULL);
+    VarRefDestroy(ref);
+}
+
+static char *RenderWithData(const char *template, JsonElement *data)
+{
+    Buffer *out = BufferNew();
+    assert_true(MustacheRender(out, template, data));
+    JsonDestroy(data);
+    return BufferClose(out);
+}
+
+static void test_mustache_template_data(void)
+{
+    EvalContext *ctx = EvalContextNew();
+
+    PutTestVariable(ctx, "default:b.x", "x in b");
+    PutTestVariable(ctx, "default:b.y", "y in b");
+    PutTestVariable(ctx, "default:b.arr[k]", "arr k");
+    PutTestVariable(ctx, "default:c.x", "x in c");
+    PutTestVariable(ctx, "ns:b.x", "x in ns:b");
+    EvalContextClassPutHard(ctx, "linux", "");
+    EvalContextClassPutHard(ctx, "web", "");
+    EvalContextClassPutSoftNS(ctx, "ns", "nsclass", CONTEXT_SCOPE_NAMESPACE, "");
+
+    const char *const templates[] =
+    {
+        "{{vars.b.x}} {{vars.c.x}} {{vars.ns:b.x}} {{vars.b.missing}} {{vars.b.arr[k]}}",
+        "{{#classes.linux}}linux{{/classes.linux}}{{^classes.windows}} not windows{{/classes.windows}}",
+        "{{#classes.ns:nsclass}}nsclass{{/classes.ns:nsclass}}{{#classes.default:linux}}bad{{/classes.default:linux}}",
+        "{{#vars.b}}{{@}}={{.}};{{/vars.b}}",
+        "{{$vars.c}}",
+        "{{#classes}}{{@}};{{/classes}}",
+        "{{%-top-}}",
+        "no tags at all",
+    };
+
+    for (size_t i = 0; i < sizeof(templates) / sizeof(templates[0]); i++)
+    {
+        char *expected = RenderWithData(templates[i], DefaultTemplateData(ctx, NULL));
+        MustacheTemplateRefs *refs = MustacheTemplateRefsNew(templates[i]);
+        char *actual = RenderWithData(templates[i], MustacheTemplateData(ctx, refs));
+        MustacheTemplateRefsDestroy(refs);
+        assert_string_equal(actual, expected);
+        free(expected);
+        free(actual);
+    }
+
+    /* Only what the template refers to is collected */
+    MustacheTemplateRefs *refs = MustacheTemplateRefsNew("{{vars.b.x}}{{#classes.web}}{{/classes.web}}");
+    JsonElement *data = MustacheTemplateData(ctx, refs);
+    MustacheTemplateRefsDestroy(refs);
+    JsonElement *vars = JsonObjectGetAsObject(data, "vars");
+    assert_int_equal(JsonLength(vars), 1);
+    assert_int_equal(JsonLength(JsonObjectGetAsObject(vars, "b")), 1);
+    assert_int_equal(JsonLength(JsonObjectGetAsObject(data, "classes")), 1);
+    JsonDestroy(data);
+
+    EvalContextDestroy(ctx);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -129,6 +193,7 @@ int main()
         unit_test(test_hostinnetgroup_found),
         unit_test(test_hostinnetgroup_not_found),
         unit_test(test_basename),
+        unit_test(test_mustache_template_data),
     };
 
     return run_tests(tests);
@@ -0,0 +1,104 @@
+#include <test.h>
+
+#include <cf3.defs.h>
+#include <hash.h>
+#include <files_digest.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+
+
+char CFWORKDIR[CF_BUFSIZE];
+
+char SMALL_FILE[CF_BUFSIZE];
+char BIG_FILE[CF_BUFSIZE];
+char EMPTY_FILE[CF_BUFSIZE];
+
+static const HashMethod TYPES[] = { HASH_METHOD_MD5, HASH_METHOD_SHA1, HASH_METHOD_SHA256 };
+#define NUM_TYPES (sizeof(TYPES) / sizeof(TYPES[0]))
+
+static void WriteTestFile(const char *path, size_t size)
+{
+    FILE *fp = fopen(path, "w");
+    assert_true(fp != NULL);
+    for (size_t i = 0; i < size; i++)
+    {
+        fputc((int) (i * 31 % 253), fp);
+    }
+    fclose(fp);
+}
+
+static void tests_setup(void)
+{
+    xsnprintf(CFWORKDIR, CF_BUFSIZE, "/tmp/files_digest_test.XXXXXX");
+    mkdtemp(CFWORKDIR);
+
+    xsnprintf(SMALL_FILE, CF_BUFSIZE, "%s/small", CFWORKDIR);
+    xsnprintf(BIG_FILE, CF_BUFSIZE, "%s/big", CFWORKDIR);
+    xsnprintf(EMPTY_FILE, CF_BUFSIZE, "%s/empty", CFWORKDIR);
+
+    WriteTestFile(SMALL_FILE, 12345);
+    /* Hashed in parallel, not a multiple of the block size */
+    WriteTestFile(BIG_FILE, HASH_FILE_PARALLEL_MIN_SIZE + 4321);
+    WriteTestFile(EMPTY_FILE, 0);
+}
+
+static void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+}
+
+static void AssertSameAsHashFile(const char *path, size_t n_types)
+{
+    unsigned char digests[NUM_TYPES][EVP_MAX_MD_SIZE + 1];
+    assert_true(HashFileMulti(path, TYPES, n_types, digests));
+
+    for (size_t i = 0; i < n_types; i++)
+    {
+        unsigned char digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+        HashFile(path, digest, TYPES[i], false);
+        assert_true(HashesMatch(digests[i], digest, TYPES[i]));
+    }
+}
+
+static void test_hash_file_multi(void)
+{
+    AssertSameAsHashFile(SMALL_FILE, 1);
+    AssertSameAsHashFile(SMALL_FILE, NUM_TYPES);
+    AssertSameAsHashFile(EMPTY_FILE, NUM_TYPES);
+}
+
+static void test_hash_file_multi_parallel(void)
+{
+    AssertSameAsHashFile(BIG_FILE, 1);
+    AssertSameAsHashFile(BIG_FILE, 2);
+    AssertSameAsHashFile(BIG_FILE, NUM_TYPES);
+}
+
+static void test_hash_file_multi_error(void)
+{
+    char path[CF_BUFSIZE];
+    xsnprintf(path, sizeof(path), "%s/nonexisting", CFWORKDIR);
+
+    unsigned char digests[NUM_TYPES][EVP_MAX_MD_SIZE + 1];
+    assert_false(HashFileMulti(path, TYPES, NUM_TYPES, digests));
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    tests_setup();
+
+    const UnitTest tests[] =
+        {
+            unit_test(test_hash_file_multi),
+            unit_test(test_hash_file_multi_parallel),
+            unit_test(test_hash_file_multi_error),
+        };
+
+    int ret = run_tests(tests);
+
+    tests_teardown();
+
+    return ret;
+}
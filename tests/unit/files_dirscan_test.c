@@ -0,0 +1,223 @@
+#include <test.h>
+
+#include <cf3.defs.h>
+#include <files_dirscan.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+
+
+#define NUM_SUBDIRS 20
+
+char CFWORKDIR[CF_BUFSIZE];
+
+static void tests_setup(void)
+{
+    xsnprintf(CFWORKDIR, CF_BUFSIZE, "/tmp/files_dirscan_test.XXXXXX");
+    mkdtemp(CFWORKDIR);
+
+    char path[CF_BUFSIZE];
+    for (int i = 0; i < NUM_SUBDIRS; i++)
+    {
+        xsnprintf(path, sizeof(path), "%s/dir%d", CFWORKDIR, i);
+        mkdir(path, 0700);
+        xsnprintf(path, sizeof(path), "%s/dir%d/file", CFWORKDIR, i);
+        FILE *fp = fopen(path, "w");
+        fclose(fp);
+    }
+    xsnprintf(path, sizeof(path), "%s/file", CFWORKDIR);
+    FILE *fp = fopen(path, "w");
+    fclose(fp);
+    xsnprintf(path, sizeof(path), "%s/link", CFWORKDIR);
+    symlink("dir0", path);
+}
+
+static void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+}
+
+static const DirScanEntry *FindEntry(const DirScan *dir, const char *name)
+{
+    for (size_t i = 0; i < DirScanLength(dir); i++)
+    {
+        const DirScanEntry *entry = DirScanAt(dir, i);
+        if (strcmp(entry->name, name) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void test_open(void)
+{
+    DirScan *dir = DirScanOpen(CFWORKDIR);
+    assert_true(dir != NULL);
+
+    /* subdirectories, file, link, "." and ".." */
+    assert_int_equal(DirScanLength(dir), NUM_SUBDIRS + 4);
+    assert_true(FindEntry(dir, "dir3") != NULL);
+    assert_true(FindEntry(dir, "nosuchentry") == NULL);
+
+    struct stat sb, lsb;
+    assert_int_equal(stat(CFWORKDIR, &sb), 0);
+    assert_true(DirScanIsDirectory(dir, &sb));
+
+    assert_int_equal(DirScanStat(dir, "link", &lsb, false), 0);
+    assert_true(S_ISLNK(lsb.st_mode));
+    assert_int_equal(DirScanStat(dir, "link", &lsb, true), 0);
+    assert_true(S_ISDIR(lsb.st_mode));
+    assert_int_equal(DirScanStat(dir, "nosuchentry", &lsb, false), -1);
+
+    DirScan *subdir = DirScanOpenAt(dir, "dir1", false, false);
+    assert_true(subdir != NULL);
+    assert_int_equal(DirScanLength(subdir), 3);
+    assert_int_equal(DirScanStat(dir, "dir1", &sb, false), 0);
+    assert_true(DirScanIsDirectory(subdir, &sb));
+    assert_false(DirScanIsDirectory(dir, &sb));
+    DirScanClose(subdir);
+
+    /* Links to directories are only opened when following them */
+    assert_true(DirScanOpenAt(dir, "link", false, false) == NULL);
+    assert_true(DirScanOpenAt(dir, "file", false, false) == NULL);
+    subdir = DirScanOpenAt(dir, "link", true, true);
+    assert_true(subdir != NULL);
+    assert_false(FindEntry(subdir, "file")->dir);
+    DirScanClose(subdir);
+
+    DirScanClose(dir);
+}
+
+static void test_entry_types(void)
+{
+    DirScan *dir = DirScanOpen(CFWORKDIR);
+    assert_true(dir != NULL);
+
+    /* The type from readdir() is optional, but right if it is there */
+    for (size_t i = 0; i < DirScanLength(dir); i++)
+    {
+        const DirScanEntry *entry = DirScanAt(dir, i);
+        struct stat lsb;
+        assert_int_equal(DirScanStat(dir, entry->name, &lsb, false), 0);
+        if (entry->type != 0)
+        {
+            assert_int_equal(entry->type, lsb.st_mode & S_IFMT);
+            assert_int_equal(entry->dir, S_ISDIR(lsb.st_mode));
+        }
+    }
+
+    DirScanClose(dir);
+}
+
+static void test_read_ahead(void)
+{
+    DirScan *top = DirScanOpen("/");
+    assert_true(top != NULL);
+    DirScan *dir = DirScanOpenAt(top, CFWORKDIR + 1, false, true);
+    DirScanClose(top);
+    assert_true(dir != NULL);
+
+    assert_true(FindEntry(dir, "dir0")->dir);
+    assert_false(FindEntry(dir, "file")->dir);
+    assert_false(FindEntry(dir, "link")->dir);
+
+    /* All the entries were stat'ed, even if readdir() gave their type */
+    for (size_t i = 0; i < DirScanLength(dir); i++)
+    {
+        assert_true(DirScanAt(dir, i)->have_lsb);
+    }
+    const DirScanEntry *file = FindEntry(dir, "file");
+    struct stat sb;
+    assert_int_equal(DirScanEntryStat(dir, file, &sb, false), 0);
+    assert_true(S_ISREG(sb.st_mode));
+    assert_int_equal(sb.st_ino, file->lsb.st_ino);
+
+    /* Links were not followed, stat() is done when asked for */
+    const DirScanEntry *link = FindEntry(dir, "link");
+    assert_false(link->have_sb);
+    assert_int_equal(DirScanEntryStat(dir, link, &sb, false), 0);
+    assert_true(S_ISLNK(sb.st_mode));
+    assert_int_equal(DirScanEntryStat(dir, link, &sb, true), 0);
+    assert_true(S_ISDIR(sb.st_mode));
+
+    DirScanPool *pool = DirScanPoolNew(4, false);
+    assert_true(pool != NULL);
+
+    DirScanRequest *requests[NUM_SUBDIRS];
+    size_t submitted = 0;
+    for (int i = 0; i < NUM_SUBDIRS; i++)
+    {
+        char name[64];
+        xsnprintf(name, sizeof(name), "dir%d", i);
+        requests[i] = DirScanPoolSubmit(pool, dir, name);
+        if (requests[i] != NULL)
+        {
+            submitted++;
+        }
+    }
+    /* The read ahead is limited, but some are always accepted */
+    assert_true(submitted > 0);
+    assert_true(submitted < NUM_SUBDIRS);
+
+    /* The parent doesn't have to be kept open */
+    DirScanClose(dir);
+
+    for (int i = 0; i < NUM_SUBDIRS; i++)
+    {
+        if (requests[i] == NULL)
+        {
+            continue;
+        }
+        if (i % 2 == 0)
+        {
+            DirScan *subdir = DirScanRequestTake(requests[i]);
+            assert_true(subdir != NULL);
+            assert_true(FindEntry(subdir, "file") != NULL);
+            DirScanClose(subdir);
+        }
+        else
+        {
+            DirScanRequestCancel(requests[i]);
+        }
+    }
+
+    DirScanPoolDestroy(pool);
+}
+
+static void test_read_ahead_error(void)
+{
+    DirScan *dir = DirScanOpen(CFWORKDIR);
+    assert_true(dir != NULL);
+
+    DirScanPool *pool = DirScanPoolNew(1, false);
+    assert_true(pool != NULL);
+
+    DirScanRequest *req = DirScanPoolSubmit(pool, dir, "nosuchentry");
+    assert_true(req != NULL);
+    assert_true(DirScanRequestTake(req) == NULL);
+    assert_int_equal(errno, ENOENT);
+
+    DirScanPoolDestroy(pool);
+    DirScanClose(dir);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    tests_setup();
+
+    const UnitTest tests[] =
+        {
+            unit_test(test_open),
+            unit_test(test_entry_types),
+            unit_test(test_read_ahead),
+            unit_test(test_read_ahead_error),
+        };
+
+    int ret = run_tests(tests);
+
+    tests_teardown();
+
+    return ret;
+}
@@ -0,0 +1,113 @@
+#include <test.h>
+
+#include <files_editline_batch.h>
+#include <item_lib.h>
+
+
+static Item *MakeLines(const char *const *lines, size_t n)
+{
+    Item *list = NULL;
+    for (size_t i = n; i > 0; i--)
+    {
+        PrependItem(&list, lines[i - 1], NULL);
+    }
+    return list;
+}
+
+static Item *Nth(Item *list, size_t n)
+{
+    while (n-- > 0)
+    {
+        list = list->next;
+    }
+    return list;
+}
+
+static void test_full_match(void)
+{
+    const char *const lines[] = { "abc", "bbb", "ccc", "b+", "xabc" };
+    Item *list = MakeLines(lines, 5);
+    EditLineBatch *batch = EditLineBatchNew(true);
+
+    assert_true(EditLineBatchAdd(batch, "a.*"));
+    assert_true(EditLineBatchAdd(batch, "b+"));
+    assert_true(EditLineBatchAdd(batch, "b+"));
+    assert_int_equal(EditLineBatchLength(batch), 2);
+
+    /* Not scanned yet */
+    assert_false(EditLineBatchHas(batch, "a.*"));
+
+    EditLineBatchScan(batch, list);
+    assert_true(EditLineBatchHas(batch, "a.*"));
+    assert_true(EditLineBatchHas(batch, "b+"));
+    assert_false(EditLineBatchHas(batch, "c+"));
+    assert_false(EditLineBatchHas(NULL, "a.*"));
+
+    assert_true(EditLineBatchMayMatch(batch, Nth(list, 0)));
+    assert_true(EditLineBatchMayMatch(batch, Nth(list, 1)));
+    assert_false(EditLineBatchMayMatch(batch, Nth(list, 2)));
+    /* Matched as a literal line, like FullTextMatch() does */
+    assert_true(EditLineBatchMayMatch(batch, Nth(list, 3)));
+    /* Only whole lines match */
+    assert_false(EditLineBatchMayMatch(batch, Nth(list, 4)));
+
+    EditLineBatchDestroy(batch);
+    DeleteItemList(list);
+}
+
+static void test_partial_match(void)
+{
+    const char *const lines[] = { "axb", "zzz", "y" };
+    Item *list = MakeLines(lines, 3);
+    EditLineBatch *batch = EditLineBatchNew(false);
+
+    assert_true(EditLineBatchAdd(batch, "x"));
+    assert_true(EditLineBatchAdd(batch, "^y$"));
+    EditLineBatchScan(batch, list);
+
+    assert_true(EditLineBatchMayMatch(batch, Nth(list, 0)));
+    assert_false(EditLineBatchMayMatch(batch, Nth(list, 1)));
+    assert_true(EditLineBatchMayMatch(batch, Nth(list, 2)));
+
+    /* A changed line has to be matched again */
+    Item *zzz = Nth(list, 1);
+    free(zzz->name);
+    zzz->name = xstrdup("zxz");
+    EditLineBatchLineChanged(batch, zzz);
+    assert_true(EditLineBatchMayMatch(batch, zzz));
+
+    EditLineBatchDestroy(batch);
+    DeleteItemList(list);
+}
+
+static void test_not_combined(void)
+{
+    EditLineBatch *batch = EditLineBatchNew(true);
+
+    /* Group references would refer to other groups in the combination */
+    assert_false(EditLineBatchAdd(batch, "(a)\\1"));
+    assert_false(EditLineBatchAdd(batch, "(a)(?1)"));
+    assert_false(EditLineBatchAdd(batch, "(?<n>a)\\k<n>"));
+    assert_false(EditLineBatchAdd(batch, "(*CR)a"));
+    /* Invalid */
+    assert_false(EditLineBatchAdd(batch, "(a"));
+
+    /* Escaped backslashes are fine */
+    assert_true(EditLineBatchAdd(batch, "a\\\\1"));
+    assert_int_equal(EditLineBatchLength(batch), 1);
+
+    EditLineBatchDestroy(batch);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+        {
+            unit_test(test_full_match),
+            unit_test(test_partial_match),
+            unit_test(test_not_combined),
+        };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,109 @@
+#include <test.h>
+
+#include <files_editline_index.h>
+#include <item_lib.h>
+
+
+static Item *MakeLines(const char *const *lines, size_t n)
+{
+    Item *list = NULL;
+    for (size_t i = n; i > 0; i--)
+    {
+        PrependItem(&list, lines[i - 1], NULL);
+    }
+    return list;
+}
+
+static Item *Nth(Item *list, size_t n)
+{
+    while (n-- > 0)
+    {
+        list = list->next;
+    }
+    return list;
+}
+
+static void test_region_contains(void)
+{
+    const char *const lines[] = { "a", "b", "c", "b", "d", "e" };
+    Item *list = MakeLines(lines, 6);
+    EditLineIndex *index = EditLineIndexNew();
+
+    assert_true(EditLineIndexRegionContains(index, list, list, NULL, "a"));
+    assert_true(EditLineIndexRegionContains(index, list, list, NULL, "e"));
+    assert_false(EditLineIndexRegionContains(index, list, list, NULL, "f"));
+
+    /* [c, e) */
+    Item *c = Nth(list, 2);
+    Item *e = Nth(list, 5);
+    assert_false(EditLineIndexRegionContains(index, list, c, e, "a"));
+    assert_true(EditLineIndexRegionContains(index, list, c, e, "b"));
+    assert_true(EditLineIndexRegionContains(index, list, c, e, "c"));
+    assert_true(EditLineIndexRegionContains(index, list, c, e, "d"));
+    assert_false(EditLineIndexRegionContains(index, list, c, e, "e"));
+
+    /* [e, end) */
+    assert_false(EditLineIndexRegionContains(index, list, e, NULL, "b"));
+    assert_true(EditLineIndexRegionContains(index, list, e, NULL, "e"));
+
+    EditLineIndexDestroy(index);
+    DeleteItemList(list);
+}
+
+static void test_previous_last(void)
+{
+    const char *const lines[] = { "x", "x", "y" };
+    Item *list = MakeLines(lines, 3);
+    EditLineIndex *index = EditLineIndexNew();
+
+    assert_true(EditLineIndexPrevious(index, list, list) == NULL);
+    assert_true(EditLineIndexPrevious(index, list, Nth(list, 1)) == list);
+    assert_true(EditLineIndexPrevious(index, list, Nth(list, 2)) == Nth(list, 1));
+    assert_true(EditLineIndexLast(index, list) == Nth(list, 2));
+    assert_true(EditLineIndexLast(index, NULL) == NULL);
+
+    EditLineIndexDestroy(index);
+    DeleteItemList(list);
+}
+
+static void test_invalidate(void)
+{
+    const char *const lines[] = { "one", "two", "three" };
+    Item *list = MakeLines(lines, 3);
+    EditLineIndex *index = EditLineIndexNew();
+
+    assert_false(EditLineIndexRegionContains(index, list, list, NULL, "four"));
+
+    Item *two = Nth(list, 1);
+    InsertAfter(&list, two, "four");
+    EditLineIndexInvalidate(index);
+    assert_true(EditLineIndexRegionContains(index, list, list, NULL, "four"));
+    assert_true(EditLineIndexLast(index, list) == Nth(list, 3));
+
+    /* A new first line is noticed even without invalidating */
+    PrependItem(&list, "zero", NULL);
+    assert_true(EditLineIndexPrevious(index, list, Nth(list, 1)) == list);
+    assert_true(EditLineIndexRegionContains(index, list, list, NULL, "zero"));
+
+    free(two->name);
+    two->name = xstrdup("TWO");
+    EditLineIndexInvalidate(index);
+    assert_false(EditLineIndexRegionContains(index, list, list, NULL, "two"));
+    assert_true(EditLineIndexRegionContains(index, list, list, NULL, "TWO"));
+
+    EditLineIndexDestroy(index);
+    DeleteItemList(list);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+        {
+            unit_test(test_region_contains),
+            unit_test(test_previous_last),
+            unit_test(test_invalidate),
+        };
+
+    return run_tests(tests);
+}
@@ -107,6 +107,56 @@ void test_file_read_invalid(void)
     assert_false(w);
 }
 
+void test_file_content_equals(void)
+{
+    assert_true(FileContentEquals(FILE_NAME, FILE_CONTENTS, FILE_SIZE, false));
+
+    /* Same size, differs at the end */
+    char *other = xstrdup(FILE_CONTENTS);
+    other[FILE_SIZE - 1] = 'x';
+    assert_false(FileContentEquals(FILE_NAME, other, FILE_SIZE, false));
+    free(other);
+
+    /* Prefix and different size */
+    assert_false(FileContentEquals(FILE_NAME, FILE_CONTENTS, FILE_SIZE - 1, false));
+
+    assert_true(FileContentEquals(FILE_NAME_EMPTY, "", 0, false));
+    assert_false(FileContentEquals(FILE_NAME_EMPTY, "x", 1, false));
+    assert_false(FileContentEquals("nonexisting file", "", 0, false));
+}
+
+static int CountFilesCallback(ARG_UNUSED const char *path, const struct stat *sb, void *user_data)
+{
+    assert_true(sb != NULL);
+    assert_false(S_ISDIR(sb->st_mode));
+    (*(int *) user_data)++;
+    return 0;
+}
+
+void test_traverse_directory_tree(void)
+{
+    char path[CF_BUFSIZE];
+    const char *const dirs[] = { "tree", "tree/sub", "tree/sub/subsub" };
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++)
+    {
+        xsnprintf(path, sizeof(path), "%s/%s", CFWORKDIR, dirs[i]);
+        assert_int_equal(mkdir(path, 0700), 0);
+    }
+
+    const char *const files[] = { "tree/file1", "tree/sub/file2", "tree/sub/subsub/file3" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    {
+        xsnprintf(path, sizeof(path), "%s/%s", CFWORKDIR, files[i]);
+        assert_true(FileWriteOver(path, FILE_CONTENTS));
+    }
+
+    /* Files in subdirectories are found, not just those of the top one */
+    int count = 0;
+    xsnprintf(path, sizeof(path), "%s/tree", CFWORKDIR);
+    assert_true(TraverseDirectoryTree(path, CountFilesCallback, &count));
+    assert_int_equal(count, 3);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -119,6 +169,8 @@ int main()
             unit_test(test_file_read_truncate),
             unit_test(test_file_read_empty),
             unit_test(test_file_read_invalid),
+            unit_test(test_file_content_equals),
+            unit_test(test_traverse_directory_tree),
         };
 
     int ret = run_tests(tests);
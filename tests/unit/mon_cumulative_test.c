@@ -0,0 +1,43 @@
+#include <test.h>
+
+#include <mon_cumulative.h>
+
+static void test_uint32(void)
+{
+    /* The first value is only stored */
+    assert_int_equal(GetInstantUint32Value("sda", "reads", 100, 1000), (unsigned) -1);
+    assert_int_equal(GetInstantUint32Value("sda", "reads", 400, 1010), 30);
+
+    /* Different counters don't interfere */
+    assert_int_equal(GetInstantUint32Value("sda", "writes", 10, 1010), (unsigned) -1);
+    assert_int_equal(GetInstantUint32Value("sdb", "reads", 10, 1010), (unsigned) -1);
+    assert_int_equal(GetInstantUint32Value("sda", "reads", 500, 1020), 10);
+
+    /* No time passed */
+    assert_int_equal(GetInstantUint32Value("sda", "reads", 600, 1020), (unsigned) -1);
+
+    /* Wraparound, on a counter not seen before */
+    assert_int_equal(GetInstantUint32Value("sdc", "writes", UINT32_MAX - 9, 1020), (unsigned) -1);
+    assert_int_equal(GetInstantUint32Value("sdc", "writes", 90, 1030), 10);
+}
+
+static void test_uint64(void)
+{
+    assert_true(GetInstantUint64Value("mem", "free", 1000, 1) == (unsigned long long) -1);
+    assert_true(GetInstantUint64Value("mem", "free", 3000, 3) == 1000);
+
+    assert_true(GetInstantUint64Value("swap", "resv", UINT64_MAX - 49, 1) == (unsigned long long) -1);
+    assert_true(GetInstantUint64Value("swap", "resv", 50, 2) == 100);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_uint32),
+        unit_test(test_uint64),
+    };
+
+    return run_tests(tests);
+}
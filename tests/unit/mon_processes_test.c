@@ -6,6 +6,7 @@
 #include <logging.h>                                   /* LogSetGlobalLevel */
 #include <misc_lib.h>                                          /* xsnprintf */
 #include <known_dirs.h>
+#include <sys/stat.h>
 
 char CFWORKDIR[CF_BUFSIZE];
 
@@ -130,6 +131,45 @@ void test_processes_monitor(void)
     assert_in_range((long long) cf_this[ob_users], lower, upper);
 }
 
+static char *ReadUsersFile(struct stat *sb)
+{
+    char filename[CF_BUFSIZE];
+    xsnprintf(filename, sizeof(filename), "%s/cf_users", GetStateDir());
+    assert_int_equal(stat(filename, sb), 0);
+
+    FILE *f = fopen(filename, "r");
+    assert_true(f != NULL);
+    char *contents = xcalloc(1, CF_BUFSIZE);
+    fread(contents, 1, CF_BUFSIZE - 1, f);
+    fclose(f);
+    return contents;
+}
+
+void test_users_file_not_rewritten(void)
+{
+    double cf_this[100] = { 0.0 };
+    MonProcessesGatherData(cf_this);
+
+    struct stat sb1;
+    char *users1 = ReadUsersFile(&sb1);
+    assert_true(users1[0] != '\0');
+
+    MonProcessesGatherData(cf_this);
+
+    struct stat sb2;
+    char *users2 = ReadUsersFile(&sb2);
+
+    /* The file is replaced (new inode) when written, users may come and go
+     * between the two samples though */
+    if (strcmp(users1, users2) == 0)
+    {
+        assert_int_equal(sb1.st_ino, sb2.st_ino);
+    }
+
+    free(users1);
+    free(users2);
+}
+
 int main()
 {
     LogSetGlobalLevel(LOG_LEVEL_DEBUG);
@@ -151,6 +191,7 @@ int main()
     const UnitTest tests[] =
     {
         unit_test(test_processes_monitor),
+        unit_test(test_users_file_not_rewritten),
     };
 
     int ret = run_tests(tests);
@@ -0,0 +1,79 @@
+#include <test.h>
+
+#include <mon_scheduler.h>
+
+static int FAST_RUNS = 0;
+static int SLOW_RUNS = 0;
+
+static void FastProbe(double *cf_this)
+{
+    FAST_RUNS++;
+    cf_this[ob_users] = FAST_RUNS;
+}
+
+static void SlowProbe(double *cf_this)
+{
+    SLOW_RUNS++;
+    cf_this[ob_rootprocs] = 42.0;
+}
+
+static void test_schedule(void)
+{
+    double cf_this[CF_OBSERVABLES];
+
+    MonProbeRegister("fast", &FastProbe, 60, MON_PROBE_COST_LOW);
+    MonProbeRegister("slow", &SlowProbe, 600, MON_PROBE_COST_LOW);
+    MonProbesStart();
+    const time_t start = time(NULL);
+
+    /* Everything runs the first time */
+    MonProbesRun(start);
+    assert_int_equal(FAST_RUNS, 1);
+    assert_int_equal(SLOW_RUNS, 1);
+
+    memset(cf_this, 0, sizeof(cf_this));
+    MonProbesCollect(cf_this);
+    assert_double_close(cf_this[ob_users], 1.0);
+    assert_double_close(cf_this[ob_rootprocs], 42.0);
+    assert_double_close(cf_this[ob_otherprocs], 0.0);
+    /* The spare slots are left alone */
+    assert_double_close(cf_this[CF_OBSERVABLES - 1], 0.0);
+
+    /* Nothing is due yet */
+    MonProbesRun(start + 30);
+    assert_int_equal(FAST_RUNS, 1);
+    assert_int_equal(SLOW_RUNS, 1);
+
+    /* Probes may run up to a wheel tick early */
+    MonProbesRun(start + 57);
+    assert_int_equal(FAST_RUNS, 2);
+    assert_int_equal(SLOW_RUNS, 1);
+
+    /* The values of the slow probe are still published */
+    memset(cf_this, 0, sizeof(cf_this));
+    MonProbesCollect(cf_this);
+    assert_double_close(cf_this[ob_users], 2.0);
+    assert_double_close(cf_this[ob_rootprocs], 42.0);
+
+    /* Skipping more than a whole round of the wheel */
+    MonProbesRun(start + 3600);
+    assert_int_equal(FAST_RUNS, 3);
+    assert_int_equal(SLOW_RUNS, 2);
+
+    MonProbesRun(start + 3600);
+    assert_int_equal(FAST_RUNS, 3);
+    assert_int_equal(SLOW_RUNS, 2);
+
+    MonProbesStop();
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_schedule),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,364 @@
+#include <test.h>
+
+#include <mon_stats.h>
+#include <math.h>
+
+/* The anomaly statistics as cf-monitord computed them before they were moved
+ * to mon_stats.c, to check that the same classes come out. */
+
+#define REF_FORGETRATE 0.6
+
+static double RefWAverage(double new_val, double old_val, double age)
+{
+    const double cf_sane_monitor_limit = 9999999.0;
+    double average, weight_new, weight_old;
+
+    const bool old_bad = (old_val > cf_sane_monitor_limit);
+    const bool new_bad = (new_val > cf_sane_monitor_limit);
+    if (old_bad && new_bad)
+    {
+        return 0.0;
+    }
+    else if (old_bad)
+    {
+        return new_val;
+    }
+    else if (new_bad)
+    {
+        return old_val;
+    }
+
+    if (age < 2.0)
+    {
+        weight_new = REF_FORGETRATE;
+        weight_old = (1.0 - REF_FORGETRATE);
+    }
+    else
+    {
+        weight_new = (1.0 - REF_FORGETRATE);
+        weight_old = REF_FORGETRATE;
+    }
+
+    if ((old_val == 0) && (new_val == 0))
+    {
+        return 0.0;
+    }
+
+    average = (weight_new * new_val + weight_old * old_val);
+
+    if (average < 0)
+    {
+        return 0.0;
+    }
+
+    return average;
+}
+
+static double RefRejectAnomaly(double new, double average, double variance,
+                               double localav, double localvar, double draw)
+{
+    double dev = sqrt(variance + localvar);
+    double delta;
+    int bigger;
+
+    if (average == 0)
+    {
+        return new;
+    }
+
+    if (new > MON_THRESHOLD_HIGH * 4.0)
+    {
+        return 0.0;
+    }
+
+    if (new > MON_THRESHOLD_HIGH)
+    {
+        return average;
+    }
+
+    if ((new - average) * (new - average) < MON_NOISE_THRESHOLD * MON_NOISE_THRESHOLD)
+    {
+        return new;
+    }
+
+    bigger = (new - average > 0);
+
+    delta = sqrt((new - average) * (new - average) + (new - localav) * (new - localav));
+
+    if (delta > 4.0 * dev)
+    {
+        if (draw < 0.7)
+        {
+            return new;
+        }
+        else
+        {
+            return bigger ? (average + 2.0 * dev) : (average - 2.0 * dev);
+        }
+    }
+
+    return new;
+}
+
+/* Class suffixes (space separated) set by the old SetClasses() */
+static void RefSetClasses(double variable, double av_expect, double av_var,
+                          double localav_expect, double localav_var,
+                          char *classes, size_t size, double *sig_out)
+{
+    char buffer[256];
+    double dev, delta, sigma, ldelta, lsigma, sig;
+
+    delta = variable - av_expect;
+    sigma = sqrt(av_var);
+    ldelta = variable - localav_expect;
+    lsigma = sqrt(localav_var);
+    sig = sqrt(sigma * sigma + lsigma * lsigma);
+    *sig_out = sig;
+    classes[0] = '\0';
+
+    if ((sigma == 0.0) || (lsigma == 0.0))
+    {
+        return;
+    }
+
+    if ((delta > 0) && (ldelta > 0))
+    {
+        strcpy(buffer, "_high");
+    }
+    else if ((delta < 0) && (ldelta < 0))
+    {
+        strcpy(buffer, "_low");
+    }
+    else
+    {
+        strcpy(buffer, "_normal");
+    }
+
+    dev = sqrt(delta * delta / (1.0 + sigma * sigma) + ldelta * ldelta / (1.0 + lsigma * lsigma));
+
+    if (fabs(delta) < MON_NOISE_THRESHOLD)
+    {
+        snprintf(classes, size, "%s", buffer);
+        if (dev > 2.0 * sqrt(2.0))
+        {
+            snprintf(classes, size, "%s %s_microanomaly", buffer, buffer);
+        }
+        return;
+    }
+
+    snprintf(classes, size, "%s%s", buffer, (dev <= sqrt(2.0)) ? "_normal" : "_dev1");
+    if (dev > 2.0 * sqrt(2.0))
+    {
+        size_t len = strlen(classes);
+        snprintf(classes + len, size - len, " %s_dev2", buffer);
+    }
+    if (dev > 3.0 * sqrt(2.0))
+    {
+        size_t len = strlen(classes);
+        snprintf(classes + len, size - len, " %s_anomaly", buffer);
+    }
+}
+
+/* Class suffixes for the given classification, the same ones SetClasses() in
+ * env_monitor.c sets */
+static void ClassSuffixes(const MonStatsClass *class, char *classes, size_t size)
+{
+    const char *dir = MonStatsDirectionToString(class->direction);
+
+    switch (class->level)
+    {
+    case MON_STATS_LEVEL_NONE:
+        classes[0] = '\0';
+        break;
+    case MON_STATS_LEVEL_NOISE:
+        snprintf(classes, size, "_%s", dir);
+        break;
+    case MON_STATS_LEVEL_MICROANOMALY:
+        snprintf(classes, size, "_%s _%s_microanomaly", dir, dir);
+        break;
+    case MON_STATS_LEVEL_NORMAL:
+        snprintf(classes, size, "_%s_normal", dir);
+        break;
+    case MON_STATS_LEVEL_DEV1:
+        snprintf(classes, size, "_%s_dev1", dir);
+        break;
+    case MON_STATS_LEVEL_DEV2:
+        snprintf(classes, size, "_%s_dev1 _%s_dev2", dir, dir);
+        break;
+    case MON_STATS_LEVEL_ANOMALY:
+        snprintf(classes, size, "_%s_dev1 _%s_dev2 _%s_anomaly", dir, dir, dir);
+        break;
+    }
+}
+
+/* Values spanning all the interesting ranges: zeros, noise, big jumps,
+ * values over the thresholds */
+static double RandomValue(void)
+{
+    switch (rand() % 6)
+    {
+    case 0:
+        return 0.0;
+    case 1:
+        return (double) (rand() % 10);
+    case 2:
+        return (double) (rand() % 100) / 7.0;
+    case 3:
+        return (double) (rand() % 10000);
+    case 4:
+        return (double) (rand() % 100) * 1000.0;
+    default:
+        return (double) (rand() % 10) * MON_THRESHOLD_HIGH;
+    }
+}
+
+static void test_waverage(void)
+{
+    for (int i = 0; i < 100000; i++)
+    {
+        const double new_val = RandomValue();
+        const double old_val = RandomValue();
+        const double age = (double) (rand() % 5);
+
+        assert_true(MonStatsWAverage(new_val, old_val, age, REF_FORGETRATE) ==
+                    RefWAverage(new_val, old_val, age));
+    }
+
+    /* Corrupted values are ignored */
+    assert_true(MonStatsWAverage(1e8, 10.0, 3.0, REF_FORGETRATE) == 10.0);
+    assert_true(MonStatsWAverage(10.0, 1e8, 3.0, REF_FORGETRATE) == 10.0);
+    assert_true(MonStatsWAverage(1e8, 1e8, 3.0, REF_FORGETRATE) == 0.0);
+}
+
+static void test_reject_anomaly(void)
+{
+    for (int i = 0; i < 100000; i++)
+    {
+        const double new_val = RandomValue();
+        const double average = RandomValue();
+        const double variance = RandomValue();
+        const double localav = RandomValue();
+        const double localvar = RandomValue();
+        const double draw = (double) (rand() % 10) / 10.0;
+
+        assert_true(MonStatsRejectAnomaly(new_val, average, variance, localav, localvar, draw) ==
+                    RefRejectAnomaly(new_val, average, variance, localav, localvar, draw));
+    }
+}
+
+/* Run the statistics over a couple of cycles and compare the averages and
+ * classes with the old per-observable code */
+static void test_update_and_classify(void)
+{
+    MonStats stats;
+    MonStatsInit(&stats);
+
+    Averages ref_local;
+    Averages slot;
+    for (int i = 0; i < CF_OBSERVABLES; i++)
+    {
+        ref_local.Q[i] = QDefinite(0.0);
+        slot.Q[i] = QDefinite(0.0);
+    }
+
+    for (long iter = 0; iter < 200; iter++)
+    {
+        double cf_this[CF_OBSERVABLES];
+        for (int i = 0; i < CF_OBSERVABLES; i++)
+        {
+            cf_this[i] = RandomValue();
+        }
+        const double wage = (double) iter / 50.0;
+        const double draw = (double) (rand() % 10) / 10.0;
+
+        Averages ref_slot = slot;
+        Averages ref_new;
+        for (int i = 0; i < CF_OBSERVABLES; i++)
+        {
+            const double this = RefRejectAnomaly(cf_this[i], ref_slot.Q[i].expect, ref_slot.Q[i].var,
+                                                 ref_local.Q[i].expect, ref_local.Q[i].var, draw);
+            ref_new.Q[i].q = this;
+            ref_local.Q[i].q = this;
+            ref_new.Q[i].expect = RefWAverage(this, ref_slot.Q[i].expect, wage);
+            ref_local.Q[i].expect = RefWAverage(ref_new.Q[i].expect, ref_local.Q[i].expect, iter);
+
+            const double delta2 = (this - ref_slot.Q[i].expect) * (this - ref_slot.Q[i].expect);
+            if (ref_slot.Q[i].var > delta2 * 2.0)
+            {
+                ref_new.Q[i].var = delta2;
+            }
+            else
+            {
+                ref_new.Q[i].var = RefWAverage(delta2, ref_slot.Q[i].var, wage);
+            }
+            ref_local.Q[i].var = RefWAverage(ref_new.Q[i].var, ref_local.Q[i].var, iter);
+        }
+
+        Averages newvals;
+        MonStatsUpdate(&stats, cf_this, 1000 + iter, &slot, &newvals,
+                       wage, iter, REF_FORGETRATE, draw);
+        assert_int_equal(newvals.last_seen, 1000 + iter);
+
+        MonStatsClass classes[CF_OBSERVABLES];
+        MonStatsClassify(&stats, cf_this, &newvals, classes);
+
+        for (int i = 0; i < CF_OBSERVABLES; i++)
+        {
+            assert_true(newvals.Q[i].q == ref_new.Q[i].q);
+            assert_true(newvals.Q[i].expect == ref_new.Q[i].expect);
+            assert_true(newvals.Q[i].var == ref_new.Q[i].var);
+            assert_true(stats.local.Q[i].expect == ref_local.Q[i].expect);
+            assert_true(stats.local.Q[i].var == ref_local.Q[i].var);
+
+            char expected[256], actual[256];
+            double sig;
+            RefSetClasses(cf_this[i], ref_new.Q[i].expect, ref_new.Q[i].var,
+                          ref_local.Q[i].expect, ref_local.Q[i].var,
+                          expected, sizeof(expected), &sig);
+            ClassSuffixes(&classes[i], actual, sizeof(actual));
+
+            assert_string_equal(actual, expected);
+            assert_true(classes[i].sigma == sig);
+        }
+
+        /* The next cycle works with the new averages */
+        slot = newvals;
+    }
+}
+
+static void test_gradient(void)
+{
+    MonStats stats;
+    MonStatsInit(&stats);
+
+    Averages slot, newvals;
+    memset(&slot, 0, sizeof(slot));
+
+    double cf_this[CF_OBSERVABLES] = { 0.0 };
+    cf_this[0] = 10.0;
+    MonStatsUpdate(&stats, cf_this, 1, &slot, &newvals, 0.0, 0, REF_FORGETRATE, 0.0);
+    assert_true(newvals.Q[0].dq == 0.0);
+
+    /* The gradient is relative to the previous cycle */
+    slot = newvals;
+    cf_this[0] = 12.0;
+    MonStatsUpdate(&stats, cf_this, 2, &slot, &newvals, 0.0, 1, REF_FORGETRATE, 0.0);
+    assert_true(newvals.Q[0].dq == 2.0);
+    assert_true(stats.local.Q[0].dq == 2.0);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    srand(42);
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_waverage),
+        unit_test(test_reject_anomaly),
+        unit_test(test_update_and_classify),
+        unit_test(test_gradient),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,116 @@
+#include <test.h>
+
+#include <mustache_template.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+
+
+static char TEMPLATE_DIR[] = "/tmp/mustache_template_test.XXXXXX";
+static char TEMPLATE_FILE[PATH_MAX];
+
+static void WriteTemplate(const char *path, const char *text)
+{
+    FILE *f = fopen(path, "w");
+    assert_true(f != NULL);
+    assert_int_equal(fwrite(text, 1, strlen(text), f), strlen(text));
+    assert_int_equal(fclose(f), 0);
+}
+
+static void test_refs(void)
+{
+    MustacheTemplateRefs *refs = MustacheTemplateRefsNew(
+        "{{vars.sys.fqhost}} {{#classes.linux}}{{{ vars.ns:b.list }}}{{/classes.linux}}"
+        "{{! vars.ignored.comment }}{{#vars.b.d}}{{@}}={{.}} {{vars.b.x.y}}{{/vars.b.d}}"
+        "{{%vars.whole}} {{name}} {{^classes.other}}none{{/classes.other}}");
+
+    assert_false(refs->all);
+    assert_false(refs->all_classes);
+    assert_true(StringSetContains(refs->classes, "linux"));
+    assert_true(StringSetContains(refs->classes, "other"));
+    assert_int_equal(StringSetSize(refs->classes), 2);
+    assert_true(StringSetContains(refs->vars, "sys.fqhost"));
+    assert_true(StringSetContains(refs->vars, "ns:b.list"));
+    assert_true(StringSetContains(refs->vars, "b.d"));
+    assert_true(StringSetContains(refs->vars, "b.x"));
+    assert_int_equal(StringSetSize(refs->vars), 4);
+    assert_true(StringSetContains(refs->bundles, "whole"));
+    assert_int_equal(StringSetSize(refs->bundles), 1);
+    assert_true(StringSetContains(refs->scopes, "b"));
+    assert_true(StringSetContains(refs->scopes, "sys"));
+    assert_true(StringSetContains(refs->scopes, "whole"));
+    assert_false(StringSetContains(refs->scopes, "ignored"));
+    MustacheTemplateRefsDestroy(refs);
+
+    /* Everything is needed for these */
+    refs = MustacheTemplateRefsNew("{{%-top-}}");
+    assert_true(refs->all);
+    MustacheTemplateRefsDestroy(refs);
+
+    refs = MustacheTemplateRefsNew("{{#vars}}{{/vars}}");
+    assert_true(refs->all);
+    MustacheTemplateRefsDestroy(refs);
+
+    refs = MustacheTemplateRefsNew("{{=<% %>=}}<%vars.b.x%>");
+    assert_true(refs->all);
+    MustacheTemplateRefsDestroy(refs);
+
+    refs = MustacheTemplateRefsNew("{{#classes}}{{@}}{{/classes}}");
+    assert_false(refs->all);
+    assert_true(refs->all_classes);
+    MustacheTemplateRefsDestroy(refs);
+}
+
+static void test_load(void)
+{
+    WriteTemplate(TEMPLATE_FILE, "Hello {{vars.b.x}}");
+
+    const MustacheTemplate *template = MustacheTemplateLoad(TEMPLATE_FILE);
+    assert_true(template != NULL);
+    assert_string_equal(template->text, "Hello {{vars.b.x}}");
+    assert_int_equal(template->length, strlen("Hello {{vars.b.x}}"));
+    assert_true(StringSetContains(template->refs->vars, "b.x"));
+
+    /* Not read again while the file stays the same */
+    assert_true(MustacheTemplateLoad(TEMPLATE_FILE) == template);
+
+    /* Replaced file */
+    char new_file[PATH_MAX];
+    xsnprintf(new_file, sizeof(new_file), "%s/new.mustache", TEMPLATE_DIR);
+    WriteTemplate(new_file, "Bye {{vars.b.y}}");
+    assert_int_equal(rename(new_file, TEMPLATE_FILE), 0);
+
+    template = MustacheTemplateLoad(TEMPLATE_FILE);
+    assert_true(template != NULL);
+    assert_string_equal(template->text, "Bye {{vars.b.y}}");
+    assert_true(StringSetContains(template->refs->vars, "b.y"));
+    assert_false(StringSetContains(template->refs->vars, "b.x"));
+
+    /* Changed in place */
+    WriteTemplate(TEMPLATE_FILE, "Bye again {{vars.b.y}}");
+    template = MustacheTemplateLoad(TEMPLATE_FILE);
+    assert_true(template != NULL);
+    assert_string_equal(template->text, "Bye again {{vars.b.y}}");
+
+    unlink(TEMPLATE_FILE);
+    assert_true(MustacheTemplateLoad(TEMPLATE_FILE) == NULL);
+
+    MustacheTemplateCacheClear();
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+
+    assert_true(mkdtemp(TEMPLATE_DIR) != NULL);
+    xsnprintf(TEMPLATE_FILE, sizeof(TEMPLATE_FILE), "%s/test.mustache", TEMPLATE_DIR);
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_refs),
+        unit_test(test_load),
+    };
+
+    int ret = run_tests(tests);
+
+    rmdir(TEMPLATE_DIR);
+    return ret;
+}
@@ -0,0 +1,151 @@
+#include <test.h>
+
+#include <sys/stat.h>
+#include <net_sockets.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+
+static char PROCDIR[] = "/tmp/net_sockets_test.XXXXXX";
+
+#define MAX_SOCKETS 8
+
+typedef struct
+{
+    size_t count;
+    NetSocket sockets[MAX_SOCKETS];
+} Collected;
+
+static void Collect(const NetSocket *sock, void *data)
+{
+    Collected *collected = data;
+    assert_true(collected->count < MAX_SOCKETS);
+    collected->sockets[collected->count++] = *sock;
+}
+
+static void Count(ARG_UNUSED const NetSocket *sock, void *data)
+{
+    (*(size_t *) data)++;
+}
+
+static void WriteProcNetFile(const char *name, const char *contents)
+{
+    char path[PATH_MAX];
+    xsnprintf(path, sizeof(path), "%s/proc/net/%s", PROCDIR, name);
+    FILE *f = fopen(path, "w");
+    assert_true(f != NULL);
+    fputs(contents, f);
+    fclose(f);
+}
+
+static void AssertAddress(const NetSocket *sock, bool local, const char *expected)
+{
+    char buf[INET6_ADDRSTRLEN];
+    NetSocketAddressToString(sock, local, buf, sizeof(buf));
+    assert_string_equal(buf, expected);
+}
+
+static void test_proc_net_tcp(void)
+{
+    WriteProcNetFile("tcp",
+        "  sl  local_address rem_address   st tx_queue rx_queue tr tm->when retrnsmt   uid  timeout inode\n"
+        "   0: 0100007F:0277 00000000:0000 0A 00000000:00000000 00:00000000 00000000     0        0 12827515 1 0000000000000000 100 0 0 10 0\n"
+        "   1: 3200A8C0:895C 0102A8C0:01BB 01 00000000:00000000 02:000005B6 00000000  1000        0 12849532 2 0000000000000000 20 4 30 10 -1\n"
+        "   2: garbage\n");
+
+    Collected collected = { 0 };
+    assert_true(NetSocketsForEach(PROCDIR, NET_SOCKET_TCP4, &Collect, &collected));
+    assert_int_equal(collected.count, 2);
+
+    const NetSocket *listen = &collected.sockets[0];
+    assert_int_equal(listen->type, NET_SOCKET_TCP4);
+    assert_int_equal(listen->state, NET_SOCKET_STATE_LISTEN);
+    assert_string_equal(NetSocketStateToString(listen->state), "LISTEN");
+    assert_int_equal(listen->local_port, 631);
+    assert_int_equal(listen->remote_port, 0);
+    AssertAddress(listen, true, "127.0.0.1");
+    AssertAddress(listen, false, "0.0.0.0");
+
+    const NetSocket *conn = &collected.sockets[1];
+    assert_int_equal(conn->state, NET_SOCKET_STATE_ESTABLISHED);
+    assert_int_equal(conn->local_port, 35164);
+    assert_int_equal(conn->remote_port, 443);
+    AssertAddress(conn, true, "192.168.0.50");
+    AssertAddress(conn, false, "192.168.2.1");
+}
+
+static void test_proc_net_tcp6(void)
+{
+    WriteProcNetFile("tcp6",
+        "  sl  local_address                         remote_address                        st tx_queue rx_queue tr tm->when retrnsmt   uid  timeout inode\n"
+        "   0: 00000000000000000000000001000000:0277 00000000000000000000000000000000:0000 0A 00000000:00000000 00:00000000 00000000     0        0 12827514 1 0000000000000000 100 0 0 10 0\n"
+        "   1: 0000000000000000FFFF00000100007F:B1DA 0000000000000000FFFF00000100007F:0016 06 00000000:00000000 03:00000AF3 00000000     0        0 0 3 0000000000000000\n");
+
+    Collected collected = { 0 };
+    assert_true(NetSocketsForEach(PROCDIR, NET_SOCKET_TCP6, &Collect, &collected));
+    assert_int_equal(collected.count, 2);
+
+    assert_int_equal(collected.sockets[0].type, NET_SOCKET_TCP6);
+    assert_int_equal(collected.sockets[0].local_port, 631);
+    AssertAddress(&collected.sockets[0], true, "::1");
+    AssertAddress(&collected.sockets[0], false, "::");
+
+    assert_int_equal(collected.sockets[1].state, NET_SOCKET_STATE_TIME_WAIT);
+    assert_int_equal(collected.sockets[1].remote_port, 22);
+    AssertAddress(&collected.sockets[1], true, "::ffff:127.0.0.1");
+}
+
+static void test_state_to_string(void)
+{
+    assert_string_equal(NetSocketStateToString(NET_SOCKET_STATE_SYN_RECV), "SYN_RECV");
+    /* TCP_NEW_SYN_RECV, reported by sock_diag for pending connections */
+    assert_string_equal(NetSocketStateToString(12), "SYN_RECV");
+    assert_string_equal(NetSocketStateToString(NET_SOCKET_STATE_CLOSING), "CLOSING");
+    assert_string_equal(NetSocketStateToString(13), "UNKNOWN");
+}
+
+static void test_proc_net_missing(void)
+{
+    /* e.g. IPv6 disabled in the kernel */
+    Collected collected = { 0 };
+    assert_false(NetSocketsForEach(PROCDIR, NET_SOCKET_UDP6, &Collect, &collected));
+    assert_int_equal(collected.count, 0);
+}
+
+static void test_real_sockets(void)
+{
+    /* Uses sock_diag (with fallback to /proc/net) on Linux, just make sure
+     * it doesn't fail */
+#ifdef __linux__
+    size_t count = 0;
+    assert_true(NetSocketsForEach("", NET_SOCKET_TCP4, &Count, &count) ||
+                access("/proc/net/tcp", R_OK) != 0);
+#endif
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+
+    assert_true(mkdtemp(PROCDIR) != NULL);
+    char path[PATH_MAX];
+    xsnprintf(path, sizeof(path), "%s/proc", PROCDIR);
+    mkdir(path, 0700);
+    xsnprintf(path, sizeof(path), "%s/proc/net", PROCDIR);
+    mkdir(path, 0700);
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_proc_net_tcp),
+        unit_test(test_proc_net_tcp6),
+        unit_test(test_state_to_string),
+        unit_test(test_proc_net_missing),
+        unit_test(test_real_sockets),
+    };
+
+    int ret = run_tests(tests);
+
+    char cmd[PATH_MAX + 16];
+    xsnprintf(cmd, sizeof(cmd), "rm -rf '%s'", PROCDIR);
+    system(cmd);
+
+    return ret;
+}
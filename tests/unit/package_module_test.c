@@ -0,0 +1,91 @@
+#include <test.h>
+
+#include <cf3.defs.h>
+#include <known_dirs.h>
+#include <rlist.h>
+#include <file_lib.h>
+
+#include <package_module.c>
+
+static void test_setup(void)
+{
+    static char env[] = /* Needs to be static for putenv() */
+        "CFENGINE_TEST_OVERRIDE_WORKDIR=/tmp/package_module_test.XXXXXX";
+
+    char *workdir = strchr(env, '=') + 1; /* start of the path */
+    assert(workdir - 1 && workdir[0] == '/');
+
+    mkdtemp(workdir);
+    putenv(env);
+    mkdir(GetStateDir(), (S_IRWXU | S_IRWXG | S_IRWXO));
+}
+
+static void test_update_packages_db(void)
+{
+    Rlist *data = NULL;
+    RlistAppendScalar(&data, "Name=foo");
+    RlistAppendScalar(&data, "Version=1.0");
+    RlistAppendScalar(&data, "Architecture=x86_64");
+    RlistAppendScalar(&data, "Name=bar");
+    RlistAppendScalar(&data, "Version=2.1");
+    RlistAppendScalar(&data, "Architecture=noarch");
+
+    assert_int_equal(UpdatePackagesDB(data, "test_module", UPDATE_TYPE_INSTALLED), 0);
+    RlistDestroy(data);
+
+    PackageModuleBody body = { .name = "test_module" };
+    PackageModuleWrapper wrapper = { .name = "test_module", .package_module = &body };
+
+    assert_int_equal(IsPackageInCache(NULL, &wrapper, "foo", "1.0", "x86_64"), 1);
+    assert_int_equal(IsPackageInCache(NULL, &wrapper, "bar", NULL, NULL), 1);
+    assert_int_equal(IsPackageInCache(NULL, &wrapper, "bar", "1.0", NULL), 0);
+    assert_int_equal(IsPackageInCache(NULL, &wrapper, "baz", NULL, NULL), 0);
+
+    /* Drop the in-memory cache, the lists have to be loaded from the DB */
+    PackagesCacheMapDestroy(INSTALLED_PACKAGES_CACHE);
+    INSTALLED_PACKAGES_CACHE = NULL;
+
+    assert_int_equal(IsPackageInCache(NULL, &wrapper, "foo", "1.0", "x86_64"), 1);
+    assert_int_equal(IsPackageInCache(NULL, &wrapper, "bar", "2.1", "noarch"), 1);
+    assert_int_equal(IsPackageInCache(NULL, &wrapper, "baz", NULL, NULL), 0);
+
+    const StringMap *cache = GetPackagesCache(dbid_packages_installed, "test_module");
+    assert_true(cache != NULL);
+    assert_string_equal(StringMapGet(cache, INVENTORY_KEY),
+                        "foo,1.0,x86_64\nbar,2.1,noarch\n");
+
+    /* The DB is replaced as a whole */
+    data = NULL;
+    RlistAppendScalar(&data, "Name=baz");
+    RlistAppendScalar(&data, "Version=3");
+    RlistAppendScalar(&data, "Architecture=noarch");
+    assert_int_equal(UpdatePackagesDB(data, "test_module", UPDATE_TYPE_INSTALLED), 0);
+    RlistDestroy(data);
+
+    PackagesCacheMapDestroy(INSTALLED_PACKAGES_CACHE);
+    INSTALLED_PACKAGES_CACHE = NULL;
+
+    assert_int_equal(IsPackageInCache(NULL, &wrapper, "foo", NULL, NULL), 0);
+    assert_int_equal(IsPackageInCache(NULL, &wrapper, "baz", "3", "noarch"), 1);
+}
+
+static void test_teardown(void)
+{
+    DeleteDirectoryTree(GetWorkDir());
+    rmdir(GetWorkDir());
+}
+
+int main()
+{
+    const UnitTest tests[] =
+        {
+            unit_test(test_setup),
+            unit_test(test_update_packages_db),
+            unit_test(test_teardown),
+        };
+
+    PRINT_TEST_BANNER();
+    int ret = run_tests(tests);
+
+    return ret;
+}
@@ -0,0 +1,120 @@
+#include <test.h>
+
+#include <cf3.defs.h>
+#include <processes_select.h>
+
+/* The native (/proc) process table has to have the same columns as the
+ * Linux ps legend and must contain this very process. */
+
+static void test_load_process_table_from_proc(void)
+{
+    char *names[CF_PROCCOLS];
+    char *legend = NULL;
+
+    Seq *entries = LoadProcessTableFromProc(names, &legend);
+    assert_true(entries != NULL);
+    assert_true(SeqLength(entries) > 0);
+    assert_true(legend != NULL);
+
+    assert_string_equal(names[0], "USER");
+    assert_string_equal(names[1], "PID");
+    assert_string_equal(names[2], "PPID");
+    assert_string_equal(names[14], "COMMAND");
+    assert_true(names[15] == NULL);
+
+    const pid_t self = getpid();
+    bool found = false;
+    for (size_t i = 0; i < SeqLength(entries); i++)
+    {
+        const ProcessTableEntry *entry = SeqAt(entries, i);
+        assert_true(entry->line != NULL);
+        if (entry->pid != self)
+        {
+            continue;
+        }
+
+        found = true;
+        assert_true(entry->have_values[0]);
+        assert_int_equal(entry->values[0], geteuid());
+        assert_true(entry->have_values[1]);
+        assert_int_equal(entry->values[1], self);
+        assert_true(entry->have_values[2]);
+        assert_int_equal(entry->values[2], getppid());
+        assert_true(strstr(entry->columns[14], "process_table_linux_test") != NULL);
+        assert_true(strstr(entry->line, entry->columns[14]) != NULL);
+    }
+    assert_true(found);
+
+    for (int i = 0; names[i] != NULL; i++)
+    {
+        free(names[i]);
+    }
+    free(legend);
+    SeqDestroy(entries);
+}
+
+static char *ARGV0 = NULL;
+
+static char *GetSelfCommand(void)
+{
+    char *names[CF_PROCCOLS];
+    char *legend = NULL;
+
+    Seq *entries = LoadProcessTableFromProc(names, &legend);
+    assert_true(entries != NULL);
+
+    char *command = NULL;
+    for (size_t i = 0; i < SeqLength(entries); i++)
+    {
+        const ProcessTableEntry *entry = SeqAt(entries, i);
+        if (entry->pid == getpid())
+        {
+            command = xstrdup(entry->columns[14]);
+        }
+    }
+
+    for (int i = 0; names[i] != NULL; i++)
+    {
+        free(names[i]);
+    }
+    free(legend);
+    SeqDestroy(entries);
+
+    assert_true(command != NULL);
+    return command;
+}
+
+static void test_changed_command_line(void)
+{
+    /* Like setproctitle(), the process stays the same otherwise */
+    char *before = GetSelfCommand();
+    assert_true(strstr(before, ARGV0) != NULL);
+
+    const size_t last = strlen(ARGV0) - 1;
+    const char orig = ARGV0[last];
+    ARGV0[last] = (orig == 'X') ? 'Y' : 'X';
+    char *changed = xstrdup(ARGV0);
+
+    char *after = GetSelfCommand();
+    assert_true(strstr(after, changed) != NULL);
+    assert_string_not_equal(after, before);
+
+    ARGV0[last] = orig;
+    free(changed);
+    free(after);
+    free(before);
+}
+
+int main(ARG_UNUSED int argc, char **argv)
+{
+    ARGV0 = argv[0];
+    PRINT_TEST_BANNER();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_load_process_table_from_proc),
+        unit_test(test_changed_command_line),
+    };
+
+    return run_tests(tests);
+}
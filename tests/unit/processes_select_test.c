@@ -0,0 +1,146 @@
+#include <test.h>
+
+#include <processes_select.c>
+
+/* A small process table in the Linux ps format. */
+static const char *TABLE[] = {
+    "USER       PID  PPID  PGID %CPU %MEM    VSZ  NI   RSS TT       NLWP STIME     ELAPSED     TIME COMMAND",
+    "root         1     0     1  0.0  0.1 169000   0 13000 ?           1 Sep02  4-03:40:00 00:00:09 /sbin/init",
+    "root       702     1   702  0.0  0.0  15000   0  7000 ?           1 Sep02  4-03:39:50 00:00:00 /usr/sbin/sshd -D",
+    "www-data  1201  1200  1200  0.5  0.2  55000   0 20000 ?           4 Sep02  4-03:39:00 00:01:30 nginx: worker process",
+    "alice     3140   702  3140  0.0  0.0   9000   0  5000 pts/0       1 Sep05  1-00:00:00 00:00:00 -bash",
+};
+
+static void setup(void)
+{
+    VPSHARDCLASS = PLATFORM_CONTEXT_LINUX;
+    CFSTARTTIME = 1410000000;          /* 2014-09-06 */
+    for (size_t i = 0; i < sizeof(TABLE) / sizeof(TABLE[0]); i++)
+    {
+        AppendItem(&PROCESSTABLE, TABLE[i], "");
+    }
+    PROCESS_TABLE_TIME = CFSTARTTIME;
+}
+
+static void teardown(void)
+{
+    ClearProcessTable();
+}
+
+static Item *Select(const char *process_regex, const ProcessSelect *a, bool attrselect)
+{
+    setup();
+    Item *result = SelectProcesses(process_regex, a, attrselect);
+    teardown();
+    return result;
+}
+
+static void test_select_promiser_only(void)
+{
+    ProcessSelect a = PROCESS_SELECT_INIT;
+    Item *result = Select("sshd", &a, false);
+    assert_int_equal(ListLen(result), 1);
+    assert_int_equal(result->counter, 702);
+    DeleteItemList(result);
+
+    result = Select("^nomatch$", &a, false);
+    assert_true(result == NULL);
+}
+
+static void test_select_default_result(void)
+{
+    /* Without process_result, any matching attribute selects the process */
+    ProcessSelect a = PROCESS_SELECT_INIT;
+    a.min_thread = 2;
+    a.max_thread = 10;
+    Item *result = Select(".*", &a, true);
+    assert_int_equal(ListLen(result), 1);
+    assert_int_equal(result->counter, 1201);
+    DeleteItemList(result);
+
+    /* No attributes, nothing selected */
+    ProcessSelect none = PROCESS_SELECT_INIT;
+    result = Select(".*", &none, true);
+    assert_true(result == NULL);
+}
+
+static void test_select_process_result(void)
+{
+    Rlist *owners = NULL;
+    RlistAppendScalar(&owners, "root");
+    RlistAppendScalar(&owners, "alice");
+
+    ProcessSelect a = PROCESS_SELECT_INIT;
+    a.owner = owners;
+    a.min_ppid = 1;
+    a.max_ppid = 1000;
+    a.min_ttime = 0;
+    a.max_ttime = 60;
+    a.command = "/usr/sbin/.*";
+    a.process_result = "process_owner.ppid.ttime.!command";
+
+    Item *result = Select(".*", &a, true);
+    assert_int_equal(ListLen(result), 1);
+    assert_int_equal(result->counter, 3140);
+    DeleteItemList(result);
+
+    a.process_result = "command|pid";
+    result = Select(".*", &a, true);
+    assert_int_equal(ListLen(result), 1);
+    assert_int_equal(result->counter, 702);
+    DeleteItemList(result);
+
+    a.process_result = "";
+    result = Select(".*", &a, true);
+    assert_true(result == NULL);
+
+    RlistDestroy(owners);
+}
+
+static void test_select_many_owners(void)
+{
+    /* More owners than columns, the last ones must not be dropped */
+    Rlist *owners = NULL;
+    for (int i = 0; i < 2 * CF_PROCCOLS; i++)
+    {
+        char owner[32];
+        xsnprintf(owner, sizeof(owner), "user%d", i);
+        RlistAppendScalar(&owners, owner);
+    }
+    RlistAppendScalar(&owners, "alice");
+
+    ProcessSelect a = PROCESS_SELECT_INIT;
+    a.owner = owners;
+    a.process_result = "process_owner";
+
+    Item *result = Select(".*", &a, true);
+    assert_int_equal(ListLen(result), 1);
+    assert_int_equal(result->counter, 3140);
+    DeleteItemList(result);
+
+    RlistDestroy(owners);
+}
+
+static void test_is_process_name_running(void)
+{
+    setup();
+    assert_true(IsProcessNameRunning(".*sshd.*"));
+    assert_false(IsProcessNameRunning("sshd"));
+    assert_true(IsProcessNameRunning("-bash"));
+    teardown();
+}
+
+int main(void)
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+        {
+            unit_test(test_select_promiser_only),
+            unit_test(test_select_default_result),
+            unit_test(test_select_process_result),
+            unit_test(test_select_many_owners),
+            unit_test(test_is_process_name_running),
+        };
+
+    return run_tests(tests);
+}
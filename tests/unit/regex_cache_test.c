@@ -0,0 +1,77 @@
+#include <test.h>
+
+#include <regex_cache.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+
+
+static void test_match(void)
+{
+    RegexCacheClear();
+
+    assert_true(RegexCacheMatchFull("[a-z]+[0-9]*", "abc123"));
+    assert_false(RegexCacheMatchFull("[a-z]+[0-9]*", "abc123 "));
+    assert_false(RegexCacheMatchFull("[a-z]+", "123"));
+    /* Same options as CompileRegex(): '.' matches newlines */
+    assert_true(RegexCacheMatchFull("a.*b", "a\nb"));
+
+    size_t hits, misses;
+    RegexCacheGetStats(&hits, &misses);
+    assert_int_equal(hits, 2);
+    assert_int_equal(misses, 2);
+}
+
+static void test_invalid(void)
+{
+    RegexCacheClear();
+
+    assert_true(RegexCacheGet("[a-z") == NULL);
+    assert_false(RegexCacheMatchFull("[a-z", "[a-z"));
+}
+
+static void test_reference(void)
+{
+    RegexCacheClear();
+
+    CachedRegex *first = RegexCacheGet("foo(bar)?");
+    assert_true(first != NULL);
+    CachedRegex *second = RegexCacheGet("foo(bar)?");
+    assert_true(first == second);
+    RegexCacheRelease(second);
+
+    int ovector[OVECCOUNT];
+    assert_int_equal(CachedRegexExec(first, "xfoobar", strlen("xfoobar"),
+                                     ovector, OVECCOUNT), 2);
+    assert_int_equal(ovector[0], 1);
+    assert_int_equal(ovector[3], 7);
+    assert_true(CachedRegexMatchFull(first, "foo"));
+    assert_false(CachedRegexMatchFull(first, "xfoo"));
+
+    /* Fill the cache many times over, the regex in use must survive. */
+    for (int i = 0; i < 1000; i++)
+    {
+        char pattern[64];
+        xsnprintf(pattern, sizeof(pattern), "pattern%d.*", i);
+        assert_true(RegexCacheMatchFull(pattern, pattern));
+    }
+    assert_true(CachedRegexMatchFull(first, "foobar"));
+
+    CachedRegex *again = RegexCacheGet("foo(bar)?");
+    assert_true(again == first);
+    RegexCacheRelease(again);
+    RegexCacheRelease(first);
+
+    RegexCacheClear();
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+        {
+            unit_test(test_match),
+            unit_test(test_invalid),
+            unit_test(test_reference),
+        };
+
+    return run_tests(tests);
+}
@@ -3,6 +3,7 @@
 #include <cf3.defs.h>
 #include <matching.h>
 #include <match_scope.h>
+#include <regex_cache.h>
 #include <eval_context.h>
 
 static void test_full_text_match(void)
@@ -43,6 +44,32 @@ static void test_block_text_match2(void)
     EvalContextDestroy(ctx);
 }
 
+static void test_block_text_match_cached(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    int start, end;
+
+    CachedRegex *crx = RegexCacheGet("[a-z]+");
+    assert_true(crx != NULL);
+
+    assert_true(BlockTextMatchCached(ctx, crx, "1234abcd6789", &start, &end));
+    assert_int_equal(start, 4);
+    assert_int_equal(end, 8);
+    assert_true(BlockTextMatchCached(ctx, crx, "xy", &start, &end));
+    assert_int_equal(start, 0);
+    assert_int_equal(end, 2);
+    assert_false(BlockTextMatchCached(ctx, crx, "1234", &start, &end));
+
+    assert_true(FullTextMatchCached(ctx, "[a-z]+", crx, "abcd"));
+    assert_false(FullTextMatchCached(ctx, "[a-z]+", crx, "abcd6789"));
+
+    RegexCacheRelease(crx);
+
+    /* An invalid regex never matches */
+    assert_false(BlockTextMatchCached(ctx, NULL, "1234", &start, &end));
+    EvalContextDestroy(ctx);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -52,6 +79,7 @@ int main()
         unit_test(test_full_text_match2),
         unit_test(test_block_text_match),
         unit_test(test_block_text_match2),
+        unit_test(test_block_text_match_cached),
     };
 
     return run_tests(tests);
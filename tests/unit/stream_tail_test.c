@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <test.h>
+#include <known_dirs.h>
+
+#include <cf3.defs.h>
+#include <item_lib.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+#include <stream_tail.h>
+
+
+char CFWORKDIR[CF_BUFSIZE];
+static char LOG_FILE[CF_BUFSIZE];
+
+void tests_setup(void)
+{
+    static char env[] = /* Needs to be static for putenv() */
+        "CFENGINE_TEST_OVERRIDE_WORKDIR=/tmp/stream_tail_test.XXXXXX";
+
+    char *workdir = strchr(env, '=') + 1; /* start of the path */
+    assert(workdir - 1 && workdir[0] == '/');
+
+    mkdtemp(workdir);
+    strlcpy(CFWORKDIR, workdir, CF_BUFSIZE);
+    putenv(env);
+    mkdir(GetStateDir(), (S_IRWXU | S_IRWXG | S_IRWXO));
+
+    xsnprintf(LOG_FILE, sizeof(LOG_FILE), "%s/app.log", CFWORKDIR);
+}
+
+void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+}
+
+static void WriteLog(const char *mode, const char *data)
+{
+    FILE *f = fopen(LOG_FILE, mode);
+    assert_true(f != NULL);
+    assert_true(fputs(data, f) >= 0);
+    fclose(f);
+}
+
+/* Read the new lines and check they are the expected ones (comma-separated) */
+static void AssertNewLines(StreamTail *tail, const char *expected)
+{
+    Item *lines = NULL;
+    assert_true(StreamTailRead(tail, &lines));
+
+    char buf[CF_BUFSIZE] = "";
+    for (const Item *ip = lines; ip != NULL; ip = ip->next)
+    {
+        strlcat(buf, ip->name, sizeof(buf));
+        if (ip->next != NULL)
+        {
+            strlcat(buf, ",", sizeof(buf));
+        }
+    }
+    assert_string_equal(buf, expected);
+    DeleteItemList(lines);
+}
+
+static void test_tail(void)
+{
+    WriteLog("w", "a\nb\npart");
+
+    StreamTail *tail = StreamTailNew(LOG_FILE, "test_tail");
+    AssertNewLines(tail, "a,b");
+    AssertNewLines(tail, "");
+
+    /* The incomplete line is only returned once it's complete */
+    WriteLog("a", "ial\nc\n");
+    AssertNewLines(tail, "partial,c");
+
+    /* copytruncate-style rotation */
+    WriteLog("w", "x\n");
+    AssertNewLines(tail, "x");
+
+    /* Rotation by renaming, the rest of the old file is read first */
+    char rotated[CF_BUFSIZE];
+    xsnprintf(rotated, sizeof(rotated), "%s.1", LOG_FILE);
+    assert_int_equal(rename(LOG_FILE, rotated), 0);
+    FILE *f = fopen(rotated, "a");
+    fputs("old\n", f);
+    fclose(f);
+    WriteLog("w", "new\n");
+    AssertNewLines(tail, "old,new");
+
+    StreamTailDestroy(tail);
+}
+
+static void test_checkpoint(void)
+{
+    WriteLog("w", "1\n2\n");
+
+    StreamTail *tail = StreamTailNew(LOG_FILE, "test_checkpoint");
+    AssertNewLines(tail, "1,2");
+    WriteLog("a", "3\n4");
+    AssertNewLines(tail, "3");
+
+    /* Not saved again too soon */
+    StreamTailCheckpoint(tail, 1000, false);
+    StreamTailCheckpoint(tail, 1000 + 60, false);
+    StreamTailDestroy(tail);
+
+    /* Continues from the checkpoint, including the incomplete line */
+    WriteLog("a", "\n5\n");
+    tail = StreamTailNew(LOG_FILE, "test_checkpoint");
+    AssertNewLines(tail, "4,5");
+
+    /* Forced checkpoint */
+    StreamTailCheckpoint(tail, 1000 + 120, true);
+    StreamTailDestroy(tail);
+
+    tail = StreamTailNew(LOG_FILE, "test_checkpoint");
+    AssertNewLines(tail, "");
+    StreamTailDestroy(tail);
+
+    /* A checkpoint for a different file is not used */
+    char replacement[CF_BUFSIZE];
+    xsnprintf(replacement, sizeof(replacement), "%s.new", LOG_FILE);
+    FILE *f = fopen(replacement, "w");
+    fputs("6\n7\n8\n9\n10\n", f);
+    fclose(f);
+    assert_int_equal(rename(replacement, LOG_FILE), 0);
+    tail = StreamTailNew(LOG_FILE, "test_checkpoint");
+    AssertNewLines(tail, "6,7,8,9,10");
+    StreamTailDestroy(tail);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    tests_setup();
+
+    const UnitTest tests[] =
+        {
+            unit_test(test_tail),
+            unit_test(test_checkpoint),
+        };
+
+    int ret = run_tests(tests);
+
+    tests_teardown();
+    return ret;
+}
@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <test.h>
+#include <known_dirs.h>
+
+#include <cf3.defs.h>
+#include <alloc.h>                                             /* xmemdup */
+#include <dbm_api.h>
+#include <misc_lib.h>                                          /* xsnprintf */
+#include <string_lib.h>                                        /* StringEqual */
+#include <time_series.h>
+
+
+char CFWORKDIR[CF_BUFSIZE];
+
+void tests_setup(void)
+{
+    static char env[] = /* Needs to be static for putenv() */
+        "CFENGINE_TEST_OVERRIDE_WORKDIR=/tmp/time_series_test.XXXXXX";
+
+    char *workdir = strchr(env, '=') + 1; /* start of the path */
+    assert(workdir - 1 && workdir[0] == '/');
+
+    mkdtemp(workdir);
+    strlcpy(CFWORKDIR, workdir, CF_BUFSIZE);
+    putenv(env);
+    mkdir(GetStateDir(), (S_IRWXU | S_IRWXG | S_IRWXO));
+}
+
+void tests_teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    xsnprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+}
+
+static void test_block_roundtrip(void)
+{
+    Buffer *block = TimeSeriesBlockNew();
+    const double values[] = { 0.0, 1.5, 1.5, -3.25, 1e10, 42.0, 42.0, 0.1 };
+    const size_t n = sizeof(values) / sizeof(values[0]);
+
+    time_t t = 1000000;
+    for (size_t i = 0; i < n; i++)
+    {
+        /* Irregular intervals */
+        t += (i % 3 == 0) ? 300 : 150;
+        assert_true(TimeSeriesBlockAppend(block, t, values[i]));
+    }
+
+    /* Only later points can be appended */
+    assert_false(TimeSeriesBlockAppend(block, t, 1.0));
+
+    size_t count;
+    TimeSeriesPoint *points = TimeSeriesBlockDecode(BufferData(block), BufferSize(block), &count);
+    assert_true(points != NULL);
+    assert_int_equal(count, n);
+
+    t = 1000000;
+    for (size_t i = 0; i < n; i++)
+    {
+        t += (i % 3 == 0) ? 300 : 150;
+        assert_int_equal(points[i].time, t);
+        assert_true(points[i].value == values[i]);
+    }
+    free(points);
+
+    /* Truncated blocks are detected */
+    assert_true(TimeSeriesBlockDecode(BufferData(block), BufferSize(block) - 1, &count) == NULL);
+    assert_true(TimeSeriesBlockDecode(BufferData(block), 4, &count) == NULL);
+
+    BufferDestroy(block);
+}
+
+static void test_block_compression(void)
+{
+    Buffer *block = TimeSeriesBlockNew();
+    for (int i = 0; i < 1000; i++)
+    {
+        assert_true(TimeSeriesBlockAppend(block, 1000000 + i * 300, 5.0));
+    }
+
+    /* Regular timestamps and a constant value take two bytes per point */
+    assert_true(BufferSize(block) <= sizeof(TimeSeriesBlockHeader) + 2 * 1000);
+    BufferDestroy(block);
+}
+
+static void test_parse_key(void)
+{
+    char *name;
+    TimeSeriesTier tier;
+    time_t start;
+
+    assert_true(TimeSeriesParseKey("cpu@0@1700000000", &name, &tier, &start));
+    assert_string_equal(name, "cpu");
+    assert_int_equal(tier, TIME_SERIES_TIER_RAW);
+    assert_int_equal(start, 1700000000);
+    free(name);
+
+    assert_true(TimeSeriesParseKey("a@b@1@604800", &name, &tier, &start));
+    assert_string_equal(name, "a@b");
+    assert_int_equal(tier, TIME_SERIES_TIER_HOURLY);
+    free(name);
+
+    assert_false(TimeSeriesParseKey("MIGRATED_HISTORY", &name, &tier, &start));
+    assert_false(TimeSeriesParseKey("cpu@5@1700000000", &name, &tier, &start));
+    assert_false(TimeSeriesParseKey("cpu@0@17x", &name, &tier, &start));
+    assert_false(TimeSeriesParseKey("@0@1", &name, &tier, &start));
+}
+
+static int PointTimeCompare(const void *a, const void *b, ARG_UNUSED void *data)
+{
+    const TimeSeriesPoint *const point_a = a;
+    const TimeSeriesPoint *const point_b = b;
+    return (point_a->time > point_b->time) - (point_a->time < point_b->time);
+}
+
+/* All the points of the given tier of the series #name */
+static Seq *GetPoints(CF_DB *db, const char *name, TimeSeriesTier tier)
+{
+    Seq *result = SeqNew(64, free);
+
+    CF_DBC *cursor;
+    assert_true(NewDBCursor(db, &cursor));
+
+    char *key;
+    void *value;
+    int key_size, value_size;
+    while (NextDB(cursor, &key, &key_size, &value, &value_size))
+    {
+        char *key_name;
+        TimeSeriesTier key_tier;
+        time_t start;
+        if (!TimeSeriesParseKey(key, &key_name, &key_tier, &start))
+        {
+            continue;
+        }
+        const bool match = (StringEqual(key_name, name) && key_tier == tier);
+        free(key_name);
+        if (!match)
+        {
+            continue;
+        }
+
+        size_t count;
+        TimeSeriesPoint *points = TimeSeriesBlockDecode(value, value_size, &count);
+        assert_true(points != NULL);
+        for (size_t i = 0; i < count; i++)
+        {
+            SeqAppend(result, xmemdup(&(points[i]), sizeof(TimeSeriesPoint)));
+        }
+        free(points);
+    }
+    DeleteDBCursor(cursor);
+
+    SeqSort(result, PointTimeCompare, NULL);
+    return result;
+}
+
+static void test_append(void)
+{
+    CF_DB *db;
+    assert_true(OpenDB(&db, dbid_timeseries));
+
+    /* The last two days, every 2.5 minutes */
+    const time_t now = time(NULL);
+    const time_t first = now - 2 * SECONDS_PER_DAY;
+    size_t expected = 0;
+    for (time_t t = first; t <= now; t += TIME_SERIES_RAW_RESOLUTION)
+    {
+        assert_true(TimeSeriesAppend(db, "load", t, 1.0));
+        expected++;
+    }
+
+    /* Samples within the resolution are dropped */
+    assert_true(TimeSeriesAppend(db, "load", now, 2.0));
+
+    Seq *points = GetPoints(db, "load", TIME_SERIES_TIER_RAW);
+    assert_int_equal(SeqLength(points), expected);
+    for (size_t i = 0; i < SeqLength(points); i++)
+    {
+        const TimeSeriesPoint *point = SeqAt(points, i);
+        assert_int_equal(point->time % TIME_SERIES_RAW_RESOLUTION, 0);
+        assert_true(point->value == 1.0);
+        if (i > 0)
+        {
+            const TimeSeriesPoint *prev = SeqAt(points, i - 1);
+            assert_true(point->time > prev->time);
+        }
+    }
+    SeqDestroy(points);
+
+    /* Other series are not affected */
+    points = GetPoints(db, "cpu", TIME_SERIES_TIER_RAW);
+    assert_int_equal(SeqLength(points), 0);
+    SeqDestroy(points);
+
+    /* Completed raw blocks were downsampled into the hourly tier */
+    points = GetPoints(db, "load", TIME_SERIES_TIER_HOURLY);
+    assert_true(SeqLength(points) > 24);
+    for (size_t i = 0; i < SeqLength(points); i++)
+    {
+        const TimeSeriesPoint *point = SeqAt(points, i);
+        assert_int_equal(point->time % SECONDS_PER_HOUR, 0);
+        assert_true(point->value == 1.0);
+    }
+    SeqDestroy(points);
+
+    CloseDB(db);
+}
+
+static void test_prune(void)
+{
+    CF_DB *db;
+    assert_true(OpenDB(&db, dbid_timeseries));
+
+    const time_t now = time(NULL);
+    assert_true(TimeSeriesAppendToTier(db, "old", TIME_SERIES_TIER_RAW, now - 30 * SECONDS_PER_DAY, 1.0));
+    assert_true(TimeSeriesAppendToTier(db, "old", TIME_SERIES_TIER_HOURLY, now - 30 * SECONDS_PER_DAY, 1.0));
+    assert_true(TimeSeriesAppendToTier(db, "old", TIME_SERIES_TIER_HOURLY, now - 4 * SECONDS_PER_YEAR, 1.0));
+    assert_true(WriteDB(db, "MIGRATED_HISTORY", &now, sizeof(now)));
+
+    /* The old raw block and the hourly block from 4 years ago */
+    assert_int_equal(TimeSeriesPrune(db, now), 2);
+    assert_int_equal(TimeSeriesPrune(db, now), 0);
+    assert_true(HasKeyDB(db, "MIGRATED_HISTORY", sizeof("MIGRATED_HISTORY")));
+
+    Seq *points = GetPoints(db, "old", TIME_SERIES_TIER_RAW);
+    assert_int_equal(SeqLength(points), 0);
+    SeqDestroy(points);
+    points = GetPoints(db, "old", TIME_SERIES_TIER_HOURLY);
+    assert_int_equal(SeqLength(points), 1);
+    SeqDestroy(points);
+
+    CloseDB(db);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    tests_setup();
+
+    const UnitTest tests[] =
+        {
+            unit_test(test_block_roundtrip),
+            unit_test(test_block_compression),
+            unit_test(test_parse_key),
+            unit_test(test_append),
+            unit_test(test_prune),
+        };
+
+    int ret = run_tests(tests);
+
+    tests_teardown();
+    return ret;
+}
+
+/* STUBS */
+
+void FatalError(ARG_UNUSED char *s, ...)
+{
+    fail();
+    exit(42);
+}